@@ -1,8 +1,19 @@
 /** \file implementation of the API defined in catalog.h */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
 #include "catalog.h"
 #include "catalog_result.h"
+#include "query.h"
+#include "trace.h"
+#ifdef HAVE_SQLITE2
+/* sqlite 2 is only used to convert old catalogs, see convert_catalog().
+ * it must be included before sqlite3.h */
 #include <sqlite.h>
+#undef SQLITE_VERSION
+#endif
+#include <sqlite3.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -12,14 +23,106 @@
 #include <string.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <math.h>
 
 #define SCHEMA_VERSION 1
-#define SCHEMA_REVISION 0
+#define SCHEMA_REVISION 6
+
+/**
+ * Number of entries that can be added during a source update
+ * before the update transaction is committed and reopened.
+ */
+#define UPDATE_COMMIT_ENTRIES 1000
+
+/**
+ * Time after which the update transaction is committed
+ * and reopened, even if less than UPDATE_COMMIT_ENTRIES
+ * have been added (ms).
+ * This makes the entries added so far visible to the
+ * queries run from other processes without having to
+ * wait for the end of a long update.
+ */
+#define UPDATE_COMMIT_TIMEOUT 500
+
+/**
+ * Time after which a launch counts half as much
+ * as a launch made now (s).
+ */
+#define FRECENCY_HALF_LIFE (7*24*3600)
+
+/**
+ * Frecencies are stored as integers, in 1/FRECENCY_PRECISION
+ * of a second, so that they survive the conversion to text and
+ * back unchanged, which catalog_query_next_page() relies on.
+ */
+#define FRECENCY_PRECISION 1000000
+
+/**
+ * Number of virtual machine instructions sqlite executes
+ * between two checks of catalog->stop, while a query is running.
+ */
+#define PROGRESS_OPCODES 100
+
+/**
+ * Queries of up to that many words are kept compiled
+ * by catalog_executequery(). Longer queries are compiled
+ * every time.
+ */
+#define QUERY_CACHED_WORDS 4
+
+/**
+ * Maximum number of trigrams to look for in
+ * catalog_executequery(). Looking for more
+ * trigrams would not make the candidate set
+ * much smaller.
+ */
+#define QUERY_MAX_TRIGRAMS 8
+
+/**
+ * Statements that are kept compiled in the catalog
+ * structure, see statement_sql
+ */
+enum catalog_statement
+{
+        STATEMENT_SOURCE_VERSION,
+        STATEMENT_UPSERT_ENTRY,
+        STATEMENT_RENAME_ENTRY,
+        STATEMENT_INSERT_TRIGRAM,
+        STATEMENT_COUNT
+};
+
+/**
+ * SQL of the statements in enum catalog_statement,
+ * in the same order.
+ */
+static const char *statement_sql[STATEMENT_COUNT] =
+{
+        /* STATEMENT_SOURCE_VERSION */
+        "SELECT version FROM sources WHERE id=?",
+
+        /* STATEMENT_UPSERT_ENTRY */
+        "INSERT INTO entries "
+        " (path, name, long_name, source_id, launcher, version, enabled, mask) "
+        " VALUES (?, ?, ?, ?, ?, ?, 1, ?) "
+        "ON CONFLICT (source_id, path) DO UPDATE "
+        " SET long_name=excluded.long_name, launcher=excluded.launcher, version=excluded.version "
+        " WHERE name=excluded.name "
+        "RETURNING id",
+
+        /* STATEMENT_RENAME_ENTRY */
+        "UPDATE entries "
+        "SET name=?, long_name=?, launcher=?, version=?, mask=? "
+        "WHERE source_id=? AND path=? "
+        "RETURNING id",
+
+        /* STATEMENT_INSERT_TRIGRAM */
+        "INSERT INTO entry_trigrams (trigram, entry_id) VALUES (?, ?)"
+};
 
 /** Hidden catalog structure */
 struct catalog
 {
-        sqlite *db;
+        sqlite3 *db;
         gboolean stop;
         GString* sql;
         GString* error;
@@ -41,6 +144,79 @@ struct catalog
          * version of the 'current source', used as a cache for source_version()
          */
         int current_source_version;
+
+        /**
+         * TRUE while a source update transaction is open, between
+         * catalog_begin_source_update() and catalog_end_source_update()
+         */
+        gboolean in_update;
+        /**
+         * Number of entries added since the update transaction
+         * has been opened
+         */
+        int update_count;
+        /**
+         * Time at which the update transaction has been opened
+         */
+        GTimeVal update_start;
+
+        /**
+         * Compiled statements, indexed by enum catalog_statement.
+         *
+         * Statements are compiled the first time they're
+         * needed and finalized by catalog_disconnect()
+         */
+        sqlite3_stmt *statements[STATEMENT_COUNT];
+
+        /**
+         * Compiled statements for catalog_executequery(),
+         * indexed by the number of words in the query and
+         * the number of trigrams looked for.
+         *
+         * Statements are compiled the first time they're
+         * needed and finalized by catalog_disconnect()
+         */
+        sqlite3_stmt *queries[QUERY_CACHED_WORDS+1][QUERY_MAX_TRIGRAMS+1];
+};
+
+/** Hidden structure, see catalog_query_open() */
+struct catalog_query
+{
+        struct catalog *catalog;
+
+        /**
+         * Parameters of the query: trigrams or the mask of the words,
+         * one LIKE pattern per word
+         * (three for deep queries) and 2 strings for the keyset
+         * (see query_sql())
+         */
+        GPtrArray *argv;
+        int word_count;
+        int trigram_count;
+
+        /** TRUE for queries opened by catalog_query_open_deep() */
+        gboolean deep;
+
+        /** TRUE once a page has been read */
+        gboolean started;
+
+        /** key of the last result: frecency, as stored */
+        char *last_frecency;
+        /** key of the last result: id */
+        char last_id[16];
+        /** number of results of the current page */
+        int page_count;
+        /** TRUE if the callback stopped the current page */
+        gboolean stopped;
+
+        /** compiled statement for the 1st page */
+        sqlite3_stmt *first_vm;
+        /** LIMIT of first_vm */
+        int first_limit;
+        /** compiled statement for the next pages */
+        sqlite3_stmt *next_vm;
+        /** LIMIT of next_vm */
+        int next_limit;
 };
 
 #define return_unless_connected(catalog) if(!check_connected(catalog, __FILE__, __LINE__)) { return; }
@@ -49,21 +225,55 @@ struct catalog
 /* ------------------------- prototypes */
 static int getinteger_callback(void *userdata, int column_count, char **result, char **names);
 static gboolean exists(const char *path);
+static gboolean is_sqlite3_file(const char *path);
+static gboolean convert_catalog(struct catalog *catalog);
+#ifdef HAVE_SQLITE2
+static gboolean convert_from_sqlite2(struct catalog *catalog, const char *old_path);
+static int convert_callback(void *userdata, int column_count, char **values, char **names);
+#endif
 static gboolean handle_sqlite_retval(struct catalog *catalog, int retval, char *errmsg, const char *sql);
-static int execute_update_nocatalog_printf(sqlite *db, const char *sql, char **errmsg, ...);
-static int execute_update_nocatalog_vprintf(sqlite *db, const char *sql, char **errmsg, va_list ap);
+static int execute_update_nocatalog_printf(sqlite3 *db, const char *sql, char **errmsg, ...);
+static int execute_update_nocatalog_vprintf(sqlite3 *db, const char *sql, char **errmsg, va_list ap);
 static gboolean execute_update_printf(struct catalog *catalog, gboolean autocommit, const char *sql, ...);
 static int progress_callback(void *userdata);
-static gboolean execute_query_printf(struct catalog *catalog, sqlite_callback callback, void *userdata, const char *sql, ...);
-static gboolean create_tables(sqlite *db, char **errmsg);
+static void busy_wait(struct catalog *catalog);
+static gboolean execute_query_printf(struct catalog *catalog, sqlite3_callback callback, void *userdata, const char *sql, ...);
+static gboolean create_tables(sqlite3 *db, char **errmsg);
 static int result_sqlite_callback(void *userdata, int col_count, char **col_data, char **col_names);
 static void get_id(struct catalog  *catalog, int *id_out);
 static int findid_callback(void *userdata, int column_count, char **result, char **names);
 static int timestamp_callback(void *userdata, int column_count, char **result, char **names);
-static gboolean findentry(struct catalog *catalog, const char *path, int source_id, int *id_out);
+static int catalog_version_callback(void *userdata, int column_count, char **result, char **names);
 static gboolean source_version(struct catalog *catalog, int source_id, int *version_out);
 static gboolean check_connected(struct catalog *catalog, const char *file, int line);
 static void reset_error(struct catalog *catalog);
+static gboolean update_commit(struct catalog *catalog, gboolean reopen);
+static gboolean update_checkpoint(struct catalog *catalog);
+static gboolean execute_statement(struct catalog *catalog, sqlite3_stmt **cached, const char *sql, gboolean update, int argc, const char **argv, sqlite3_callback callback, void *userdata);
+static void statements_finalize(struct catalog *catalog);
+static char *query_sql(int words, int trigrams, gboolean deep, gboolean keyset, int limit);
+static GPtrArray *query_args(const char *query, int *word_count_out, int *trigram_count_out);
+static GPtrArray *deep_query_args(const char *query, int *word_count_out);
+static char *fuzzy_pattern(const char *word);
+static struct catalog_query *catalog_query_new(struct catalog *catalog, GPtrArray *argv, int word_count, int trigram_count, gboolean deep);
+static int page_sqlite_callback(void *userdata, int col_count, char **col_data, char **col_names);
+static gboolean upgrade_tables(struct catalog *catalog);
+static int version_callback(void *userdata, int column_count, char **result, char **names);
+static gboolean upgrade_to_revision_1(struct catalog *catalog);
+static gboolean upgrade_to_revision_2(struct catalog *catalog);
+static gboolean upgrade_to_revision_3(struct catalog *catalog);
+static gboolean upgrade_to_revision_4(struct catalog *catalog);
+static gboolean upgrade_to_revision_5(struct catalog *catalog);
+static gboolean upgrade_to_revision_6(struct catalog *catalog);
+static void frecency_add_launch_sqlite_function(sqlite3_context *context, int argc, sqlite3_value **argv);
+static double frecency_add_launch(double frecency, double now);
+static void char_mask_sqlite_function(sqlite3_context *context, int argc, sqlite3_value **argv);
+static gint64 name_mask(const char *name);
+static float frecency_pertinence(double frecency, gulong now);
+static int collect_entry_names_callback(void *userdata, int column_count, char **result, char **names);
+static void add_trigrams_from(GPtrArray *trigrams, const char *str, guint max);
+static void free_trigrams(GPtrArray *trigrams);
+static gboolean index_trigrams(struct catalog *catalog, int entry_id, const char *name);
 
 /* ------------------------- public functions */
 
@@ -71,8 +281,13 @@ gboolean catalog_add_entry(struct catalog *catalog,
                            const struct catalog_entry *entry,
                            int *id_out)
 {
-        int old_id=-1;
         int version;
+        char source_id_str[16];
+        char version_str[16];
+        char mask_str[24];
+        const char *argv[7];
+        int id;
+        gboolean reindex;
 
         g_return_val_if_fail(catalog!=NULL, FALSE);
         g_return_val_if_fail(entry!=NULL, FALSE);
@@ -88,39 +303,65 @@ gboolean catalog_add_entry(struct catalog *catalog,
                 return FALSE;
         }
 
-
-        if(findentry(catalog, entry->path, entry->source_id, &old_id))
-        {
-                if(id_out) {
-                        *id_out=old_id;
-                }
-                return execute_update_printf(catalog, TRUE/*autocommit*/,
-                                             "UPDATE entries "
-                                             "SET name='%q', long_name='%q', source_id=%d, launcher='%q', version=%d "
-                                             "WHERE id=%d",
-                                             entry->name,
-                                             entry->long_name,
-                                             entry->source_id,
-                                             entry->launcher,
-                                             version,
-                                             old_id);
-        } else
-        {
-                if(execute_update_printf(catalog, TRUE/*autocommit*/,
-                                         "INSERT INTO entries "
-                                         " (id, path, name, long_name, source_id, launcher, version, enabled) "
-                                         " VALUES (NULL, '%q', '%q', '%q', %d, '%q', %d, 1)",
-                                         entry->path,
-                                         entry->name,
-                                         entry->long_name,
-                                         entry->source_id,
-                                         entry->launcher,
-                                         version)) {
-                        get_id(catalog, id_out);
-                        return TRUE;
+        g_snprintf(source_id_str, sizeof(source_id_str), "%d", entry->source_id);
+        g_snprintf(version_str, sizeof(version_str), "%d", version);
+        g_snprintf(mask_str, sizeof(mask_str), "%" G_GINT64_FORMAT, name_mask(entry->name));
+
+        /* a new entry is inserted; an existing entry that hasn't been
+         * renamed, the usual case when re-indexing, is updated in place
+         * and keeps its id, enabled flag, lastuse and trigrams */
+        argv[0]=entry->path;
+        argv[1]=entry->name;
+        argv[2]=entry->long_name;
+        argv[3]=source_id_str;
+        argv[4]=entry->launcher;
+        argv[5]=version_str;
+        argv[6]=mask_str;
+        id=-1;
+        sqlite3_set_last_insert_rowid(catalog->db, 0);
+        if(!execute_statement(catalog,
+                              &catalog->statements[STATEMENT_UPSERT_ENTRY],
+                              statement_sql[STATEMENT_UPSERT_ENTRY],
+                              TRUE/*update*/,
+                              7,
+                              argv,
+                              findid_callback,
+                              &id)) {
+                return FALSE;
+        }
+        reindex = sqlite3_last_insert_rowid(catalog->db)!=0;
+
+        if(id==-1) {
+                /* renamed entry; it keeps its id, enabled flag and lastuse,
+                 * and loses its trigrams, see the trigger entries_rename_trigrams */
+                argv[0]=entry->name;
+                argv[1]=entry->long_name;
+                argv[2]=entry->launcher;
+                argv[3]=version_str;
+                argv[4]=mask_str;
+                argv[5]=source_id_str;
+                argv[6]=entry->path;
+                if(!execute_statement(catalog,
+                                      &catalog->statements[STATEMENT_RENAME_ENTRY],
+                                      statement_sql[STATEMENT_RENAME_ENTRY],
+                                      TRUE/*update*/,
+                                      7,
+                                      argv,
+                                      findid_callback,
+                                      &id)) {
+                        return FALSE;
                 }
+                g_return_val_if_fail(id!=-1, FALSE);
+                reindex=TRUE;
+        }
+
+        if(id_out) {
+                *id_out=id;
+        }
+        if(reindex && !index_trigrams(catalog, id, entry->name)) {
                 return FALSE;
         }
+        return update_checkpoint(catalog);
 }
 
 gboolean catalog_add_source(struct catalog *catalog, const char *type, int *id_out)
@@ -185,6 +426,12 @@ struct catalog *catalog_new(const char *path)
         catalog->busy_wait_cond=g_cond_new();
         catalog->busy_wait_mutex=g_mutex_new();
         catalog->path=g_strdup(path);
+        catalog->current_source_id=0;
+        catalog->current_source_version=0;
+        catalog->in_update=FALSE;
+        catalog->update_count=0;
+        memset(catalog->statements, 0, sizeof(catalog->statements));
+        memset(catalog->queries, 0, sizeof(catalog->queries));
 
         return catalog;
 }
@@ -214,7 +461,7 @@ gboolean catalog_connect(struct catalog *catalog)
 {
         gboolean newdb;
         char *errmsg;
-        sqlite *db;
+        sqlite3 *db;
 
         g_return_val_if_fail(catalog!=NULL, FALSE);
 
@@ -225,36 +472,89 @@ gboolean catalog_connect(struct catalog *catalog)
                 return FALSE;
         }
 
+        if(exists(catalog->path) && !is_sqlite3_file(catalog->path)) {
+                if(!convert_catalog(catalog)) {
+                        return FALSE;
+                }
+        }
+
         newdb = !exists(catalog->path);
         errmsg = NULL;
-        db = sqlite_open(catalog->path, 0600, &errmsg);
-        if(!db) {
+        db = NULL;
+        if(sqlite3_open(catalog->path, &db)!=SQLITE_OK) {
                 g_string_append_printf(catalog->error,
                                        "opening catalog %s failed: %s\n",
                                        catalog->path,
-                                       errmsg==NULL ? "unknown error":errmsg);
-                if(errmsg) {
-                        sqlite_freemem(errmsg);
-                }
+                                       db==NULL ? "out of memory":sqlite3_errmsg(db));
+                sqlite3_close(db);
                 return FALSE;
         }
         if(newdb) {
+                chmod(catalog->path, 0600);
                 if(!create_tables(db, &errmsg)) {
                         g_string_append_printf(catalog->error,
                                                "initialization of catalog %s failed: %s\n",
                                                catalog->path,
                                                errmsg==NULL ? "unknown error":errmsg);
                         if(errmsg) {
-                                sqlite_freemem(errmsg);
+                                sqlite3_free(errmsg);
                         }
 
-                        sqlite_close(db);
+                        sqlite3_close(db);
                         unlink(catalog->path);
                         return FALSE;
                 }
         }
 
+        /* in WAL mode, queries read a snapshot of the catalog and
+         * never wait for the indexer, and the indexer doesn't wait
+         * for the queries either */
+        if(execute_update_nocatalog_printf(db,
+                                           "PRAGMA journal_mode=WAL;"
+                                           "PRAGMA synchronous=NORMAL;",
+                                           &errmsg)!=SQLITE_OK) {
+                g_string_append_printf(catalog->error,
+                                       "switching catalog %s to WAL failed: %s\n",
+                                       catalog->path,
+                                       errmsg==NULL ? "unknown error":errmsg);
+                if(errmsg) {
+                        sqlite3_free(errmsg);
+                }
+                sqlite3_close(db);
+                return FALSE;
+        }
+
+        sqlite3_create_function(db,
+                                "frecency_add_launch",
+                                2/*argc*/,
+                                SQLITE_UTF8|SQLITE_DETERMINISTIC,
+                                NULL/*userdata*/,
+                                frecency_add_launch_sqlite_function,
+                                NULL/*no step*/,
+                                NULL/*no final*/);
+        sqlite3_create_function(db,
+                                "char_mask",
+                                1/*argc*/,
+                                SQLITE_UTF8|SQLITE_DETERMINISTIC,
+                                NULL/*userdata*/,
+                                char_mask_sqlite_function,
+                                NULL/*no step*/,
+                                NULL/*no final*/);
+
         catalog->db=db;
+        if(!upgrade_tables(catalog)) {
+                char *error = g_strdup(catalog_error(catalog));
+                reset_error(catalog);
+                g_string_append_printf(catalog->error,
+                                       "upgrade of catalog %s failed: %s\n",
+                                       catalog->path,
+                                       error);
+                g_free(error);
+                statements_finalize(catalog);
+                sqlite3_close(db);
+                catalog->db=NULL;
+                return FALSE;
+        }
         return TRUE;
 }
 
@@ -266,7 +566,12 @@ void catalog_disconnect(struct catalog *catalog)
 
         return_unless_connected(catalog);
 
-        sqlite_close(catalog->db);
+        if(catalog->in_update) {
+                /* keep what has been indexed so far */
+                update_commit(catalog, FALSE/*don't reopen*/);
+        }
+        statements_finalize(catalog);
+        sqlite3_close(catalog->db);
         catalog->db=NULL;
 }
 
@@ -294,9 +599,10 @@ gboolean catalog_executequery(struct catalog *catalog,
                               catalog_callback_f callback,
                               void *userdata)
 {
-        GString *sql;
-        gboolean has_space;
-        const char *cptr;
+        char *sql;
+        int word_count;
+        GPtrArray *argv;
+        int trigram_count;
         gboolean ret;
 
         g_return_val_if_fail(catalog!=NULL, FALSE);
@@ -308,45 +614,140 @@ gboolean catalog_executequery(struct catalog *catalog,
         if(catalog->stop)
                 return TRUE;
 
-        /* the order of the columns is important, see result_sqlite_callback() */
+        argv = query_args(query, &word_count, &trigram_count);
+        sql = query_sql(word_count, trigram_count, FALSE/*not deep*/, FALSE/*no keyset*/, 0/*no limit*/);
+        catalog->callback=callback;
+        catalog->callback_userdata=userdata;
+        ret = execute_statement(catalog,
+                                word_count<=QUERY_CACHED_WORDS
+                                ? &catalog->queries[word_count][trigram_count]
+                                : NULL,
+                                sql,
+                                FALSE/*not an update*/,
+                                argv->len,
+                                (const char **)argv->pdata,
+                                result_sqlite_callback,
+                                catalog/*userdata*/);
+        g_free(sql);
+        free_trigrams(argv);
 
-        sql = g_string_new("SELECT e.id, e.path, e.name, e.long_name, "
-                           "       s.id, e.launcher, e.enabled, e.lastuse "
-                           "FROM entries e, sources s "
-                           "WHERE e.enabled==1 AND e.source_id=s.id AND s.enabled==1 AND e.name LIKE '%%");
+        /* the catalog was probably called from two threads
+         * at the same time: this is forbidden
+         */
+        g_return_val_if_fail(catalog->callback==callback,
+                             FALSE);
 
-        has_space=FALSE;
-        for(cptr=query; *cptr!='\0'; cptr++)
-        {
-                char c = *cptr;
-                switch(c) {
-                case ' ':
-                        has_space=TRUE;
-                        break;
+        catalog->callback=NULL;
+        catalog->callback_userdata=NULL;
 
-                case '\'':
-                case '"':
-                        break;
+        return ret;
+}
 
-                default:
-                        if(has_space) {
-                                g_string_append(sql,
-                                                "%%' AND e.name LIKE '%%");
-                                has_space=FALSE;
-                        }
-                        g_string_append_c(sql, c);
-                }
+struct catalog_query *catalog_query_open(struct catalog *catalog,
+                                         const char *query)
+{
+        GPtrArray *argv;
+        int word_count;
+        int trigram_count;
+
+        g_return_val_if_fail(catalog!=NULL, NULL);
+        g_return_val_if_fail(query!=NULL, NULL);
+
+        return_val_unless_connected(catalog, NULL);
+
+        argv=query_args(query, &word_count, &trigram_count);
+        return catalog_query_new(catalog, argv, word_count, trigram_count, FALSE/*not deep*/);
+}
+
+struct catalog_query *catalog_query_open_deep(struct catalog *catalog,
+                                              const char *query)
+{
+        GPtrArray *argv;
+        int word_count;
+
+        g_return_val_if_fail(catalog!=NULL, NULL);
+        g_return_val_if_fail(query!=NULL, NULL);
+
+        return_val_unless_connected(catalog, NULL);
+
+        argv=deep_query_args(query, &word_count);
+        return catalog_query_new(catalog, argv, word_count, 0/*no trigrams*/, TRUE/*deep*/);
+}
+
+gboolean catalog_query_next_page(struct catalog_query *cquery,
+                                 int page_size,
+                                 catalog_callback_f callback,
+                                 void *userdata,
+                                 gboolean *more_out)
+{
+        struct catalog *catalog;
+        sqlite3_stmt **vm;
+        int *limit;
+        char *sql;
+        const char **argv;
+        int argc;
+        gboolean ret;
+
+        g_return_val_if_fail(cquery!=NULL, FALSE);
+        g_return_val_if_fail(page_size>0, FALSE);
+        g_return_val_if_fail(callback!=NULL, FALSE);
+
+        catalog=cquery->catalog;
+        return_val_unless_connected(catalog, FALSE);
+
+        if(more_out) {
+                *more_out=FALSE;
         }
-        g_string_append(sql,
-                        "%%' "
-                        "ORDER BY e.lastuse DESC");
+        if(catalog->stop) {
+                return TRUE;
+        }
+
+        if(cquery->started && cquery->last_frecency==NULL) {
+                /* the first page was empty */
+                return TRUE;
+        }
+
+        argc=cquery->argv->len;
+        argv=g_new(const char *, argc+2);
+        memcpy(argv, cquery->argv->pdata, argc*sizeof(const char *));
+        if(cquery->started) {
+                vm=&cquery->next_vm;
+                limit=&cquery->next_limit;
+                argv[argc]=cquery->last_frecency;
+                argv[argc+1]=cquery->last_id;
+                argc+=2;
+        } else {
+                vm=&cquery->first_vm;
+                limit=&cquery->first_limit;
+        }
+        if(*limit!=page_size && *vm!=NULL) {
+                sqlite3_finalize(*vm);
+                *vm=NULL;
+        }
+        *limit=page_size;
+
+        sql = query_sql(cquery->word_count,
+                        cquery->trigram_count,
+                        cquery->deep,
+                        cquery->started/*keyset*/,
+                        page_size);
+        cquery->page_count=0;
+        cquery->stopped=FALSE;
         catalog->callback=callback;
         catalog->callback_userdata=userdata;
-        ret = execute_query_printf(catalog,
-                                   result_sqlite_callback,
-                                   catalog/*userdata*/,
-                                   sql->str);
-        g_string_free(sql, TRUE/*free content*/);
+        TRACE(TRACE_SQL_EXEC, 0/*query id unknown*/, page_size, cquery->deep ? "deep page":"page");
+        ret = execute_statement(catalog,
+                                vm,
+                                sql,
+                                FALSE/*not an update*/,
+                                argc,
+                                argv,
+                                page_sqlite_callback,
+                                cquery/*userdata*/);
+        TRACE(TRACE_SQL_DONE, 0/*query id unknown*/, cquery->page_count, NULL);
+        g_free(sql);
+        g_free(argv);
+        cquery->started=TRUE;
 
         /* the catalog was probably called from two threads
          * at the same time: this is forbidden
@@ -357,9 +758,30 @@ gboolean catalog_executequery(struct catalog *catalog,
         catalog->callback=NULL;
         catalog->callback_userdata=NULL;
 
+        if(more_out) {
+                *more_out = ret
+                        && cquery->page_count==page_size
+                        && !cquery->stopped
+                        && !catalog->stop;
+        }
         return ret;
 }
 
+void catalog_query_close(struct catalog_query *cquery)
+{
+        g_return_if_fail(cquery!=NULL);
+
+        if(cquery->first_vm) {
+                sqlite3_finalize(cquery->first_vm);
+        }
+        if(cquery->next_vm) {
+                sqlite3_finalize(cquery->next_vm);
+        }
+        free_trigrams(cquery->argv);
+        g_free(cquery->last_frecency);
+        g_free(cquery);
+}
+
 const char *catalog_error(struct catalog *catalog)
 {
         g_return_val_if_fail(catalog!=NULL, NULL);
@@ -393,6 +815,59 @@ gulong catalog_timestamp_get(struct catalog *catalog)
         return ts;
 }
 
+gboolean catalog_version_get(struct catalog *catalog, struct catalog_version *version)
+{
+        g_return_val_if_fail(version!=NULL, FALSE);
+
+        memset(version, 0, sizeof(struct catalog_version));
+        return_val_unless_connected(catalog, FALSE);
+
+        /* there's always one row; if the callback isn't called,
+         * the query has been interrupted */
+        version->source_count=-1;
+        if(!execute_query_printf(catalog,
+                                 catalog_version_callback,
+                                 version/*userdata*/,
+                                 "SELECT (SELECT value FROM history WHERE event='indexed'), "
+                                 " COUNT(*), TOTAL(version), TOTAL(enabled), "
+                                 " (SELECT COUNT(*) FROM entries WHERE enabled=0), "
+                                 " (SELECT MAX(lastuse) FROM entries) "
+                                 "FROM sources")) {
+                return FALSE;
+        }
+        return version->source_count>=0;
+}
+
+gboolean catalog_version_equal(const struct catalog_version *a, const struct catalog_version *b)
+{
+        g_return_val_if_fail(a!=NULL, FALSE);
+        g_return_val_if_fail(b!=NULL, FALSE);
+
+        return a->timestamp==b->timestamp
+                && a->source_count==b->source_count
+                && a->source_versions==b->source_versions
+                && a->enabled_sources==b->enabled_sources
+                && a->disabled_entries==b->disabled_entries
+                && a->lastuse==b->lastuse;
+}
+
+gboolean catalog_warm_up(struct catalog *catalog)
+{
+        return_val_unless_connected(catalog, FALSE);
+
+        /* a full scan of each index reads all its pages; the
+         * entries are read as the results of the first query are.
+         * The trigrams are left alone: there are too many of them
+         * and a query only reads a few of their pages. */
+        return execute_query_printf(catalog,
+                                    NULL/*no callback*/,
+                                    NULL/*no userdata*/,
+                                    "SELECT COUNT(frecency) FROM entries INDEXED BY frecency_idx;"
+                                    "SELECT COUNT(enabled) FROM entries INDEXED BY e_enabled_idx;"
+                                    "SELECT COUNT(source_id) FROM entries INDEXED BY source_idx;"
+                                    "SELECT COUNT(enabled) FROM sources INDEXED BY s_enabled_idx;");
+}
+
 gboolean catalog_timestamp_update(struct catalog *catalog)
 {
         GTimeVal now;
@@ -416,6 +891,35 @@ gboolean catalog_timestamp_update(struct catalog *catalog)
         }
 }
 
+gboolean catalog_get_enabled_entries(struct catalog *catalog,
+                                     catalog_callback_f callback,
+                                     void *userdata)
+{
+        char *sql;
+        gboolean ret;
+
+        g_return_val_if_fail(catalog!=NULL, FALSE);
+        g_return_val_if_fail(callback!=NULL, FALSE);
+
+        return_val_unless_connected(catalog, FALSE);
+
+        sql = query_sql(0/*words*/, 0/*trigrams*/, FALSE/*not deep*/, FALSE/*no keyset*/, 0/*no limit*/);
+        catalog->callback=callback;
+        catalog->callback_userdata=userdata;
+        ret = execute_statement(catalog,
+                                NULL/*not cached*/,
+                                sql,
+                                FALSE/*not an update*/,
+                                0/*argc*/,
+                                NULL/*argv*/,
+                                result_sqlite_callback,
+                                catalog/*userdata*/);
+        g_free(sql);
+        catalog->callback=NULL;
+        catalog->callback_userdata=NULL;
+        return ret;
+}
+
 gboolean catalog_get_source_content(struct catalog *catalog,
                                     int source_id,
                                     catalog_callback_f callback,
@@ -431,7 +935,8 @@ gboolean catalog_get_source_content(struct catalog *catalog,
                                    result_sqlite_callback,
                                    catalog/*userdata*/,
                                    "SELECT e.id, e.path, e.name, e.long_name, "
-                                   " s.id, e.launcher, e.enabled, e.lastuse "
+                                   " s.id, e.launcher, e.enabled, e.lastuse, "
+                                   " e.launches, e.frecency "
                                    "FROM entries e, sources s "
                                    "WHERE e.source_id=%d and s.id=%d "
                                    "ORDER BY UPPER(e.name), UPPER(e.long_name)",
@@ -520,18 +1025,28 @@ void catalog_restart(struct catalog *catalog)
 gboolean catalog_update_entry_timestamp(struct catalog *catalog, int entry_id)
 {
         GTimeVal timeval;
+        double now;
 
         g_return_val_if_fail(catalog, FALSE);
 
         return_val_unless_connected(catalog, FALSE);
 
         g_get_current_time(&timeval);
+        now = timeval.tv_sec + timeval.tv_usec/1000000.0;
+
+        /* the frecency is read and written by the same statement, so
+         * that launches recorded at the same time by other processes
+         * aren't lost */
         return execute_update_printf(catalog, TRUE/*autocommit*/,
                                      "UPDATE entries "
-                                     "SET lastuse='%16.16lx.%6.6lu' "
+                                     "SET lastuse=%lu, "
+                                     " frecency=CASE WHEN launches=0 THEN %lld "
+                                     "  ELSE frecency_add_launch(frecency, %lld) END, "
+                                     " launches=launches+1 "
                                      "WHERE id=%d",
                                      (unsigned long)timeval.tv_sec,
-                                     (unsigned long)timeval.tv_usec,
+                                     (long long)floor(now*FRECENCY_PRECISION+0.5),
+                                     (long long)floor(now*FRECENCY_PRECISION+0.5),
                                      entry_id);
 }
 
@@ -546,18 +1061,34 @@ gboolean catalog_begin_source_update(struct catalog *catalog, int source_id)
 
         return_val_unless_connected(catalog, FALSE);
 
+        if(catalog->in_update) {
+                reset_error(catalog);
+                g_string_append(catalog->error,
+                                "a source update is already in progress");
+                return FALSE;
+        }
+
         if(!source_version(catalog, source_id, &old_version)) {
                 return FALSE;
         }
         new_version=old_version+1;
+        if(!execute_update_printf(catalog,
+                                  FALSE/*no autocommit*/,
+                                  "BEGIN")) {
+                return FALSE;
+        }
+        /* an error rolls back the transaction, see execute_update_nocatalog_vprintf() */
         if(execute_update_printf(catalog,
-                                 TRUE/*autocommit*/,
+                                 FALSE/*no autocommit*/,
                                  "UPDATE sources SET version=%d WHERE id=%d",
                                  new_version,
                                  source_id))
         {
                 catalog->current_source_id=source_id;
                 catalog->current_source_version=new_version;
+                catalog->in_update=TRUE;
+                catalog->update_count=0;
+                g_get_current_time(&catalog->update_start);
                 return TRUE;
         }
         return FALSE;
@@ -576,11 +1107,17 @@ gboolean catalog_end_source_update(struct catalog *catalog, int source_id)
                 return FALSE;
         }
 
-        return execute_update_printf(catalog,
-                                     TRUE/*autocommit*/,
-                                     "DELETE FROM entries WHERE source_id=%d and version<%d",
-                                     source_id,
-                                     version);
+        if(!execute_update_printf(catalog,
+                                  TRUE/*autocommit*/,
+                                  "DELETE FROM entries WHERE source_id=%d and version<%d",
+                                  source_id,
+                                  version)) {
+                return FALSE;
+        }
+        if(catalog->in_update) {
+                return update_commit(catalog, FALSE/*don't reopen*/);
+        }
+        return TRUE;
 }
 
 gboolean catalog_entry_set_enabled(struct catalog *catalog, int entry_id, gboolean enabled)
@@ -657,79 +1194,342 @@ static gboolean exists(const char *path)
         struct stat buf;
         return stat(path, &buf)==0 && buf.st_size>0;
 }
-static gboolean handle_sqlite_retval(struct catalog *catalog, int retval, char *errmsg, const char *sql)
+
+/**
+ * Check the header of a catalog file.
+ *
+ * @param path path of an existing file
+ * @return TRUE unless the file is readable and hasn't been
+ * created by sqlite 3
+ */
+static gboolean is_sqlite3_file(const char *path)
 {
-        g_return_val_if_fail(catalog!=NULL, FALSE);
+        static const char header[] = "SQLite format 3";
+        char buffer[sizeof(header)];
+        FILE *file;
+        gboolean ret;
 
-        reset_error(catalog);
-        if(retval==SQLITE_OK || retval==SQLITE_ABORT || retval==SQLITE_INTERRUPT) {
+        file = fopen(path, "r");
+        if(file==NULL) {
+                /* sqlite3_open() will report the error */
                 return TRUE;
         }
-
-        if(errmsg==NULL)
-        {
-                const char *staticerror=sqlite_error_string(retval);
-                if(staticerror)
-                        g_string_append(catalog->error, staticerror);
-                else
-                        g_string_printf(catalog->error, "unknown error (%d)", retval);
-        } else
-        {
-                g_string_append(catalog->error, errmsg);
-                sqlite_freemem(errmsg);
-        }
-        if(sql)
-        {
-                g_string_append(catalog->error, " (SQL: ");
-                g_string_append(catalog->error, sql);
-                g_string_append(catalog->error, ")");
-        }
-        return FALSE;
+        ret = fread(buffer, 1, sizeof(buffer), file)==sizeof(buffer)
+                && memcmp(buffer, header, sizeof(header))==0;
+        fclose(file);
+        return ret;
 }
 
-static int execute_update_nocatalog_printf(sqlite *db,
-                                           const char *sql,
-                                           char **errmsg, ...)
-{
-        va_list ap;
-        va_start(ap, errmsg);
-        return execute_update_nocatalog_vprintf(db, sql, errmsg, ap);
-}
-static int execute_update_nocatalog_vprintf(sqlite *db,
-                                            const char *sql,
-                                            char **errmsg,
-                                            va_list ap)
+/**
+ * Convert a catalog created by an older version of ocha,
+ * with sqlite 2, into an sqlite 3 catalog.
+ *
+ * The old catalog is kept, with the extension .sqlite2. If
+ * ocha has been compiled without sqlite 2, the old catalog is
+ * only moved out of the way and catalog_connect() creates
+ * a new, empty catalog.
+ *
+ * @return FALSE if there was an error (see catalog->error)
+ */
+static gboolean convert_catalog(struct catalog *catalog)
 {
-        int ret;
-
-        sqlite_busy_timeout(db, 30000/*30 seconds timout, for updates*/);
+        char *old_path;
+        gboolean ret;
 
-        ret=sqlite_exec_vprintf(db,
-                            sql,
-                            NULL/*no callback*/,
-                            NULL/*no userdata*/,
-                            errmsg,
-                            ap);
-        if(ret!=0) {
-                sqlite_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        old_path = g_strdup_printf("%s.sqlite2", catalog->path);
+        if(rename(catalog->path, old_path)!=0) {
+                g_string_append_printf(catalog->error,
+                                       "moving old catalog %s to %s failed: %s\n",
+                                       catalog->path,
+                                       old_path,
+                                       strerror(errno));
+                g_free(old_path);
+                return FALSE;
         }
 
-        sqlite_busy_timeout(db, -1/*disable, for queries*/);
-
+#ifdef HAVE_SQLITE2
+        ret = convert_from_sqlite2(catalog, old_path);
+        if(!ret) {
+                unlink(catalog->path);
+                rename(old_path, catalog->path);
+        }
+#else
+        g_warning("catalog %s was created by an older version of ocha; "
+                  "it has been moved to %s and must be indexed again",
+                  catalog->path,
+                  old_path);
+        ret = TRUE;
+#endif
+        g_free(old_path);
         return ret;
 }
-static gboolean execute_update_printf(struct catalog *catalog,
-                                      gboolean autocommit,
-                                      const char *sql, ...)
+
+#ifdef HAVE_SQLITE2
+/**
+ * Statement rows are copied into, see convert_callback()
+ */
+struct convert_data
 {
-        va_list ap;
+        sqlite3_stmt *insert;
+        /** column that contains lastuse, in hexadecimal, or -1 */
+        int lastuse_column;
+        /** sqlite3 error code */
         int ret;
-        char *errmsg = NULL;
+};
 
-        va_start(ap, sql);
+/**
+ * Copy the tables of revision 0 from an sqlite 2 catalog into
+ * a new catalog at catalog->path.
+ *
+ * The tables added by later revisions are re-created by
+ * upgrade_tables() from the content of the tables of revision 0.
+ *
+ * @param catalog
+ * @param old_path path of the sqlite 2 catalog
+ * @return FALSE if there was an error (see catalog->error)
+ */
+static gboolean convert_from_sqlite2(struct catalog *catalog, const char *old_path)
+{
+        static const struct {
+                const char *select;
+                const char *insert;
+                int lastuse_column;
+        } tables[] = {
+                { "SELECT id, type, version, enabled FROM sources",
+                  "INSERT INTO sources (id, type, version, enabled) VALUES (?, ?, ?, ?)",
+                  -1 },
+                { "SELECT source_id, attribute, value FROM source_attrs",
+                  "INSERT INTO source_attrs (source_id, attribute, value) VALUES (?, ?, ?)",
+                  -1 },
+                { "SELECT event, value FROM history",
+                  "INSERT INTO history (event, value) VALUES (?, ?)",
+                  -1 },
+                { "SELECT id, path, name, long_name, source_id, launcher, lastuse, version, enabled "
+                  "FROM entries",
+                  "INSERT INTO entries "
+                  " (id, path, name, long_name, source_id, launcher, lastuse, version, enabled) "
+                  " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                  6 },
+        };
+        sqlite *old_db;
+        sqlite3 *db;
+        char *errmsg;
+        struct convert_data data;
+        guint i;
 
-        if(autocommit) {
-                char *buffer = g_strdup_printf("BEGIN;%s;COMMIT;", sql);
+        errmsg=NULL;
+        old_db = sqlite_open(old_path, 0600, &errmsg);
+        if(!old_db) {
+                g_string_append_printf(catalog->error,
+                                       "opening old catalog %s failed: %s\n",
+                                       old_path,
+                                       errmsg==NULL ? "unknown error":errmsg);
+                if(errmsg) {
+                        sqlite_freemem(errmsg);
+                }
+                return FALSE;
+        }
+
+        db = NULL;
+        if(sqlite3_open(catalog->path, &db)!=SQLITE_OK) {
+                g_string_append_printf(catalog->error,
+                                       "creating catalog %s failed: %s\n",
+                                       catalog->path,
+                                       db==NULL ? "out of memory":sqlite3_errmsg(db));
+                sqlite3_close(db);
+                sqlite_close(old_db);
+                return FALSE;
+        }
+        chmod(catalog->path, 0600);
+
+        data.ret=SQLITE_OK;
+        if(!create_tables(db, &errmsg)
+           || execute_update_nocatalog_printf(db, "BEGIN", &errmsg)!=SQLITE_OK) {
+                g_string_append_printf(catalog->error,
+                                       "initialization of catalog %s failed: %s\n",
+                                       catalog->path,
+                                       errmsg==NULL ? "unknown error":errmsg);
+                if(errmsg) {
+                        sqlite3_free(errmsg);
+                }
+                sqlite3_close(db);
+                sqlite_close(old_db);
+                return FALSE;
+        }
+
+        for(i=0; i<G_N_ELEMENTS(tables) && data.ret==SQLITE_OK; i++) {
+                int old_ret;
+
+                data.ret = sqlite3_prepare_v2(db, tables[i].insert, -1/*strlen*/, &data.insert, NULL/*tail*/);
+                if(data.ret!=SQLITE_OK) {
+                        break;
+                }
+                data.lastuse_column=tables[i].lastuse_column;
+                old_ret = sqlite_exec(old_db,
+                                      tables[i].select,
+                                      convert_callback,
+                                      &data,
+                                      &errmsg);
+                sqlite3_finalize(data.insert);
+                if(old_ret!=SQLITE_OK && data.ret==SQLITE_OK) {
+                        g_string_append_printf(catalog->error,
+                                               "reading old catalog %s failed: %s\n",
+                                               old_path,
+                                               errmsg==NULL ? "unknown error":errmsg);
+                        if(errmsg) {
+                                sqlite_freemem(errmsg);
+                        }
+                        sqlite3_close(db);
+                        sqlite_close(old_db);
+                        return FALSE;
+                }
+        }
+        sqlite_close(old_db);
+
+        if(data.ret==SQLITE_OK) {
+                data.ret = execute_update_nocatalog_printf(db, "COMMIT", &errmsg);
+        } else {
+                errmsg = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+        }
+        if(data.ret!=SQLITE_OK) {
+                g_string_append_printf(catalog->error,
+                                       "converting catalog %s failed: %s\n",
+                                       catalog->path,
+                                       errmsg==NULL ? "unknown error":errmsg);
+                if(errmsg) {
+                        sqlite3_free(errmsg);
+                }
+                sqlite3_close(db);
+                return FALSE;
+        }
+        sqlite3_close(db);
+        return TRUE;
+}
+
+/**
+ * sqlite 2 callback that inserts the row into the sqlite 3
+ * catalog, using the statement in struct convert_data.
+ *
+ * lastuse is converted from hexadecimal to a number of
+ * seconds.
+ */
+static int convert_callback(void *userdata,
+                            int column_count,
+                            char **values,
+                            char **names)
+{
+        struct convert_data *data;
+        int i;
+
+        g_return_val_if_fail(userdata!=NULL, 1);
+        data = (struct convert_data *)userdata;
+
+        for(i=0; i<column_count; i++) {
+                if(values[i]==NULL) {
+                        sqlite3_bind_null(data->insert, i+1);
+                } else if(i==data->lastuse_column) {
+                        sqlite3_bind_int64(data->insert,
+                                           i+1,
+                                           strtoul(values[i], NULL/*endptr*/, 16/*base*/));
+                } else {
+                        sqlite3_bind_text(data->insert, i+1, values[i], -1/*strlen*/, SQLITE_TRANSIENT);
+                }
+        }
+        data->ret = sqlite3_step(data->insert);
+        sqlite3_reset(data->insert);
+        if(data->ret!=SQLITE_DONE) {
+                return 1;
+        }
+        data->ret=SQLITE_OK;
+        return 0;
+}
+#endif /*HAVE_SQLITE2*/
+static gboolean handle_sqlite_retval(struct catalog *catalog, int retval, char *errmsg, const char *sql)
+{
+        g_return_val_if_fail(catalog!=NULL, FALSE);
+
+        reset_error(catalog);
+        if(retval==SQLITE_OK || retval==SQLITE_ABORT || retval==SQLITE_INTERRUPT) {
+                if(errmsg) {
+                        sqlite3_free(errmsg);
+                }
+                return TRUE;
+        }
+
+        if(errmsg==NULL)
+        {
+                const char *staticerror=sqlite3_errstr(retval);
+                if(staticerror)
+                        g_string_append(catalog->error, staticerror);
+                else
+                        g_string_printf(catalog->error, "unknown error (%d)", retval);
+        } else
+        {
+                g_string_append(catalog->error, errmsg);
+                sqlite3_free(errmsg);
+        }
+        if(sql)
+        {
+                g_string_append(catalog->error, " (SQL: ");
+                g_string_append(catalog->error, sql);
+                g_string_append(catalog->error, ")");
+        }
+        return FALSE;
+}
+
+static int execute_update_nocatalog_printf(sqlite3 *db,
+                                           const char *sql,
+                                           char **errmsg, ...)
+{
+        va_list ap;
+        int ret;
+        va_start(ap, errmsg);
+        ret = execute_update_nocatalog_vprintf(db, sql, errmsg, ap);
+        va_end(ap);
+        return ret;
+}
+static int execute_update_nocatalog_vprintf(sqlite3 *db,
+                                            const char *sql,
+                                            char **errmsg,
+                                            va_list ap)
+{
+        int ret;
+        char *formatted;
+
+        formatted = sqlite3_vmprintf(sql, ap);
+        if(formatted==NULL) {
+                return SQLITE_NOMEM;
+        }
+
+        sqlite3_busy_timeout(db, 30000/*30 seconds timout, for updates*/);
+
+        ret=sqlite3_exec(db,
+                         formatted,
+                         NULL/*no callback*/,
+                         NULL/*no userdata*/,
+                         errmsg);
+        if(ret!=SQLITE_OK && !sqlite3_get_autocommit(db)) {
+                sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        }
+
+        sqlite3_busy_timeout(db, 0/*disable, for queries*/);
+        sqlite3_free(formatted);
+
+        return ret;
+}
+static gboolean execute_update_printf(struct catalog *catalog,
+                                      gboolean autocommit,
+                                      const char *sql, ...)
+{
+        va_list ap;
+        int ret;
+        char *errmsg = NULL;
+
+        va_start(ap, sql);
+
+        /* during a source update, everything goes into the update transaction */
+        if(autocommit && !catalog->in_update) {
+                char *buffer = g_strdup_printf("BEGIN;%s;COMMIT;", sql);
                 ret = execute_update_nocatalog_vprintf(catalog->db,
                                                        buffer,
                                                        &errmsg,
@@ -741,6 +1541,11 @@ static gboolean execute_update_printf(struct catalog *catalog,
                                                        &errmsg,
                                                        ap);
         }
+        va_end(ap);
+        if(ret!=SQLITE_OK) {
+                /* the transaction has been rolled back */
+                catalog->in_update=FALSE;
+        }
         return handle_sqlite_retval(catalog, ret, errmsg, sql);
 }
 
@@ -750,13 +1555,36 @@ static int progress_callback(void *userdata)
         return catalog->stop ? 1:0;
 }
 
+/**
+ * Wait a little before trying again after SQLITE_BUSY.
+ *
+ * In WAL mode, queries only get SQLITE_BUSY in rare cases, such
+ * as when another connection is recovering the log.
+ *
+ * The wait ends early if catalog_interrupt() is called.
+ */
+static void busy_wait(struct catalog *catalog)
+{
+        g_mutex_lock(catalog->busy_wait_mutex);
+        if(!catalog->stop) {
+                GTimeVal timeval;
+                g_get_current_time(&timeval);
+                g_time_val_add(&timeval, 10000/*1/100th of a second*/);
+                g_cond_timed_wait(catalog->busy_wait_cond,
+                                  catalog->busy_wait_mutex,
+                                  &timeval);
+        }
+        g_mutex_unlock(catalog->busy_wait_mutex);
+}
+
 static gboolean execute_query_printf(struct catalog *catalog,
-                                     sqlite_callback callback,
+                                     sqlite3_callback callback,
                                      void *userdata,
                                      const char *sql, ...)
 {
         va_list ap;
         char *errmsg=NULL;
+        char *formatted;
         int ret;
 
         /* callers should call return_(val_)unless_connected before
@@ -765,38 +1593,482 @@ static gboolean execute_query_printf(struct catalog *catalog,
         g_return_val_if_fail(catalog->db!=NULL, FALSE);
 
         va_start(ap, sql);
+        formatted = sqlite3_vmprintf(sql, ap);
+        va_end(ap);
+        if(formatted==NULL) {
+                return handle_sqlite_retval(catalog, SQLITE_NOMEM, NULL, sql);
+        }
 
-        sqlite_progress_handler(catalog->db, 1, progress_callback, catalog);
+        sqlite3_progress_handler(catalog->db, PROGRESS_OPCODES, progress_callback, catalog);
         do {
                 if(catalog->stop) {
                         ret=SQLITE_ABORT;
                         break;
                 }
-                ret = sqlite_exec_vprintf(catalog->db,
-                                          sql,
-                                          callback,
-                                          userdata,
-                                          &errmsg,
-                                          ap);
+                if(errmsg) {
+                        sqlite3_free(errmsg);
+                        errmsg=NULL;
+                }
+                ret = sqlite3_exec(catalog->db,
+                                   formatted,
+                                   callback,
+                                   userdata,
+                                   &errmsg);
                 if(ret==SQLITE_BUSY) {
-                        g_mutex_lock(catalog->busy_wait_mutex);
-                        if(!catalog->stop) {
-                                GTimeVal timeval;
-                                g_get_current_time(&timeval);
-                                g_time_val_add(&timeval, 10000/*1/10th of a second*/);
-                                g_cond_timed_wait(catalog->busy_wait_cond,
-                                                  catalog->busy_wait_mutex,
-                                                  &timeval);
-                        }
-                        g_mutex_unlock(catalog->busy_wait_mutex);
+                        busy_wait(catalog);
                 }
         } while(ret==SQLITE_BUSY);
-        sqlite_progress_handler(catalog->db, 0, NULL/*no callback*/, NULL/*no userdata*/);
+        sqlite3_progress_handler(catalog->db, 0, NULL/*no callback*/, NULL/*no userdata*/);
+        sqlite3_free(formatted);
 
         return handle_sqlite_retval(catalog, ret, errmsg, sql);
 }
 
-static gboolean create_tables(sqlite *db, char **errmsg)
+/**
+ * Execute a compiled statement, compiling it first if necessary.
+ *
+ * The statement is run just like execute_query_printf() or
+ * execute_update_printf() would, except that the parameters
+ * are bound instead of being formatted into the SQL.
+ *
+ * @param catalog
+ * @param cached where the compiled statement is kept; if it's NULL
+ * the statement is compiled, run and thrown away. if it points to NULL,
+ * the compiled statement is stored there.
+ * @param sql SQL of the statement, with one ? per parameter
+ * @param update TRUE for statements that modify the catalog, which
+ * wait for locks (up to 30s) instead of being interruptible
+ * @param argc number of parameters
+ * @param argv parameters, in the order of the ?s in sql
+ * @param callback callback to call for each row, or NULL
+ * @param userdata passed to callback
+ * @return FALSE if there was an error (see catalog->error)
+ */
+static gboolean execute_statement(struct catalog *catalog,
+                                  sqlite3_stmt **cached,
+                                  const char *sql,
+                                  gboolean update,
+                                  int argc,
+                                  const char **argv,
+                                  sqlite3_callback callback,
+                                  void *userdata)
+{
+        sqlite3_stmt *vm;
+        char *errmsg;
+        int ret;
+        int i;
+        int column_count;
+        char **values;
+        char **names;
+
+        /* callers should call return_(val_)unless_connected before
+         * this function
+         */
+        g_return_val_if_fail(catalog->db!=NULL, FALSE);
+        g_return_val_if_fail(sql!=NULL, FALSE);
+
+        if(!update && catalog->stop) {
+                return TRUE;
+        }
+
+        errmsg=NULL;
+        vm = cached ? *cached:NULL;
+        if(vm==NULL) {
+                /* sqlite3_prepare_v2() statements are compiled again
+                 * automatically when the schema changes */
+                ret = sqlite3_prepare_v2(catalog->db, sql, -1/*strlen*/, &vm, NULL/*tail*/);
+                if(ret!=SQLITE_OK) {
+                        errmsg = sqlite3_mprintf("%s", sqlite3_errmsg(catalog->db));
+                        return handle_sqlite_retval(catalog, ret, errmsg, sql);
+                }
+                if(cached) {
+                        *cached=vm;
+                }
+        }
+
+        if(update) {
+                sqlite3_busy_timeout(catalog->db, 30000/*30 seconds timout, for updates*/);
+        } else {
+                sqlite3_progress_handler(catalog->db, PROGRESS_OPCODES, progress_callback, catalog);
+        }
+
+        ret=SQLITE_OK;
+        for(i=0; i<argc && ret==SQLITE_OK; i++) {
+                ret = sqlite3_bind_text(vm, i+1, argv[i], -1/*strlen*/, SQLITE_TRANSIENT);
+        }
+
+        column_count = sqlite3_column_count(vm);
+        values = g_new(char *, column_count+1);
+        names = g_new(char *, column_count+1);
+        while(ret==SQLITE_OK || ret==SQLITE_ROW || ret==SQLITE_BUSY) {
+                if(!update && catalog->stop) {
+                        ret=SQLITE_ABORT;
+                        break;
+                }
+                ret = sqlite3_step(vm);
+                if(ret==SQLITE_ROW && callback) {
+                        for(i=0; i<column_count; i++) {
+                                values[i]=(char *)sqlite3_column_text(vm, i);
+                                names[i]=(char *)sqlite3_column_name(vm, i);
+                        }
+                        if(callback(userdata, column_count, values, names)!=0) {
+                                ret=SQLITE_ABORT;
+                        }
+                } else if(ret==SQLITE_BUSY && !update) {
+                        busy_wait(catalog);
+                } else if(ret==SQLITE_BUSY) {
+                        /* the busy timeout expired */
+                        break;
+                }
+        }
+        g_free(values);
+        g_free(names);
+
+        if(ret==SQLITE_DONE) {
+                ret=SQLITE_OK;
+        } else if(ret!=SQLITE_ABORT) {
+                errmsg = sqlite3_mprintf("%s", sqlite3_errmsg(catalog->db));
+        }
+
+        /* reset releases the locks held by the statement */
+        if(cached) {
+                sqlite3_reset(vm);
+        } else {
+                sqlite3_finalize(vm);
+        }
+
+        if(update) {
+                if(ret!=SQLITE_OK && ret!=SQLITE_ABORT) {
+                        if(!sqlite3_get_autocommit(catalog->db)) {
+                                sqlite3_exec(catalog->db, "ROLLBACK", NULL, NULL, NULL);
+                        }
+                        /* the transaction has been rolled back */
+                        catalog->in_update=FALSE;
+                }
+                sqlite3_busy_timeout(catalog->db, 0/*disable, for queries*/);
+        } else {
+                sqlite3_progress_handler(catalog->db, 0, NULL/*no callback*/, NULL/*no userdata*/);
+        }
+        return handle_sqlite_retval(catalog, ret, errmsg, sql);
+}
+
+/**
+ * Finalize all compiled statements.
+ *
+ * This must be done before closing the connection.
+ */
+static void statements_finalize(struct catalog *catalog)
+{
+        int i;
+
+        g_return_if_fail(catalog);
+
+        for(i=0; i<STATEMENT_COUNT; i++) {
+                if(catalog->statements[i]) {
+                        sqlite3_finalize(catalog->statements[i]);
+                        catalog->statements[i]=NULL;
+                }
+        }
+        for(i=0; i<=QUERY_CACHED_WORDS; i++) {
+                int j;
+                for(j=0; j<=QUERY_MAX_TRIGRAMS; j++) {
+                        if(catalog->queries[i][j]) {
+                                sqlite3_finalize(catalog->queries[i][j]);
+                                catalog->queries[i][j]=NULL;
+                        }
+                }
+        }
+}
+
+/**
+ * Create the SQL for catalog_executequery() and catalog_query_next_page().
+ *
+ * The statement takes one parameter per trigram and then
+ * one parameter per word, which must be a LIKE pattern.
+ *
+ * Candidates are the entries that contain all the trigrams. This
+ * is just an approximation, the LIKE patterns decide whether
+ * a candidate matches or not.
+ *
+ * Without trigrams, in QUERY_MODE_FUZZY or when the words are too
+ * short, the statement takes the mask of the words twice before
+ * the LIKE patterns, and the candidates are the entries whose
+ * name contains all the characters of the words, see name_mask().
+ *
+ * A deep statement takes three parameters per word, which are
+ * compared to the name, the long name and the path of the
+ * entries. Since the trigrams only index the names, deep statements
+ * have no trigrams and look at all the entries.
+ *
+ * Results are sorted by frecency, then by id, the order of the index
+ * frecency_idx. With a keyset, the statement takes 2 more parameters,
+ * the frecency and the id of the last result of the previous page,
+ * and only returns the results that come after it, so that each page
+ * is a range of the index.
+ *
+ * @param words number of words in the query
+ * @param trigrams number of trigrams to look for
+ * @param deep if TRUE, match the words against the name, the long
+ * name and the path
+ * @param keyset if TRUE, add the keyset parameters
+ * @param limit maximum number of results, 0 for no limit
+ * @return SQL statement, to free with g_free()
+ */
+static char *query_sql(int words, int trigrams, gboolean deep, gboolean keyset, int limit)
+{
+        GString *sql;
+        int i;
+
+        /* the order of the columns is important, see result_sqlite_callback() */
+        sql = g_string_new("SELECT e.id, e.path, e.name, e.long_name, "
+                           "       s.id, e.launcher, e.enabled, e.lastuse, "
+                           "       e.launches, e.frecency "
+                           "FROM entries e, sources s "
+                           "WHERE ");
+        if(trigrams>0) {
+                g_string_append(sql, "e.id IN (");
+                for(i=0; i<trigrams; i++) {
+                        if(i>0) {
+                                g_string_append(sql, " INTERSECT ");
+                        }
+                        g_string_append(sql, "SELECT entry_id FROM entry_trigrams WHERE trigram=?");
+                }
+                g_string_append(sql, ") AND ");
+        }
+        g_string_append(sql, "e.enabled==1 AND e.source_id=s.id AND s.enabled==1");
+        if(trigrams==0 && words>0 && !deep) {
+                /* checked before the LIKE patterns, which are much slower;
+                 * +0 makes sure the parameter is compared as a number */
+                g_string_append(sql, " AND (e.mask & ?)=?+0");
+        }
+        for(i=0; i<words; i++) {
+                if(deep) {
+                        g_string_append(sql,
+                                        " AND (e.name LIKE ?"
+                                        "      OR e.long_name LIKE ?"
+                                        "      OR e.path LIKE ?)");
+                } else {
+                        g_string_append(sql, " AND e.name LIKE ?");
+                }
+        }
+        if(keyset) {
+                /* +0 makes sure the parameters are compared as numbers;
+                 * unlike the equivalent OR, a row value comparison
+                 * is a range of the index */
+                g_string_append(sql, " AND (e.frecency, e.id)<(?+0, ?+0)");
+        }
+        /* entries that have never been launched have a frecency
+         * of 0 and come last */
+        g_string_append(sql, " ORDER BY e.frecency DESC, e.id DESC");
+        if(limit>0) {
+                g_string_append_printf(sql, " LIMIT %d", limit);
+        }
+
+        return g_string_free(sql, FALSE/*return content*/);
+}
+
+/**
+ * Split a query into the parameters of the statement
+ * created by query_sql() for a deep query.
+ *
+ * There are no trigrams, since the trigrams only index
+ * the names.
+ *
+ * @param query the query
+ * @param word_count_out set to the number of words of the query
+ * @return three LIKE patterns per word, to free
+ * with free_trigrams()
+ */
+static GPtrArray *deep_query_args(const char *query, int *word_count_out)
+{
+        GPtrArray *argv;
+        char **words;
+        int word_count;
+        int i;
+
+        g_return_val_if_fail(query!=NULL, NULL);
+        g_return_val_if_fail(word_count_out!=NULL, NULL);
+
+        argv = g_ptr_array_new();
+        words = g_strsplit(query, " ", -1/*no max*/);
+        word_count=0;
+        for(i=0; words[i]!=NULL; i++) {
+                if(words[i][0]!='\0') {
+                        /* name, long_name, path */
+                        g_ptr_array_add(argv, g_strdup_printf("%%%s%%", words[i]));
+                        g_ptr_array_add(argv, g_strdup_printf("%%%s%%", words[i]));
+                        g_ptr_array_add(argv, g_strdup_printf("%%%s%%", words[i]));
+                        word_count++;
+                }
+        }
+        g_strfreev(words);
+        *word_count_out=word_count;
+        return argv;
+}
+
+/**
+ * Split a query into the parameters of the statement
+ * created by query_sql().
+ *
+ * In QUERY_MODE_FUZZY, the characters of a word don't have to
+ * be next to each other in the name, so there are no trigrams
+ * to look for and the LIKE patterns are built by fuzzy_pattern().
+ *
+ * @param query the query
+ * @param word_count_out set to the number of words of the query
+ * @param trigram_count_out set to the number of trigrams to look for
+ * @return trigrams, or twice the mask of the words if there are
+ * no trigrams, then one LIKE pattern per word, to free
+ * with free_trigrams()
+ */
+static GPtrArray *query_args(const char *query, int *word_count_out, int *trigram_count_out)
+{
+        GPtrArray *argv;
+        char **words;
+        int word_count;
+        gboolean fuzzy;
+        guint64 mask;
+        int i;
+
+        g_return_val_if_fail(query!=NULL, NULL);
+        g_return_val_if_fail(word_count_out!=NULL, NULL);
+        g_return_val_if_fail(trigram_count_out!=NULL, NULL);
+
+        fuzzy = query_get_mode()==QUERY_MODE_FUZZY;
+        argv = g_ptr_array_new();
+        words = g_strsplit(query, " ", -1/*no max*/);
+        if(!fuzzy) {
+                for(i=0; words[i]!=NULL; i++) {
+                        add_trigrams_from(argv, words[i], QUERY_MAX_TRIGRAMS);
+                }
+        }
+        *trigram_count_out=argv->len;
+        mask=0;
+        word_count=0;
+        for(i=0; words[i]!=NULL; i++) {
+                if(words[i][0]!='\0') {
+                        char *prepared = query_prepare(words[i]);
+                        mask|=query_char_mask(prepared);
+                        g_free(prepared);
+                        word_count++;
+                }
+        }
+        if(argv->len==0 && word_count>0) {
+                /* see query_sql() and name_mask() */
+                g_ptr_array_add(argv, g_strdup_printf("%" G_GINT64_FORMAT, (gint64)mask));
+                g_ptr_array_add(argv, g_strdup_printf("%" G_GINT64_FORMAT, (gint64)mask));
+        }
+        for(i=0; words[i]!=NULL; i++) {
+                if(words[i][0]!='\0') {
+                        if(fuzzy) {
+                                g_ptr_array_add(argv, fuzzy_pattern(words[i]));
+                        } else {
+                                g_ptr_array_add(argv, g_strdup_printf("%%%s%%", words[i]));
+                        }
+                }
+        }
+        g_strfreev(words);
+        *word_count_out=word_count;
+        return argv;
+}
+
+/**
+ * Create a LIKE pattern that matches the names that contain the
+ * characters of a word in the same order, "%g%n%m%" for "gnm".
+ *
+ * @param word a word of the query, not empty
+ * @return a pattern, to free with g_free()
+ */
+static char *fuzzy_pattern(const char *word)
+{
+        GString *pattern;
+        const char *current;
+
+        pattern = g_string_new("%");
+        for(current=word; *current!='\0'; current=g_utf8_next_char(current)) {
+                g_string_append_len(pattern,
+                                    current,
+                                    g_utf8_next_char(current)-current);
+                g_string_append_c(pattern, '%');
+        }
+        return g_string_free(pattern, FALSE/*return content*/);
+}
+
+/**
+ * Create a struct catalog_query.
+ *
+ * @param catalog
+ * @param argv parameters of the query, see struct catalog_query
+ * @param word_count
+ * @param trigram_count
+ * @param deep
+ * @return a new query, to free with catalog_query_close()
+ */
+static struct catalog_query *catalog_query_new(struct catalog *catalog,
+                                               GPtrArray *argv,
+                                               int word_count,
+                                               int trigram_count,
+                                               gboolean deep)
+{
+        struct catalog_query *cquery;
+
+        cquery = g_new(struct catalog_query, 1);
+        cquery->catalog=catalog;
+        cquery->argv=argv;
+        cquery->word_count=word_count;
+        cquery->trigram_count=trigram_count;
+        cquery->deep=deep;
+        cquery->started=FALSE;
+        cquery->last_frecency=NULL;
+        cquery->last_id[0]='\0';
+        cquery->page_count=0;
+        cquery->stopped=FALSE;
+        cquery->first_vm=NULL;
+        cquery->first_limit=0;
+        cquery->next_vm=NULL;
+        cquery->next_limit=0;
+        return cquery;
+}
+
+/**
+ * sqlite callback for catalog_query_next_page(), which
+ * keeps the key of the last result and passes the
+ * result on to result_sqlite_callback().
+ *
+ * @param userdata a struct catalog_query
+ */
+static int page_sqlite_callback(void *userdata,
+                                int col_count,
+                                char **col_data,
+                                char **col_names)
+{
+        struct catalog_query *cquery;
+        int ret;
+
+        cquery = (struct catalog_query *)userdata;
+        g_return_val_if_fail(cquery!=NULL, 1);
+        g_return_val_if_fail(col_count>9, 1);
+
+        if(cquery->catalog->stop) {
+                return 1;
+        }
+
+        g_free(cquery->last_frecency);
+        cquery->last_frecency=g_strdup(col_data[9]);
+        g_strlcpy(cquery->last_id, col_data[0], sizeof(cquery->last_id));
+        cquery->page_count++;
+
+        ret = result_sqlite_callback(cquery->catalog,
+                                     col_count,
+                                     col_data,
+                                     col_names);
+        if(ret!=0) {
+                cquery->stopped=TRUE;
+        }
+        return ret;
+}
+
+static gboolean create_tables(sqlite3 *db, char **errmsg)
 {
         int ret;
         ret = execute_update_nocatalog_printf(db, "BEGIN", errmsg);
@@ -838,10 +2110,9 @@ static gboolean create_tables(sqlite *db, char **errmsg)
         }
         ret = execute_update_nocatalog_printf(db,
                                               "CREATE TABLE VERSION ( version INTEGER, revision INTEGER );"
-                                              "INSERT INTO VERSION VALUES ( %d, %d );",
+                                              "INSERT INTO VERSION VALUES ( %d, 0 );",
                                               errmsg,
-                                              SCHEMA_VERSION,
-                                              SCHEMA_REVISION);
+                                              SCHEMA_VERSION);
         if(ret!=SQLITE_OK) {
                 return FALSE;
         }
@@ -886,8 +2157,18 @@ static int result_sqlite_callback(void *userdata,
         result.entry.long_name = col_data[3];
         result.entry.source_id = atoi(col_data[4]);
         result.entry.launcher = col_data[5];
-        result.pertinence = 0.5;
         result.enabled = *col_data[6]=='1';
+        /* lastuse, launches and frecency are written by catalog_update_entry_timestamp() */
+        result.lastuse = col_data[7]==NULL ? 0:strtoul(col_data[7], NULL/*endptr*/, 10/*base*/);
+        result.launches = atoi(col_data[8]);
+        if(result.launches==0) {
+                result.pertinence = 0.5;
+        } else {
+                GTimeVal now;
+                g_get_current_time(&now);
+                result.pertinence = frecency_pertinence(strtod(col_data[9], NULL/*endptr*/)/FRECENCY_PRECISION,
+                                                        now.tv_sec);
+        }
 
         go_on = catalog->callback(catalog,
                                   &result,
@@ -898,12 +2179,24 @@ static int result_sqlite_callback(void *userdata,
 static void get_id(struct catalog  *catalog, int *id_out)
 {
         if(id_out!=NULL) {
-                *id_out=sqlite_last_insert_rowid(catalog->db);
+                *id_out=sqlite3_last_insert_rowid(catalog->db);
         }
 }
 
+/**
+ * An entry id and name, see collect_entry_names_callback()
+ */
+struct entry_name
+{
+        int id;
+        char *name;
+};
+
 /**
  * sqlite callback that expects an id as the 1st (and only) result
+ *
+ * The statement is run to completion, as it might be an
+ * INSERT or an UPDATE with a RETURNING clause.
  */
 static int findid_callback(void *userdata,
                            int column_count,
@@ -915,7 +2208,7 @@ static int findid_callback(void *userdata,
         g_return_val_if_fail(column_count>0, 1);
         id_out =  (int *)userdata;
         *id_out=atoi(result[0]);
-        return 1; /* no need for more results */
+        return 0;
 }
 
 
@@ -935,36 +2228,35 @@ static int timestamp_callback(void *userdata,
         return 1; /* no need for more results */
 }
 
-static gboolean findentry(struct catalog *catalog,
-                          const char *path,
-                          int source_id,
-                          int *id_out)
+/**
+ * sqlite callback that expects the columns of struct catalog_version,
+ * in order, and fills a struct catalog_version. NULL columns are 0.
+ */
+static int catalog_version_callback(void *userdata,
+                                    int column_count,
+                                    char **result,
+                                    char **names)
 {
-        int id=-1;
-
-        g_return_val_if_fail(catalog!=NULL, FALSE);
-        g_return_val_if_fail(path!=NULL, FALSE);
-
-        if(execute_query_printf(catalog,
-                                findid_callback,
-                                &id,
-                                "SELECT id FROM entries "
-                                " WHERE path='%q' AND source_id='%d'",
-                                path,
-                                source_id)
-                        && id!=-1)
-        {
-                if(id_out)
-                        *id_out=id;
-                return TRUE;
-        }
-        return FALSE;
+        struct catalog_version *version;
+        g_return_val_if_fail(userdata!=NULL, 1);
+        g_return_val_if_fail(column_count>5, 1);
+        version = (struct catalog_version *)userdata;
+        version->timestamp=result[0] ? strtoul(result[0], NULL/*endptr*/, 10/*base*/):0;
+        version->source_count=result[1] ? atoi(result[1]):0;
+        version->source_versions=result[2] ? (gulong)strtod(result[2], NULL/*endptr*/):0;
+        version->enabled_sources=result[3] ? (int)strtod(result[3], NULL/*endptr*/):0;
+        version->disabled_entries=result[4] ? atoi(result[4]):0;
+        version->lastuse=result[5] ? strtoul(result[5], NULL/*endptr*/, 10/*base*/):0;
+        return 1; /* no need for more results */
 }
 
 static gboolean source_version(struct catalog *catalog,
                                int source_id,
                                int *version_out)
 {
+        char source_id_str[16];
+        const char *argv[1];
+
         g_return_val_if_fail(catalog, FALSE);
         g_return_val_if_fail(version_out, FALSE);
 
@@ -973,11 +2265,16 @@ static gboolean source_version(struct catalog *catalog,
                 return TRUE;
         }
 
-        if(execute_query_printf(catalog,
-                                getinteger_callback,
-                                version_out/*userdata*/,
-                                "SELECT version FROM sources WHERE id=%d",
-                                source_id))
+        g_snprintf(source_id_str, sizeof(source_id_str), "%d", source_id);
+        argv[0]=source_id_str;
+        if(execute_statement(catalog,
+                             &catalog->statements[STATEMENT_SOURCE_VERSION],
+                             statement_sql[STATEMENT_SOURCE_VERSION],
+                             FALSE/*not an update*/,
+                             1,
+                             argv,
+                             getinteger_callback,
+                             version_out/*userdata*/))
         {
                 catalog->current_source_id=source_id;
                 catalog->current_source_version=*version_out;
@@ -1008,3 +2305,509 @@ static void reset_error(struct catalog *catalog)
         g_return_if_fail(catalog);
         g_string_truncate(catalog->error, 0);
 }
+
+/**
+ * Commit the source update transaction.
+ *
+ * @param catalog
+ * @param reopen if TRUE, open a new update transaction right away
+ * @return FALSE if the transaction could not be committed
+ */
+static gboolean update_commit(struct catalog *catalog, gboolean reopen)
+{
+        g_return_val_if_fail(catalog, FALSE);
+        g_return_val_if_fail(catalog->in_update, FALSE);
+
+        if(!execute_update_printf(catalog,
+                                  FALSE/*no autocommit*/,
+                                  reopen ? "COMMIT;BEGIN" : "COMMIT")) {
+                return FALSE;
+        }
+        catalog->in_update=reopen;
+        catalog->update_count=0;
+        g_get_current_time(&catalog->update_start);
+        return TRUE;
+}
+
+/**
+ * Called after an entry has been added. Commit
+ * and reopen the source update transaction, if
+ * there is one, once it's been open for too long.
+ *
+ * @param catalog
+ * @return FALSE if there was an error
+ */
+static gboolean update_checkpoint(struct catalog *catalog)
+{
+        GTimeVal now;
+        glong elapsed;
+
+        g_return_val_if_fail(catalog, FALSE);
+
+        if(!catalog->in_update) {
+                return TRUE;
+        }
+
+        catalog->update_count++;
+        g_get_current_time(&now);
+        elapsed = (now.tv_sec-catalog->update_start.tv_sec)*1000
+                + (now.tv_usec-catalog->update_start.tv_usec)/1000;
+        if(catalog->update_count<UPDATE_COMMIT_ENTRIES
+           && elapsed<UPDATE_COMMIT_TIMEOUT) {
+                return TRUE;
+        }
+        return update_commit(catalog, TRUE/*reopen*/);
+}
+
+/**
+ * Bring the tables of a catalog up to SCHEMA_REVISION.
+ *
+ * @param catalog a catalog whose db is set
+ * @return FALSE if the catalog could not be upgraded
+ */
+static gboolean upgrade_tables(struct catalog *catalog)
+{
+        int version[2];
+
+        g_return_val_if_fail(catalog!=NULL, FALSE);
+        g_return_val_if_fail(catalog->db!=NULL, FALSE);
+
+        version[0]=-1;
+        version[1]=-1;
+        /* run as an update, so that it can't be interrupted */
+        if(!execute_statement(catalog,
+                              NULL/*not cached*/,
+                              "SELECT version, revision FROM VERSION",
+                              TRUE/*update*/,
+                              0/*argc*/,
+                              NULL/*argv*/,
+                              version_callback,
+                              version/*userdata*/)) {
+                return FALSE;
+        }
+        if(version[0]!=SCHEMA_VERSION) {
+                reset_error(catalog);
+                g_string_append_printf(catalog->error,
+                                       "unsupported catalog version: %d (expected %d)",
+                                       version[0],
+                                       SCHEMA_VERSION);
+                return FALSE;
+        }
+        if(version[1]<1 && !upgrade_to_revision_1(catalog)) {
+                return FALSE;
+        }
+        if(version[1]<2 && !upgrade_to_revision_2(catalog)) {
+                return FALSE;
+        }
+        if(version[1]<3 && !upgrade_to_revision_3(catalog)) {
+                return FALSE;
+        }
+        if(version[1]<4 && !upgrade_to_revision_4(catalog)) {
+                return FALSE;
+        }
+        if(version[1]<5 && !upgrade_to_revision_5(catalog)) {
+                return FALSE;
+        }
+        if(version[1]<6 && !upgrade_to_revision_6(catalog)) {
+                return FALSE;
+        }
+        return TRUE;
+}
+
+/**
+ * sqlite callback that expects a version and a revision as the 1st and 2nd results
+ */
+static int version_callback(void *userdata,
+                            int column_count,
+                            char **result,
+                            char **names)
+{
+        int *version_out;
+        g_return_val_if_fail(userdata!=NULL, 1);
+        g_return_val_if_fail(column_count>1, 1);
+        version_out = (int *)userdata;
+        version_out[0]=atoi(result[0]);
+        version_out[1]=atoi(result[1]);
+        return 1; /* no need for more results */
+}
+
+/**
+ * Revision 1: add the trigram index on entry names.
+ */
+static gboolean upgrade_to_revision_1(struct catalog *catalog)
+{
+        GArray *existing;
+        guint i;
+        gboolean ret;
+
+        if(!execute_update_printf(catalog,
+                                  FALSE/*no autocommit*/,
+                                  "BEGIN;"
+                                  "CREATE TABLE entry_trigrams (trigram VARCHAR NOT NULL, "
+                                  "entry_id INTEGER NOT NULL);"
+                                  "CREATE INDEX trigram_idx ON entry_trigrams (trigram);"
+                                  "CREATE INDEX trigram_entry_idx ON entry_trigrams (entry_id);"
+                                  "CREATE TRIGGER entries_delete_trigrams AFTER DELETE ON entries "
+                                  "BEGIN DELETE FROM entry_trigrams WHERE entry_id=old.id; END;")) {
+                return FALSE;
+        }
+
+        /* names are collected first, to avoid modifying the database
+         * from the query callback */
+        existing = g_array_new(FALSE/*not zero-terminated*/,
+                               FALSE/*don't clear*/,
+                               sizeof(struct entry_name));
+        ret = execute_statement(catalog,
+                                NULL/*not cached*/,
+                                "SELECT id, name FROM entries",
+                                TRUE/*update, can't be interrupted*/,
+                                0/*argc*/,
+                                NULL/*argv*/,
+                                collect_entry_names_callback,
+                                existing/*userdata*/);
+        for(i=0; i<existing->len; i++) {
+                struct entry_name *entry = &g_array_index(existing,
+                                                                struct entry_name,
+                                                                i);
+                if(ret) {
+                        ret = index_trigrams(catalog, entry->id, entry->name);
+                }
+                g_free(entry->name);
+        }
+        g_array_free(existing, TRUE/*free content*/);
+
+        if(!ret) {
+                /* errors roll back the transaction, see execute_statement() */
+                return FALSE;
+        }
+        return execute_update_printf(catalog,
+                                     FALSE/*no autocommit*/,
+                                     "UPDATE VERSION SET revision=1;"
+                                     "COMMIT");
+}
+
+/**
+ * Revision 2: make (source_id, path) unique, so that
+ * catalog_add_entry() can replace entries without looking
+ * them up first.
+ *
+ * Entries that were added twice, which could happen in earlier
+ * revisions, are removed, keeping the most recent one.
+ */
+static gboolean upgrade_to_revision_2(struct catalog *catalog)
+{
+        return execute_update_printf(catalog,
+                                     FALSE/*no autocommit*/,
+                                     "BEGIN;"
+                                     "DELETE FROM entries WHERE id NOT IN "
+                                     " (SELECT MAX(id) FROM entries GROUP BY source_id, path);"
+                                     "CREATE UNIQUE INDEX source_path_idx ON entries (source_id, path);"
+                                     "CREATE TRIGGER entries_replace_trigrams BEFORE INSERT ON entries "
+                                     "BEGIN DELETE FROM entry_trigrams WHERE entry_id=new.id; END;"
+                                     "UPDATE VERSION SET revision=2;"
+                                     "COMMIT");
+}
+
+/**
+ * Revision 3: keep the launch count and the frecency of the entries.
+ *
+ * Entries that have been launched before get a frecency corresponding
+ * to one launch at the time they were last used.
+ */
+static gboolean upgrade_to_revision_3(struct catalog *catalog)
+{
+        return execute_update_printf(catalog,
+                                     FALSE/*no autocommit*/,
+                                     "BEGIN;"
+                                     "CREATE TABLE entry_launches (entry_id INTEGER PRIMARY KEY, "
+                                     "launches INTEGER NOT NULL, "
+                                     "frecency INTEGER NOT NULL);"
+                                     "CREATE TRIGGER entries_delete_launches AFTER DELETE ON entries "
+                                     "BEGIN DELETE FROM entry_launches WHERE entry_id=old.id; END;"
+                                     "INSERT INTO entry_launches (entry_id, launches, frecency) "
+                                     " SELECT id, 1, lastuse*%d FROM entries WHERE lastuse IS NOT NULL;"
+                                     "UPDATE VERSION SET revision=3;"
+                                     "COMMIT",
+                                     FRECENCY_PRECISION);
+}
+
+/**
+ * Revision 4: entries are added with an upsert, see catalog_add_entry(),
+ * and only lose their trigrams when they're renamed.
+ */
+static gboolean upgrade_to_revision_4(struct catalog *catalog)
+{
+        return execute_update_printf(catalog,
+                                     FALSE/*no autocommit*/,
+                                     "BEGIN;"
+                                     "DROP TRIGGER entries_replace_trigrams;"
+                                     "CREATE TRIGGER entries_rename_trigrams AFTER UPDATE OF name ON entries "
+                                     "WHEN old.name<>new.name "
+                                     "BEGIN DELETE FROM entry_trigrams WHERE entry_id=old.id; END;"
+                                     "UPDATE VERSION SET revision=4;"
+                                     "COMMIT");
+}
+
+/**
+ * Revision 5: keep the launch count and the frecency in entries,
+ * sorted by the index frecency_idx, so that the results of a query
+ * can be read in order from the index, a page at a time.
+ */
+static gboolean upgrade_to_revision_5(struct catalog *catalog)
+{
+        return execute_update_printf(catalog,
+                                     FALSE/*no autocommit*/,
+                                     "BEGIN;"
+                                     "ALTER TABLE entries ADD COLUMN launches INTEGER NOT NULL DEFAULT 0;"
+                                     "ALTER TABLE entries ADD COLUMN frecency INTEGER NOT NULL DEFAULT 0;"
+                                     "UPDATE entries SET launches=l.launches, frecency=l.frecency "
+                                     " FROM entry_launches l WHERE l.entry_id=entries.id;"
+                                     "DROP TRIGGER entries_delete_launches;"
+                                     "DROP TABLE entry_launches;"
+                                     "CREATE INDEX frecency_idx ON entries (frecency DESC, id DESC);"
+                                     "UPDATE VERSION SET revision=5;"
+                                     "COMMIT");
+}
+
+/**
+ * Revision 6: keep the mask of the characters of the names,
+ * see name_mask(), so that queries without trigrams can skip
+ * most entries without running a LIKE.
+ */
+static gboolean upgrade_to_revision_6(struct catalog *catalog)
+{
+        return execute_update_printf(catalog,
+                                     FALSE/*no autocommit*/,
+                                     "BEGIN;"
+                                     "ALTER TABLE entries ADD COLUMN mask INTEGER NOT NULL DEFAULT 0;"
+                                     "UPDATE entries SET mask=char_mask(name);"
+                                     "UPDATE VERSION SET revision=6;"
+                                     "COMMIT");
+}
+
+/**
+ * sqlite function frecency_add_launch(frecency, now), which
+ * computes frecency_add_launch() on frecencies stored in
+ * 1/FRECENCY_PRECISION of a second.
+ */
+static void frecency_add_launch_sqlite_function(sqlite3_context *context,
+                                                int argc,
+                                                sqlite3_value **argv)
+{
+        double frecency;
+        double now;
+
+        g_return_if_fail(argc==2);
+
+        frecency = sqlite3_value_double(argv[0])/FRECENCY_PRECISION;
+        now = sqlite3_value_double(argv[1])/FRECENCY_PRECISION;
+        frecency = frecency_add_launch(frecency, now);
+        sqlite3_result_int64(context,
+                             (sqlite3_int64)floor(frecency*FRECENCY_PRECISION+0.5));
+}
+
+/**
+ * Add a launch to a frecency.
+ *
+ * The frecency of an entry launched at t1, t2, ... tn is
+ * H*log2(2^(t1/H) + 2^(t2/H) + ... + 2^(tn/H)), H being
+ * FRECENCY_HALF_LIFE. Comparing frecencies is the same as
+ * comparing the launch counts, each launch weighted by
+ * 2^((t-now)/H), no matter when now is, so entries can be sorted
+ * by frecency without taking the current time into account.
+ *
+ * @param frecency frecency of an entry that has been launched
+ * at least once
+ * @param now time of the new launch (s)
+ * @return new frecency
+ */
+static double frecency_add_launch(double frecency, double now)
+{
+        double high;
+        double low;
+
+        if(frecency>now) {
+                high=frecency;
+                low=now;
+        } else {
+                high=now;
+                low=frecency;
+        }
+        /* H*log2(2^(high/H)+2^(low/H)) without overflowing */
+        return high + FRECENCY_HALF_LIFE*log(1.0+exp((low-high)*M_LN2/FRECENCY_HALF_LIFE))/M_LN2;
+}
+
+/**
+ * sqlite function char_mask(name), which computes name_mask().
+ */
+static void char_mask_sqlite_function(sqlite3_context *context,
+                                      int argc,
+                                      sqlite3_value **argv)
+{
+        const char *name;
+
+        g_return_if_fail(argc==1);
+
+        name = (const char *)sqlite3_value_text(argv[0]);
+        sqlite3_result_int64(context, name==NULL ? 0:name_mask(name));
+}
+
+/**
+ * Compute the mask of the characters of a name, stored in
+ * the column mask of entries.
+ *
+ * A query can only match the names whose mask contains
+ * the mask of its words, see query_matcher_may_match().
+ *
+ * @param name name of an entry
+ * @return query_char_mask() of the prepared name, as stored
+ */
+static gint64 name_mask(const char *name)
+{
+        char *prepared;
+        guint64 mask;
+
+        prepared = query_prepare(name);
+        mask = query_char_mask(prepared);
+        g_free(prepared);
+        /* sqlite integers are signed */
+        return (gint64)mask;
+}
+
+/**
+ * Compute the pertinence of an entry that has been launched.
+ *
+ * @param frecency frecency, see frecency_add_launch()
+ * @param now current time (s)
+ * @return a pertinence between 0.5 (never launched) and 1.0
+ */
+static float frecency_pertinence(double frecency, gulong now)
+{
+        double weight;
+
+        /* launch count, each launch weighted by 2^((t-now)/H) */
+        weight = exp((frecency-now)*M_LN2/FRECENCY_HALF_LIFE);
+        return 0.5 + 0.5*weight/(weight+1.0);
+}
+
+/**
+ * sqlite callback that adds struct entry_name into a GArray
+ * for each id, name row.
+ */
+static int collect_entry_names_callback(void *userdata,
+                                        int column_count,
+                                        char **result,
+                                        char **names)
+{
+        GArray *array;
+        struct entry_name entry;
+
+        g_return_val_if_fail(userdata!=NULL, 1);
+        g_return_val_if_fail(column_count>1, 1);
+
+        array = (GArray *)userdata;
+        entry.id=atoi(result[0]);
+        entry.name=g_strdup(result[1]);
+        g_array_append_val(array, entry);
+        return 0;
+}
+
+/**
+ * Extract the trigrams of a string.
+ *
+ * Trigrams are sequences of 3 bytes, converted to lower case.
+ *
+ * LIKE is only case-insensitive on ASCII characters
+ * and treats % and _ specially, so trigrams that contain
+ * a non-ASCII character, a % or an _ are ignored.
+ *
+ * @param trigrams array of char * to add the trigrams to, unless
+ * they're already there. Trigrams are allocated with g_malloc().
+ * @param str string to extract the trigrams from
+ * @param max maximum number of trigrams the array may contain
+ */
+static void add_trigrams_from(GPtrArray *trigrams, const char *str, guint max)
+{
+        int len;
+        int i;
+
+        g_return_if_fail(trigrams!=NULL);
+        g_return_if_fail(str!=NULL);
+
+        len = strlen(str);
+        for(i=0; i+3<=len && trigrams->len<max; i++) {
+                char trigram[4];
+                gboolean usable=TRUE;
+                guint j;
+
+                for(j=0; j<3; j++) {
+                        char c = str[i+j];
+                        if((c & 0x80)!=0 || c=='%' || c=='_') {
+                                usable=FALSE;
+                        }
+                        trigram[j]=g_ascii_tolower(c);
+                }
+                trigram[3]='\0';
+                for(j=0; usable && j<trigrams->len; j++) {
+                        if(strcmp(trigram, (char *)g_ptr_array_index(trigrams, j))==0) {
+                                usable=FALSE;
+                        }
+                }
+                if(usable) {
+                        g_ptr_array_add(trigrams, g_strdup(trigram));
+                }
+        }
+}
+
+/**
+ * Free an array filled by add_trigrams_from() and its content.
+ */
+static void free_trigrams(GPtrArray *trigrams)
+{
+        guint i;
+        g_return_if_fail(trigrams!=NULL);
+        for(i=0; i<trigrams->len; i++) {
+                g_free(g_ptr_array_index(trigrams, i));
+        }
+        g_ptr_array_free(trigrams, TRUE/*free segment*/);
+}
+
+/**
+ * Add the trigrams of an entry name into the trigram index.
+ *
+ * @param catalog
+ * @param entry_id
+ * @param name entry name
+ * @return FALSE if there was an error
+ */
+static gboolean index_trigrams(struct catalog *catalog, int entry_id, const char *name)
+{
+        GPtrArray *trigrams;
+        char entry_id_str[16];
+        const char *argv[2];
+        gboolean ret;
+        guint i;
+
+        g_return_val_if_fail(catalog!=NULL, FALSE);
+        g_return_val_if_fail(name!=NULL, FALSE);
+
+        g_snprintf(entry_id_str, sizeof(entry_id_str), "%d", entry_id);
+
+        trigrams = g_ptr_array_new();
+        add_trigrams_from(trigrams, name, G_MAXUINT);
+        ret=TRUE;
+        argv[1]=entry_id_str;
+        for(i=0; ret && i<trigrams->len; i++) {
+                argv[0]=(const char *)g_ptr_array_index(trigrams, i);
+                ret = execute_statement(catalog,
+                                        &catalog->statements[STATEMENT_INSERT_TRIGRAM],
+                                        statement_sql[STATEMENT_INSERT_TRIGRAM],
+                                        TRUE/*update*/,
+                                        2,
+                                        argv,
+                                        NULL/*no callback*/,
+                                        NULL/*no userdata*/);
+        }
+        free_trigrams(trigrams);
+        return ret;
+}
@@ -50,12 +50,27 @@ struct catalog_query_result
         /** entry values */
         struct catalog_entry entry;
 
-        /** result pertinence */
+        /**
+         * result pertinence, between 0.5 for entries that
+         * have never been launched and 1.0 for entries that
+         * are launched often
+         */
         float pertinence;
 
         /** query id */
         QueryId query_id;
 
+        /**
+         * Time of the last use of the entry, in seconds since
+         * the epoch, 0 if it's never been used
+         */
+        gulong lastuse;
+
+        /**
+         * Number of times the entry has been launched
+         */
+        int launches;
+
         /**
          * TRUE if the entry is enabled.
          * Only enabled entries are sent by run_query, so
@@ -178,6 +193,69 @@ gulong catalog_timestamp_get(struct catalog *catalog);
  */
 gboolean catalog_timestamp_update(struct catalog *gcatalog);
 
+/**
+ * Version of the content of a catalog.
+ *
+ * Two versions are equal only if nothing that changes the
+ * results of a query happened in between: no source was indexed,
+ * added, removed, enabled or disabled, no entry was launched
+ * or disabled.
+ */
+struct catalog_version
+{
+        /** see catalog_timestamp_get() */
+        gulong timestamp;
+        /** number of sources */
+        int source_count;
+        /** sum of the versions of the sources, incremented by catalog_begin_source_update() */
+        gulong source_versions;
+        /** number of sources that are enabled */
+        int enabled_sources;
+        /** number of entries that are disabled */
+        int disabled_entries;
+        /** time at which an entry was last launched */
+        gulong lastuse;
+};
+
+/**
+ * Get the current version of the content of the catalog.
+ *
+ * The version is checked with a single, cheap query. It's
+ * the same across connections, as long as the catalog
+ * doesn't change.
+ *
+ * @param catalog
+ * @param version structure to fill (out)
+ * @return FALSE if there was an error, including if the catalog
+ * is disconnected
+ */
+gboolean catalog_version_get(struct catalog *catalog, struct catalog_version *version);
+
+/**
+ * Compare two versions of the content of a catalog.
+ *
+ * @return TRUE if the catalog hasn't changed between the two versions
+ */
+gboolean catalog_version_equal(const struct catalog_version *a, const struct catalog_version *b);
+
+/**
+ * Read the indexes queries use, so that they're in the
+ * cache of the connection and of the system when the
+ * first query is run.
+ *
+ * It's only worth calling on a connection that's just
+ * been opened; on an older one, the indexes are in
+ * the cache already.
+ *
+ * This can take a while on a large catalog, but it
+ * stops as soon as catalog_interrupt() is called.
+ *
+ * @param catalog
+ * @return FALSE if there was an error, including if the catalog
+ * is disconnected
+ */
+gboolean catalog_warm_up(struct catalog *catalog);
+
 /**
  * Execute a query and add the results into
  * the query runner.
@@ -202,6 +280,108 @@ gboolean catalog_executequery(struct catalog *catalog,
                               catalog_callback_f callback,
                               void *userdata);
 
+/**
+ * A query whose results are read page by page,
+ * see catalog_query_open()
+ */
+struct catalog_query;
+
+/**
+ * Prepare a query whose results will be read
+ * page by page using catalog_query_next_page().
+ *
+ * Words are looked for in names the way query_get_mode()
+ * says, see query.h. In QUERY_MODE_FUZZY, no index can help.
+ *
+ * Results are sorted the same way catalog_executequery()
+ * sorts them. Each page starts where the previous one
+ * ended, so no statement is kept open between two pages
+ * and reading a page costs the same no matter how many
+ * pages have been read before.
+ *
+ * The query must be closed using catalog_query_close() before
+ * the catalog is disconnected.
+ *
+ * This method will always fail while the catalog
+ * is disconnected.
+ *
+ * @param catalog the catalog
+ * @param query query to run
+ * @return a query to pass to catalog_query_next_page() or NULL
+ */
+struct catalog_query *catalog_query_open(struct catalog *catalog,
+                                         const char *query);
+
+/**
+ * Prepare a deep query, whose results will be read
+ * page by page using catalog_query_next_page().
+ *
+ * A deep query returns the entries for which every word
+ * of the query is found in the name, the long name or the
+ * path. It's more expensive than catalog_query_open(), as
+ * no index can help.
+ *
+ * Results are sorted the same way catalog_query_open()
+ * sorts them and they include the results of catalog_query_open().
+ *
+ * @param catalog the catalog
+ * @param query query to run
+ * @return a query to pass to catalog_query_next_page() or NULL
+ */
+struct catalog_query *catalog_query_open_deep(struct catalog *catalog,
+                                              const char *query);
+
+/**
+ * Read the next page of results of a query.
+ *
+ * If the catalog has been interrupted some time before, th
+ * query will return immediately. Use catalog_restart() to
+ * recover from an interruption.
+ *
+ * @param cquery query returned by catalog_query_open()
+ * @param page_size maximum number of results to read
+ * @param callback function to call for every results
+ * @param userdata userdata to pass to the callback
+ * @param more_out if non-null, set to TRUE if there
+ * might be more results to read, FALSE if the last page
+ * has been read, the query was interrupted or the callback
+ * asked for the query to stop
+ * @return return FALSE if there was a fatal error, in
+ * which case the catalog must be immediately
+ * disconnected.
+ */
+gboolean catalog_query_next_page(struct catalog_query *cquery,
+                                 int page_size,
+                                 catalog_callback_f callback,
+                                 void *userdata,
+                                 gboolean *more_out);
+
+/**
+ * Free a query returned by catalog_query_open().
+ *
+ * @param cquery the query
+ */
+void catalog_query_close(struct catalog_query *cquery);
+
+/**
+ * Get all entries that can be returned by catalog_executequery(),
+ * that is, the enabled entries of the enabled sources.
+ *
+ * Entries are sorted the same way catalog_executequery() sorts
+ * them, highest frecency first.
+ *
+ * This method will always fail while the catalog
+ * is disconnected.
+ *
+ * @param catalog the catalog
+ * @param callback function to call for every entry
+ * @param userdata userdata to pass to the callback
+ * @return return FALSE if there was an error
+ */
+gboolean catalog_get_enabled_entries(struct catalog *catalog,
+                                     catalog_callback_f callback,
+                                     void *userdata);
+
 /**
  * Get the content of a source as a query result.
  * If the catalog has been interrupted some time before, th
@@ -242,8 +422,10 @@ gboolean catalog_get_source_content_count(struct catalog *catalog,
  * Update the timestamp of the given entry, because it
  * has just been chosen by the user.
  *
- * Entries with the most up-to-date timestamp will
- * appear first.
+ * This also counts the launch and updates the frecency of
+ * the entry, a launch count in which recent launches weigh more.
+ * Entries with the highest frecency appear first and get
+ * a higher pertinence.
  *
  * This method will always fail while the catalog
  * is disconnected.
@@ -3,6 +3,7 @@
 #endif
 #include "catalog.h"
 #include "catalog_result.h"
+#include "query.h"
 #include <stdio.h>
 #include <check.h>
 #include <sys/types.h>
@@ -11,17 +12,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifdef HAVE_SQLITE2
 #include <sqlite.h>
+#undef SQLITE_VERSION
+#endif
+#include <sqlite3.h>
 #include <fcntl.h>
 
 /** database file */
 #define PATH ".catalog_check.db"
 #define TEST_LAUNCHER "test"
+/** number of entries to add in the timed tests */
+#define TIMED_ENTRY_COUNT 2500
+/** number of launches recorded by each thread in test_concurrent_launches */
+#define CONCURRENT_LAUNCH_COUNT 50
+/** lastuse of hello.txt in revision_0_sql() */
+#define REVISION_0_LASTUSE 0x42000000
 
 static struct catalog *catalog;
 static int source_id;
-static GMutex *execute_query_mutex;
-static GCond  *execute_query_cond;
+/** set by indexer_thread() once it's done */
+static gint indexer_done;
 
 #define CATALOG_ENTRY(path, filename) { filename, path, path, TEST_LAUNCHER, 0 }
 struct catalog_entry entries[] = {
@@ -51,10 +62,17 @@ static void execute_query_and_expect(const char *query, int goal_length, char *g
 static void assert_array_contains(const char *query, int goal_length, char *goal[], GArray *array, gboolean ordered);
 static gboolean test_source_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
 static gboolean nevercalled_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
+static gboolean first_result_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
 static gboolean countdown_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
 static gboolean countdown_interrupt_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
-static gpointer execute_query_thread(void *userdata);
+static gpointer indexer_thread(void *userdata);
+static gpointer launcher_thread(void *userdata);
+static gboolean count_results_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
+static gint compare_doubles(gconstpointer a, gconstpointer b);
+static char *revision_0_sql(const char *lastuse);
+static void assert_revision_0_content(void);
 static void addentries(struct catalog *catalog, int sourceid, int count, const char *name_pattern);
+static void addentries_quietly(struct catalog *catalog, int sourceid, int count, const char *name_pattern);
 static void _assert_source_exists(struct catalog *catalog, const char *type, int sourceid, const char *file, int line);
 
 /* ------------------------- test suite: catalog */
@@ -63,6 +81,9 @@ static void setup()
 {
         g_thread_init_with_errorcheck_mutexes(NULL/*vtable*/);
         unlink_if_exists(PATH);
+        unlink_if_exists(PATH "-wal");
+        unlink_if_exists(PATH "-shm");
+        unlink_if_exists(PATH ".sqlite2");
 
         catalog=catalog_new(PATH);
 }
@@ -71,6 +92,9 @@ static void teardown()
 {
         catalog_free(catalog);
         unlink(PATH);
+        unlink(PATH "-wal");
+        unlink(PATH "-shm");
+        unlink(PATH ".sqlite2");
 }
 
 static void setup_query()
@@ -548,6 +572,237 @@ START_TEST(test_source_update)
 }
 END_TEST
 
+/**
+ * Compare the time it takes to add entries with one transaction
+ * per entry (outside of any source update) and with one transaction
+ * per source update.
+ */
+START_TEST(test_source_update_timed)
+{
+        int source1_id;
+        int source2_id;
+        unsigned int source2_count;
+        GTimer *timer;
+        gdouble unbatched;
+        gdouble batched;
+
+        printf("--- test_source_update_timed\n");
+
+        catalog_cmd(catalog,
+                    "connnect",
+                    catalog_connect(catalog));
+        catalog_cmd(catalog,
+                    "add_source(1)",
+                    catalog_add_source(catalog, "test", &source1_id));
+        catalog_cmd(catalog,
+                    "add_source(2)",
+                    catalog_add_source(catalog, "test", &source2_id));
+
+        timer = g_timer_new();
+        addentries_quietly(catalog, source1_id, TIMED_ENTRY_COUNT, "unbatched-%d");
+        unbatched = g_timer_elapsed(timer, NULL/*microseconds*/);
+
+        g_timer_start(timer);
+        catalog_cmd(catalog,
+                    "begin_source_update",
+                    catalog_begin_source_update(catalog, source2_id));
+        addentries_quietly(catalog, source2_id, TIMED_ENTRY_COUNT, "batched-%d");
+        catalog_cmd(catalog,
+                    "end_source_update",
+                    catalog_end_source_update(catalog, source2_id));
+        batched = g_timer_elapsed(timer, NULL/*microseconds*/);
+        g_timer_destroy(timer);
+
+        printf("--- test_source_update_timed: %d entries: "
+               "%.3fs with one transaction per entry, "
+               "%.3fs with one transaction per source update\n",
+               TIMED_ENTRY_COUNT,
+               unbatched,
+               batched);
+
+        catalog_cmd(catalog,
+                    "get count",
+                    catalog_get_source_content_count(catalog,
+                                                     source2_id,
+                                                     &source2_count));
+        fail_unless(source2_count==TIMED_ENTRY_COUNT,
+                    "entries lost during intermediate commits");
+
+        printf("--- test_source_update_timed OK\n");
+}
+END_TEST
+
+/**
+ * Run queries while another connection indexes entries and
+ * report how long the queries took.
+ */
+START_TEST(test_query_while_indexing_timed)
+{
+        struct catalog *indexer;
+        GThread *thread;
+        GArray *latencies;
+        GTimer *timer;
+        gboolean indexed;
+        static const int percentiles[] = { 50, 90, 99, 100 };
+        int i;
+
+        printf("--- test_query_while_indexing_timed\n");
+
+        catalog_cmd(catalog,
+                    "connnect",
+                    catalog_connect(catalog));
+        catalog_cmd(catalog,
+                    "add_source",
+                    catalog_add_source(catalog, "test", &source_id));
+        catalog_cmd(catalog,
+                    "begin_source_update",
+                    catalog_begin_source_update(catalog, source_id));
+        addentries_quietly(catalog, source_id, TIMED_ENTRY_COUNT, "existing-%d");
+        catalog_cmd(catalog,
+                    "end_source_update",
+                    catalog_end_source_update(catalog, source_id));
+
+        indexer = catalog_new(PATH);
+        catalog_cmd(indexer,
+                    "connect indexer",
+                    catalog_connect(indexer));
+
+        indexer_done=0;
+        thread = g_thread_create(indexer_thread,
+                                 indexer/*userdata*/,
+                                 TRUE/*joinable*/,
+                                 NULL);
+        fail_unless(thread!=NULL,
+                    "thread creation failed");
+
+        latencies = g_array_new(FALSE/*not zero-terminated*/,
+                                FALSE/*don't clear*/,
+                                sizeof(gdouble));
+        timer = g_timer_new();
+        do {
+                int count = 0;
+                gdouble latency;
+
+                g_timer_start(timer);
+                catalog_cmd(catalog,
+                            "executequery()",
+                            catalog_executequery(catalog,
+                                                 "existing-12",
+                                                 count_results_callback,
+                                                 &count));
+                latency = g_timer_elapsed(timer, NULL/*microseconds*/);
+                fail_unless(count==111,
+                            "wrong number of results");
+                g_array_append_val(latencies, latency);
+        } while(!g_atomic_int_get(&indexer_done));
+        g_timer_destroy(timer);
+
+        indexed = GPOINTER_TO_INT(g_thread_join(thread));
+        catalog_cmd(indexer, "indexer", indexed);
+        catalog_free(indexer);
+
+        g_array_sort(latencies, compare_doubles);
+        printf("--- test_query_while_indexing_timed: %u queries while indexing %d entries:",
+               latencies->len,
+               TIMED_ENTRY_COUNT*4);
+        for(i=0; i<G_N_ELEMENTS(percentiles); i++) {
+                guint index = (latencies->len-1)*percentiles[i]/100;
+                printf(" p%d=%.2fms",
+                       percentiles[i],
+                       g_array_index(latencies, gdouble, index)*1000.0);
+        }
+        printf("\n");
+        g_array_free(latencies, TRUE/*free content*/);
+
+        printf("--- test_query_while_indexing_timed OK\n");
+}
+END_TEST
+
+/**
+ * Make sure catalogs created before the trigram index existed
+ * are upgraded when connecting.
+ */
+START_TEST(test_upgrade_from_revision_0)
+{
+        char *errmsg=NULL;
+        char *sql;
+        sqlite3 *db;
+        int ret;
+
+        printf("--- test_upgrade_from_revision_0\n");
+
+        fail_unless(sqlite3_open(PATH, &db)==SQLITE_OK, "sqlite3_open() failed");
+        sql = revision_0_sql("1107296256");
+        ret = sqlite3_exec(db,
+                           sql,
+                           NULL/*no callback*/,
+                           NULL/*no userdata*/,
+                           &errmsg);
+        g_free(sql);
+        fail_unless(ret==SQLITE_OK, "creation of a revision 0 catalog failed");
+        sqlite3_close(db);
+
+        catalog_cmd(catalog,
+                    "connnect",
+                    catalog_connect(catalog));
+        assert_revision_0_content();
+
+        /* connect again, now that the catalog is up-to-date */
+        catalog_disconnect(catalog);
+        catalog_cmd(catalog,
+                    "reconnnect",
+                    catalog_connect(catalog));
+        assert_revision_0_content();
+
+        printf("--- test_upgrade_from_revision_0 OK\n");
+}
+END_TEST
+
+#ifdef HAVE_SQLITE2
+/**
+ * Make sure catalogs created with sqlite 2 by older
+ * versions of ocha are converted when connecting.
+ */
+START_TEST(test_convert_from_sqlite2)
+{
+        char *errmsg=NULL;
+        char *sql;
+        sqlite *db;
+        int ret;
+
+        printf("--- test_convert_from_sqlite2\n");
+
+        db = sqlite_open(PATH, 0600, &errmsg);
+        fail_unless(db!=NULL, "sqlite_open() failed");
+        /* lastuse used to be in hexadecimal */
+        sql = revision_0_sql("0000000042000000.000000");
+        ret = sqlite_exec(db,
+                          sql,
+                          NULL/*no callback*/,
+                          NULL/*no userdata*/,
+                          &errmsg);
+        g_free(sql);
+        fail_unless(ret==SQLITE_OK, "creation of an sqlite 2 catalog failed");
+        sqlite_close(db);
+
+        catalog_cmd(catalog,
+                    "connnect",
+                    catalog_connect(catalog));
+        assert_revision_0_content();
+        fail_unless(exists(PATH ".sqlite2"),
+                    "old catalog not kept");
+
+        catalog_disconnect(catalog);
+        catalog_cmd(catalog,
+                    "reconnnect",
+                    catalog_connect(catalog));
+        assert_revision_0_content();
+
+        printf("--- test_convert_from_sqlite2 OK\n");
+}
+END_TEST
+#endif /*HAVE_SQLITE2*/
+
 START_TEST(test_check_source_create_new)
 {
 
@@ -598,6 +853,79 @@ START_TEST(test_timestamp)
 }
 END_TEST
 
+/**
+ * The version changes whenever the catalog changes
+ * in a way that changes the results of queries.
+ */
+START_TEST(test_version)
+{
+        struct catalog_version v1;
+        struct catalog_version v2;
+        struct catalog_entry entry = CATALOG_ENTRY("toto", "/tmp/toto.txt");
+        int source_id=-1;
+        int entry_id=-1;
+
+        printf("--- test_version\n");
+
+        catalog_cmd(catalog,
+                    "connnect",
+                    catalog_connect(catalog));
+
+        catalog_cmd(catalog, "version", catalog_version_get(catalog, &v1));
+        catalog_cmd(catalog, "version", catalog_version_get(catalog, &v2));
+        fail_unless(catalog_version_equal(&v1, &v2), "nothing changed");
+
+        catalog_cmd(catalog, "add_source", catalog_add_source(catalog, "test", &source_id));
+        catalog_cmd(catalog, "version", catalog_version_get(catalog, &v2));
+        fail_unless(!catalog_version_equal(&v1, &v2), "new source");
+
+        v1=v2;
+        catalog_cmd(catalog, "begin", catalog_begin_source_update(catalog, source_id));
+        entry.source_id=source_id;
+        catalog_cmd(catalog, "add_entry", catalog_add_entry(catalog, &entry, &entry_id));
+        catalog_cmd(catalog, "end", catalog_end_source_update(catalog, source_id));
+        catalog_cmd(catalog, "version", catalog_version_get(catalog, &v2));
+        fail_unless(!catalog_version_equal(&v1, &v2), "source updated");
+
+        v1=v2;
+        catalog_cmd(catalog, "launch", catalog_update_entry_timestamp(catalog, entry_id));
+        catalog_cmd(catalog, "version", catalog_version_get(catalog, &v2));
+        fail_unless(!catalog_version_equal(&v1, &v2), "entry launched");
+
+        v1=v2;
+        catalog_cmd(catalog, "disable", catalog_entry_set_enabled(catalog, entry_id, FALSE));
+        catalog_cmd(catalog, "version", catalog_version_get(catalog, &v2));
+        fail_unless(!catalog_version_equal(&v1, &v2), "entry disabled");
+
+        v1=v2;
+        catalog_disconnect(catalog);
+        catalog_cmd(catalog,
+                    "connnect",
+                    catalog_connect(catalog));
+        catalog_cmd(catalog, "version", catalog_version_get(catalog, &v2));
+        fail_unless(catalog_version_equal(&v1, &v2), "same version after reconnection");
+
+        printf("--- test_version OK\n");
+}
+END_TEST
+
+START_TEST(test_warm_up)
+{
+        int source_id=-1;
+
+        printf("--- test_warm_up\n");
+
+        catalog_cmd(catalog,
+                    "connnect",
+                    catalog_connect(catalog));
+        catalog_cmd(catalog, "add_source", catalog_add_source(catalog, "test", &source_id));
+        addentries(catalog, source_id, 10, "entry-%d");
+        catalog_cmd(catalog, "warm_up", catalog_warm_up(catalog));
+
+        printf("--- test_warm_up OK\n");
+}
+END_TEST
+
 START_TEST(test_check_source_transform)
 {
         int source_id=-1;
@@ -717,6 +1045,178 @@ START_TEST(test_lastexecuted_first)
 }
 END_TEST
 
+START_TEST(test_mostlaunched_first)
+{
+        static char *goal[] = { "total.h", "toto.h", "toto.c" };
+        struct catalog_query_result first;
+
+        printf("--- test_mostlaunched_first\n");
+        catalog_update_entry_timestamp(catalog, entries_id[2]/*total.h*/);
+        catalog_update_entry_timestamp(catalog, entries_id[2]/*total.h*/);
+        catalog_update_entry_timestamp(catalog, entries_id[1]/*toto.h*/);
+        execute_query_and_expect("tot",
+                                 3,
+                                 goal,
+                                 TRUE/*ordered*/);
+
+        first.id=-1;
+        catalog_cmd(catalog,
+                    "executequery(total)",
+                    catalog_executequery(catalog, "total", first_result_callback, &first));
+        fail_unless(first.id==entries_id[2], "total.h not found");
+        fail_unless(first.launches==2,
+                    g_strdup_printf("wrong launch count: %d", first.launches));
+        fail_unless(first.pertinence>0.5 && first.pertinence<=1.0,
+                    g_strdup_printf("wrong pertinence: %f", first.pertinence));
+
+        first.id=-1;
+        catalog_cmd(catalog,
+                    "executequery(toto.c)",
+                    catalog_executequery(catalog, "toto.c", first_result_callback, &first));
+        fail_unless(first.id==entries_id[0], "toto.c not found");
+        fail_unless(first.launches==0,
+                    g_strdup_printf("wrong launch count: %d", first.launches));
+        fail_unless(first.pertinence==0.5,
+                    g_strdup_printf("wrong pertinence: %f", first.pertinence));
+}
+END_TEST
+
+/**
+ * Launches recorded at the same time by different
+ * connections are all counted.
+ */
+START_TEST(test_concurrent_launches)
+{
+        struct catalog *other;
+        struct catalog_query_result first;
+        GThread *thread;
+        int i;
+
+        printf("--- test_concurrent_launches\n");
+
+        other = catalog_new(PATH);
+        catalog_cmd(other,
+                    "connect other",
+                    catalog_connect(other));
+        thread = g_thread_create(launcher_thread,
+                                 other/*userdata*/,
+                                 TRUE/*joinable*/,
+                                 NULL);
+        fail_unless(thread!=NULL,
+                    "thread creation failed");
+        for(i=0; i<CONCURRENT_LAUNCH_COUNT; i++) {
+                catalog_cmd(catalog,
+                            "update_entry_timestamp",
+                            catalog_update_entry_timestamp(catalog, entries_id[2]/*total.h*/));
+        }
+        fail_unless(GPOINTER_TO_INT(g_thread_join(thread)),
+                    "launches of the other connection failed");
+        catalog_free(other);
+
+        first.id=-1;
+        catalog_cmd(catalog,
+                    "executequery(total)",
+                    catalog_executequery(catalog, "total", first_result_callback, &first));
+        fail_unless(first.id==entries_id[2], "total.h not found");
+        fail_unless(first.launches==2*CONCURRENT_LAUNCH_COUNT,
+                    g_strdup_printf("wrong launch count: %d", first.launches));
+}
+END_TEST
+
+START_TEST(test_query_pages)
+{
+        GArray *all = g_array_new(TRUE/*zero_terminated*/, TRUE/*clear*/, sizeof(char *));
+        GArray *paged = g_array_new(TRUE/*zero_terminated*/, TRUE/*clear*/, sizeof(char *));
+        struct catalog_query *cquery;
+        gboolean more = TRUE;
+        int pages = 0;
+
+        printf("--- test_query_pages\n");
+        catalog_update_entry_timestamp(catalog, entries_id[5]/*talm.h*/);
+        catalog_update_entry_timestamp(catalog, entries_id[1]/*toto.h*/);
+
+        catalog_cmd(catalog,
+                    "executequery(t)",
+                    catalog_executequery(catalog, "t", collect_result_names_callback, &all));
+        fail_unless(all->len==entries_length,
+                    g_strdup_printf("expected %d results, got %d",
+                                    (int)entries_length, all->len));
+
+        cquery = catalog_query_open(catalog, "t");
+        fail_unless(cquery!=NULL, "catalog_query_open() failed");
+        while(more) {
+                catalog_cmd(catalog,
+                            "next_page()",
+                            catalog_query_next_page(cquery,
+                                                    3/*page_size*/,
+                                                    collect_result_names_callback,
+                                                    &paged,
+                                                    &more));
+                pages++;
+                fail_unless(pages<=3, "too many pages");
+        }
+        catalog_query_close(cquery);
+
+        /* 3+3+2 */
+        fail_unless(pages==3, g_strdup_printf("wrong page count: %d", pages));
+        assert_array_contains("t (paged)",
+                              all->len,
+                              (char **)all->data,
+                              paged,
+                              TRUE/*ordered*/);
+}
+END_TEST
+
+START_TEST(test_query_deep)
+{
+        static char *goal[] = { "hello.txt" };
+        GArray *names = g_array_new(TRUE/*zero_terminated*/, TRUE/*clear*/, sizeof(char *));
+        struct catalog_query *cquery;
+        gboolean more = TRUE;
+        int pages = 0;
+
+        printf("--- test_query_deep\n");
+
+        /* "tmp" is only in the long names and paths */
+        execute_query_and_expect("tmp", 0, NULL, FALSE/*not ordered*/);
+
+        cquery = catalog_query_open_deep(catalog, "tmp");
+        fail_unless(cquery!=NULL, "catalog_query_open_deep() failed");
+        while(more) {
+                catalog_cmd(catalog,
+                            "next_page()",
+                            catalog_query_next_page(cquery,
+                                                    5/*page_size*/,
+                                                    collect_result_names_callback,
+                                                    &names,
+                                                    &more));
+                pages++;
+                fail_unless(pages<=2, "too many pages");
+        }
+        catalog_query_close(cquery);
+        fail_unless(names->len==entries_length,
+                    g_strdup_printf("expected %d results, got %d",
+                                    (int)entries_length, names->len));
+
+        g_array_set_size(names, 0);
+        cquery = catalog_query_open_deep(catalog, "TMP hell");
+        fail_unless(cquery!=NULL, "catalog_query_open_deep() failed");
+        catalog_cmd(catalog,
+                    "next_page()",
+                    catalog_query_next_page(cquery,
+                                            5/*page_size*/,
+                                            collect_result_names_callback,
+                                            &names,
+                                            &more));
+        catalog_query_close(cquery);
+        assert_array_contains("TMP hell (deep)",
+                              1,
+                              goal,
+                              names,
+                              FALSE/*not ordered*/);
+}
+END_TEST
+
 START_TEST(test_execute_query_with_space)
 {
         static char *goal[] = { "toto.c" };
@@ -728,6 +1228,125 @@ START_TEST(test_execute_query_with_space)
 }
 END_TEST
 
+START_TEST(test_execute_query_many_words)
+{
+        static char *goal[] = { "toto.c" };
+        printf("--- test_execute_query_many_words\n");
+        /* more words than what the catalog keeps compiled */
+        execute_query_and_expect("t o . c to",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+        /* run it again, to use the compiled statements */
+        execute_query_and_expect("to .c",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+        execute_query_and_expect("to .c",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+}
+END_TEST
+
+START_TEST(test_execute_query_fuzzy)
+{
+        static char *goal[] = { "toto.h", "total.h" };
+        struct catalog_query *cquery;
+        GArray *names = g_array_new(TRUE/*zero_terminated*/, TRUE/*clear*/, sizeof(char *));
+
+        printf("--- test_execute_query_fuzzy\n");
+        execute_query_and_expect("tth",
+                                 0,
+                                 NULL,
+                                 FALSE/*not ordered*/);
+
+        query_set_mode(QUERY_MODE_FUZZY);
+        execute_query_and_expect("tth",
+                                 2,
+                                 goal,
+                                 FALSE/*not ordered*/);
+        execute_query_and_expect("TTH",
+                                 2,
+                                 goal,
+                                 FALSE/*not ordered*/);
+
+        cquery = catalog_query_open(catalog, "tt .h");
+        fail_unless(cquery!=NULL, "catalog_query_open() failed");
+        catalog_cmd(catalog,
+                    "next_page()",
+                    catalog_query_next_page(cquery,
+                                            5/*page_size*/,
+                                            collect_result_names_callback,
+                                            &names,
+                                            NULL/*more_out*/));
+        catalog_query_close(cquery);
+        assert_array_contains("tt .h (paged)",
+                              2,
+                              goal,
+                              names,
+                              FALSE/*not ordered*/);
+        query_set_mode(QUERY_MODE_SUBSTRING);
+}
+END_TEST
+
+START_TEST(test_execute_query_quote)
+{
+        static char *goal[] = { "To'to" };
+        struct catalog_entry entry = CATALOG_ENTRY("/tmp/to'to.txt", "To'to");
+
+        printf("--- test_execute_query_quote\n");
+        entry.source_id=source_id;
+        catalog_cmd(catalog,
+                    "addentry(/tmp/to'to.txt)",
+                    catalog_add_entry(catalog,
+                                      &entry,
+                                      NULL/*id_out*/));
+        execute_query_and_expect("o'to",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+}
+END_TEST
+
+START_TEST(test_execute_query_renamed)
+{
+        static char *goal[] = { "renamed.c" };
+        struct catalog_entry entry = CATALOG_ENTRY("/tmp/toto.c", "renamed.c");
+        int id=-1;
+
+        printf("--- test_execute_query_renamed\n");
+        entry.source_id=source_id;
+        catalog_cmd(catalog,
+                    "addentry(/tmp/toto.c)",
+                    catalog_add_entry(catalog,
+                                      &entry,
+                                      &id));
+        fail_unless(id==entries_id[0],
+                    "renamed entry got a new id");
+        execute_query_and_expect("renamed",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+        execute_query_and_expect("toto.c",
+                                 0,
+                                 NULL,
+                                 FALSE/*not ordered*/);
+
+        /* the mask of the name must follow the rename */
+        query_set_mode(QUERY_MODE_FUZZY);
+        execute_query_and_expect("rnmd",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+        execute_query_and_expect("tto.c",
+                                 0,
+                                 NULL,
+                                 FALSE/*not ordered*/);
+        query_set_mode(QUERY_MODE_SUBSTRING);
+}
+END_TEST
+
 START_TEST(test_callback_stops_query)
 {
         int count=1;
@@ -794,59 +1413,49 @@ START_TEST(test_recover_from_interruption)
 }
 END_TEST
 
+/**
+ * Queries see the content of the catalog as it was before
+ * the current write transaction of another connection,
+ * without waiting for the transaction to end.
+ */
 START_TEST(test_busy)
 {
-        GThread *thread;
         static char *goal[] = { "toto.c" };
+        char *errmsg=NULL;
+        sqlite3 *db;
+        GTimer *timer;
+        int ret;
 
         printf("--- test_busy\n");
-        execute_query_mutex = g_mutex_new();
-        execute_query_cond = g_cond_new();
-
-        g_mutex_lock(execute_query_mutex);
-        thread =  g_thread_create(execute_query_thread,
-                                  NULL/*userdata*/,
-                                  FALSE/*not joinable*/,
-                                  NULL);
-        fail_unless(thread!=NULL,
-                    "thread creation failed");
-
-        printf("test_busy: broadcast (interrupt)\n");
-
-        g_cond_wait(execute_query_cond, execute_query_mutex);
-
-/* tell the thread to lock and interrupt us in a few seconds*/
-        g_cond_broadcast(execute_query_cond);
-        g_mutex_unlock(execute_query_mutex);
-
-        printf("test_busy: execute query\n");
-        mark_point();
-        execute_query_and_expect("toto.c",
-                                 0,
-                                 NULL,
-                                 FALSE/*not ordered*/);
-        mark_point();
-
-        printf("test_busy: query done\n");
-        catalog_restart(catalog);
-
-        g_mutex_lock(execute_query_mutex);
-
-/* tell the thread to rollback in a few seconds*/
-        g_cond_broadcast(execute_query_cond);
-        g_mutex_unlock(execute_query_mutex);
 
+        fail_unless(sqlite3_open(PATH, &db)==SQLITE_OK, "sqlite3_open() failed");
+        ret = sqlite3_exec(db,
+                           "BEGIN; "
+                           "INSERT INTO entries (path, name, long_name, source_id, launcher, version, enabled) "
+                           " VALUES ('/tmp/busy/toto.c', 'toto.c', '/tmp/busy/toto.c', 1, 'test', 0, 1);",
+                           NULL/*no callback*/,
+                           NULL/*userdata*/,
+                           &errmsg);
+        if(errmsg) {
+                printf("sqlite error: %s\n", errmsg);
+        }
+        fail_unless(ret==SQLITE_OK, "sqlite3_exec(lock) failed");
 
+        timer = g_timer_new();
         mark_point();
         execute_query_and_expect("toto.c",
                                  1,
                                  goal,
                                  FALSE/*not ordered*/);
         mark_point();
+        fail_unless(g_timer_elapsed(timer, NULL/*microseconds*/)<1.0,
+                    "query waited for the write transaction");
+        g_timer_destroy(timer);
+
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        sqlite3_close(db);
 
-        g_mutex_lock(execute_query_mutex);
-        g_cond_broadcast(execute_query_cond); /* tell the thread to finish*/
-        g_mutex_unlock(execute_query_mutex);
+        printf("--- test_busy OK\n");
 }
 END_TEST
 
@@ -926,6 +1535,31 @@ START_TEST(test_get_source_enabled)
 }
 END_TEST
 
+START_TEST(test_get_enabled_entries)
+{
+        static char *array[] = { "toto.h", "total.h", "etalma.c", "talm.c",
+                                 "talm.h", "hello.txt", "hullo.txt" };
+        GArray *found = g_array_new(TRUE/*zero_terminated*/, TRUE/*clear*/, sizeof(char *));
+
+        printf("--- test_get_enabled_entries\n");
+
+        catalog_cmd(catalog,
+                    "set enabled(FALSE) failed",
+                    catalog_entry_set_enabled(catalog, entries_id[0], FALSE));
+
+        catalog_cmd(catalog,
+                    "get_enabled_entries()",
+                    catalog_get_enabled_entries(catalog,
+                                                collect_result_names_callback,
+                                                &found));
+        assert_array_contains("<enabled entries>",
+                              7,
+                              array,
+                              found,
+                              FALSE/*not ordered*/);
+}
+END_TEST
+
 /* ------------------------- main */
 
 static Suite *catalog_check_suite(void)
@@ -933,6 +1567,7 @@ static Suite *catalog_check_suite(void)
         Suite *s;
         TCase *tc_core;
         TCase *tc_query;
+        TCase *tc_timed;
 
         s = suite_create("catalog");
 
@@ -954,6 +1589,12 @@ static Suite *catalog_check_suite(void)
         tcase_add_test(tc_core, test_check_source_create_new);
         tcase_add_test(tc_core, test_check_source_transform);
         tcase_add_test(tc_core, test_timestamp);
+        tcase_add_test(tc_core, test_version);
+        tcase_add_test(tc_core, test_warm_up);
+        tcase_add_test(tc_core, test_upgrade_from_revision_0);
+#ifdef HAVE_SQLITE2
+        tcase_add_test(tc_core, test_convert_from_sqlite2);
+#endif
 
         tc_query = tcase_create("catalog_query");
         tcase_set_timeout(tc_query, 60/*s.*/);
@@ -961,15 +1602,31 @@ static Suite *catalog_check_suite(void)
         suite_add_tcase(s, tc_query);
         tcase_add_test(tc_query, test_execute_query);
         tcase_add_test(tc_query, test_execute_query_with_space);
+        tcase_add_test(tc_query, test_execute_query_many_words);
+        tcase_add_test(tc_query, test_execute_query_fuzzy);
+        tcase_add_test(tc_query, test_execute_query_quote);
+        tcase_add_test(tc_query, test_execute_query_renamed);
         tcase_add_test(tc_query, test_execute_query_test_source);
         tcase_add_test(tc_query, test_callback_stops_query);
         tcase_add_test(tc_query, test_interrupt_stops_query);
         tcase_add_test(tc_query, test_recover_from_interruption);
         tcase_add_test(tc_query, test_busy);
         tcase_add_test(tc_query, test_lastexecuted_first);
+        tcase_add_test(tc_query, test_mostlaunched_first);
+        tcase_add_test(tc_query, test_concurrent_launches);
+        tcase_add_test(tc_query, test_query_pages);
+        tcase_add_test(tc_query, test_query_deep);
         tcase_add_test(tc_query, test_disable_entry);
         tcase_add_test(tc_query, test_disable_source);
         tcase_add_test(tc_query, test_get_source_enabled);
+        tcase_add_test(tc_query, test_get_enabled_entries);
+
+        tc_timed = tcase_create("catalog_timed");
+        tcase_set_timeout(tc_timed, 300/*s.*/);
+        tcase_add_checked_fixture(tc_timed, setup, teardown);
+        suite_add_tcase(s, tc_timed);
+        tcase_add_test(tc_timed, test_source_update_timed);
+        tcase_add_test(tc_timed, test_query_while_indexing_timed);
 
         return s;
 }
@@ -1154,6 +1811,24 @@ static gboolean test_source_callback(struct catalog *catalog,
         *checked=TRUE;
         return TRUE/*continue*/;
 }
+/**
+ * Callback that copies the first result into a struct catalog_query_result
+ * and stops the query. Strings are not copied.
+ *
+ * @param userdata a struct catalog_query_result
+ */
+static gboolean first_result_callback(struct catalog *catalog,
+                                      const struct catalog_query_result *result,
+                                      void *userdata)
+{
+        struct catalog_query_result *first = (struct catalog_query_result *)userdata;
+        *first=*result;
+        first->entry.name=NULL;
+        first->entry.long_name=NULL;
+        first->entry.path=NULL;
+        first->entry.launcher=NULL;
+        return FALSE/*stop*/;
+}
 /**
  * Callback that should never be called
  *
@@ -1215,56 +1890,157 @@ static gboolean countdown_interrupt_callback(struct catalog *catalog,
         return TRUE/*continue*/;
 }
 
-static gpointer execute_query_thread(void *userdata)
+/**
+ * Index entries, like ocha index would, using its own
+ * connection, for test_query_while_indexing_timed().
+ *
+ * Sets indexer_done at the end.
+ *
+ * @param userdata a connected catalog
+ * @return TRUE if everything went well, as a pointer
+ */
+static gpointer indexer_thread(void *userdata)
 {
-        char *errmsg=NULL;
-        sqlite *db=sqlite_open(PATH, 0600, &errmsg);
-        if(!db) {
-                if(errmsg)
-                        printf("sqlite error: %s\n", errmsg);
-                fail("sqlite_open() failed");
-        }
+        struct catalog *indexer = (struct catalog *)userdata;
+        struct catalog_entry entry;
+        int indexer_source_id;
+        gboolean ret;
+        int i;
 
-        g_mutex_lock(execute_query_mutex);
-        printf("execute_query_thread: lock\n");
-        sqlite_exec(db,
-                    "BEGIN; INSERT INTO entries VALUES (NULL, '', '', '', '', '', '', 0, 0);",
-                    NULL/*no callback*/,
-                    NULL/*userdata*/,
-                    &errmsg);
-        if(errmsg) {
-                printf("sqlite error: %s\n", errmsg);
-                fail("sqlite_exec(lock) failed");
+        ret = catalog_add_source(indexer, "test", &indexer_source_id)
+                && catalog_begin_source_update(indexer, indexer_source_id);
+        entry.source_id=indexer_source_id;
+        entry.launcher=TEST_LAUNCHER;
+        for(i=0; ret && i<TIMED_ENTRY_COUNT*4; i++) {
+                char *name = g_strdup_printf("indexed-%d", i);
+                entry.name=name;
+                entry.path=name;
+                entry.long_name=name;
+                ret = catalog_add_entry(indexer, &entry, NULL/*id_out*/);
+                g_free(name);
         }
-        printf("execute_query_thread: wait (before interrupt)\n");
-        g_cond_broadcast(execute_query_cond);
-        g_cond_wait(execute_query_cond, execute_query_mutex);
-        printf("execute_query_thread: sleep (before interrupt)\n");
-        sleep(2);
-        printf("execute_query_thread: interrupt\n");
-        catalog_interrupt(catalog);
-        printf("execute_query_thread: wait (before rollback)\n");
-        g_cond_wait(execute_query_cond, execute_query_mutex);
-        printf("execute_query_thread: sleep (before rollback)\n");
-        sleep(2);
-        printf("execute_query_thread: rollback\n");
-        sqlite_exec(db,
-                    "ROLLBACK;",
-                    NULL/*no callback*/,
-                    NULL/*userdata*/,
-                    &errmsg);
-        if(errmsg) {
-                printf("sqlite error: %s\n", errmsg);
-                fail("sqlite_exec(rollback) failed");
+        ret = ret && catalog_end_source_update(indexer, indexer_source_id);
+
+        g_atomic_int_inc(&indexer_done);
+        return GINT_TO_POINTER(ret);
+}
+
+/**
+ * Count the results.
+ *
+ * @param catalog ignored
+ * @param result ignored
+ * @param userdata a pointer to an integer, the counter
+ */
+/**
+ * Record CONCURRENT_LAUNCH_COUNT launches of total.h
+ * (thread function).
+ *
+ * @param userdata a connected catalog
+ * @return TRUE if all launches were recorded, as a pointer
+ */
+static gpointer launcher_thread(void *userdata)
+{
+        struct catalog *other = (struct catalog *)userdata;
+        gboolean ret = TRUE;
+        int i;
+
+        for(i=0; ret && i<CONCURRENT_LAUNCH_COUNT; i++) {
+                ret = catalog_update_entry_timestamp(other, entries_id[2]/*total.h*/);
         }
+        return GINT_TO_POINTER(ret);
+}
 
-        sqlite_close(db);
-        printf("execute_query_thread: wait (before end)\n");
-        g_cond_wait(execute_query_cond, execute_query_mutex);
-        printf("execute_query_thread: done\n");
-        g_mutex_unlock(execute_query_mutex);
+static gboolean count_results_callback(struct catalog *catalog,
+                                       const struct catalog_query_result *result,
+                                       void *userdata)
+{
+        int *counter = (int *)userdata;
+        g_return_val_if_fail(counter!=NULL, FALSE);
+        (*counter)++;
+        return TRUE/*continue*/;
+}
 
-        return NULL;
+/** Compare gdoubles, for g_array_sort() */
+static gint compare_doubles(gconstpointer a, gconstpointer b)
+{
+        gdouble da = *(const gdouble *)a;
+        gdouble db = *(const gdouble *)b;
+        return da<db ? -1:(da>db ? 1:0);
+}
+
+/**
+ * SQL that creates a catalog of revision 0, with
+ * a few entries.
+ *
+ * @param lastuse lastuse of hello.txt, as stored
+ * @return SQL to free with g_free()
+ */
+static char *revision_0_sql(const char *lastuse)
+{
+        return g_strdup_printf("BEGIN;"
+                               "CREATE TABLE entries (id INTEGER PRIMARY KEY, "
+                               "path VARCHAR NOT NULL, "
+                               "name VARCHAR NOT NULL, "
+                               "long_name VARCHAR NOT NULL, "
+                               "source_id INTEGER, "
+                               "launcher VARCHAR NOT NULL, "
+                               "lastuse TIMESTAMP, "
+                               "version INTEGER, "
+                               "enabled INTEGER NOT NULL, "
+                               "UNIQUE (id, path));"
+                               "CREATE TABLE sources (id INTEGER PRIMARY KEY , "
+                               "type VARCHAR NOT NULL, "
+                               "version INTEGER NOT NULL, "
+                               "enabled INTEGER NOT NULL);"
+                               "CREATE TABLE source_attrs (source_id INTEGER, "
+                               "attribute VARCHAR NOT NULL,"
+                               "value VARCHAR NOT NULL,"
+                               "PRIMARY KEY (source_id, attribute));"
+                               "CREATE TABLE VERSION ( version INTEGER, revision INTEGER );"
+                               "INSERT INTO VERSION VALUES ( 1, 0 );"
+                               "CREATE TABLE history ( event VARCHAR NOT NULL, value VARCHAR NOT NULL);"
+                               "INSERT INTO sources VALUES (1, 'test', 0, 1);"
+                               "INSERT INTO entries VALUES (1, '/tmp/toto.c', 'toto.c', '/tmp/toto.c', 1, 'test', NULL, 0, 1);"
+                               "INSERT INTO entries VALUES (2, '/tmp/hello.txt', 'hello.txt', '/tmp/hello.txt', 1, 'test', '%s', 0, 1);"
+                               /* duplicate, possible before revision 2 */
+                               "INSERT INTO entries VALUES (3, '/tmp/toto.c', 'toto.c', '/tmp/toto.c', 1, 'test', NULL, 0, 1);"
+                               "COMMIT;",
+                               lastuse);
+}
+
+/**
+ * Check the content of the catalog created by revision_0_sql(),
+ * once upgraded.
+ */
+static void assert_revision_0_content(void)
+{
+        static char *goal[] = { "toto.c" };
+        struct catalog_query_result first;
+
+        execute_query_and_expect("toto.c",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+
+        first.id=-1;
+        catalog_cmd(catalog,
+                    "executequery(hello.txt)",
+                    catalog_executequery(catalog,
+                                         "hello.txt",
+                                         first_result_callback,
+                                         &first));
+        fail_unless(first.id==2, "hello.txt not found");
+        fail_unless(first.lastuse==REVISION_0_LASTUSE, "lastuse lost");
+        fail_unless(first.launches==1, "lastuse not counted as a launch");
+
+        /* queries without trigrams need the masks of the names */
+        query_set_mode(QUERY_MODE_FUZZY);
+        execute_query_and_expect("tto.c",
+                                 1,
+                                 goal,
+                                 FALSE/*not ordered*/);
+        query_set_mode(QUERY_MODE_SUBSTRING);
 }
 
 static void addentries(struct catalog *catalog,
@@ -1292,6 +2068,33 @@ static void addentries(struct catalog *catalog,
         }
 }
 
+/**
+ * Same as addentries(), without the output.
+ */
+static void addentries_quietly(struct catalog *catalog,
+                               int sourceid,
+                               int count,
+                               const char *name_pattern)
+{
+        struct catalog_entry entry;
+        int i;
+        entry.source_id=sourceid;
+        entry.launcher=TEST_LAUNCHER;
+        for(i=0; i<count; i++)
+        {
+                char *name = g_strdup_printf(name_pattern, i);
+                entry.name=name;
+                entry.path=name;
+                entry.long_name=name;
+                catalog_cmd(catalog,
+                            name,
+                            catalog_add_entry(catalog,
+                                              &entry,
+                                              NULL/*id_out*/));
+                g_free(name);
+        }
+}
+
 static void _assert_source_exists(struct catalog *catalog, const char *type, int source_id, const char *file, int line)
 {
         struct catalog_entry entry = CATALOG_ENTRY("Toto", "/tmp/toto.txt");
@@ -9,48 +9,53 @@
 #include "result_queue.h"
 #include "launcher.h"
 #include "launchers.h"
+#include "mempool.h"
+#include "pacing.h"
+#include "query.h"
+#include "query_cache.h"
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
 #include "string_utils.h"
+#include "trace.h"
 
 /**
- * Number of results to send without pausing
- * in the "first bunch".
- * The goal of the first bunch is to provide
- * an estimate and let the user refine it. It
- * must be fast.
+ * Maximum number of results to send, ever
  */
-#define FIRST_BUNCH_SIZE 4
+#define MAXIMUM 200
+
 /**
- * Time to wait after the first bunch has been
- * sent before sending more results (ms).
- * If the user doesn't react after that time,
- * it probably means that more results will
- * help.
+ * Maximum number of queries whose results are kept in the cache
  */
-#define AFTER_FIRST_BUNCH_TIMEOUT 800
+#define CACHE_ENTRIES 64
 
 /**
- * Time to wait between several "later bunches" (ms).
- * Too many results at once would drown the UI.
- * The goal is to present the result as they come
- * slow enough for the user and the UI not to
- * be drowned in useless results
+ * Maximum size of the results kept in the cache (bytes)
  */
-#define LATER_BUNCH_TIMEOUT 400
+#define CACHE_SIZE (4*1024*1024)
 
 /**
- * Number of results to put into a "later bunch"
+ * Time the connection to the catalog is kept open after
+ * the queryrunner has been stopped (ms), so that the
+ * next popup doesn't have to reconnect.
  */
-#define LATER_BUNCH_SIZE 8
+#define IDLE_TIMEOUT (10*60*1000)
 
 /**
- * Maximum number of results to send, ever
+ * Weight of a word of the query found in the name
+ * of an entry, see deep_pertinence().
  */
-#define MAXIMUM 200
-
-#define DEBUG 1
+#define NAME_WEIGHT 1.0
+/**
+ * Weight of a word of the query found in the long name
+ * of an entry, but not in its name.
+ */
+#define LONG_NAME_WEIGHT 0.75
+/**
+ * Weight of a word of the query found in the path
+ * of an entry only.
+ */
+#define PATH_WEIGHT 0.5
 
 /**
  * Extension of the structure queryrunner for this implementation
@@ -101,6 +106,29 @@ struct catalog_queryrunner
          * ID of the last query (starts at 0)
          */
         QueryId current_query_id;
+
+        /**
+         * The last query, used by the main thread
+         * exclusively (may be NULL)
+         */
+        char *current_query;
+
+        /**
+         * Results of the last queries, struct result_set *, used
+         * by the query thread exclusively, except for
+         * query_cache_get_stats()
+         */
+        struct query_cache *cache;
+
+        /**
+         * Protects telemetry
+         */
+        GMutex *telemetry_lock;
+
+        /**
+         * Time it took to send the results, see catalog_queryrunner_get_telemetry()
+         */
+        struct catalog_queryrunner_telemetry telemetry;
 };
 
 /** catalog_queryrunner to queryrunner */
@@ -113,7 +141,12 @@ enum CatalogQueryrunnerMessageAction {
         CATALOG_QUERYRUNNER_ACTION_CONNECT,
         /** run the query */
         CATALOG_QUERYRUNNER_ACTION_QUERY,
-        /** disconnect from the catalog */
+        /** run the query again, looking deeper into the catalog */
+        CATALOG_QUERYRUNNER_ACTION_CONSOLIDATE,
+        /**
+         * stop using the catalog; the connection is closed
+         * after IDLE_TIMEOUT, unless it's used again
+         */
         CATALOG_QUERYRUNNER_ACTION_DISCONNECT,
         /** stop the thread */
         CATALOG_QUERYRUNNER_ACTION_SHUTDOWN
@@ -129,9 +162,57 @@ struct catalog_queryrunner_msg {
         /* query to run, to be freed by g_free (or NULL) */
         char *query;
 
+        /* time at which the message was sent */
+        GTimeVal sent;
 };
 
 
+/**
+ * Results of a query, kept so that the next query can
+ * be run in memory if it's a refinement of this one.
+ */
+struct result_set {
+        /** the query */
+        char *query;
+
+        /** memory of the results and their strings */
+        struct mempool *mempool;
+
+        /**
+         * struct catalog_query_result *, allocated from mempool,
+         * in the order they've been sent
+         */
+        GPtrArray *results;
+
+        /**
+         * names of the results prepared by query_prepare(),
+         * allocated from mempool, in the same order as results
+         */
+        GPtrArray *prepared_names;
+
+        /**
+         * TRUE if results contains all the entries that
+         * match the query
+         */
+        gboolean complete;
+
+        /** number of references, see result_set_ref() */
+        int refcount;
+};
+
+/**
+ * Data used by run_deep_query() and deep_result_callback()
+ */
+struct deep_data {
+        struct thread_data *data;
+
+        /** prepared words of the query */
+        char **words;
+
+        /** IDs of the results that have already been sent */
+        GHashTable *sent;
+};
+
 /**
  * Data used by the thread
  */
@@ -144,6 +225,49 @@ struct thread_data {
         /** Number of results found so far */
         int count;
 
+        /** Time at which the current query was sent by the main thread */
+        GTimeVal query_sent;
+
+        /**
+         * Time between query_sent and the first result
+         * of the current query (ms), -1 if none has been sent
+         */
+        long time_to_first_result;
+
+        /** Results of the query currently being run, or NULL */
+        struct catalog_result_pool *pool;
+
+        /**
+         * Query currently being run, compiled, which weights the
+         * pertinence of the results, see send_result(). NULL
+         * for deep queries.
+         */
+        struct query_matcher *matcher;
+
+        /**
+         * struct result * that have been created but not
+         * sent yet, see flush_results()
+         */
+        GPtrArray *batch;
+
+        /** Results of the query currently being run, or NULL */
+        struct result_set *current_set;
+
+        /** Results of the last query that's been run, or NULL */
+        struct result_set *last_set;
+
+        /**
+         * Version of the catalog the results in the cache come
+         * from, read once per connection, see check_cache_version()
+         */
+        struct catalog_version cache_version;
+
+        /**
+         * FALSE if cache_version couldn't be read; the cache
+         * isn't used until it's been read
+         */
+        gboolean cache_version_known;
+
         /**
          * Message read by catalog_queryrunner_msg_wait()
          * that will be returned by the next call
@@ -154,12 +278,32 @@ struct thread_data {
 
 /* ------------------------- prototypes */
 static gpointer runquery_thread(gpointer userdata);
+static void run_query(struct thread_data *data, const char *query);
+static void run_query_in_memory(struct thread_data *data, const char *query);
+static gboolean run_query_from_cache(struct thread_data *data, const char *query);
+static void cache_current_set(struct thread_data *data);
+static void check_cache_version(struct thread_data *data);
+static void run_deep_query(struct thread_data *data, const char *query);
+static gboolean deep_result_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
+static float deep_pertinence(char **words, const struct catalog_query_result *qresult);
+static gboolean send_result(struct thread_data *data, const struct catalog_query_result *qresult, const char *prepared_name);
+static void flush_results(struct thread_data *data);
+static void sort_batch(GPtrArray *batch);
+static struct result_set *result_set_new(const char *query);
+static void result_set_add(struct result_set *set, const struct catalog_query_result *qresult, const char *prepared_name);
+static struct result_set *result_set_ref(struct result_set *set);
+static void result_set_unref(struct result_set *set);
+static void forget_last_set(struct thread_data *data);
 static gboolean result_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
 static void catalog_queryrunner_msg_send(struct catalog_queryrunner *self, enum CatalogQueryrunnerMessageAction action, QueryId query_id, const char *msg);
 static void catalog_queryrunner_msg_free(struct catalog_queryrunner_msg *msg);
 static gboolean catalog_queryrunner_msg_wait(struct thread_data *data, unsigned long timeout);
 static struct catalog_queryrunner_msg *catalog_queryrunner_msg_next(struct thread_data *data);
 static void handle_thread_error(struct catalog_queryrunner *self);
+static void disconnect(struct thread_data *data);
+static void telemetry_start(struct thread_data *data, struct catalog_queryrunner_msg *msg);
+static void telemetry_end(struct thread_data *data, gboolean full_list);
+static long elapsed_ms(GTimeVal *since);
 
 /* ------------------------- member functions (queryrunner) */
 static QueryId catalog_queryrunner_run_query(struct queryrunner *_self, const char *query);
@@ -193,11 +337,17 @@ struct queryrunner *catalog_queryrunner_new(const char *path, struct result_queu
         queryrunner->base.stop=catalog_queryrunner_stop;
         queryrunner->base.release=catalog_queryrunner_release;
         queryrunner->current_query_id=0;
+        queryrunner->current_query=NULL;
         queryrunner->path=g_strdup(path);
         queryrunner->queue=catalog_queryrunner_queue;
         queryrunner->incoming=g_async_queue_new();
         queryrunner->catalog=catalog;
         queryrunner->started=FALSE;
+        queryrunner->cache=query_cache_new(CACHE_ENTRIES,
+                                           CACHE_SIZE,
+                                           (query_cache_free_f)result_set_unref);
+        queryrunner->telemetry_lock=g_mutex_new();
+        memset(&queryrunner->telemetry, 0, sizeof(struct catalog_queryrunner_telemetry));
         queryrunner->thread=g_thread_create(runquery_thread,
                                             queryrunner/*userdata*/,
                                             TRUE/*joinable*/,
@@ -205,6 +355,27 @@ struct queryrunner *catalog_queryrunner_new(const char *path, struct result_queu
         return QUERYRUNNER(queryrunner);
 }
 
+void catalog_queryrunner_get_cache_stats(struct queryrunner *_self, struct query_cache_stats *stats)
+{
+        g_return_if_fail(_self!=NULL);
+        g_return_if_fail(stats!=NULL);
+
+        query_cache_get_stats(CATALOG_QUERYRUNNER(_self)->cache, stats);
+}
+
+void catalog_queryrunner_get_telemetry(struct queryrunner *_self, struct catalog_queryrunner_telemetry *telemetry)
+{
+        struct catalog_queryrunner *self;
+
+        g_return_if_fail(_self!=NULL);
+        g_return_if_fail(telemetry!=NULL);
+
+        self = CATALOG_QUERYRUNNER(_self);
+        g_mutex_lock(self->telemetry_lock);
+        memcpy(telemetry, &self->telemetry, sizeof(struct catalog_queryrunner_telemetry));
+        g_mutex_unlock(self->telemetry_lock);
+}
+
 /* ------------------------- member functions */
 /**
  * Open a connection to the catalog.
@@ -216,9 +387,6 @@ static void catalog_queryrunner_start(struct queryrunner *_self)
         struct catalog_queryrunner *self;
 
         g_return_if_fail(_self!=NULL);
-#ifdef DEBUG
-        printf("%s:%d start\n", __FILE__, __LINE__);
-#endif
 
         self = CATALOG_QUERYRUNNER(_self);
 
@@ -233,10 +401,6 @@ static void catalog_queryrunner_stop(struct queryrunner *_self)
         struct catalog_queryrunner *self;
 
         g_return_if_fail(_self!=NULL);
-#ifdef DEBUG
-
-        printf("%s:%d stop\n", __FILE__, __LINE__);
-#endif
 
         self = CATALOG_QUERYRUNNER(_self);
 
@@ -255,18 +419,14 @@ static QueryId catalog_queryrunner_run_query(struct queryrunner *_self, const ch
         g_return_val_if_fail(_self!=NULL, 0);
         g_return_val_if_fail(query!=NULL, 0);
 
-
-#ifdef DEBUG
-
-        printf("%s:%d:run_query(%s) enter\n",
-               __FILE__, __LINE__, query);
-#endif
-
         self = CATALOG_QUERYRUNNER(_self);
         g_return_val_if_fail(self->started, 0);
 
         self->current_query_id++;
         query_id = self->current_query_id;
+        result_queue_set_current_query(self->queue, _self, query_id);
+        g_free(self->current_query);
+        self->current_query=g_strdup(query);
         if(self->started) {
                 catalog_queryrunner_msg_send(self,
                                              CATALOG_QUERYRUNNER_ACTION_QUERY,
@@ -276,8 +436,23 @@ static QueryId catalog_queryrunner_run_query(struct queryrunner *_self, const ch
         return query_id;
 }
 
+/**
+ * Look for more results for the current query, in the long
+ * name and the path of the entries.
+ */
 static void catalog_queryrunner_consolidate(struct queryrunner *_self)
 {
+        struct catalog_queryrunner *self;
+
+        g_return_if_fail(_self!=NULL);
+        self = CATALOG_QUERYRUNNER(_self);
+
+        if(self->started && self->current_query!=NULL) {
+                catalog_queryrunner_msg_send(self,
+                                             CATALOG_QUERYRUNNER_ACTION_CONSOLIDATE,
+                                             self->current_query_id,
+                                             self->current_query);
+        }
 }
 
 static void catalog_queryrunner_release(struct queryrunner *_self)
@@ -287,21 +462,16 @@ static void catalog_queryrunner_release(struct queryrunner *_self)
         g_return_if_fail(_self!=NULL);
         self = CATALOG_QUERYRUNNER(_self);
 
-#ifdef DEBUG
-        printf("%s:%d stopping", __FILE__, __LINE__);
-#endif
-
         catalog_queryrunner_msg_send(self, CATALOG_QUERYRUNNER_ACTION_SHUTDOWN, 0/*query_id*/, NULL);
         g_thread_join(self->thread);
 
         g_async_queue_unref(self->incoming);
         catalog_free(self->catalog);
+        query_cache_free(self->cache);
+        g_mutex_free(self->telemetry_lock);
+        g_free(self->current_query);
         g_free(self->path);
         g_free(self);
-
-#ifdef DEBUG
-        printf("%s:%d released\n", __FILE__, __LINE__);
-#endif
 }
 
 /* ------------------------- static functions */
@@ -310,60 +480,61 @@ static gpointer runquery_thread(gpointer userdata)
         struct catalog_queryrunner *queryrunner;
         struct catalog_queryrunner_msg *msg;
         gboolean shutdown = FALSE;
+        gboolean idle = FALSE;
+        gboolean warm_up;
         struct catalog *catalog;
         GAsyncQueue *queue;
         struct thread_data data;
         memset(&data, 0, sizeof(struct thread_data));
 
-#ifdef DEBUG
-        printf("%s:%d thread start\n", __FILE__, __LINE__);
-#endif
-
         queryrunner = (struct catalog_queryrunner *)userdata;
         data.queryrunner=queryrunner;
         g_return_val_if_fail(queryrunner!=NULL, NULL);
+        data.batch=g_ptr_array_new();
         catalog = queryrunner->catalog;
         queue = g_async_queue_ref(queryrunner->incoming);
 
         do {
+                if(idle && !catalog_queryrunner_msg_wait(&data, IDLE_TIMEOUT)) {
+                        disconnect(&data);
+                        idle=FALSE;
+                }
                 msg = catalog_queryrunner_msg_next(&data);
 
                 switch(msg->action) {
                 case CATALOG_QUERYRUNNER_ACTION_CONNECT:
-#ifdef DEBUG
-                        printf("%s:%d: thread:connect\n", /*@nocommit@*/
-                               __FILE__,
-                               __LINE__
-                               );
-#endif
-
+                        forget_last_set(&data);
+                        idle=FALSE;
+                        /* an open connection's indexes are in the cache already */
+                        warm_up=FALSE;
                         if(!catalog_is_connected(catalog)) {
                                 if(!catalog_connect(catalog)) {
                                         handle_thread_error(queryrunner);
+                                        break;
                                 }
+                                warm_up=TRUE;
+                        }
+                        catalog_restart(catalog);
+                        check_cache_version(&data);
+                        /* the first query shouldn't wait for the disk;
+                         * it'll interrupt the warm-up, if necessary */
+                        if(warm_up
+                           && !catalog_queryrunner_msg_wait(&data, 0)
+                           && !catalog_warm_up(catalog)) {
+                                handle_thread_error(queryrunner);
                         }
                         break;
 
                 case CATALOG_QUERYRUNNER_ACTION_QUERY:
-#ifdef DEBUG
-                        printf("%s:%d: thread:query(%s) %d\n", /*@nocommit@*/
-                               __FILE__,
-                               __LINE__,
-                               msg->query,
-                               catalog_is_connected(catalog)
-                               );
-#endif
                         if(msg->query!=NULL && strlen(msg->query)>0) {
                                 if(catalog_is_connected(catalog)) {
                                         catalog_restart(catalog);
                                         data.query_id=msg->query_id;
                                         data.count=0;
-                                        if(!catalog_executequery(catalog,
-                                                                 msg->query,
-                                                                 result_callback,
-                                                                 &data)) {
-                                                handle_thread_error(queryrunner);
-                                        }
+                                        telemetry_start(&data, msg);
+                                        TRACE(TRACE_QUERY_START, msg->query_id, 0, msg->query);
+                                        run_query(&data, msg->query);
+                                        TRACE(TRACE_QUERY_END, msg->query_id, data.count, msg->query);
                                         data.query_id=0;
                                 } else {
                                         g_warning("not connected, "
@@ -371,64 +542,459 @@ static gpointer runquery_thread(gpointer userdata)
                                                   "sent before _QUERY");
                                 }
                         }
-                        printf("%s:%d: query done: %s\n", /*@nocommit@*/
-                               __FILE__,
-                               __LINE__,
-                               msg->query
-                               );
+                        break;
 
+                case CATALOG_QUERYRUNNER_ACTION_CONSOLIDATE:
+                        if(msg->query!=NULL && strlen(msg->query)>0
+                           && catalog_is_connected(catalog)) {
+                                catalog_restart(catalog);
+                                data.query_id=msg->query_id;
+                                TRACE(TRACE_QUERY_START, msg->query_id, 0, msg->query);
+                                run_deep_query(&data, msg->query);
+                                TRACE(TRACE_QUERY_END, msg->query_id, data.count, msg->query);
+                                data.query_id=0;
+                        }
                         break;
 
                 case CATALOG_QUERYRUNNER_ACTION_SHUTDOWN:
-#ifdef DEBUG
-                        printf("%s:%d: thread:shutdown\n", /*@nocommit@*/
-                               __FILE__,
-                               __LINE__
-                               );
-#endif
                         shutdown=TRUE;
-                        /* fallthrough */
+                        disconnect(&data);
+                        break;
 
                 case CATALOG_QUERYRUNNER_ACTION_DISCONNECT:
-#ifdef DEBUG
-                        printf("%s:%d: thread:disconnect\n", /*@nocommit@*/
-                               __FILE__,
-                               __LINE__
-                               );
-#endif
-                        if(catalog_is_connected(catalog)) {
-                                catalog_disconnect(catalog);
-                        }
+                        forget_last_set(&data);
+                        idle=TRUE;
                         break;
                 }
                 catalog_queryrunner_msg_free(msg);
         } while(!shutdown);
 
         g_async_queue_unref(queryrunner->incoming);
-
-#ifdef DEBUG
-        printf("%s:%d thread end\n", __FILE__, __LINE__);
-#endif
+        g_ptr_array_free(data.batch, TRUE/*free segment*/);
         return NULL;
 }
 
+/**
+ * Run a query and send the results, one bunch at a time.
+ *
+ * Each bunch is read as one page of the query, so that nothing
+ * is kept open in the catalog while waiting between two bunches.
+ * The size of the bunches and the time between them are chosen
+ * by pacing.h, depending on how fast the UI is.
+ * All the results of the query are allocated from the same pool.
+ * The query stops as soon as there's a new message.
+ *
+ * If the query is a refinement of the last query and all the
+ * results of the last query are known, the catalog is not
+ * queried at all, see run_query_in_memory(). The catalog isn't
+ * queried either if the results of the query are in the cache and
+ * the catalog hasn't changed since, see run_query_from_cache().
+ *
+ * @param data thread data
+ * @param query the query
+ */
+static void run_query(struct thread_data *data, const char *query)
+{
+        struct catalog_queryrunner *queryrunner;
+        struct catalog_query *cquery;
+        struct pacing pacing;
+        int page_size;
+        gboolean more;
+        gboolean complete;
+
+        queryrunner = data->queryrunner;
+        if(run_query_from_cache(data, query)) {
+                return;
+        }
+        if(data->last_set!=NULL
+           && data->last_set->complete
+           && query_is_refinement(data->last_set->query, query)) {
+                run_query_in_memory(data, query);
+                return;
+        }
+        forget_last_set(data);
+
+        cquery = catalog_query_open(queryrunner->catalog, query);
+        if(cquery==NULL) {
+                handle_thread_error(queryrunner);
+                return;
+        }
+
+        data->pool=catalog_result_pool_new(queryrunner->path);
+        data->matcher=query_compile(query);
+        data->current_set=result_set_new(query);
+        complete=FALSE;
+        pacing_init(&pacing, queryrunner->queue, TRUE/*first bunch*/);
+        page_size=MIN(pacing_bunch_size(&pacing), MAXIMUM);
+        while(TRUE) {
+                if(!catalog_query_next_page(cquery,
+                                            page_size,
+                                            result_callback,
+                                            data,
+                                            &more)) {
+                        flush_results(data);
+                        handle_thread_error(queryrunner);
+                        break;
+                }
+                flush_results(data);
+                if(!more) {
+                        /* the query may also have stopped because it's
+                         * been interrupted by a new message or
+                         * because MAXIMUM has been reached */
+                        complete = data->count<MAXIMUM
+                                && data->next_msg==NULL
+                                && g_async_queue_length(queryrunner->incoming)==0;
+                        break;
+                }
+                if(data->count>=MAXIMUM) {
+                        break;
+                }
+                if(catalog_queryrunner_msg_wait(data, pacing_timeout(&pacing))) {
+                        break;
+                }
+                page_size=MIN(pacing_bunch_size(&pacing), MAXIMUM-data->count);
+        }
+        catalog_query_close(cquery);
+        catalog_result_pool_release(data->pool);
+        data->pool=NULL;
+        query_matcher_free(data->matcher);
+        data->matcher=NULL;
+        telemetry_end(data, complete || data->count>=MAXIMUM);
+
+        data->current_set->complete=complete;
+        if(complete || data->count>=MAXIMUM) {
+                cache_current_set(data);
+        }
+        data->last_set=data->current_set;
+        data->current_set=NULL;
+}
+
+/**
+ * Run a query that's a refinement of the last query, by
+ * filtering the results of the last query.
+ *
+ * All results are sent at once. The results that have been
+ * sent become the new complete result set.
+ *
+ * @param data thread data, with a complete last_set
+ * @param query the query
+ */
+static void run_query_in_memory(struct thread_data *data, const char *query)
+{
+        struct result_set *last_set;
+        guint i;
+
+        g_return_if_fail(data->last_set!=NULL);
+
+        last_set=data->last_set;
+        data->pool=catalog_result_pool_new(data->queryrunner->path);
+        data->current_set=result_set_new(query);
+        data->matcher=query_compile(query);
+        for(i=0; i<last_set->results->len; i++) {
+                const char *prepared;
+
+                prepared=(const char *)g_ptr_array_index(last_set->prepared_names, i);
+                if(query_matcher_ismatch(data->matcher, prepared)) {
+                        send_result(data,
+                                    (const struct catalog_query_result *)g_ptr_array_index(last_set->results, i),
+                                    prepared);
+                }
+        }
+        query_matcher_free(data->matcher);
+        data->matcher=NULL;
+        flush_results(data);
+        catalog_result_pool_release(data->pool);
+        data->pool=NULL;
+        telemetry_end(data, TRUE/*full list*/);
+
+        result_set_unref(last_set);
+        data->current_set->complete=TRUE;
+        cache_current_set(data);
+        data->last_set=data->current_set;
+        data->current_set=NULL;
+}
+
+/**
+ * Send the results of a query from the cache, if they're there.
+ *
+ * The cache only contains results of the version of the
+ * catalog check_cache_version() found, so this doesn't
+ * touch the catalog. On a cache hit, all results are sent
+ * at once and the cached results become the last result set.
+ *
+ * @param data thread data
+ * @param query the query
+ * @return TRUE if the results were in the cache and have been sent
+ */
+static gboolean run_query_from_cache(struct thread_data *data, const char *query)
+{
+        struct catalog_queryrunner *queryrunner;
+        struct result_set *set;
+        guint i;
+
+        queryrunner = data->queryrunner;
+        if(!data->cache_version_known) {
+                return FALSE;
+        }
+
+        set=(struct result_set *)query_cache_lookup(queryrunner->cache, query);
+        if(set==NULL) {
+                return FALSE;
+        }
+        result_set_ref(set);
+        forget_last_set(data);
+
+        data->pool=catalog_result_pool_new(queryrunner->path);
+        data->matcher=query_compile(query);
+        for(i=0; i<set->results->len; i++) {
+                send_result(data,
+                            (const struct catalog_query_result *)g_ptr_array_index(set->results, i),
+                            (const char *)g_ptr_array_index(set->prepared_names, i));
+        }
+        query_matcher_free(data->matcher);
+        data->matcher=NULL;
+        flush_results(data);
+        catalog_result_pool_release(data->pool);
+        data->pool=NULL;
+        telemetry_end(data, TRUE/*full list*/);
+
+        data->last_set=set;
+        return TRUE;
+}
+
+/**
+ * Add the current result set into the cache.
+ *
+ * @param data thread data, with a current set that contains all
+ * the results the query will ever send
+ */
+static void cache_current_set(struct thread_data *data)
+{
+        struct result_set *set;
+
+        g_return_if_fail(data->current_set!=NULL);
+
+        set=data->current_set;
+        query_cache_add(data->queryrunner->cache,
+                        set->query,
+                        result_set_ref(set),
+                        mempool_size(set->mempool)+2*set->results->len*sizeof(gpointer));
+}
+
+/**
+ * Read the version of the catalog and clear the cache if the
+ * catalog has changed since the results in the cache were added.
+ *
+ * This is done once per connection, when the queryrunner is
+ * started, so that queries never have to check the catalog
+ * before using the cache. If the version can't be read, the
+ * cache is cleared and not used until the next connection.
+ *
+ * @param data thread data, connected to the catalog
+ */
+static void check_cache_version(struct thread_data *data)
+{
+        struct catalog_version version;
+        gboolean known;
+
+        known=catalog_version_get(data->queryrunner->catalog, &version);
+        if(known
+           && data->cache_version_known
+           && catalog_version_equal(&version, &data->cache_version)) {
+                return;
+        }
+        query_cache_clear(data->queryrunner->cache);
+        forget_last_set(data);
+        data->cache_version=version;
+        data->cache_version_known=known;
+}
+
+/**
+ * Run a deep query, after the user has waited for the results
+ * of a query, and send the results that haven't been sent yet.
+ *
+ * The results are sent as later bunches, paced by pacing.h, until
+ * MAXIMUM results have been sent for the query or there's a new message.
+ *
+ * @param data thread data
+ * @param query the query, which is normally the last query
+ */
+static void run_deep_query(struct thread_data *data, const char *query)
+{
+        struct catalog_queryrunner *queryrunner;
+        struct catalog_query *cquery;
+        struct deep_data deep;
+        struct pacing pacing;
+        char *prepared;
+        gboolean more;
+        guint i;
+        int j;
+
+        queryrunner = data->queryrunner;
+        cquery = catalog_query_open_deep(queryrunner->catalog, query);
+        if(cquery==NULL) {
+                handle_thread_error(queryrunner);
+                return;
+        }
+
+        deep.data=data;
+        deep.sent=g_hash_table_new(g_direct_hash, g_direct_equal);
+        data->count=0;
+        if(data->last_set!=NULL && strcmp(data->last_set->query, query)==0) {
+                for(i=0; i<data->last_set->results->len; i++) {
+                        const struct catalog_query_result *qresult;
+
+                        qresult=(const struct catalog_query_result *)g_ptr_array_index(data->last_set->results, i);
+                        g_hash_table_insert(deep.sent,
+                                            GINT_TO_POINTER(qresult->id),
+                                            GINT_TO_POINTER(1));
+                }
+                data->count=data->last_set->results->len;
+        }
+        prepared=query_prepare(query);
+        deep.words=g_strsplit(prepared, " ", -1/*no max*/);
+        g_free(prepared);
+        for(i=0, j=0; deep.words[i]!=NULL; i++) {
+                if(deep.words[i][0]!='\0') {
+                        deep.words[j]=deep.words[i];
+                        j++;
+                } else {
+                        g_free(deep.words[i]);
+                }
+        }
+        deep.words[j]=NULL;
+
+        data->pool=catalog_result_pool_new(queryrunner->path);
+        pacing_init(&pacing, queryrunner->queue, FALSE/*not first bunch*/);
+        while(data->count<MAXIMUM) {
+                if(!catalog_query_next_page(cquery,
+                                            MIN(pacing_bunch_size(&pacing), MAXIMUM-data->count),
+                                            deep_result_callback,
+                                            &deep,
+                                            &more)) {
+                        flush_results(data);
+                        handle_thread_error(queryrunner);
+                        break;
+                }
+                flush_results(data);
+                if(!more || data->count>=MAXIMUM) {
+                        break;
+                }
+                if(catalog_queryrunner_msg_wait(data, pacing_timeout(&pacing))) {
+                        break;
+                }
+        }
+        catalog_query_close(cquery);
+        catalog_result_pool_release(data->pool);
+        data->pool=NULL;
+
+        g_strfreev(deep.words);
+        g_hash_table_destroy(deep.sent);
+}
+
+/**
+ * Send the results of a deep query that haven't been sent already,
+ * weighted by deep_pertinence().
+ */
+static gboolean deep_result_callback(struct catalog *catalog,
+                                     const struct catalog_query_result *qresult,
+                                     void *userdata)
+{
+        struct deep_data *deep;
+        struct catalog_query_result weighted;
+
+        g_return_val_if_fail(userdata!=NULL, FALSE);
+        g_return_val_if_fail(qresult!=NULL, FALSE);
+
+        deep = (struct deep_data *)userdata;
+        if(g_hash_table_lookup(deep->sent, GINT_TO_POINTER(qresult->id))) {
+                return TRUE;
+        }
+        memcpy(&weighted, qresult, sizeof(struct catalog_query_result));
+        weighted.pertinence*=deep_pertinence(deep->words, qresult);
+        return send_result(deep->data, &weighted, NULL/*prepare name*/);
+}
+
+/**
+ * Compute how well a result of a deep query matches the query.
+ *
+ * Each word of the query counts for NAME_WEIGHT if it's found
+ * in the name, LONG_NAME_WEIGHT if it's found in the long name or
+ * PATH_WEIGHT if it's found in the path only.
+ *
+ * @param words prepared words of the query
+ * @param qresult result of the deep query
+ * @return average weight of the words, between PATH_WEIGHT and 1
+ */
+static float deep_pertinence(char **words, const struct catalog_query_result *qresult)
+{
+        char *name;
+        char *long_name;
+        float total;
+        int i;
+
+        if(words[0]==NULL) {
+                return 1.0;
+        }
+
+        name=query_prepare(qresult->entry.name);
+        long_name=query_prepare(qresult->entry.long_name);
+        total=0.0;
+        for(i=0; words[i]!=NULL; i++) {
+                if(strstr(name, words[i])!=NULL) {
+                        total+=NAME_WEIGHT;
+                } else if(strstr(long_name, words[i])!=NULL) {
+                        total+=LONG_NAME_WEIGHT;
+                } else {
+                        /* the catalog found it somewhere */
+                        total+=PATH_WEIGHT;
+                }
+        }
+        g_free(name);
+        g_free(long_name);
+        return total/i;
+}
+
 static gboolean result_callback(struct catalog *catalog,
                                 const struct catalog_query_result *qresult,
                                 void *userdata)
 {
-        const struct catalog_entry *entry = &qresult->entry;
         struct thread_data *data;
-        struct catalog_queryrunner *queryrunner;
-        struct launcher *launcher;
-        struct result *result;
-        int count;
 
         g_return_val_if_fail(userdata!=NULL, FALSE);
-        g_return_val_if_fail(entry!=NULL, FALSE);
+        g_return_val_if_fail(qresult!=NULL, FALSE);
 
         data = (struct thread_data *)userdata;
-        queryrunner = data->queryrunner;
-        g_return_val_if_fail(userdata, FALSE);
+        return send_result(data, qresult, NULL/*prepare name*/);
+}
+
+/**
+ * Create a result, add it to the batch of results to send
+ * and to the current result set, if there is one.
+ *
+ * The pertinence of the result is weighted by how well
+ * its name matches the query currently being run, see
+ * query_matcher_score(). The result set keeps the
+ * pertinence as it was.
+ *
+ * The result is only sent by the next call to flush_results().
+ *
+ * @param data thread data
+ * @param qresult the entry
+ * @param prepared_name the name of the entry prepared by
+ * query_prepare() or NULL
+ * @return TRUE if more results can be sent
+ */
+static gboolean send_result(struct thread_data *data,
+                            const struct catalog_query_result *qresult,
+                            const char *prepared_name)
+{
+        const struct catalog_entry *entry = &qresult->entry;
+        struct catalog_query_result weighted;
+        struct launcher *launcher;
+        struct result *result;
+        char *prepared;
+        int count;
 
         launcher = launchers_get(entry->launcher);
         if(!launcher)
@@ -444,38 +1010,177 @@ static gboolean result_callback(struct catalog *catalog,
                 return TRUE;
         }
 
-        printf("%s:%d: create result: %s, %d\n", /*@nocommit@*/
-               __FILE__,
-               __LINE__,
-               launcher->id,
-               qresult->id
-               );
-
-        result = catalog_result_create(queryrunner->path,
+        prepared=NULL;
+        if(prepared_name==NULL) {
+                prepared=query_prepare(entry->name);
+                prepared_name=prepared;
+        }
+        memcpy(&weighted, qresult, sizeof(struct catalog_query_result));
+        if(data->matcher!=NULL) {
+                float score;
+
+                score=query_matcher_score(data->matcher, prepared_name, entry->name);
+                /* the catalog doesn't casefold the way query.c does, so
+                 * it may find names query.c wouldn't */
+                if(score>0.0) {
+                        weighted.pertinence*=score;
+                }
+        }
+        result = catalog_result_create(data->pool,
                                        launcher,
-                                       qresult);
-        result_queue_add(queryrunner->queue,
-                         QUERYRUNNER(queryrunner),
-                         data->query_id,
-                         result);
+                                       &weighted,
+                                       prepared_name);
+        g_ptr_array_add(data->batch, result);
+        TRACE(TRACE_RESULT_ENQUEUE, data->query_id, qresult->id, launcher->id);
+        if(data->current_set!=NULL) {
+                result_set_add(data->current_set, qresult, prepared_name);
+        }
+        g_free(prepared);
         count = data->count;
         count++;
         data->count=count;
-        if(count>=MAXIMUM) {
-                return FALSE;
+        return count<MAXIMUM;
+}
+
+/**
+ * Send the results created by send_result() to the
+ * result queue, all at once, most pertinent first.
+ *
+ * @param data thread data
+ */
+static void flush_results(struct thread_data *data)
+{
+        if(data->batch->len==0) {
+                return;
         }
+        sort_batch(data->batch);
+        result_queue_add_batch(data->queryrunner->queue,
+                               QUERYRUNNER(data->queryrunner),
+                               data->query_id,
+                               (struct result **)data->batch->pdata,
+                               data->batch->len);
+        g_ptr_array_set_size(data->batch, 0);
+        if(data->time_to_first_result<0) {
+                data->time_to_first_result=elapsed_ms(&data->query_sent);
+                TRACE(TRACE_FIRST_RESULT, data->query_id, data->time_to_first_result, NULL);
+        }
+}
 
-        if(count==FIRST_BUNCH_SIZE) {
-                if(catalog_queryrunner_msg_wait(data, AFTER_FIRST_BUNCH_TIMEOUT)) {
-                        return FALSE;
-                }
-        } else if(count%LATER_BUNCH_SIZE==0) {
-                if(catalog_queryrunner_msg_wait(data, LATER_BUNCH_TIMEOUT)) {
-                        return FALSE;
+/**
+ * Sort a batch of results by pertinence, most pertinent first.
+ *
+ * The catalog sends the entries by frecency; the sort is stable,
+ * so results with the same pertinence stay in that order. Batches
+ * are never larger than MAXIMUM, so an insertion sort will do.
+ *
+ * @param batch struct result *
+ */
+static void sort_batch(GPtrArray *batch)
+{
+        guint i;
+
+        for(i=1; i<batch->len; i++) {
+                struct result *result = (struct result *)g_ptr_array_index(batch, i);
+                guint j;
+
+                for(j=i;
+                    j>0 && ((struct result *)g_ptr_array_index(batch, j-1))->pertinence<result->pertinence;
+                    j--) {
+                        g_ptr_array_index(batch, j)=g_ptr_array_index(batch, j-1);
                 }
+                g_ptr_array_index(batch, j)=result;
         }
+}
 
-        return TRUE;
+/**
+ * Create a new, empty and incomplete result set.
+ *
+ * @param query query the results match
+ * @return a new set, with one reference, to release with result_set_unref()
+ */
+static struct result_set *result_set_new(const char *query)
+{
+        struct result_set *set;
+
+        set = g_new(struct result_set, 1);
+        set->query=g_strdup(query);
+        set->mempool=mempool_new();
+        set->results=g_ptr_array_new();
+        set->prepared_names=g_ptr_array_new();
+        set->complete=FALSE;
+        set->refcount=1;
+        return set;
+}
+
+/**
+ * Add a copy of a result and of its prepared name into a set, so
+ * that the queries that reuse the set don't have to prepare the
+ * name again.
+ */
+static void result_set_add(struct result_set *set,
+                           const struct catalog_query_result *qresult,
+                           const char *prepared_name)
+{
+        struct catalog_query_result *copy;
+
+        g_return_if_fail(set!=NULL);
+        g_return_if_fail(qresult!=NULL);
+        g_return_if_fail(prepared_name!=NULL);
+
+        copy=mempool_alloc_type(set->mempool, struct catalog_query_result);
+        memcpy(copy, qresult, sizeof(struct catalog_query_result));
+        copy->entry.name=mempool_strdup(set->mempool, qresult->entry.name);
+        copy->entry.long_name=mempool_strdup(set->mempool, qresult->entry.long_name);
+        copy->entry.path=mempool_strdup(set->mempool, qresult->entry.path);
+        copy->entry.launcher=mempool_strdup(set->mempool, qresult->entry.launcher);
+        g_ptr_array_add(set->results, copy);
+        g_ptr_array_add(set->prepared_names, mempool_strdup(set->mempool, prepared_name));
+}
+
+/**
+ * Add a reference to a set, which may be shared by
+ * the cache and the thread data.
+ *
+ * @return the set
+ */
+static struct result_set *result_set_ref(struct result_set *set)
+{
+        g_return_val_if_fail(set!=NULL, NULL);
+
+        set->refcount++;
+        return set;
+}
+
+/**
+ * Release a reference to a set and free the
+ * set once there's no reference left.
+ */
+static void result_set_unref(struct result_set *set)
+{
+        g_return_if_fail(set!=NULL);
+
+        set->refcount--;
+        if(set->refcount>0) {
+                return;
+        }
+        g_free(set->query);
+        g_ptr_array_free(set->results, TRUE/*free segment*/);
+        g_ptr_array_free(set->prepared_names, TRUE/*free segment*/);
+        mempool_delete(set->mempool);
+        g_free(set);
+}
+
+/**
+ * Forget the results of the last query, because they
+ * can't be used to run the next query or because the
+ * catalog might have changed.
+ */
+static void forget_last_set(struct thread_data *data)
+{
+        if(data->last_set!=NULL) {
+                result_set_unref(data->last_set);
+                data->last_set=NULL;
+        }
 }
 
 static void catalog_queryrunner_msg_send(struct catalog_queryrunner *self,
@@ -491,12 +1196,8 @@ static void catalog_queryrunner_msg_send(struct catalog_queryrunner *self,
         msg->action = action;
         msg->query_id = query_id;
         msg->query = query ? g_strdup(query):NULL;
+        g_get_current_time(&msg->sent);
 
-
-#ifdef DEBUG
-        printf("%s:%d:push(%d, %s)\n",
-               __FILE__, __LINE__, action, query);
-#endif
         g_async_queue_lock(self->incoming);
         {
                 g_async_queue_push_unlocked(self->incoming, msg);
@@ -504,11 +1205,6 @@ static void catalog_queryrunner_msg_send(struct catalog_queryrunner *self,
 
         }
         g_async_queue_unlock(self->incoming);
-
-#ifdef DEBUG
-        printf("%s:%d:pushed(%d, %s)\n",
-               __FILE__, __LINE__, action, query);
-#endif
 }
 static void catalog_queryrunner_msg_free(struct catalog_queryrunner_msg *msg)
 {
@@ -525,10 +1221,6 @@ static struct catalog_queryrunner_msg *catalog_queryrunner_msg_next(struct threa
         struct catalog_queryrunner_msg *msg;
         GAsyncQueue *queue;
 
-#ifdef DEBUG
-        printf("%s:%d:pop())\n",
-               __FILE__, __LINE__);
-#endif
         queue = data->queryrunner->incoming;
 
         g_async_queue_lock(queue);
@@ -539,22 +1231,24 @@ static struct catalog_queryrunner_msg *catalog_queryrunner_msg_next(struct threa
                 msg=g_async_queue_pop_unlocked(queue);
         }
 
-        while(msg->action==CATALOG_QUERYRUNNER_ACTION_QUERY) {
+        while(msg->action==CATALOG_QUERYRUNNER_ACTION_QUERY
+              || msg->action==CATALOG_QUERYRUNNER_ACTION_CONSOLIDATE) {
                 struct catalog_queryrunner_msg *msg2;
                 msg2 = (struct catalog_queryrunner_msg *)g_async_queue_try_pop_unlocked(queue);
                 if(msg2==NULL) {
                         break;
+                } else if(msg->action==CATALOG_QUERYRUNNER_ACTION_QUERY
+                          && msg2->action==CATALOG_QUERYRUNNER_ACTION_CONSOLIDATE
+                          && msg2->query_id==msg->query_id) {
+                        /* run the query, then consolidate it */
+                        data->next_msg=msg2;
+                        break;
                 } else {
                         catalog_queryrunner_msg_free(msg);
                         msg=msg2;
                 }
         }
         g_async_queue_unlock(queue);
-#ifdef DEBUG
-        printf("%s:%d:poped(): %d, %s\n",
-               __FILE__, __LINE__, msg->action, msg->query);
-#endif
-
         return msg;
 }
 
@@ -570,6 +1264,24 @@ static void handle_thread_error(struct catalog_queryrunner *self)
                 catalog_error(self->catalog));
 }
 
+/**
+ * Disconnect from the catalog, if the thread is connected,
+ * and forget about the last query.
+ *
+ * @param data thread data
+ */
+static void disconnect(struct thread_data *data)
+{
+        struct catalog *catalog;
+
+        forget_last_set(data);
+        catalog = data->queryrunner->catalog;
+        if(!catalog_is_connected(catalog)) {
+                return;
+        }
+        catalog_disconnect(catalog);
+}
+
 /**
  * Wait for a message.
  *
@@ -599,3 +1311,62 @@ static gboolean catalog_queryrunner_msg_wait(struct thread_data *data, unsigned
         }
         return FALSE;
 }
+
+/**
+ * Start measuring the time it takes to send the
+ * results of a query.
+ *
+ * @param data thread data
+ * @param msg message that asked for the query
+ */
+static void telemetry_start(struct thread_data *data, struct catalog_queryrunner_msg *msg)
+{
+        data->query_sent=msg->sent;
+        data->time_to_first_result=-1;
+}
+
+/**
+ * Record the time it took to send the results of a query: the time
+ * it took for the first result to be sent and, if the query
+ * wasn't interrupted, for the whole list to be sent.
+ *
+ * @param data thread data
+ * @param full_list TRUE if all the results of the query have been sent
+ */
+static void telemetry_end(struct thread_data *data, gboolean full_list)
+{
+        struct catalog_queryrunner *queryrunner;
+        long time_to_full_list;
+
+        queryrunner = data->queryrunner;
+        time_to_full_list = full_list ? elapsed_ms(&data->query_sent):-1;
+        if(full_list) {
+                TRACE(TRACE_FULL_LIST, data->query_id, time_to_full_list, NULL);
+        }
+
+        g_mutex_lock(queryrunner->telemetry_lock);
+        queryrunner->telemetry.queries++;
+        if(data->time_to_first_result>=0) {
+                queryrunner->telemetry.first_results++;
+                queryrunner->telemetry.time_to_first_result+=data->time_to_first_result;
+        }
+        if(full_list) {
+                queryrunner->telemetry.full_lists++;
+                queryrunner->telemetry.time_to_full_list+=time_to_full_list;
+        }
+        g_mutex_unlock(queryrunner->telemetry_lock);
+}
+
+/**
+ * Time elapsed since some point in time.
+ *
+ * @return elapsed time in milliseconds
+ */
+static long elapsed_ms(GTimeVal *since)
+{
+        GTimeVal now;
+
+        g_get_current_time(&now);
+        return (now.tv_sec-since->tv_sec)*1000
+                + (now.tv_usec-since->tv_usec)/1000;
+}
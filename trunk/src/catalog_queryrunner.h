@@ -8,6 +8,7 @@
 
 #include "queryrunner.h"
 #include "result_queue.h"
+#include "query_cache.h"
 
 /**
  * Create a new catalog-based queryrunner.
@@ -16,6 +17,48 @@
  */
 struct queryrunner *catalog_queryrunner_new(const char *path, struct result_queue *queue);
 
+/**
+ * Get statistics about the cache of query results of
+ * a catalog-based queryrunner.
+ *
+ * The results of the queries are kept in the cache for as
+ * long as the catalog doesn't change. This call is thread-safe.
+ *
+ * @param queryrunner a queryrunner created by catalog_queryrunner_new()
+ * @param stats structure to fill (out)
+ */
+void catalog_queryrunner_get_cache_stats(struct queryrunner *queryrunner, struct query_cache_stats *stats);
+
+/**
+ * Time it took a catalog-based queryrunner to send the
+ * results of its queries, see catalog_queryrunner_get_telemetry()
+ */
+struct catalog_queryrunner_telemetry
+{
+        /** number of queries run, deep queries excluded */
+        gulong queries;
+        /** number of queries that sent at least one result */
+        gulong first_results;
+        /** total time-to-first-result of these queries, in ms */
+        gulong time_to_first_result;
+        /** number of queries that sent all their results */
+        gulong full_lists;
+        /** total time-to-full-list of these queries, in ms */
+        gulong time_to_full_list;
+};
+
+/**
+ * Get the time it took a catalog-based queryrunner to send
+ * the results of the queries it has run so far.
+ *
+ * The time of a query is counted from the time run_query()
+ * was called. This call is thread-safe.
+ *
+ * @param queryrunner a queryrunner created by catalog_queryrunner_new()
+ * @param telemetry structure to fill (out)
+ */
+void catalog_queryrunner_get_telemetry(struct queryrunner *queryrunner, struct catalog_queryrunner_telemetry *telemetry);
+
 /**
  * Get the list of indexers.
  *
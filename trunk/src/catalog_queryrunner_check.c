@@ -159,6 +159,74 @@ START_TEST(test_slow_thinker)
 END_TEST
 
 
+/**
+ * Once all the results of "he" are known, the results
+ * of "hel" are found without going back to the catalog
+ * and sent at once, without waiting between two bunches.
+ */
+START_TEST(test_refine_in_memory)
+{
+        GTimer *timer;
+
+        printf("--test_refine_in_memory START\n");
+        get_results_counted(run("he"), 10);
+
+        timer=g_timer_new();
+        get_results_counted(run("hel"), 5);
+        /* 300ms without results checked by get_results_counted(),
+         * the catalog would have waited 800ms after the 1st bunch */
+        fail_unless(g_timer_elapsed(timer, NULL/*microseconds*/)<1.0,
+                    "results of 'hel' not sent at once");
+        g_timer_destroy(timer);
+
+        get_results_counted(run("hell"), 2);
+        get_results_counted(run("hello"), 1);
+        run("hellow");
+        assert_no_more_results();
+        printf("--test_refine_in_memory OK\n");
+}
+END_TEST
+
+
+/**
+ * consolidate() finds entries whose long name or path
+ * match the query, and doesn't send the results of the
+ * query a second time.
+ */
+START_TEST(test_consolidate)
+{
+        struct catalog *catalog;
+        struct catalog_entry entry;
+        int source_id;
+        QueryId id;
+
+        printf("--test_consolidate START\n");
+        catalog =  catalog_new_and_connect(CATALOG_PATH, NULL/*errs*/);
+        fail_unless(catalog!=NULL, "no catalog in " CATALOG_PATH);
+        fail_unless(catalog_add_source(catalog, "test2", &source_id), "add_source");
+        CATALOG_ENTRY_INIT(&entry);
+        entry.source_id=source_id;
+        entry.launcher=TEST_LAUNCHER;
+        entry.name="xyzzy";
+        entry.long_name="straight to hell";
+        entry.path="/tmp/xyzzy";
+        fail_unless(catalog_add_entry(catalog, &entry, NULL/*id_out*/), "add entry");
+        entry.name="plugh";
+        entry.long_name="plugh";
+        entry.path="/tmp/hellhole/plugh";
+        fail_unless(catalog_add_entry(catalog, &entry, NULL/*id_out*/), "add entry");
+        catalog_free(catalog);
+
+        id=run("hell");
+        get_results_counted(id, 2);
+        runner->consolidate(runner);
+        get_results_counted(id, 2);
+        assert_no_more_results();
+        printf("--test_consolidate OK\n");
+}
+END_TEST
+
+
 START_TEST(test_back_to_nothing)
 {
         printf("--test_back_to_nothing START\n");
@@ -233,6 +301,71 @@ START_TEST(test_query_id)
 }
 END_TEST
 
+/**
+ * The catalog is only checked for changes when the
+ * queryrunner is started; until then, the results of
+ * the queries come from the cache.
+ */
+START_TEST(test_cache_version)
+{
+        struct catalog *catalog;
+        struct catalog_entry entry;
+        struct query_cache_stats stats;
+        int source_id;
+
+        printf("--test_cache_version START\n");
+        get_results_counted(run("hell"), 2);
+
+        catalog =  catalog_new_and_connect(CATALOG_PATH, NULL/*errs*/);
+        fail_unless(catalog!=NULL, "no catalog in " CATALOG_PATH);
+        fail_unless(catalog_add_source(catalog, "test2", &source_id), "add_source");
+        CATALOG_ENTRY_INIT(&entry);
+        entry.source_id=source_id;
+        entry.launcher=TEST_LAUNCHER;
+        entry.name="hellcat";
+        entry.long_name="hellcat";
+        entry.path="/tmp/hellcat";
+        fail_unless(catalog_add_entry(catalog, &entry, NULL/*id_out*/), "add entry");
+        catalog_free(catalog);
+
+        get_results_counted(run("hello"), 1);
+        get_results_counted(run("hell"), 2);
+        catalog_queryrunner_get_cache_stats(runner, &stats);
+        fail_unless(stats.hits==1, "cache hits: %lu", stats.hits);
+
+        runner->stop(runner);
+        runner->start(runner);
+        get_results_counted(run("hell"), 3);
+        printf("--test_cache_version OK\n");
+}
+END_TEST
+
+/**
+ * The time it took to send the results of the
+ * queries is recorded.
+ */
+START_TEST(test_telemetry)
+{
+        struct catalog_queryrunner_telemetry telemetry;
+
+        printf("--test_telemetry START\n");
+        get_results_counted(run("hell"), 2);
+        catalog_queryrunner_get_telemetry(runner, &telemetry);
+        fail_unless(telemetry.queries==1, "queries: %lu", telemetry.queries);
+        fail_unless(telemetry.first_results==1, "first results: %lu", telemetry.first_results);
+        fail_unless(telemetry.full_lists==1, "full lists: %lu", telemetry.full_lists);
+        fail_unless(telemetry.time_to_first_result<=telemetry.time_to_full_list,
+                    "first result after full list");
+
+        run("hellow");
+        assert_no_more_results();
+        catalog_queryrunner_get_telemetry(runner, &telemetry);
+        fail_unless(telemetry.queries==2, "queries: %lu", telemetry.queries);
+        fail_unless(telemetry.first_results==1, "first results: %lu", telemetry.first_results);
+        printf("--test_telemetry OK\n");
+}
+END_TEST
+
 /* ------------------------- main */
 
 static Suite *catalog_queryrunner_check_suite(void)
@@ -245,10 +378,14 @@ static Suite *catalog_queryrunner_check_suite(void)
         tcase_add_checked_fixture(tc_core, setup, teardown);
         tcase_add_test(tc_core, test_fast_typer);
         tcase_add_test(tc_core, test_slow_thinker);
+        tcase_add_test(tc_core, test_refine_in_memory);
+        tcase_add_test(tc_core, test_consolidate);
         tcase_add_test(tc_core, test_back_to_nothing);
         tcase_add_test(tc_core, test_to_nothing_and_back_again);
         tcase_add_test(tc_core, test_start_stop);
         tcase_add_test(tc_core, test_query_id);
+        tcase_add_test(tc_core, test_telemetry);
+        tcase_add_test(tc_core, test_cache_version);
 
         return s;
 }
@@ -1,4 +1,6 @@
 #include "catalog_result.h"
+#include "mempool.h"
+#include "query.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -20,7 +22,25 @@ struct catalog_result
         struct result base;
         int entry_id;
         struct launcher *launcher;
+        /** pool the result and its strings were allocated from */
+        struct catalog_result_pool *pool;
+};
+
+/**
+ * Hidden structure, see catalog_result_pool_new()
+ */
+struct catalog_result_pool
+{
+        /** memory of the results, and the pool itself */
+        struct mempool *mempool;
+        /** path to the catalog, shared by all results */
         const char *catalog_path;
+        /**
+         * Number of results that haven't been released yet,
+         * +1 until catalog_result_pool_release() has been called.
+         * Only accessed through g_atomic_int functions.
+         */
+        gint refcount;
 };
 
 /* ------------------------- prototypes */
@@ -29,27 +49,61 @@ static gboolean catalog_result_validate(struct result *_self);
 static void update_entry_timestamp(const char *catalog_path, int entry_id);
 static gboolean catalog_result_execute(struct result *_self, GError **err);
 static void catalog_result_free(struct result *self);
+static void catalog_result_pool_unref(struct catalog_result_pool *pool);
 
 /* ------------------------- public function */
 
-struct result *catalog_result_create(const char *catalog_path,
+struct catalog_result_pool *catalog_result_pool_new(const char *catalog_path)
+{
+        struct mempool *mempool;
+        struct catalog_result_pool *pool;
+
+        g_return_val_if_fail(catalog_path, NULL);
+
+        mempool = mempool_new();
+        pool = mempool_alloc_type(mempool, struct catalog_result_pool);
+        pool->mempool=mempool;
+        pool->catalog_path=mempool_strdup(mempool, catalog_path);
+        pool->refcount=1;
+        return pool;
+}
+
+void catalog_result_pool_release(struct catalog_result_pool *pool)
+{
+        g_return_if_fail(pool);
+        catalog_result_pool_unref(pool);
+}
+
+struct result *catalog_result_create(struct catalog_result_pool *pool,
                                      struct launcher *launcher,
-                                     const struct catalog_query_result *qresult)
+                                     const struct catalog_query_result *qresult,
+                                     const char *prepared_name)
 {
         struct catalog_result *result;
+        struct mempool *mempool;
 
-        g_return_val_if_fail(catalog_path, NULL);
+        g_return_val_if_fail(pool, NULL);
         g_return_val_if_fail(qresult, NULL);
         g_return_val_if_fail(launcher, NULL);
 
-        result =  g_new(struct catalog_result, 1);
+        mempool = pool->mempool;
+        result = mempool_alloc_type(mempool, struct catalog_result);
         result->entry_id=qresult->id;
         result->launcher=launcher;
-        result->base.path=g_strdup(qresult->entry.path);
-        result->base.name=g_strdup(qresult->entry.name);
-        result->base.long_name=g_strdup(qresult->entry.long_name);
+        result->base.path=mempool_strdup(mempool, qresult->entry.path);
+        result->base.name=mempool_strdup(mempool, qresult->entry.name);
+        result->base.long_name=mempool_strdup(mempool, qresult->entry.long_name);
+        if(prepared_name!=NULL) {
+                result->base.prepared_name=mempool_strdup(mempool, prepared_name);
+        } else {
+                char *prepared = query_prepare(qresult->entry.name);
+                result->base.prepared_name=mempool_strdup(mempool, prepared);
+                g_free(prepared);
+        }
         result->base.enabled=qresult->enabled;
-        result->catalog_path=g_strdup(catalog_path);
+        result->base.pertinence=qresult->pertinence;
+        result->pool=pool;
+        g_atomic_int_inc(&pool->refcount);
 
         result->base.execute=catalog_result_execute;
         result->base.validate=catalog_result_validate;
@@ -96,7 +150,7 @@ static gboolean catalog_result_execute(struct result *_self, GError **err)
                             self->base.path,
                             err))
         {
-                update_entry_timestamp(self->catalog_path, self->entry_id);
+                update_entry_timestamp(self->pool->catalog_path, self->entry_id);
                 return TRUE;
         }
         return FALSE;
@@ -107,9 +161,19 @@ static void catalog_result_free(struct result *_self)
         struct catalog_result *self = (struct catalog_result *)_self;
         g_return_if_fail(self);
 
-        g_free((gpointer)self->base.path);
-        g_free((gpointer)self->base.name);
-        g_free((gpointer)self->base.long_name);
-        g_free((gpointer)self->catalog_path);
-        g_free(self);
+        /* the memory of the result belongs to the pool */
+        catalog_result_pool_unref(self->pool);
+}
+
+/**
+ * Remove one reference to the pool and free it
+ * if it was the last one.
+ *
+ * @param pool
+ */
+static void catalog_result_pool_unref(struct catalog_result_pool *pool)
+{
+        if(g_atomic_int_dec_and_test(&pool->refcount)) {
+                mempool_delete(pool->mempool);
+        }
 }
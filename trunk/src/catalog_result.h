@@ -6,7 +6,50 @@
 #include "catalog.h"
 #include "launcher.h"
 
-struct result *catalog_result_create(const char *catalog_path, struct launcher *launcher, const struct catalog_query_result *result);
+/**
+ * Memory shared by the results of one query.
+ *
+ * The results of a query are allocated one after the other
+ * from the same memory pool, and they all refer to the same
+ * copy of the catalog path. The memory is freed at once, when
+ * the query runner has released the pool and the last result
+ * has been released.
+ *
+ * Results can be created by one thread only, but they can be
+ * released by any thread.
+ */
+struct catalog_result_pool;
+
+/**
+ * Create a new, empty pool.
+ *
+ * @param catalog_path path to the catalog the results come from
+ * @return a new pool, to be released with catalog_result_pool_release()
+ */
+struct catalog_result_pool *catalog_result_pool_new(const char *catalog_path);
+
+/**
+ * Tell the pool that no more results will be created from it.
+ *
+ * The memory of the pool is freed once all the results
+ * created from it have been released as well.
+ *
+ * @param pool
+ */
+void catalog_result_pool_release(struct catalog_result_pool *pool);
+
+/**
+ * Create a result from a catalog entry.
+ *
+ * @param pool pool the result will be allocated from; it
+ * must not have been released yet
+ * @param launcher launcher for the entry
+ * @param result the entry
+ * @param prepared_name name of the entry prepared with query_prepare(),
+ * or NULL to have it prepared by this function
+ * @return a new result, to be released with result->release()
+ */
+struct result *catalog_result_create(struct catalog_result_pool *pool, struct launcher *launcher, const struct catalog_query_result *result, const char *prepared_name);
 
 
 #endif /*CATALOG_RESULT_H*/
@@ -0,0 +1,491 @@
+/** \file
+ * Implementation of the API defined in composite_queryrunner.h
+ */
+
+#include "composite_queryrunner.h"
+#include "result_queue.h"
+#include "string_set.h"
+#include <glib.h>
+
+/**
+ * Maximum number of results held back by the merge. Once
+ * it's reached, the pending results are sent without waiting
+ * for the main loop to be idle.
+ */
+#define MAX_PENDING 64
+
+/**
+ * A child of the composite.
+ *
+ * Only used by the thread of the main context.
+ */
+struct child
+{
+        /** The child itself */
+        struct queryrunner *runner;
+
+        /** ID of the current query, as returned by the child */
+        QueryId query_id;
+
+        /**
+         * TRUE if the child only runs the query when the
+         * composite is consolidated (see composite_queryrunner_add_deep())
+         */
+        gboolean deep;
+};
+
+/**
+ * Extension of the structure queryrunner for this implementation
+ */
+struct composite_queryrunner
+{
+        struct queryrunner base;
+
+        /**
+         * Where the merged results will be sent
+         */
+        struct result_queue *queue;
+
+        /**
+         * Where the children send their results
+         */
+        struct result_queue *children_queue;
+
+        /**
+         * Context children_queue is attached to
+         */
+        GMainContext *context;
+
+        /**
+         * struct child *
+         */
+        GPtrArray *children;
+
+        /**
+         * Results sent by the children and not merged yet,
+         * most pertinent first. Results with the same pertinence
+         * are kept in the order they were sent.
+         */
+        struct result *pending[MAX_PENDING];
+
+        /**
+         * Number of results in pending
+         */
+        guint pending_count;
+
+        /**
+         * Idle source that sends the pending results,
+         * NULL if it's not running
+         */
+        GSource *flush;
+
+        /**
+         * Path of the results accepted for the current
+         * query, to ignore the results of deep children
+         * that have been sent already
+         */
+        struct string_set *paths;
+
+        /**
+         * Current query, NULL before the first query
+         */
+        char *query;
+
+        /**
+         * TRUE between start() and stop()
+         */
+        gboolean started;
+
+        /**
+         * ID of the last query (starts at 0)
+         */
+        QueryId current_query_id;
+};
+
+/** composite_queryrunner to queryrunner */
+#define QUERYRUNNER(composite_qr) (&(composite_qr)->base)
+/** queryrunner to composite_queryrunner */
+#define COMPOSITE_QUERYRUNNER(qr) ((struct composite_queryrunner *)(qr))
+
+/* ------------------------- prototypes */
+static void child_result_handler(struct result_queue_element *element, gpointer userdata);
+static struct child *find_child(struct composite_queryrunner *self, struct queryrunner *runner);
+static void add_child(struct queryrunner *composite, struct queryrunner *child, gboolean deep);
+static gboolean accept_path(struct composite_queryrunner *self, struct child *c, struct result *result);
+static void add_pending(struct composite_queryrunner *self, struct result *result);
+static void send_pending(struct composite_queryrunner *self);
+static void discard_pending(struct composite_queryrunner *self);
+static void flush_start(struct composite_queryrunner *self);
+static void flush_stop(struct composite_queryrunner *self);
+static gboolean flush_cb(gpointer userdata);
+
+/* ------------------------- member functions (queryrunner) */
+static QueryId composite_queryrunner_run_query(struct queryrunner *_self, const char *query);
+static void composite_queryrunner_consolidate(struct queryrunner *_self);
+static void composite_queryrunner_start(struct queryrunner *_self);
+static void composite_queryrunner_stop(struct queryrunner *_self);
+static void composite_queryrunner_release(struct queryrunner *_self);
+
+/* ------------------------- public functions */
+struct queryrunner *composite_queryrunner_new(GMainContext *context, struct result_queue *queue)
+{
+        struct composite_queryrunner *queryrunner;
+
+        g_return_val_if_fail(queue!=NULL, NULL);
+
+        queryrunner = g_new(struct composite_queryrunner, 1);
+
+        queryrunner->base.start=composite_queryrunner_start;
+        queryrunner->base.run_query=composite_queryrunner_run_query;
+        queryrunner->base.consolidate=composite_queryrunner_consolidate;
+        queryrunner->base.stop=composite_queryrunner_stop;
+        queryrunner->base.release=composite_queryrunner_release;
+        queryrunner->queue=queue;
+        queryrunner->context=context;
+        queryrunner->children_queue=result_queue_new(context,
+                                                     child_result_handler,
+                                                     queryrunner/*userdata*/);
+        queryrunner->children=g_ptr_array_new();
+        queryrunner->pending_count=0;
+        queryrunner->flush=NULL;
+        queryrunner->paths=string_set_new();
+        queryrunner->query=NULL;
+        queryrunner->started=FALSE;
+        queryrunner->current_query_id=0;
+        return QUERYRUNNER(queryrunner);
+}
+
+struct result_queue *composite_queryrunner_get_queue(struct queryrunner *composite)
+{
+        g_return_val_if_fail(composite!=NULL, NULL);
+        return COMPOSITE_QUERYRUNNER(composite)->children_queue;
+}
+
+void composite_queryrunner_add(struct queryrunner *composite, struct queryrunner *child)
+{
+        add_child(composite, child, FALSE/*not deep*/);
+}
+
+void composite_queryrunner_add_deep(struct queryrunner *composite, struct queryrunner *child)
+{
+        add_child(composite, child, TRUE/*deep*/);
+}
+
+/* ------------------------- member functions */
+
+static void composite_queryrunner_start(struct queryrunner *_self)
+{
+        struct composite_queryrunner *self;
+        guint i;
+
+        g_return_if_fail(_self!=NULL);
+        self = COMPOSITE_QUERYRUNNER(_self);
+
+        for(i=0; i<self->children->len; i++) {
+                struct child *c = (struct child *)g_ptr_array_index(self->children, i);
+                c->runner->start(c->runner);
+        }
+        self->started=TRUE;
+}
+
+static void composite_queryrunner_stop(struct queryrunner *_self)
+{
+        struct composite_queryrunner *self;
+        guint i;
+
+        g_return_if_fail(_self!=NULL);
+        self = COMPOSITE_QUERYRUNNER(_self);
+
+        for(i=0; i<self->children->len; i++) {
+                struct child *c = (struct child *)g_ptr_array_index(self->children, i);
+                c->runner->stop(c->runner);
+                c->query_id=0;
+        }
+        discard_pending(self);
+        self->started=FALSE;
+}
+
+/**
+ * Run the query on all children, except the deep ones.
+ *
+ * Results the children have sent for the previous
+ * query and that haven't been merged yet are discarded.
+ */
+static QueryId composite_queryrunner_run_query(struct queryrunner *_self, const char *query)
+{
+        struct composite_queryrunner *self;
+        guint i;
+
+        g_return_val_if_fail(_self!=NULL, 0);
+        g_return_val_if_fail(query!=NULL, 0);
+
+        self = COMPOSITE_QUERYRUNNER(_self);
+        g_return_val_if_fail(self->started, 0);
+
+        discard_pending(self);
+        g_free(self->query);
+        self->query=g_strdup(query);
+        self->current_query_id++;
+        result_queue_set_current_query(self->queue, _self, self->current_query_id);
+        for(i=0; i<self->children->len; i++) {
+                struct child *c = (struct child *)g_ptr_array_index(self->children, i);
+                if(c->deep) {
+                        /* whatever it's still sending is out of date */
+                        c->query_id=0;
+                } else {
+                        /* The results are handled on this thread, so none of
+                         * them can come in before query_id has been set */
+                        c->query_id=c->runner->run_query(c->runner, query);
+                }
+        }
+        return self->current_query_id;
+}
+
+/**
+ * Consolidate the children.
+ *
+ * Deep children are given the current query first,
+ * as it's the first time they hear about it.
+ */
+static void composite_queryrunner_consolidate(struct queryrunner *_self)
+{
+        struct composite_queryrunner *self;
+        guint i;
+
+        g_return_if_fail(_self!=NULL);
+        self = COMPOSITE_QUERYRUNNER(_self);
+
+        for(i=0; i<self->children->len; i++) {
+                struct child *c = (struct child *)g_ptr_array_index(self->children, i);
+                if(c->deep) {
+                        if(self->query==NULL) {
+                                continue;
+                        }
+                        c->query_id=c->runner->run_query(c->runner, self->query);
+                }
+                c->runner->consolidate(c->runner);
+        }
+}
+
+static void composite_queryrunner_release(struct queryrunner *_self)
+{
+        struct composite_queryrunner *self;
+        guint i;
+
+        g_return_if_fail(_self!=NULL);
+        self = COMPOSITE_QUERYRUNNER(_self);
+
+        discard_pending(self);
+        for(i=0; i<self->children->len; i++) {
+                struct child *c = (struct child *)g_ptr_array_index(self->children, i);
+                c->runner->release(c->runner);
+                g_free(c);
+        }
+        g_ptr_array_free(self->children, TRUE/*free segment*/);
+        string_set_free(self->paths);
+        g_free(self->query);
+
+        /* the children have been released, nothing will be
+         * added to the queue anymore, and whatever's left
+         * there will be released with it */
+        result_queue_delete(self->children_queue);
+        g_free(self);
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Add a child to the composite.
+ *
+ * @param composite
+ * @param child
+ * @param deep TRUE if the child only runs the query when consolidated
+ */
+static void add_child(struct queryrunner *composite, struct queryrunner *child, gboolean deep)
+{
+        struct composite_queryrunner *self;
+        struct child *c;
+
+        g_return_if_fail(composite!=NULL);
+        g_return_if_fail(child!=NULL);
+
+        self = COMPOSITE_QUERYRUNNER(composite);
+        g_return_if_fail(!self->started);
+
+        c = g_new(struct child, 1);
+        c->runner=child;
+        c->query_id=0;
+        c->deep=deep;
+        g_ptr_array_add(self->children, c);
+}
+
+/**
+ * Handle results sent by the children (result queue handler).
+ *
+ * Results sent for a query that's not current anymore are
+ * discarded, and so are the results of deep children that
+ * have been sent already. The others are sent as soon as
+ * the main loop is idle, most pertinent first.
+ */
+static void child_result_handler(struct result_queue_element *element, gpointer userdata)
+{
+        struct composite_queryrunner *self;
+        struct child *c;
+        struct result *result;
+
+        g_return_if_fail(element!=NULL);
+        g_return_if_fail(userdata!=NULL);
+
+        self = COMPOSITE_QUERYRUNNER(userdata);
+        result = element->result;
+
+        c = find_child(self, element->caller);
+        if(c==NULL
+           || !self->started
+           || c->query_id!=element->query_id
+           || !accept_path(self, c, result)) {
+                result->release(result);
+                return;
+        }
+
+        if(self->pending_count==MAX_PENDING) {
+                send_pending(self);
+        }
+        add_pending(self, result);
+        flush_start(self);
+}
+
+/**
+ * Find the child structure of a queryrunner.
+ * @return the child or NULL if it's not a child of the composite
+ */
+static struct child *find_child(struct composite_queryrunner *self, struct queryrunner *runner)
+{
+        guint i;
+
+        for(i=0; i<self->children->len; i++) {
+                struct child *c = (struct child *)g_ptr_array_index(self->children, i);
+                if(c->runner==runner) {
+                        return c;
+                }
+        }
+        return NULL;
+}
+
+/**
+ * Remember the path of a result for the current query.
+ *
+ * @param self
+ * @param c child that sent the result
+ * @param result
+ * @return FALSE if c is a deep child and a result with the
+ * same path has already been accepted for the current query
+ */
+static gboolean accept_path(struct composite_queryrunner *self, struct child *c, struct result *result)
+{
+        if(result->path==NULL) {
+                return TRUE;
+        }
+        if(string_set_contains(self->paths, result->path)) {
+                return !c->deep;
+        }
+        string_set_add(self->paths, result->path);
+        return TRUE;
+}
+
+/**
+ * Add a result to the pending results, after the results
+ * that are at least as pertinent.
+ *
+ * There must be room left in pending.
+ */
+static void add_pending(struct composite_queryrunner *self, struct result *result)
+{
+        guint i;
+
+        for(i=self->pending_count;
+            i>0 && self->pending[i-1]->pertinence<result->pertinence;
+            i--) {
+                self->pending[i]=self->pending[i-1];
+        }
+        self->pending[i]=result;
+        self->pending_count++;
+}
+
+/**
+ * Send the pending results to the queue, best first.
+ */
+static void send_pending(struct composite_queryrunner *self)
+{
+        result_queue_add_batch(self->queue,
+                               QUERYRUNNER(self),
+                               self->current_query_id,
+                               self->pending,
+                               self->pending_count);
+        self->pending_count=0;
+}
+
+/**
+ * Release all the results that haven't been merged yet
+ * and forget about the results sent for the current query.
+ */
+static void discard_pending(struct composite_queryrunner *self)
+{
+        guint i;
+
+        for(i=0; i<self->pending_count; i++) {
+                self->pending[i]->release(self->pending[i]);
+        }
+        self->pending_count=0;
+        string_set_free(self->paths);
+        self->paths=string_set_new();
+        flush_stop(self);
+}
+
+/**
+ * Make sure the pending results are sent once the
+ * children queue has nothing left to dispatch.
+ */
+static void flush_start(struct composite_queryrunner *self)
+{
+        if(self->flush!=NULL) {
+                return;
+        }
+        self->flush=g_idle_source_new();
+        g_source_set_callback(self->flush,
+                              flush_cb,
+                              self/*data*/,
+                              NULL/*notify*/);
+        g_source_attach(self->flush, self->context);
+}
+
+/**
+ * Cancel the idle source started by flush_start(), if it's running.
+ */
+static void flush_stop(struct composite_queryrunner *self)
+{
+        if(self->flush==NULL) {
+                return;
+        }
+        g_source_destroy(self->flush);
+        g_source_unref(self->flush);
+        self->flush=NULL;
+}
+
+/**
+ * Send the pending results (idle callback).
+ *
+ * @return FALSE
+ */
+static gboolean flush_cb(gpointer userdata)
+{
+        struct composite_queryrunner *self;
+
+        g_return_val_if_fail(userdata!=NULL, FALSE);
+        self = COMPOSITE_QUERYRUNNER(userdata);
+
+        g_source_unref(self->flush);
+        self->flush=NULL;
+        send_pending(self);
+        return FALSE;
+}
@@ -0,0 +1,73 @@
+#ifndef COMPOSITE_QUERYRUNNER_H
+#define COMPOSITE_QUERYRUNNER_H
+
+/** \file
+ * Implementation of a queryrunner that runs the same
+ * query on several other queryrunners, its children, and
+ * merges their results.
+ *
+ * Each child runs in its own thread and sends its results
+ * to the composite's own queue, which must be passed to the
+ * child when it's created (see composite_queryrunner_get_queue()).
+ * The composite merges the results of the children by pertinence
+ * and sends them to its queue, with its own query IDs.
+ *
+ * Results are never held back waiting for a child. Those
+ * that come in together are sent together, as soon as the
+ * main loop is idle, most pertinent first.
+ *
+ * Deep children (see composite_queryrunner_add_deep()) only
+ * run the query when the composite is consolidated.
+ */
+
+#include "queryrunner.h"
+#include "result_queue.h"
+
+/**
+ * Create a new composite queryrunner, without children.
+ *
+ * @param context main context the results will be merged on, the
+ * context of queue, or NULL for the default context
+ * @param queue queue to send the merged results to
+ * @return a new queryrunner or NULL (error)
+ */
+struct queryrunner *composite_queryrunner_new(GMainContext *context, struct result_queue *queue);
+
+/**
+ * Get the queue the children of the composite must send their results to.
+ *
+ * @param composite a queryrunner created by composite_queryrunner_new()
+ * @return a result queue that belongs to the composite
+ */
+struct result_queue *composite_queryrunner_get_queue(struct queryrunner *composite);
+
+/**
+ * Add a child to the composite.
+ *
+ * Children can only be added before the composite is started
+ * for the first time.
+ *
+ * @param composite a queryrunner created by composite_queryrunner_new()
+ * @param child a queryrunner that sends its results to
+ * the queue returned by composite_queryrunner_get_queue(). It
+ * now belongs to the composite, which will release it.
+ */
+void composite_queryrunner_add(struct queryrunner *composite, struct queryrunner *child);
+
+/**
+ * Add a deep child to the composite.
+ *
+ * A deep child doesn't run the queries as they come. It's given
+ * the current query when the composite is consolidated, and then
+ * consolidated. Its results are ignored when another result with
+ * the same path has already been sent for the current query.
+ *
+ * @param composite a queryrunner created by composite_queryrunner_new()
+ * @param child a queryrunner that sends its results to
+ * the queue returned by composite_queryrunner_get_queue(). It
+ * now belongs to the composite, which will release it.
+ * @see composite_queryrunner_add()
+ */
+void composite_queryrunner_add_deep(struct queryrunner *composite, struct queryrunner *child);
+
+#endif /*COMPOSITE_QUERYRUNNER_H*/
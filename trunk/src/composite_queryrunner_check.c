@@ -0,0 +1,378 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "composite_queryrunner.h"
+#include "result.h"
+
+#define MAX_RESULTS 16
+
+/**
+ * A queryrunner that sends results with some predefined
+ * pertinences as soon as a query is run.
+ */
+struct mock_runner
+{
+        struct queryrunner base;
+        /** where the results are sent */
+        struct result_queue *queue;
+        /** pertinence of the results to send, a negative value ends the list */
+        float pertinences[MAX_RESULTS];
+        /** path of the results to send, "mock" if NULL */
+        const char *paths[MAX_RESULTS];
+        /** last query ID */
+        QueryId query_id;
+        /** last query, NULL before the first query */
+        char *query;
+        /** number of times consolidate() was called */
+        int consolidated;
+};
+
+static struct queryrunner *runner;
+static struct result_queue *queue;
+static struct mock_runner *fast;
+static struct mock_runner *slow;
+static struct mock_runner *deep;
+/** pertinences of the results received, in order */
+static float received[MAX_RESULTS*2];
+static int received_count;
+static QueryId received_query_id;
+static int released_count;
+
+/* ------------------------- prototypes */
+static Suite *composite_queryrunner_check_suite(void);
+static struct mock_runner *mock_runner_new(struct result_queue *queue);
+static void mock_runner_send(struct mock_runner *mock);
+static void mock_runner_start(struct queryrunner *self);
+static QueryId mock_runner_run_query(struct queryrunner *self, const char *query);
+static void mock_runner_consolidate(struct queryrunner *self);
+static void mock_runner_stop(struct queryrunner *self);
+static void mock_runner_release(struct queryrunner *self);
+static void mock_result_release(struct result *result);
+static void result_handler(struct result_queue_element *element, gpointer userdata);
+static void loop_for(guint ms);
+static gboolean timeout_callback(gpointer userdata);
+
+/* ------------------------- test case */
+static void setup()
+{
+        g_thread_init(NULL/*vtable*/);
+        received_count=0;
+        received_query_id=0;
+        released_count=0;
+
+        queue=result_queue_new(NULL/*default context*/,
+                               result_handler,
+                               NULL/*userdata*/);
+        runner=composite_queryrunner_new(NULL/*default context*/, queue);
+        fast=mock_runner_new(composite_queryrunner_get_queue(runner));
+        slow=mock_runner_new(composite_queryrunner_get_queue(runner));
+        composite_queryrunner_add(runner, &fast->base);
+        composite_queryrunner_add(runner, &slow->base);
+        deep=mock_runner_new(composite_queryrunner_get_queue(runner));
+        composite_queryrunner_add_deep(runner, &deep->base);
+        runner->start(runner);
+}
+
+static void teardown()
+{
+        runner->release(runner);
+        result_queue_delete(queue);
+}
+
+START_TEST(test_merge)
+{
+        QueryId id;
+
+        fast->pertinences[0]=0.5;
+        fast->pertinences[1]=0.3;
+        fast->pertinences[2]=-1.0;
+        slow->pertinences[0]=0.9;
+        slow->pertinences[1]=0.4;
+        slow->pertinences[2]=-1.0;
+
+        id=runner->run_query(runner, "x");
+        mock_runner_send(fast);
+        mock_runner_send(slow);
+        loop_for(200);
+
+        fail_unless(received_count==4, "wrong number of results");
+        fail_unless(received_query_id==id, "wrong query id");
+        fail_unless(received[0]==0.9f, "1st result");
+        fail_unless(received[1]==0.5f, "2nd result");
+        fail_unless(received[2]==0.4f, "3rd result");
+        fail_unless(received[3]==0.3f, "4th result");
+}
+END_TEST
+
+/**
+ * Results sent by a child aren't expected to be sorted.
+ */
+START_TEST(test_unsorted_child)
+{
+        fast->pertinences[0]=0.3;
+        fast->pertinences[1]=0.8;
+        fast->pertinences[2]=0.5;
+        fast->pertinences[3]=-1.0;
+
+        runner->run_query(runner, "x");
+        mock_runner_send(fast);
+        loop_for(200);
+
+        fail_unless(received_count==3, "wrong number of results");
+        fail_unless(received[0]==0.8f, "1st result");
+        fail_unless(received[1]==0.5f, "2nd result");
+        fail_unless(received[2]==0.3f, "3rd result");
+}
+END_TEST
+
+/**
+ * A child that doesn't send anything doesn't hold
+ * back the others.
+ */
+START_TEST(test_slow_child)
+{
+        GTimer *timer;
+
+        fast->pertinences[0]=0.5;
+        fast->pertinences[1]=-1.0;
+
+        runner->run_query(runner, "x");
+        timer=g_timer_new();
+        mock_runner_send(fast);
+        while(received_count==0 && g_timer_elapsed(timer, NULL)<1.0) {
+                g_main_context_iteration(NULL, TRUE/*may block*/);
+        }
+        fail_unless(received_count==1, "result not received");
+        fail_unless(g_timer_elapsed(timer, NULL)<0.05, "result held back by the slow child");
+
+        /* and neither are the next ones */
+        g_timer_start(timer);
+        mock_runner_send(fast);
+        while(received_count==1 && g_timer_elapsed(timer, NULL)<1.0) {
+                g_main_context_iteration(NULL, TRUE/*may block*/);
+        }
+        fail_unless(received_count==2, "second bunch not received");
+        fail_unless(g_timer_elapsed(timer, NULL)<0.05, "second bunch waited");
+        g_timer_destroy(timer);
+}
+END_TEST
+
+/**
+ * Results of an older query are released, not
+ * forwarded.
+ */
+START_TEST(test_old_query)
+{
+        QueryId id;
+
+        fast->pertinences[0]=0.5;
+        fast->pertinences[1]=-1.0;
+        slow->pertinences[0]=0.5;
+        slow->pertinences[1]=-1.0;
+
+        runner->run_query(runner, "x");
+        mock_runner_send(slow);
+        id=runner->run_query(runner, "xy");
+        mock_runner_send(fast);
+        loop_for(200);
+
+        fail_unless(received_count==1, "wrong number of results");
+        fail_unless(received_query_id==id, "wrong query id");
+        fail_unless(released_count==2, "results not released");
+}
+END_TEST
+
+START_TEST(test_consolidate)
+{
+        runner->run_query(runner, "x");
+        fail_unless(deep->query==NULL, "query run on the deep child");
+        runner->run_query(runner, "xy");
+        runner->consolidate(runner);
+        fail_unless(fast->consolidated==1, "fast not consolidated");
+        fail_unless(slow->consolidated==1, "slow not consolidated");
+        fail_unless(deep->consolidated==1, "deep not consolidated");
+        fail_unless(deep->query!=NULL && strcmp("xy", deep->query)==0,
+                    "current query not run on the deep child");
+}
+END_TEST
+
+/**
+ * Results of a deep child that have been sent
+ * already are released, not forwarded.
+ */
+START_TEST(test_deep_duplicates)
+{
+        fast->pertinences[0]=0.5;
+        fast->paths[0]="a";
+        fast->pertinences[1]=-1.0;
+        deep->pertinences[0]=0.5;
+        deep->paths[0]="a";
+        deep->pertinences[1]=0.4;
+        deep->paths[1]="b";
+        deep->pertinences[2]=-1.0;
+
+        runner->run_query(runner, "x");
+        mock_runner_send(fast);
+        loop_for(100);
+        runner->consolidate(runner);
+        mock_runner_send(deep);
+        loop_for(100);
+
+        fail_unless(received_count==2, "wrong number of results");
+        fail_unless(received[0]==0.5f, "1st result");
+        fail_unless(received[1]==0.4f, "2nd result");
+        fail_unless(released_count==3, "results not released");
+}
+END_TEST
+
+/**
+ * Results a deep child sends after the query has
+ * changed are released, not forwarded.
+ */
+START_TEST(test_deep_old_query)
+{
+        deep->pertinences[0]=0.5;
+        deep->pertinences[1]=-1.0;
+
+        runner->run_query(runner, "x");
+        runner->consolidate(runner);
+        runner->run_query(runner, "xy");
+        mock_runner_send(deep);
+        loop_for(100);
+
+        fail_unless(received_count==0, "old results forwarded");
+        fail_unless(released_count==1, "results not released");
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *composite_queryrunner_check_suite(void)
+{
+        Suite *s = suite_create("composite_queryrunner");
+        TCase *tc_core = tcase_create("composite_queryrunner_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_merge);
+        tcase_add_test(tc_core, test_unsorted_child);
+        tcase_add_test(tc_core, test_slow_child);
+        tcase_add_test(tc_core, test_old_query);
+        tcase_add_test(tc_core, test_consolidate);
+        tcase_add_test(tc_core, test_deep_duplicates);
+        tcase_add_test(tc_core, test_deep_old_query);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = composite_queryrunner_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+static struct mock_runner *mock_runner_new(struct result_queue *queue)
+{
+        struct mock_runner *mock;
+
+        mock = g_new(struct mock_runner, 1);
+        mock->base.start=mock_runner_start;
+        mock->base.run_query=mock_runner_run_query;
+        mock->base.consolidate=mock_runner_consolidate;
+        mock->base.stop=mock_runner_stop;
+        mock->base.release=mock_runner_release;
+        mock->queue=queue;
+        mock->pertinences[0]=-1.0;
+        memset(mock->paths, 0, sizeof(mock->paths));
+        mock->query_id=0;
+        mock->query=NULL;
+        mock->consolidated=0;
+        return mock;
+}
+
+/**
+ * Send the results, as the thread of a real
+ * queryrunner would.
+ */
+static void mock_runner_send(struct mock_runner *mock)
+{
+        int i;
+
+        for(i=0; i<MAX_RESULTS && mock->pertinences[i]>=0.0; i++) {
+                struct result *result = g_new0(struct result, 1);
+                result->name="mock";
+                result->path=mock->paths[i]!=NULL ? mock->paths[i]:"mock";
+                result->release=mock_result_release;
+                result->pertinence=mock->pertinences[i];
+                result_queue_add(mock->queue, &mock->base, mock->query_id, result);
+        }
+}
+
+static void mock_runner_start(struct queryrunner *self)
+{
+}
+
+static QueryId mock_runner_run_query(struct queryrunner *self, const char *query)
+{
+        struct mock_runner *mock = (struct mock_runner *)self;
+        g_free(mock->query);
+        mock->query=g_strdup(query);
+        mock->query_id++;
+        return mock->query_id;
+}
+
+static void mock_runner_consolidate(struct queryrunner *self)
+{
+        ((struct mock_runner *)self)->consolidated++;
+}
+
+static void mock_runner_stop(struct queryrunner *self)
+{
+}
+
+static void mock_runner_release(struct queryrunner *self)
+{
+        g_free(((struct mock_runner *)self)->query);
+        g_free(self);
+}
+
+static void mock_result_release(struct result *result)
+{
+        released_count++;
+        g_free(result);
+}
+
+static void result_handler(struct result_queue_element *element, gpointer userdata)
+{
+        fail_unless(element->caller==runner, "wrong caller");
+        if(received_count<MAX_RESULTS*2) {
+                received[received_count]=element->result->pertinence;
+                received_count++;
+        }
+        received_query_id=element->query_id;
+        element->result->release(element->result);
+}
+
+static void loop_for(guint ms)
+{
+        gboolean timed_out = FALSE;
+
+        g_timeout_add(ms, timeout_callback, &timed_out);
+        while(!timed_out) {
+                g_main_context_iteration(NULL/*default context*/, TRUE/*may block*/);
+        }
+}
+
+static gboolean timeout_callback(gpointer userdata)
+{
+        *((gboolean *)userdata)=TRUE;
+        return FALSE;
+}
@@ -0,0 +1,115 @@
+/** \file
+ * Implementation of the API defined in debounce.h
+ */
+
+#include "debounce.h"
+
+/**
+ * Delay used when nothing is known about the user (ms).
+ */
+#define DEFAULT_DELAY 150
+
+/**
+ * Longest delay, however slow the user or the queries are (ms).
+ */
+#define MAX_DELAY 300
+
+/**
+ * A query that returns its first result in less time
+ * than this (ms) is run immediately.
+ */
+#define CHEAP_QUERY_COST 30
+
+/**
+ * Time between two keystrokes above which the user is
+ * considered to have stopped typing, not to be typing slowly (ms).
+ * Such pauses are not taken into account in the average.
+ */
+#define PAUSE 1000
+
+/* ------------------------- prototypes */
+static guint32 smooth(guint32 average, guint32 value);
+
+/* ------------------------- public functions */
+void debounce_init(struct debounce *debounce)
+{
+        g_return_if_fail(debounce!=NULL);
+
+        debounce->last_keystroke=0;
+        debounce->keystroke_interval=0;
+        debounce->query_cost=0;
+}
+
+void debounce_reset(struct debounce *debounce)
+{
+        g_return_if_fail(debounce!=NULL);
+
+        debounce->last_keystroke=0;
+}
+
+void debounce_keystroke(struct debounce *debounce, guint32 time)
+{
+        guint32 interval;
+
+        g_return_if_fail(debounce!=NULL);
+
+        if(debounce->last_keystroke!=0 && time>debounce->last_keystroke) {
+                interval=time-debounce->last_keystroke;
+                if(interval<PAUSE) {
+                        debounce->keystroke_interval=smooth(debounce->keystroke_interval,
+                                                            interval);
+                }
+        }
+        debounce->last_keystroke=time;
+}
+
+void debounce_query_cost(struct debounce *debounce, guint32 cost)
+{
+        g_return_if_fail(debounce!=NULL);
+
+        /* 0 means unknown */
+        debounce->query_cost=smooth(debounce->query_cost, MAX(cost, 1));
+}
+
+/**
+ * A cheap query is run immediately. Otherwise, the query is
+ * run once the user has waited a bit longer than usual
+ * between two keys, unless that's longer than it takes
+ * to run the query.
+ */
+guint debounce_delay(struct debounce *debounce)
+{
+        guint delay;
+
+        g_return_val_if_fail(debounce!=NULL, DEFAULT_DELAY);
+
+        if(debounce->query_cost!=0 && debounce->query_cost<CHEAP_QUERY_COST) {
+                return 0;
+        }
+        if(debounce->keystroke_interval==0) {
+                delay=DEFAULT_DELAY;
+        } else {
+                delay=debounce->keystroke_interval+debounce->keystroke_interval/2;
+        }
+        if(debounce->query_cost!=0) {
+                delay=MIN(delay, debounce->query_cost);
+        }
+        return MIN(delay, MAX_DELAY);
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Add a value to an exponential moving average.
+ *
+ * @param average current average, 0 if unknown
+ * @param value new value
+ * @return new average
+ */
+static guint32 smooth(guint32 average, guint32 value)
+{
+        if(average==0) {
+                return value;
+        }
+        return (average*3+value)/4;
+}
@@ -0,0 +1,84 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <glib.h>
+
+/** \file
+ * Decide how long to wait after a keystroke before
+ * running the query.
+ *
+ * Running a query for each keystroke is a waste when the user
+ * is typing fast and the query is slow, since the query will be
+ * replaced by the next one before the user sees the results.
+ * Waiting a fixed time is a waste when the user has stopped
+ * typing or when the query is cheap.
+ *
+ * The delay is computed from the time between the last
+ * keystrokes of the user and from the time the last queries
+ * took to return their first result. The query is run
+ * immediately when it's cheap; otherwise, it's run as soon
+ * as the user waits a bit longer than usual before typing
+ * the next key.
+ *
+ * A debounce structure is used by one thread only.
+ */
+
+/**
+ * What's known about the user and the queries.
+ */
+struct debounce
+{
+        /** time of the last keystroke (ms), 0 if unknown */
+        guint32 last_keystroke;
+
+        /** average time between two keystrokes (ms), 0 if unknown */
+        guint32 keystroke_interval;
+
+        /** average time it takes to get the first result of a query (ms), 0 if unknown */
+        guint32 query_cost;
+};
+
+/**
+ * Initialize the structure, with nothing known.
+ *
+ * @param debounce structure to initialize
+ */
+void debounce_init(struct debounce *debounce);
+
+/**
+ * Forget about the last keystroke, when the user stops
+ * typing for good, but keep the averages.
+ *
+ * @param debounce
+ */
+void debounce_reset(struct debounce *debounce);
+
+/**
+ * Tell the debounce structure that the user pressed a key.
+ *
+ * @param debounce
+ * @param time time of the keystroke (ms), as found in the
+ * key events
+ */
+void debounce_keystroke(struct debounce *debounce, guint32 time);
+
+/**
+ * Tell the debounce structure how long it took to
+ * get the first result of a query.
+ *
+ * @param debounce
+ * @param cost time between the call to run_query() and the
+ * first result (ms)
+ */
+void debounce_query_cost(struct debounce *debounce, guint32 cost);
+
+/**
+ * Time to wait after the last keystroke before
+ * running the query.
+ *
+ * @param debounce
+ * @return a delay in milliseconds, 0 to run the query immediately
+ */
+guint debounce_delay(struct debounce *debounce);
+
+#endif /*DEBOUNCE_H*/
@@ -0,0 +1,110 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <check.h>
+#include "debounce.h"
+
+static struct debounce debounce;
+
+/* ------------------------- prototypes */
+static Suite *debounce_check_suite(void);
+
+/* ------------------------- test case */
+static void setup()
+{
+        debounce_init(&debounce);
+}
+
+static void teardown()
+{
+}
+
+START_TEST(test_default)
+{
+        guint delay = debounce_delay(&debounce);
+        fail_unless(delay>0 && delay<=300, "default delay");
+}
+END_TEST
+
+START_TEST(test_fast_typist)
+{
+        debounce_keystroke(&debounce, 10000);
+        debounce_keystroke(&debounce, 10080);
+        debounce_keystroke(&debounce, 10160);
+        fail_unless(debounce.keystroke_interval==80, "interval");
+        fail_unless(debounce_delay(&debounce)==120, "a bit longer than the interval");
+}
+END_TEST
+
+START_TEST(test_slow_typist)
+{
+        debounce_keystroke(&debounce, 10000);
+        debounce_keystroke(&debounce, 10900);
+        fail_unless(debounce_delay(&debounce)==300, "maximum delay");
+}
+END_TEST
+
+START_TEST(test_pause)
+{
+        debounce_keystroke(&debounce, 10000);
+        debounce_keystroke(&debounce, 10100);
+        debounce_keystroke(&debounce, 15000);
+        fail_unless(debounce.keystroke_interval==100, "a pause isn't an interval");
+
+        debounce_reset(&debounce);
+        debounce_keystroke(&debounce, 15100);
+        fail_unless(debounce.keystroke_interval==100, "no interval after a reset");
+}
+END_TEST
+
+START_TEST(test_cheap_query)
+{
+        debounce_keystroke(&debounce, 10000);
+        debounce_keystroke(&debounce, 10100);
+        debounce_query_cost(&debounce, 5);
+        fail_unless(debounce_delay(&debounce)==0, "cheap query should run immediately");
+}
+END_TEST
+
+START_TEST(test_query_cost)
+{
+        debounce_keystroke(&debounce, 10000);
+        debounce_keystroke(&debounce, 10200);
+        debounce_query_cost(&debounce, 80);
+        fail_unless(debounce_delay(&debounce)==80, "no need to wait longer than the query");
+
+        debounce_query_cost(&debounce, 1000);
+        fail_unless(debounce.query_cost==310, "average cost");
+        fail_unless(debounce_delay(&debounce)==300, "slow query");
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *debounce_check_suite(void)
+{
+        Suite *s = suite_create("debounce");
+        TCase *tc_core = tcase_create("debounce_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_default);
+        tcase_add_test(tc_core, test_fast_typist);
+        tcase_add_test(tc_core, test_slow_typist);
+        tcase_add_test(tc_core, test_pause);
+        tcase_add_test(tc_core, test_cheap_query);
+        tcase_add_test(tc_core, test_query_cost);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = debounce_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <glib.h>
 #include "desktop_file.h"
+#include "trace.h"
 
 #define DESKTOP_SECTION "Desktop Entry"
 
@@ -51,16 +52,9 @@ gboolean launcher_application_execute(struct launcher *launcher,
         g_return_val_if_fail(err==NULL || *err==NULL, FALSE);
 
 
-        printf("%s:%d: launching application %s using %s...\n", __FILE__, __LINE__, name, uri);
-
         if(get_application(uri, &exec, &terminal, err)) {
                 int pid;
 
-                printf("%s:%d: execute: '%s' (in terminal=%c)\n",
-                       __FILE__,
-                       __LINE__,
-                       exec,
-                       terminal ? 'y':'n');
                 errno=0;
                 if(terminal)
                         pid=gnome_execute_terminal_shell(NULL, exec);
@@ -74,11 +68,7 @@ gboolean launcher_application_execute(struct launcher *launcher,
                                     exec,
                                     errno!=0 ? strerror(errno):"unknown error");
                 } else {
-                        printf("%s:%d: executed '%s' with PID %d\n",
-                               __FILE__,
-                               __LINE__,
-                               exec,
-                               pid);
+                        TRACE(TRACE_LAUNCH, 0/*no query*/, pid, exec);
                         retval=TRUE;
                 }
         }
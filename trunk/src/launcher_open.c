@@ -3,6 +3,7 @@
 #include <libgnome/gnome-url.h>
 #include <libgnome/gnome-util.h>
 #include <libgnomevfs/gnome-vfs.h>
+#include "trace.h"
 
 /** \file a launcher base on gnome_url_show that opens files accessible by GNOME VFS.
  *
@@ -46,7 +47,7 @@ static gboolean launcher_open_execute(struct launcher *launcher,
                 return FALSE;
         }
 
-        printf("%s:%d: opening %s...\n", __FILE__, __LINE__, text_uri);
+        TRACE(TRACE_LAUNCH, 0/*no query*/, 0/*no pid*/, text_uri);
         gnome_err =  NULL;
         if(!gnome_url_show(text_uri, &gnome_err)) {
                 g_set_error(err,
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <glib.h>
+#include "trace.h"
 
 /** \file a launcher based on gnome_url_show
  *
@@ -43,7 +44,7 @@ static gboolean launcher_openurl_execute(struct launcher *launcher,
         g_return_val_if_fail(err==NULL || *err==NULL, FALSE);
 
 
-        printf("%s:%d: opening %s...\n", __FILE__, __LINE__, url);
+        TRACE(TRACE_LAUNCH, 0/*no query*/, 0/*no pid*/, url);
         shown = gnome_url_show(url, &gnome_err);
         if(!shown)
         {
@@ -0,0 +1,1156 @@
+/** \file
+ * Implementation of the API defined in memory_queryrunner.h
+ */
+
+#include "memory_queryrunner.h"
+#include "catalog.h"
+#include "catalog_result.h"
+#include "result_queue.h"
+#include "launcher.h"
+#include "launchers.h"
+#include "query.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Maximum number of results to send, ever, and
+ * maximum number of matches kept for each shard
+ */
+#define MAXIMUM 200
+
+/**
+ * Maximum number of results sent to the result queue at once
+ */
+#define SEND_BATCH 32
+
+/**
+ * Number of entries in a shard, the unit of work of
+ * the scan. A newer query is checked for between two shards.
+ */
+#define SHARD_SIZE 4096
+
+/**
+ * Maximum number of threads scanning the index.
+ */
+#define MAX_SCAN_THREADS 16
+
+/**
+ * Content of the catalog, kept in memory.
+ *
+ * Entries are stored in columns: entry i is described
+ * by element i of each of the arrays. All strings are stored
+ * one after the other, NUL-terminated, in a single block
+ * of memory and referenced by their offset in this block.
+ *
+ * Entries are sorted the same way the catalog sorts
+ * query results, highest frecency first.
+ */
+struct memory_index
+{
+        /** Number of entries */
+        guint count;
+
+        /** All strings, NUL-terminated */
+        char *strings;
+
+        /** Size of strings, in bytes */
+        gsize strings_len;
+
+        /** Offset of the name of the entries in strings */
+        guint32 *names;
+
+        /** Offset of the names prepared by query_prepare() in strings */
+        guint32 *prepared_names;
+
+        /** Bytes found in the prepared names, see query_char_mask() */
+        guint64 *masks;
+
+        /** Offset of the long name of the entries in strings */
+        guint32 *long_names;
+
+        /** Offset of the path of the entries in strings */
+        guint32 *paths;
+
+        /** Entry ID in the catalog */
+        int *ids;
+
+        /** Source ID in the catalog */
+        int *source_ids;
+
+        /** Index of the launcher in launchers */
+        guint8 *launcher_ids;
+
+        /** Time of last use, see struct catalog_query_result */
+        gulong *lastuse;
+
+        /** Launch count, see struct catalog_query_result */
+        int *launches;
+
+        /** Pertinence at the time the index was loaded */
+        float *pertinence;
+
+        /** struct launcher *, the launchers referenced by launcher_ids */
+        GPtrArray *launchers;
+
+        /** Catalog timestamp at the time the index was loaded */
+        gulong timestamp;
+};
+
+/**
+ * Extension of the structure queryrunner for this implementation
+ */
+struct memory_queryrunner
+{
+        struct queryrunner base;
+        /**
+         * Where the result will be sent
+         */
+        struct result_queue *queue;
+
+        /**
+         * Where the thread will read actions
+         * from.
+         * Content will be of the type memory_queryrunner_msg and
+         * will have to be freed by the receiver.
+         */
+        GAsyncQueue *incoming;
+
+        /**
+         * Catalog path.
+         */
+        char *path;
+
+        /**
+         * The thread, while it's running (joinable)
+         */
+        GThread *thread;
+
+        /**
+         * The index, owned by the thread.
+         * NULL until it's been loaded.
+         */
+        struct memory_index *index;
+
+        /**
+         * TRUE between start() and stop(), used
+         * by the main thread exclusively
+         */
+        gboolean started;
+
+        /**
+         * ID of the last query (starts at 0)
+         */
+        QueryId current_query_id;
+
+        /**
+         * Threads that scan shards of the index, used
+         * by the thread only. NULL until a query is
+         * scanned by several threads.
+         */
+        GThreadPool *scan_pool;
+
+        /**
+         * Number of threads that scan the index, 1 to scan it
+         * on the thread itself (atomic)
+         */
+        gint scan_thread_count;
+
+        /**
+         * Protects stats
+         */
+        GMutex *stats_lock;
+
+        /**
+         * Size of the current index, see memory_queryrunner_get_index_stats()
+         */
+        struct memory_index_stats stats;
+};
+
+/** memory_queryrunner to queryrunner */
+#define QUERYRUNNER(memory_qr) (&(memory_qr)->base)
+/** queryrunner to memory_queryrunner */
+#define MEMORY_QUERYRUNNER(qr) ((struct memory_queryrunner *)(qr))
+
+enum MemoryQueryrunnerMessageAction {
+        /** reload the index if the catalog has changed */
+        MEMORY_QUERYRUNNER_ACTION_REFRESH,
+        /** run the query */
+        MEMORY_QUERYRUNNER_ACTION_QUERY,
+        /** stop the thread */
+        MEMORY_QUERYRUNNER_ACTION_SHUTDOWN
+};
+
+struct memory_queryrunner_msg {
+        /* What the thread should do */
+        enum MemoryQueryrunnerMessageAction action;
+
+        /* Id of the query 0=> no query*/
+        QueryId query_id;
+
+        /* query to run, to be freed by g_free (or NULL) */
+        char *query;
+};
+
+/**
+ * An entry that matches the query
+ */
+struct match
+{
+        /** Index of the entry */
+        guint entry;
+        /** How well the entry matches, see query_matcher_score() */
+        float score;
+        /** Pertinence of the result, weighted by score */
+        float pertinence;
+};
+
+/**
+ * The most pertinent matches found in one shard of the index.
+ *
+ * While the shard is being scanned, matches is a heap
+ * whose top is the least pertinent match. Once the shard
+ * has been scanned, matches are sorted, most pertinent first.
+ */
+struct shard
+{
+        /** MAXIMUM matches, NULL until the shard is scanned */
+        struct match *matches;
+        /** Number of elements in matches, never more than MAXIMUM */
+        guint count;
+};
+
+/**
+ * A query being run by the scan threads.
+ *
+ * Shards are handed out to the threads one at a time,
+ * so that a thread that's done with its shard takes the
+ * next one that nobody's working on.
+ */
+struct scan
+{
+        struct memory_queryrunner *self;
+        /** The query, compiled */
+        struct query_matcher *matcher;
+
+        /** Shards of the index, self->index->count/SHARD_SIZE rounded up */
+        struct shard *shards;
+        guint shard_count;
+
+        /** Next shard to hand out (atomic) */
+        gint next_shard;
+
+        /** Non-zero once the threads should stop taking new shards (atomic) */
+        gint cancelled;
+
+        /** Protects running and shards */
+        GMutex *lock;
+
+        /** Signalled when a thread stops */
+        GCond *cond;
+
+        /** Number of threads still working on the scan */
+        int running;
+};
+
+/**
+ * Index being built by load_index()
+ */
+struct memory_index_builder
+{
+        GString *strings;
+        GArray *names;
+        GArray *prepared_names;
+        GArray *masks;
+        GArray *long_names;
+        GArray *paths;
+        GArray *ids;
+        GArray *source_ids;
+        GArray *launcher_ids;
+        GArray *lastuse;
+        GArray *launches;
+        GArray *pertinence;
+        GPtrArray *launchers;
+};
+
+/* ------------------------- prototypes */
+static gpointer memory_thread(gpointer userdata);
+static void refresh_index(struct memory_queryrunner *self);
+static struct memory_index *load_index(struct catalog *catalog);
+static gboolean load_index_callback(struct catalog *catalog, const struct catalog_query_result *result, void *userdata);
+static guint32 add_string(GString *strings, const char *str);
+static void memory_index_free(struct memory_index *index);
+static gsize memory_index_size(struct memory_index *index);
+static void run_query(struct memory_queryrunner *self, QueryId query_id, const char *query);
+static void send_best(struct memory_queryrunner *self, QueryId query_id, struct scan *scan);
+static void scan_thread(gpointer data, gpointer userdata);
+static gboolean scan_next_shard(struct scan *scan);
+static void scan_shard(struct scan *scan, guint shard);
+static int scan_thread_count(void);
+static gboolean match_better(const struct match *a, const struct match *b);
+static void heap_add(struct match *heap, guint *count, const struct match *match);
+static void heap_sift_down(struct match *heap, guint count, guint i);
+static void heap_sort(struct match *heap, guint count);
+static struct result *create_result(struct memory_queryrunner *self, struct catalog_result_pool *pool, QueryId query_id, const struct match *match);
+static void memory_queryrunner_msg_send(struct memory_queryrunner *self, enum MemoryQueryrunnerMessageAction action, QueryId query_id, const char *query);
+static struct memory_queryrunner_msg *memory_queryrunner_msg_next(struct memory_queryrunner *self);
+static void memory_queryrunner_msg_free(struct memory_queryrunner_msg *msg);
+
+/* ------------------------- member functions (queryrunner) */
+static QueryId memory_queryrunner_run_query(struct queryrunner *_self, const char *query);
+static void memory_queryrunner_consolidate(struct queryrunner *_self);
+static void memory_queryrunner_start(struct queryrunner *_self);
+static void memory_queryrunner_stop(struct queryrunner *_self);
+static void memory_queryrunner_release(struct queryrunner *_self);
+
+/* ------------------------- public functions */
+struct queryrunner *memory_queryrunner_new(const char *path, struct result_queue *queue)
+{
+        struct memory_queryrunner *queryrunner;
+        struct catalog *catalog;
+
+        g_return_val_if_fail(path!=NULL, NULL);
+        g_return_val_if_fail(queue!=NULL, NULL);
+
+        catalog = catalog_new(path);
+        if(!catalog_connect(catalog)) {
+                fprintf(stderr,
+                        "connection to catalog in %s failed: %s\n",
+                        path,
+                        catalog_error(catalog));
+                catalog_free(catalog);
+                return NULL;
+        }
+        catalog_free(catalog);
+
+        queryrunner = g_new(struct memory_queryrunner, 1);
+
+        queryrunner->base.start=memory_queryrunner_start;
+        queryrunner->base.run_query=memory_queryrunner_run_query;
+        queryrunner->base.consolidate=memory_queryrunner_consolidate;
+        queryrunner->base.stop=memory_queryrunner_stop;
+        queryrunner->base.release=memory_queryrunner_release;
+        queryrunner->current_query_id=0;
+        queryrunner->path=g_strdup(path);
+        queryrunner->queue=queue;
+        queryrunner->incoming=g_async_queue_new();
+        queryrunner->index=NULL;
+        queryrunner->started=FALSE;
+        queryrunner->stats_lock=g_mutex_new();
+        memset(&queryrunner->stats, 0, sizeof(struct memory_index_stats));
+        queryrunner->scan_thread_count=scan_thread_count();
+        queryrunner->scan_pool=NULL;
+        queryrunner->thread=g_thread_create(memory_thread,
+                                            queryrunner/*userdata*/,
+                                            TRUE/*joinable*/,
+                                            NULL/*error*/);
+        return QUERYRUNNER(queryrunner);
+}
+
+void memory_queryrunner_get_index_stats(struct queryrunner *_self, struct memory_index_stats *stats)
+{
+        struct memory_queryrunner *self;
+
+        g_return_if_fail(_self!=NULL);
+        g_return_if_fail(stats!=NULL);
+
+        self = MEMORY_QUERYRUNNER(_self);
+        g_mutex_lock(self->stats_lock);
+        memcpy(stats, &self->stats, sizeof(struct memory_index_stats));
+        g_mutex_unlock(self->stats_lock);
+}
+
+void memory_queryrunner_set_scan_threads(struct queryrunner *_self, int count)
+{
+        g_return_if_fail(_self!=NULL);
+        g_return_if_fail(count>0);
+
+        g_atomic_int_set(&MEMORY_QUERYRUNNER(_self)->scan_thread_count,
+                         MIN(count, MAX_SCAN_THREADS));
+}
+
+/* ------------------------- member functions */
+
+/**
+ * Make sure the index is up-to-date.
+ *
+ * Checking the catalog is done once per start(), so
+ * that it's never done while the user is typing.
+ */
+static void memory_queryrunner_start(struct queryrunner *_self)
+{
+        struct memory_queryrunner *self;
+
+        g_return_if_fail(_self!=NULL);
+        self = MEMORY_QUERYRUNNER(_self);
+
+        if(!self->started) {
+                memory_queryrunner_msg_send(self,
+                                            MEMORY_QUERYRUNNER_ACTION_REFRESH,
+                                            0/*query_id*/,
+                                            NULL/*no query*/);
+                self->started=TRUE;
+        }
+}
+
+static void memory_queryrunner_stop(struct queryrunner *_self)
+{
+        struct memory_queryrunner *self;
+
+        g_return_if_fail(_self!=NULL);
+        self = MEMORY_QUERYRUNNER(_self);
+
+        self->started=FALSE;
+}
+
+static QueryId memory_queryrunner_run_query(struct queryrunner *_self, const char *query)
+{
+        struct memory_queryrunner *self;
+
+        g_return_val_if_fail(_self!=NULL, 0);
+        g_return_val_if_fail(query!=NULL, 0);
+
+        self = MEMORY_QUERYRUNNER(_self);
+        g_return_val_if_fail(self->started, 0);
+
+        self->current_query_id++;
+        result_queue_set_current_query(self->queue, _self, self->current_query_id);
+        memory_queryrunner_msg_send(self,
+                                    MEMORY_QUERYRUNNER_ACTION_QUERY,
+                                    self->current_query_id,
+                                    query);
+        return self->current_query_id;
+}
+
+static void memory_queryrunner_consolidate(struct queryrunner *_self)
+{
+}
+
+static void memory_queryrunner_release(struct queryrunner *_self)
+{
+        struct memory_queryrunner *self;
+
+        g_return_if_fail(_self!=NULL);
+        self = MEMORY_QUERYRUNNER(_self);
+
+        memory_queryrunner_msg_send(self,
+                                    MEMORY_QUERYRUNNER_ACTION_SHUTDOWN,
+                                    0/*query_id*/,
+                                    NULL/*no query*/);
+        g_thread_join(self->thread);
+
+        if(self->scan_pool) {
+                g_thread_pool_free(self->scan_pool,
+                                   TRUE/*immediate*/,
+                                   TRUE/*wait*/);
+        }
+        g_async_queue_unref(self->incoming);
+        if(self->index) {
+                memory_index_free(self->index);
+        }
+        g_mutex_free(self->stats_lock);
+        g_free(self->path);
+        g_free(self);
+}
+
+/* ------------------------- static functions */
+static gpointer memory_thread(gpointer userdata)
+{
+        struct memory_queryrunner *self;
+        struct memory_queryrunner_msg *msg;
+        gboolean shutdown = FALSE;
+
+        self = (struct memory_queryrunner *)userdata;
+        g_return_val_if_fail(self!=NULL, NULL);
+
+        g_async_queue_ref(self->incoming);
+        do {
+                msg = memory_queryrunner_msg_next(self);
+                switch(msg->action) {
+                case MEMORY_QUERYRUNNER_ACTION_REFRESH:
+                        refresh_index(self);
+                        break;
+
+                case MEMORY_QUERYRUNNER_ACTION_QUERY:
+                        if(msg->query!=NULL && strlen(msg->query)>0) {
+                                if(self->index==NULL) {
+                                        refresh_index(self);
+                                }
+                                if(self->index!=NULL) {
+                                        run_query(self, msg->query_id, msg->query);
+                                }
+                        }
+                        break;
+
+                case MEMORY_QUERYRUNNER_ACTION_SHUTDOWN:
+                        shutdown=TRUE;
+                        break;
+                }
+                memory_queryrunner_msg_free(msg);
+        } while(!shutdown);
+        g_async_queue_unref(self->incoming);
+
+        return NULL;
+}
+
+/**
+ * Reload the index if the catalog has been indexed
+ * since it was loaded.
+ *
+ * @param self
+ */
+static void refresh_index(struct memory_queryrunner *self)
+{
+        struct catalog *catalog;
+        struct memory_index *index;
+        gulong timestamp;
+
+        g_return_if_fail(self!=NULL);
+
+        catalog = catalog_new(self->path);
+        if(!catalog_connect(catalog)) {
+                fprintf(stderr,
+                        "connection to catalog in %s failed: %s\n",
+                        self->path,
+                        catalog_error(catalog));
+                catalog_free(catalog);
+                return;
+        }
+
+        timestamp = catalog_timestamp_get(catalog);
+        if(self->index!=NULL && self->index->timestamp==timestamp) {
+                catalog_free(catalog);
+                return;
+        }
+
+        index = load_index(catalog);
+        if(index==NULL) {
+                fprintf(stderr,
+                        "loading catalog %s failed: %s\n",
+                        self->path,
+                        catalog_error(catalog));
+        } else {
+                index->timestamp=timestamp;
+                if(self->index) {
+                        memory_index_free(self->index);
+                }
+                self->index=index;
+
+                g_mutex_lock(self->stats_lock);
+                self->stats.entries=index->count;
+                self->stats.size=memory_index_size(index);
+                self->stats.loads++;
+                g_mutex_unlock(self->stats_lock);
+        }
+        catalog_free(catalog);
+}
+
+/**
+ * Load all the enabled entries of the catalog.
+ *
+ * @param catalog a connected catalog
+ * @return a new index or NULL
+ */
+static struct memory_index *load_index(struct catalog *catalog)
+{
+        struct memory_index_builder builder;
+        struct memory_index *index;
+        gboolean success;
+
+        g_return_val_if_fail(catalog!=NULL, NULL);
+
+        builder.strings=g_string_new("");
+        builder.names=g_array_new(FALSE, FALSE, sizeof(guint32));
+        builder.prepared_names=g_array_new(FALSE, FALSE, sizeof(guint32));
+        builder.masks=g_array_new(FALSE, FALSE, sizeof(guint64));
+        builder.long_names=g_array_new(FALSE, FALSE, sizeof(guint32));
+        builder.paths=g_array_new(FALSE, FALSE, sizeof(guint32));
+        builder.ids=g_array_new(FALSE, FALSE, sizeof(int));
+        builder.source_ids=g_array_new(FALSE, FALSE, sizeof(int));
+        builder.launcher_ids=g_array_new(FALSE, FALSE, sizeof(guint8));
+        builder.lastuse=g_array_new(FALSE, FALSE, sizeof(gulong));
+        builder.launches=g_array_new(FALSE, FALSE, sizeof(int));
+        builder.pertinence=g_array_new(FALSE, FALSE, sizeof(float));
+        builder.launchers=g_ptr_array_new();
+
+        success = catalog_get_enabled_entries(catalog,
+                                              load_index_callback,
+                                              &builder);
+
+        index = g_new(struct memory_index, 1);
+        index->count=builder.ids->len;
+        index->strings_len=builder.strings->len;
+        index->strings=g_string_free(builder.strings, FALSE/*return content*/);
+        index->names=(guint32 *)g_array_free(builder.names, FALSE/*return content*/);
+        index->prepared_names=(guint32 *)g_array_free(builder.prepared_names, FALSE);
+        index->masks=(guint64 *)g_array_free(builder.masks, FALSE);
+        index->long_names=(guint32 *)g_array_free(builder.long_names, FALSE);
+        index->paths=(guint32 *)g_array_free(builder.paths, FALSE);
+        index->ids=(int *)g_array_free(builder.ids, FALSE);
+        index->source_ids=(int *)g_array_free(builder.source_ids, FALSE);
+        index->launcher_ids=(guint8 *)g_array_free(builder.launcher_ids, FALSE);
+        index->lastuse=(gulong *)g_array_free(builder.lastuse, FALSE);
+        index->launches=(int *)g_array_free(builder.launches, FALSE);
+        index->pertinence=(float *)g_array_free(builder.pertinence, FALSE);
+        index->launchers=builder.launchers;
+        index->timestamp=0;
+
+        if(!success) {
+                memory_index_free(index);
+                return NULL;
+        }
+        return index;
+}
+
+/**
+ * Add an entry into the index being built.
+ *
+ * @param catalog
+ * @param result the entry
+ * @param userdata a struct memory_index_builder
+ */
+static gboolean load_index_callback(struct catalog *catalog,
+                                    const struct catalog_query_result *result,
+                                    void *userdata)
+{
+        struct memory_index_builder *builder;
+        const struct catalog_entry *entry;
+        struct launcher *launcher;
+        char *prepared;
+        guint32 offset;
+        guint64 mask;
+        guint8 launcher_id;
+        guint i;
+
+        g_return_val_if_fail(result!=NULL, FALSE);
+        g_return_val_if_fail(userdata!=NULL, FALSE);
+
+        builder = (struct memory_index_builder *)userdata;
+        entry = &result->entry;
+
+        launcher = launchers_get(entry->launcher);
+        if(!launcher) {
+                g_warning("unclean catalog: no launcher for source referenced "
+                          "in catalog with source_id=%d launcher=%s\n",
+                          entry->source_id, entry->launcher);
+                return TRUE;
+        }
+        for(i=0; i<builder->launchers->len; i++) {
+                if(g_ptr_array_index(builder->launchers, i)==launcher) {
+                        break;
+                }
+        }
+        if(i==builder->launchers->len) {
+                g_return_val_if_fail(i<256, FALSE);
+                g_ptr_array_add(builder->launchers, launcher);
+        }
+        launcher_id=(guint8)i;
+
+        offset=add_string(builder->strings, entry->name);
+        g_array_append_val(builder->names, offset);
+        prepared=query_prepare(entry->name);
+        offset=add_string(builder->strings, prepared);
+        mask=query_char_mask(prepared);
+        g_free(prepared);
+        g_array_append_val(builder->prepared_names, offset);
+        g_array_append_val(builder->masks, mask);
+        offset=add_string(builder->strings, entry->long_name);
+        g_array_append_val(builder->long_names, offset);
+        offset=add_string(builder->strings, entry->path);
+        g_array_append_val(builder->paths, offset);
+        g_array_append_val(builder->ids, result->id);
+        g_array_append_val(builder->source_ids, entry->source_id);
+        g_array_append_val(builder->launcher_ids, launcher_id);
+        g_array_append_val(builder->lastuse, result->lastuse);
+        g_array_append_val(builder->launches, result->launches);
+        g_array_append_val(builder->pertinence, result->pertinence);
+
+        return TRUE;
+}
+
+/**
+ * Append a NUL-terminated string at the end of the string block.
+ *
+ * @return offset of the string in the block
+ */
+static guint32 add_string(GString *strings, const char *str)
+{
+        guint32 offset;
+
+        g_return_val_if_fail(strings!=NULL, 0);
+        g_return_val_if_fail(str!=NULL, 0);
+
+        offset=strings->len;
+        g_string_append_len(strings, str, strlen(str)+1);
+        return offset;
+}
+
+static void memory_index_free(struct memory_index *index)
+{
+        g_return_if_fail(index!=NULL);
+
+        g_free(index->strings);
+        g_free(index->names);
+        g_free(index->prepared_names);
+        g_free(index->masks);
+        g_free(index->long_names);
+        g_free(index->paths);
+        g_free(index->ids);
+        g_free(index->source_ids);
+        g_free(index->launcher_ids);
+        g_free(index->lastuse);
+        g_free(index->launches);
+        g_free(index->pertinence);
+        g_ptr_array_free(index->launchers, TRUE/*free segment*/);
+        g_free(index);
+}
+
+/**
+ * Compute the memory used by an index.
+ *
+ * @return size of the index, in bytes
+ */
+static gsize memory_index_size(struct memory_index *index)
+{
+        gsize per_entry;
+
+        g_return_val_if_fail(index!=NULL, 0);
+
+        per_entry = 4*sizeof(guint32) /* names, prepared_names, long_names, paths */
+                + sizeof(guint64) /* masks */
+                + 2*sizeof(int) /* ids, source_ids */
+                + sizeof(guint8) /* launcher_ids */
+                + sizeof(gulong) /* lastuse */
+                + sizeof(int) /* launches */
+                + sizeof(float); /* pertinence */
+        return sizeof(struct memory_index)
+                + index->strings_len
+                + index->count*per_entry;
+}
+
+/**
+ * Look for the entries that match the query and
+ * send the most pertinent ones to the result queue.
+ *
+ * The index is split into shards that are scanned in
+ * parallel by the scan threads, when there are several
+ * processors. Each shard keeps its MAXIMUM most pertinent
+ * matches, then the shards are merged, so the results are the
+ * same whatever the number of threads.
+ *
+ * The query is abandoned as soon as another message
+ * is waiting.
+ *
+ * @param self
+ * @param query_id
+ * @param query
+ */
+static void run_query(struct memory_queryrunner *self, QueryId query_id, const char *query)
+{
+        struct scan scan;
+        guint i;
+        int threads;
+
+        g_return_if_fail(self!=NULL);
+        g_return_if_fail(self->index!=NULL);
+        g_return_if_fail(query!=NULL);
+
+        scan.self=self;
+        scan.matcher=query_compile(query);
+        scan.shard_count=(self->index->count+SHARD_SIZE-1)/SHARD_SIZE;
+        scan.shards=g_new0(struct shard, scan.shard_count);
+        scan.next_shard=0;
+        scan.cancelled=0;
+        scan.lock=g_mutex_new();
+        scan.cond=g_cond_new();
+        scan.running=0;
+
+        threads=MIN(g_atomic_int_get(&self->scan_thread_count), (int)scan.shard_count);
+        if(threads<=1) {
+                while(scan_next_shard(&scan)) {
+                }
+        } else {
+                if(self->scan_pool==NULL) {
+                        self->scan_pool=g_thread_pool_new(scan_thread,
+                                                          NULL/*userdata*/,
+                                                          MAX_SCAN_THREADS,
+                                                          FALSE/*exclusive*/,
+                                                          NULL/*error*/);
+                }
+                scan.running=threads;
+                for(i=0; i<(guint)threads; i++) {
+                        g_thread_pool_push(self->scan_pool, &scan, NULL/*error*/);
+                }
+
+                g_mutex_lock(scan.lock);
+                while(scan.running>0) {
+                        g_cond_wait(scan.cond, scan.lock);
+                }
+                g_mutex_unlock(scan.lock);
+        }
+        if(!g_atomic_int_get(&scan.cancelled)) {
+                send_best(self, query_id, &scan);
+        }
+
+        for(i=0; i<scan.shard_count; i++) {
+                g_free(scan.shards[i].matches);
+        }
+        g_free(scan.shards);
+        g_mutex_free(scan.lock);
+        g_cond_free(scan.cond);
+        query_matcher_free(scan.matcher);
+}
+
+/**
+ * Merge the matches of the shards and send the
+ * MAXIMUM most pertinent ones to the result queue,
+ * most pertinent first.
+ *
+ * @param self
+ * @param query_id
+ * @param scan a scan whose shards have all been scanned
+ */
+static void send_best(struct memory_queryrunner *self, QueryId query_id, struct scan *scan)
+{
+        struct catalog_result_pool *pool;
+        struct result *results[SEND_BATCH];
+        guint *next;
+        int count;
+        int len;
+
+        pool=catalog_result_pool_new(self->path);
+        /* next[i] is the index of the best match of shard i not sent yet */
+        next=g_new0(guint, scan->shard_count);
+        len=0;
+        for(count=0; count<MAXIMUM; count++) {
+                struct shard *best = NULL;
+                guint i;
+
+                for(i=0; i<scan->shard_count; i++) {
+                        struct shard *shard = &scan->shards[i];
+                        if(next[i]<shard->count
+                           && (best==NULL
+                               || match_better(&shard->matches[next[i]],
+                                               &best->matches[next[best-scan->shards]]))) {
+                                best=shard;
+                        }
+                }
+                if(best==NULL) {
+                        break;
+                }
+                results[len]=create_result(self,
+                                           pool,
+                                           query_id,
+                                           &best->matches[next[best-scan->shards]]);
+                next[best-scan->shards]++;
+                len++;
+                if(len==SEND_BATCH) {
+                        result_queue_add_batch(self->queue, QUERYRUNNER(self), query_id, results, len);
+                        len=0;
+                }
+        }
+        result_queue_add_batch(self->queue, QUERYRUNNER(self), query_id, results, len);
+        g_free(next);
+        catalog_result_pool_release(pool);
+}
+
+/**
+ * Scan shards until there are no more shards to scan
+ * or the scan is cancelled (thread pool function).
+ *
+ * @param data struct scan
+ * @param userdata unused
+ */
+static void scan_thread(gpointer data, gpointer userdata)
+{
+        struct scan *scan;
+
+        scan = (struct scan *)data;
+        while(scan_next_shard(scan)) {
+        }
+
+        g_mutex_lock(scan->lock);
+        scan->running--;
+        g_cond_broadcast(scan->cond);
+        g_mutex_unlock(scan->lock);
+}
+
+/**
+ * Take the next shard nobody's working on and scan it.
+ *
+ * @param scan
+ * @return FALSE if there was nothing left to scan or if the scan
+ * was cancelled because a newer query came
+ */
+static gboolean scan_next_shard(struct scan *scan)
+{
+        guint shard;
+
+        if(g_atomic_int_get(&scan->cancelled)) {
+                return FALSE;
+        }
+        if(g_async_queue_length(scan->self->incoming)>0) {
+                g_atomic_int_inc(&scan->cancelled);
+                return FALSE;
+        }
+        shard=(guint)g_atomic_int_exchange_and_add(&scan->next_shard, 1);
+        if(shard>=scan->shard_count) {
+                return FALSE;
+        }
+        scan_shard(scan, shard);
+        return TRUE;
+}
+
+/**
+ * Look for the MAXIMUM most pertinent matches in a shard.
+ *
+ * Entries whose name doesn't contain all the characters
+ * of the query are skipped without looking at their name.
+ *
+ * @param scan
+ * @param shard index of the shard in scan->shards
+ */
+static void scan_shard(struct scan *scan, guint shard)
+{
+        struct memory_index *index;
+        struct match *matches;
+        guint count;
+        guint end;
+        guint i;
+
+        index=scan->self->index;
+        matches=g_new(struct match, MAXIMUM);
+        count=0;
+        end=MIN(index->count, (shard+1)*SHARD_SIZE);
+        for(i=shard*SHARD_SIZE; i<end; i++) {
+                struct match match;
+
+                if(!query_matcher_may_match(scan->matcher, index->masks[i])) {
+                        continue;
+                }
+                match.score=query_matcher_score(scan->matcher,
+                                                index->strings+index->prepared_names[i],
+                                                index->strings+index->names[i]);
+                if(match.score>0.0) {
+                        match.entry=i;
+                        match.pertinence=index->pertinence[i]*match.score;
+                        heap_add(matches, &count, &match);
+                }
+        }
+        heap_sort(matches, count);
+
+        g_mutex_lock(scan->lock);
+        scan->shards[shard].matches=matches;
+        scan->shards[shard].count=count;
+        g_mutex_unlock(scan->lock);
+}
+
+/**
+ * Choose the number of threads that scan the index.
+ *
+ * @return the number of processors, between 1 and MAX_SCAN_THREADS
+ */
+static int scan_thread_count(void)
+{
+        long count = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+        count=sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if(count<1) {
+                count=1;
+        }
+        if(count>MAX_SCAN_THREADS) {
+                count=MAX_SCAN_THREADS;
+        }
+        return (int)count;
+}
+
+/**
+ * Compare two matches.
+ *
+ * @return TRUE if a is more pertinent than b or, with the same
+ * pertinence, comes first in the index
+ */
+static gboolean match_better(const struct match *a, const struct match *b)
+{
+        if(a->pertinence!=b->pertinence) {
+                return a->pertinence>b->pertinence;
+        }
+        return a->entry<b->entry;
+}
+
+/**
+ * Add a match to a heap of at most MAXIMUM matches whose
+ * top is the worst match.
+ *
+ * Once the heap is full, the match replaces the top if
+ * it's better, and is ignored otherwise.
+ *
+ * @param heap
+ * @param count number of matches in the heap (in/out)
+ * @param match
+ */
+static void heap_add(struct match *heap, guint *count, const struct match *match)
+{
+        guint i;
+
+        if(*count==MAXIMUM) {
+                if(match_better(match, &heap[0])) {
+                        heap[0]=*match;
+                        heap_sift_down(heap, *count, 0);
+                }
+                return;
+        }
+
+        i=*count;
+        (*count)++;
+        while(i>0 && match_better(&heap[(i-1)/2], match)) {
+                heap[i]=heap[(i-1)/2];
+                i=(i-1)/2;
+        }
+        heap[i]=*match;
+}
+
+/**
+ * Move an element down a heap until it's worse than its children.
+ *
+ * @param heap
+ * @param count number of elements in the heap
+ * @param i index of the element to move
+ */
+static void heap_sift_down(struct match *heap, guint count, guint i)
+{
+        struct match match;
+
+        match=heap[i];
+        while(2*i+1<count) {
+                guint child = 2*i+1;
+                if(child+1<count && match_better(&heap[child], &heap[child+1])) {
+                        child++;
+                }
+                if(!match_better(&match, &heap[child])) {
+                        break;
+                }
+                heap[i]=heap[child];
+                i=child;
+        }
+        heap[i]=match;
+}
+
+/**
+ * Sort a heap built by heap_add(), best match first.
+ *
+ * @param heap
+ * @param count number of elements in the heap
+ */
+static void heap_sort(struct match *heap, guint count)
+{
+        while(count>1) {
+                struct match worst;
+
+                worst=heap[0];
+                count--;
+                heap[0]=heap[count];
+                heap[count]=worst;
+                heap_sift_down(heap, count, 0);
+        }
+}
+
+/**
+ * Create a result for a match.
+ *
+ * @param self
+ * @param pool pool of the results of the query
+ * @param query_id
+ * @param match the match
+ * @return a new result
+ */
+static struct result *create_result(struct memory_queryrunner *self,
+                                    struct catalog_result_pool *pool,
+                                    QueryId query_id,
+                                    const struct match *match)
+{
+        struct memory_index *index;
+        struct catalog_query_result qresult;
+        struct launcher *launcher;
+        guint entry;
+
+        index=self->index;
+        entry=match->entry;
+
+        qresult.id=index->ids[entry];
+        qresult.entry.name=index->strings+index->names[entry];
+        qresult.entry.long_name=index->strings+index->long_names[entry];
+        qresult.entry.path=index->strings+index->paths[entry];
+        qresult.entry.source_id=index->source_ids[entry];
+        launcher=(struct launcher *)g_ptr_array_index(index->launchers,
+                                                      index->launcher_ids[entry]);
+        qresult.entry.launcher=launcher->id;
+        qresult.pertinence=match->pertinence;
+        qresult.query_id=query_id;
+        qresult.enabled=TRUE;
+        qresult.lastuse=index->lastuse[entry];
+        qresult.launches=index->launches[entry];
+
+        return catalog_result_create(pool,
+                                     launcher,
+                                     &qresult,
+                                     index->strings+index->prepared_names[entry]);
+}
+
+static void memory_queryrunner_msg_send(struct memory_queryrunner *self,
+                                        enum MemoryQueryrunnerMessageAction action,
+                                        QueryId query_id,
+                                        const char *query)
+{
+        struct memory_queryrunner_msg *msg;
+
+        g_return_if_fail(self);
+
+        msg = g_new(struct memory_queryrunner_msg, 1);
+        msg->action = action;
+        msg->query_id = query_id;
+        msg->query = query ? g_strdup(query):NULL;
+
+        g_async_queue_push(self->incoming, msg);
+}
+
+/**
+ * Get the next message, skipping queries that have
+ * already been replaced by newer ones.
+ */
+static struct memory_queryrunner_msg *memory_queryrunner_msg_next(struct memory_queryrunner *self)
+{
+        struct memory_queryrunner_msg *msg;
+        GAsyncQueue *queue;
+
+        queue = self->incoming;
+
+        g_async_queue_lock(queue);
+        msg=g_async_queue_pop_unlocked(queue);
+        while(msg->action==MEMORY_QUERYRUNNER_ACTION_QUERY) {
+                struct memory_queryrunner_msg *msg2;
+                msg2 = (struct memory_queryrunner_msg *)g_async_queue_try_pop_unlocked(queue);
+                if(msg2==NULL) {
+                        break;
+                } else {
+                        memory_queryrunner_msg_free(msg);
+                        msg=msg2;
+                }
+        }
+        g_async_queue_unlock(queue);
+
+        return msg;
+}
+
+static void memory_queryrunner_msg_free(struct memory_queryrunner_msg *msg)
+{
+        g_return_if_fail(msg);
+
+        if(msg->query) {
+                g_free(msg->query);
+        }
+        g_free(msg);
+}
@@ -0,0 +1,64 @@
+#ifndef MEMORY_QUERYRUNNER_H
+#define MEMORY_QUERYRUNNER_H
+
+/** \file
+ * Implementation of a queryrunner that keeps the
+ * content of the catalog of catalog.h in memory.
+ *
+ * The entries are loaded from the catalog when the
+ * queryrunner is started for the first time and reloaded
+ * whenever the catalog has been indexed since then. Queries
+ * are answered from memory, without accessing the catalog.
+ */
+
+#include "queryrunner.h"
+#include "result_queue.h"
+
+/**
+ * Create a new memory-based queryrunner.
+ * @param path path of the catalog, which will be created if it doesn't exist yet
+ * @param queue queue to send the results to
+ * @return a new queryrunner or NULL (error)
+ */
+struct queryrunner *memory_queryrunner_new(const char *path, struct result_queue *queue);
+
+/**
+ * Size of the index of a memory-based queryrunner.
+ */
+struct memory_index_stats
+{
+        /** number of entries in the index, 0 until it's been loaded */
+        guint entries;
+        /** memory used by the index, in bytes */
+        gsize size;
+        /** number of times the index has been loaded from the catalog */
+        guint loads;
+};
+
+/**
+ * Get statistics about the index of a memory-based queryrunner.
+ *
+ * The index is loaded by the queryrunner's thread, the first time
+ * the queryrunner is started and whenever the catalog has changed
+ * since. This call is thread-safe.
+ *
+ * @param queryrunner a queryrunner created by memory_queryrunner_new()
+ * @param stats structure to fill (out)
+ */
+void memory_queryrunner_get_index_stats(struct queryrunner *queryrunner, struct memory_index_stats *stats);
+
+/**
+ * Set the number of threads that scan the index of
+ * a memory-based queryrunner.
+ *
+ * By default, there's one thread per processor. The results
+ * don't depend on the number of threads. This is meant for tests
+ * and benchmarks.
+ *
+ * @param queryrunner a queryrunner created by memory_queryrunner_new()
+ * @param count number of threads, 1 to scan the index on the
+ * queryrunner's own thread. It applies to the next queries.
+ */
+void memory_queryrunner_set_scan_threads(struct queryrunner *queryrunner, int count);
+
+#endif /*MEMORY_QUERYRUNNER_H*/
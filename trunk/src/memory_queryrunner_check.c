@@ -0,0 +1,533 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <check.h>
+#include <unistd.h>
+#include <string.h>
+#include "memory_queryrunner.h"
+#include "catalog.h"
+#include "query.h"
+#include "mock_launchers.h"
+
+#define CATALOG_PATH ".memory_queryrunner.test"
+
+/**
+ * Number of entries of the catalog of test_timed
+ */
+#define TIMED_ENTRY_COUNT 1000000
+
+/**
+ * Number of entries of the catalog of test_sharded, enough
+ * for several shards
+ */
+#define SHARDED_ENTRY_COUNT 20000
+
+/**
+ * Same entries as in catalog_queryrunner_check.c:
+ * 2 entries matches "hell",
+ * 1 entry matches "hello",
+ * 0 entries matches "hellow",
+ * 5 entries matches "hel",
+ * 10 entries matches "he"
+ */
+static char *entries[] = {
+                                 "hell, no",      /* "h", "he", "hell", "e" */
+                                 "hellovathing",  /* "h", "he", "hell", "hello", "e" */
+                                 "hehel",         /* "h", "he", "hel", "e" */
+                                 "bahel",         /* "h", "he", "hel", "e" */
+                                 "lahelt",        /* "h", "he", "hel","e" */
+                                 "bahareth",      /* "h", "e" */
+                                 "ta he ho",      /* "h", "he", "e" */
+                                 "barhat",        /* "h" */
+                                 "xoloth",        /* "h" */
+                                 "balaxilth",     /* "h" */
+                                 "bobo, xag ?",
+                                 "behere",        /* "h", "he", "e" */
+                                 "heboxit",       /* "h", "he", "e" */
+                                 "cahet",         /* "h", "he", "e" */
+                                 "herat",         /* "h", "he", "e" */
+                         };
+#define entries_len (sizeof(entries)/sizeof(char *))
+#define get_results_counted(query_id, count) _get_results_counted(query_id, count, __FILE__, __LINE__)
+
+static struct queryrunner *runner;
+static struct result_queue *queue;
+
+/**
+ * Query whose results are collected by result_handler()
+ */
+static QueryId expected_query_id;
+
+/**
+ * Names of the results of expected_query_id, to be
+ * freed with g_free()
+ */
+static GPtrArray *received;
+
+/**
+ * Pertinence of the results of expected_query_id (float)
+ */
+static GArray *received_pertinences;
+
+/**
+ * Number of results received for another query than expected_query_id
+ */
+static int unexpected_count;
+
+/* ------------------------- prototypes */
+static Suite *memory_queryrunner_check_suite(void);
+static void add_entries(int count, const char *name_pattern);
+static void wait_for_loads(guint loads);
+static gboolean timeout_callback(gpointer userdata);
+static void run_main_loop(guint ms);
+static void _get_results_counted(QueryId query_id, int count, const char *file, int line);
+static gboolean received_name(const char *name);
+static void clear_received(void);
+static void result_handler(struct result_queue_element *element, gpointer userdata);
+
+/* ------------------------- test case */
+
+static void setup()
+{
+        int source_id;
+        struct catalog *catalog;
+        struct catalog_entry entry;
+        int i;
+
+        unlink(CATALOG_PATH);
+        g_thread_init(NULL/*vtable*/);
+
+        catalog = catalog_new_and_connect(CATALOG_PATH, NULL/*errs*/);
+        fail_unless(catalog!=NULL, "no catalog in " CATALOG_PATH);
+        fail_unless(catalog_add_source(catalog, "test", &source_id), "add_source");
+
+        CATALOG_ENTRY_INIT(&entry);
+        entry.source_id=source_id;
+        entry.launcher=TEST_LAUNCHER;
+        for(i=0; i<entries_len; i++) {
+                entry.name=entries[i];
+                entry.path=entries[i];
+                entry.long_name=entries[i];
+                fail_unless(catalog_add_entry(catalog,
+                                              &entry,
+                                              NULL/*id_out*/),
+                            "add entry");
+        }
+        catalog_free(catalog);
+
+        received=g_ptr_array_new();
+        received_pertinences=g_array_new(FALSE/*zero_terminated*/,
+                                         FALSE/*clear*/,
+                                         sizeof(float));
+        unexpected_count=0;
+        expected_query_id=0;
+
+        queue=result_queue_new(NULL/*default context*/,
+                               result_handler,
+                               NULL/*userdata*/);
+        runner=memory_queryrunner_new(CATALOG_PATH, queue);
+        fail_unless(runner!=NULL, "no runner");
+        runner->start(runner);
+}
+
+static void teardown()
+{
+        if(runner) {
+                runner->release(runner);
+        }
+        clear_received();
+        g_ptr_array_free(received, TRUE/*free segment*/);
+        g_array_free(received_pertinences, TRUE/*free segment*/);
+        unlink(CATALOG_PATH);
+}
+
+/**
+ * The queryrunner finds the entries whose name
+ * contain the query.
+ */
+START_TEST(test_match)
+{
+        struct memory_index_stats stats;
+
+        printf("--test_match START\n");
+        get_results_counted(runner->run_query(runner, "hell"), 2);
+        fail_unless(received_name("hell, no"), "'hell, no' not found");
+        fail_unless(received_name("hellovathing"), "'hellovathing' not found");
+
+        memory_queryrunner_get_index_stats(runner, &stats);
+        fail_unless(stats.entries==entries_len,
+                    "wrong number of entries in the index: %u",
+                    stats.entries);
+        fail_unless(stats.size>0, "no size");
+        fail_unless(stats.loads==1, "index loaded %u times", stats.loads);
+        printf("--test_match OK\n");
+}
+END_TEST
+
+/**
+ * Each character typed runs a new query on the whole
+ * index, that finds fewer entries.
+ */
+START_TEST(test_refine)
+{
+        printf("--test_refine START\n");
+        get_results_counted(runner->run_query(runner, "he"), 10);
+        get_results_counted(runner->run_query(runner, "hel"), 5);
+        get_results_counted(runner->run_query(runner, "hell"), 2);
+        get_results_counted(runner->run_query(runner, "hello"), 1);
+        fail_unless(received_name("hellovathing"), "'hellovathing' not found");
+        get_results_counted(runner->run_query(runner, "hellow"), 0);
+        printf("--test_refine OK\n");
+}
+END_TEST
+
+/**
+ * The results of a query that's been replaced by a
+ * newer one never reach the handler.
+ */
+START_TEST(test_stale_query)
+{
+        QueryId first;
+        QueryId second;
+
+        printf("--test_stale_query START\n");
+        first=runner->run_query(runner, "h");
+        second=runner->run_query(runner, "hell");
+        fail_unless(first!=second, "same ID twice: 0x%lx", first);
+
+        get_results_counted(second, 2);
+        fail_unless(unexpected_count==0,
+                    "%d results of the first query received",
+                    unexpected_count);
+        printf("--test_stale_query OK\n");
+}
+END_TEST
+
+/**
+ * The queryrunner can be released while it's running a query
+ * and while its results are still in the queue.
+ */
+START_TEST(test_shutdown)
+{
+        GTimer *timer;
+
+        printf("--test_shutdown START\n");
+        expected_query_id=runner->run_query(runner, "h");
+
+        timer=g_timer_new();
+        runner->release(runner);
+        runner=NULL;
+        fail_unless(g_timer_elapsed(timer, NULL/*microseconds*/)<1.0,
+                    "release() waited for the query");
+        g_timer_destroy(timer);
+
+        /* release the results that are still in the queue */
+        run_main_loop(100);
+        printf("--test_shutdown OK\n");
+}
+END_TEST
+
+/**
+ * The most pertinent matches are sent first, and they're
+ * the same whether the index is scanned by one thread or several.
+ */
+START_TEST(test_sharded)
+{
+        GPtrArray *serial;
+        guint i;
+
+        wait_for_loads(1);
+        add_entries(SHARDED_ENTRY_COUNT, "entry-%d");
+        runner->stop(runner);
+        runner->start(runner);
+        wait_for_loads(2);
+
+        /* the newest entries come first in the index, so "entry-199"
+         * is in the last shard, yet it's one of the best matches */
+        query_set_mode(QUERY_MODE_FUZZY);
+        memory_queryrunner_set_scan_threads(runner, 4);
+        get_results_counted(runner->run_query(runner, "y-199"), 200);
+        fail_unless(received_name("entry-199"), "'entry-199' not found");
+        for(i=1; i<received->len; i++) {
+                fail_unless(g_array_index(received_pertinences, float, i-1)
+                            >=g_array_index(received_pertinences, float, i),
+                            "result %u more pertinent than result %u", i, i-1);
+        }
+
+        serial=g_ptr_array_new();
+        for(i=0; i<received->len; i++) {
+                g_ptr_array_add(serial, g_strdup(g_ptr_array_index(received, i)));
+        }
+        memory_queryrunner_set_scan_threads(runner, 1);
+        get_results_counted(runner->run_query(runner, "y-199"), 200);
+        for(i=0; i<received->len; i++) {
+                fail_unless(strcmp((char *)g_ptr_array_index(serial, i),
+                                   (char *)g_ptr_array_index(received, i))==0,
+                            "result %u: %s sharded, %s serial",
+                            i,
+                            (char *)g_ptr_array_index(serial, i),
+                            (char *)g_ptr_array_index(received, i));
+                g_free(g_ptr_array_index(serial, i));
+        }
+        g_ptr_array_free(serial, TRUE/*free segment*/);
+        query_set_mode(QUERY_MODE_SUBSTRING);
+}
+END_TEST
+
+/**
+ * Load a catalog of TIMED_ENTRY_COUNT entries and report
+ * how long loading it and running queries on it took.
+ */
+START_TEST(test_timed)
+{
+        GTimer *timer;
+        struct memory_index_stats stats;
+        gdouble load;
+        gdouble one_result;
+        gdouble many_results;
+
+        printf("--test_timed START\n");
+        wait_for_loads(1);
+        add_entries(TIMED_ENTRY_COUNT, "entry-%d");
+
+        /* the index is reloaded when the runner is started again */
+        timer=g_timer_new();
+        runner->stop(runner);
+        runner->start(runner);
+        wait_for_loads(2);
+        load=g_timer_elapsed(timer, NULL/*microseconds*/);
+
+        memory_queryrunner_get_index_stats(runner, &stats);
+        fail_unless(stats.entries==entries_len+TIMED_ENTRY_COUNT,
+                    "wrong number of entries in the index: %u",
+                    stats.entries);
+
+        /* only one match: the whole index is scanned */
+        g_timer_start(timer);
+        get_results_counted(runner->run_query(runner, "entry-123456"), 1);
+        one_result=g_timer_elapsed(timer, NULL/*microseconds*/);
+        fail_unless(received_name("entry-123456"), "'entry-123456' not found");
+
+        /* more matches than the queryrunner ever sends */
+        g_timer_start(timer);
+        get_results_counted(runner->run_query(runner, "entry-99"), 200);
+        many_results=g_timer_elapsed(timer, NULL/*microseconds*/);
+        g_timer_destroy(timer);
+
+        printf("--- test_timed: %d entries, %lu bytes: "
+               "loaded in %.3fs, "
+               "1 result in %.3fs, "
+               "200 results in %.3fs "
+               "(including 300ms spent waiting for more results)\n",
+               stats.entries,
+               (unsigned long)stats.size,
+               load,
+               one_result,
+               many_results);
+        printf("--test_timed OK\n");
+}
+END_TEST
+
+/* ------------------------- main */
+
+static Suite *memory_queryrunner_check_suite(void)
+{
+        Suite *s = suite_create("memory_queryrunner");
+        TCase *tc_core = tcase_create("memory_queryrunner_core");
+        TCase *tc_timed = tcase_create("memory_queryrunner_timed");
+
+        suite_add_tcase(s, tc_core);
+        tcase_set_timeout(tc_core, 60/*s.*/);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_match);
+        tcase_add_test(tc_core, test_refine);
+        tcase_add_test(tc_core, test_stale_query);
+        tcase_add_test(tc_core, test_shutdown);
+        tcase_add_test(tc_core, test_sharded);
+
+        suite_add_tcase(s, tc_timed);
+        tcase_set_timeout(tc_timed, 600/*s.*/);
+        tcase_add_checked_fixture(tc_timed, setup, teardown);
+        tcase_add_test(tc_timed, test_timed);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = memory_queryrunner_check_suite();
+        SRunner *sr = srunner_create(s);
+        srunner_run_all(sr, CK_NORMAL);
+        nf = srunner_ntests_failed(sr);
+        srunner_free(sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Add entries into a new source of the catalog, in
+ * one source update, and mark the catalog as changed.
+ *
+ * @param count number of entries to add
+ * @param name_pattern printf pattern of the names, which
+ * takes the index of the entry
+ */
+static void add_entries(int count, const char *name_pattern)
+{
+        struct catalog *catalog;
+        struct catalog_entry entry;
+        int source_id;
+        int i;
+
+        catalog = catalog_new_and_connect(CATALOG_PATH, NULL/*errs*/);
+        fail_unless(catalog!=NULL, "no catalog in " CATALOG_PATH);
+        fail_unless(catalog_add_source(catalog, "test", &source_id), "add_source");
+        fail_unless(catalog_begin_source_update(catalog, source_id),
+                    "begin_source_update");
+
+        CATALOG_ENTRY_INIT(&entry);
+        entry.source_id=source_id;
+        entry.launcher=TEST_LAUNCHER;
+        for(i=0; i<count; i++) {
+                char *name = g_strdup_printf(name_pattern, i);
+                entry.name=name;
+                entry.path=name;
+                entry.long_name=name;
+                fail_unless(catalog_add_entry(catalog,
+                                              &entry,
+                                              NULL/*id_out*/),
+                            "add entry");
+                g_free(name);
+        }
+        fail_unless(catalog_end_source_update(catalog, source_id),
+                    "end_source_update");
+        fail_unless(catalog_timestamp_update(catalog), "timestamp_update");
+        catalog_free(catalog);
+}
+
+/**
+ * Wait until the index has been loaded a number of times.
+ *
+ * @param loads expected value of memory_index_stats.loads
+ */
+static void wait_for_loads(guint loads)
+{
+        struct memory_index_stats stats;
+        GTimer *timer;
+
+        timer=g_timer_new();
+        do {
+                g_usleep(10*1000);
+                memory_queryrunner_get_index_stats(runner, &stats);
+        } while(stats.loads<loads && g_timer_elapsed(timer, NULL)<60.0);
+        g_timer_destroy(timer);
+        fail_unless(stats.loads==loads,
+                    "index loaded %u times, expected %u",
+                    stats.loads,
+                    loads);
+}
+
+static gboolean timeout_callback(gpointer userdata)
+{
+        gboolean *flag = (gboolean *)userdata;
+        g_return_val_if_fail(flag, FALSE);
+        *flag=TRUE;
+        return FALSE;
+}
+
+/**
+ * Run the main loop for some time.
+ *
+ * @param ms time to run the main loop for, in milliseconds
+ */
+static void run_main_loop(guint ms)
+{
+        gboolean timed_out = FALSE;
+
+        g_timeout_add(ms, timeout_callback, &timed_out);
+        while(!timed_out) {
+                g_main_context_iteration(NULL/*default context*/, TRUE/*may block*/);
+        }
+}
+
+/**
+ * Collect the results of a query and make sure there
+ * are as many as expected and no more.
+ *
+ * @param query_id
+ * @param count number of results expected
+ */
+static void _get_results_counted(QueryId query_id, int count, const char *file, int line)
+{
+        gboolean timed_out = FALSE;
+        guint timeout;
+
+        _mark_point(file, line);
+        clear_received();
+        expected_query_id=query_id;
+
+        timeout = g_timeout_add(10000, timeout_callback, &timed_out);
+        while(!timed_out && received->len<(guint)count) {
+                g_main_context_iteration(NULL/*default context*/, TRUE/*may block*/);
+        }
+        if(timed_out) {
+                _fail_unless(0, file, line, "failure",
+                             "timed out while waiting for query results", NULL);
+        }
+        g_source_remove(timeout);
+
+        /* wait for results that shouldn't be there */
+        run_main_loop(300);
+        _fail_unless(received->len==(guint)count,
+                     file,
+                     line,
+                     "received->len==count",
+                     "expected %d results, got %d",
+                     count,
+                     received->len,
+                     NULL);
+}
+
+/**
+ * @return TRUE if a result with that name was received
+ * for expected_query_id
+ */
+static gboolean received_name(const char *name)
+{
+        guint i;
+
+        for(i=0; i<received->len; i++) {
+                if(strcmp(name, (const char *)g_ptr_array_index(received, i))==0) {
+                        return TRUE;
+                }
+        }
+        return FALSE;
+}
+
+static void clear_received(void)
+{
+        guint i;
+
+        for(i=0; i<received->len; i++) {
+                g_free(g_ptr_array_index(received, i));
+        }
+        g_ptr_array_set_size(received, 0);
+        g_array_set_size(received_pertinences, 0);
+}
+
+static void result_handler(struct result_queue_element *element,
+                           gpointer userdata)
+{
+        struct result *result = element->result;
+
+        if(element->query_id==expected_query_id) {
+                g_ptr_array_add(received, g_strdup(result->name));
+                g_array_append_val(received_pertinences, result->pertinence);
+        } else {
+                unexpected_count++;
+        }
+        result->release(result);
+}
@@ -0,0 +1,196 @@
+/** \file
+ * Implementation of the API defined in mempool.h
+ */
+
+#include "mempool.h"
+#include <string.h>
+
+/**
+ * Size of the blocks memory is taken from (bytes).
+ * Large enough for the results of a whole query.
+ */
+#define BLOCK_SIZE 8192
+
+/**
+ * Chunks larger than that get a block of their own,
+ * so that they don't waste the end of the current block.
+ */
+#define LARGE_CHUNK (BLOCK_SIZE/4)
+
+/**
+ * All chunks are aligned on that many bytes.
+ */
+#define ALIGNMENT (2*sizeof(gpointer))
+
+#define ALIGN(size) (((size)+ALIGNMENT-1) & ~(gsize)(ALIGNMENT-1))
+
+/**
+ * A block of memory chunks are taken from.
+ * The chunks follow the header.
+ */
+struct mempool_block
+{
+        /** next block, NULL for the first block allocated */
+        struct mempool_block *next;
+        /** total size of the chunks area */
+        gsize size;
+        /** bytes of the chunk area already allocated */
+        gsize used;
+};
+
+#define BLOCK_HEADER_SIZE ALIGN(sizeof(struct mempool_block))
+#define BLOCK_DATA(block) (((gint8 *)(block))+BLOCK_HEADER_SIZE)
+
+/**
+ * A resource added by mempool_enlist()
+ */
+struct mempool_resource
+{
+        /** resource enlisted before this one, or NULL */
+        struct mempool_resource *next;
+        /** function to free the resource, never null. */
+        mempool_freer_f freer;
+        /** the resource to free */
+        gpointer resource;
+};
+
+struct mempool
+{
+        /** blocks, the current block first */
+        struct mempool_block *blocks;
+        /** blocks allocated for large chunks */
+        struct mempool_block *large_blocks;
+        /** enlisted resources, the last one first */
+        struct mempool_resource *resources;
+        /** see mempool_size() */
+        gsize size;
+};
+
+/* ------------------------- prototypes */
+static struct mempool_block *block_new(gsize size);
+static void blocks_free(struct mempool_block *block);
+
+/* ------------------------- public functions */
+struct mempool *mempool_new(void)
+{
+        struct mempool *retval;
+
+        retval = g_new(struct mempool, 1);
+        retval->blocks=NULL;
+        retval->large_blocks=NULL;
+        retval->resources=NULL;
+        retval->size=sizeof(struct mempool);
+        return retval;
+}
+
+gpointer mempool_alloc(struct mempool *mempool, gsize size)
+{
+        struct mempool_block *block;
+        gpointer chunk;
+
+        g_return_val_if_fail(mempool!=NULL, NULL);
+        if(size==0) {
+                return NULL;
+        }
+        size=ALIGN(size);
+
+        if(size>LARGE_CHUNK) {
+                block=block_new(size);
+                block->used=size;
+                block->next=mempool->large_blocks;
+                mempool->large_blocks=block;
+                mempool->size+=BLOCK_HEADER_SIZE+size;
+                return BLOCK_DATA(block);
+        }
+
+        block=mempool->blocks;
+        if(block==NULL || block->size-block->used<size) {
+                block=block_new(BLOCK_SIZE);
+                block->next=mempool->blocks;
+                mempool->blocks=block;
+                mempool->size+=BLOCK_HEADER_SIZE+BLOCK_SIZE;
+        }
+        chunk=BLOCK_DATA(block)+block->used;
+        block->used+=size;
+        return chunk;
+}
+
+char *mempool_strdup(struct mempool *mempool, const char *str)
+{
+        gsize len;
+        char *retval;
+
+        g_return_val_if_fail(mempool!=NULL, NULL);
+        if(str==NULL) {
+                return NULL;
+        }
+        len=strlen(str)+1;
+        retval=(char *)mempool_alloc(mempool, len);
+        memcpy(retval, str, len);
+        return retval;
+}
+
+void mempool_enlist(struct mempool *mempool, gpointer resource, mempool_freer_f freer)
+{
+        struct mempool_resource *res;
+
+        g_return_if_fail(mempool!=NULL);
+        g_return_if_fail(freer!=NULL);
+
+        res=mempool_alloc_type(mempool, struct mempool_resource);
+        res->resource=resource;
+        res->freer=freer;
+        res->next=mempool->resources;
+        mempool->resources=res;
+}
+
+gsize mempool_size(struct mempool *mempool)
+{
+        g_return_val_if_fail(mempool!=NULL, 0);
+        return mempool->size;
+}
+
+void mempool_delete(struct mempool *mempool)
+{
+        struct mempool_resource *res;
+
+        g_return_if_fail(mempool!=NULL);
+
+        for(res=mempool->resources; res!=NULL; res=res->next) {
+                res->freer(res->resource);
+        }
+        blocks_free(mempool->blocks);
+        blocks_free(mempool->large_blocks);
+        g_free(mempool);
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Allocate a new block.
+ *
+ * @param size size of the chunk area, a multiple of ALIGNMENT
+ * @return a new block, whose chunk area is set to 0
+ */
+static struct mempool_block *block_new(gsize size)
+{
+        struct mempool_block *block;
+
+        block=(struct mempool_block *)g_malloc0(BLOCK_HEADER_SIZE+size);
+        block->size=size;
+        block->used=0;
+        block->next=NULL;
+        return block;
+}
+
+/**
+ * Free a list of blocks.
+ */
+static void blocks_free(struct mempool_block *block)
+{
+        while(block!=NULL) {
+                struct mempool_block *next = block->next;
+                g_free(block);
+                block=next;
+        }
+}
@@ -0,0 +1,100 @@
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+
+#include <glib.h>
+
+/** \file
+ * Memory pools make it possible to free memory allocated
+ * all over the place in one bunch.
+ *
+ * Memory is taken from large blocks, one after the other, so
+ * allocating from a pool is usually not much more than
+ * moving a pointer, and deleting the pool frees a handful
+ * of blocks.
+ *
+ * It is not possible to free memory separately, so
+ * there's no function for that.
+ *
+ * A memory pool is not thread-safe.
+ */
+
+/**
+ * Create a new memory pool
+ *
+ * If not enough memory could be allocated, the
+ * program terminates, glib-style.
+ * @return a new memory pool, to be deleted with mempool_delete()
+ */
+struct mempool *mempool_new(void);
+
+/**
+ * Get the current size of the pool.
+ *
+ * The size, at any time, is equal to
+ * or larger than the total size of
+ * the allocated chunks.
+ */
+gsize mempool_size(struct mempool *mempool);
+
+/**
+ * Allocate some memory from the memory pool.
+ *
+ * If allocation fails, the program terminates (glib-style)
+ * @return a chunk of at least size bytes, initialized to 0,
+ * or NULL if size is 0
+ */
+gpointer mempool_alloc(struct mempool *mempool, gsize size);
+
+/**
+ * Shortcut that allocates one element of a specific type.
+ *
+ * mempool_alloc_type(mempool, struct toto) is the same as
+ * (struct toto *)mempool_alloc(mempool, sizeof(struct toto))
+ */
+#define mempool_alloc_type(mempool, type) (type *)mempool_alloc(mempool, sizeof(type))
+
+/**
+ * Shortcut that allocates several elements of a specific type.
+ *
+ * mempool_alloc_array(mempool, struct toto, 4) is the same as
+ * (struct toto *)mempool_alloc(mempool, sizeof(struct toto)*4)
+ */
+#define mempool_alloc_array(mempool, type, count) (type *)mempool_alloc(mempool, sizeof(type)*(count))
+
+/**
+ * Copy a string into the memory pool.
+ *
+ * @param mempool
+ * @param str string to copy, may be NULL
+ * @return a copy of the string, or NULL
+ */
+char *mempool_strdup(struct mempool *mempool, const char *str);
+
+/**
+ * Method used to free a resource.
+ */
+typedef void (*mempool_freer_f)(gpointer);
+
+/**
+ * Add some resource to the pool so that it'll be freed
+ * when the pool is deleted.
+ *
+ * Resources are freed in the reverse order they've been
+ * enlisted.
+ *
+ * @param mempool
+ * @param resource pointer to the resource
+ * @param freer function that will free the resource, usually
+ * some flavour of free()
+ */
+void mempool_enlist(struct mempool *mempool, gpointer resource, mempool_freer_f freer);
+
+/**
+ * Discard a memory pool and all the memory allocated
+ * for it.
+ *
+ * @param mempool memory pool
+ */
+void mempool_delete(struct mempool *mempool);
+
+#endif /*MEMPOOL_H*/
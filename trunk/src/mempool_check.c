@@ -0,0 +1,195 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "mempool.h"
+
+/* ------------------------- prototypes */
+static Suite *mempool_check_suite(void);
+static int toto(int val);
+static void test_enlist_callback(gpointer ptr);
+
+/* ------------------------- test case */
+static void setup()
+{
+}
+
+static void teardown()
+{
+}
+
+START_TEST(test_newpool)
+{
+        struct mempool *pool;
+        char *str1;
+
+        pool = mempool_new();
+        fail_unless(pool!=NULL, "null pool");
+
+        str1 = mempool_alloc(pool, 12);
+        fail_unless(str1!=NULL, "null str1");
+
+        mempool_delete(pool);
+}
+END_TEST
+
+START_TEST(test_zeroed)
+{
+        struct mempool *pool;
+        char *str1;
+        int i;
+
+        pool = mempool_new();
+        str1 = mempool_alloc(pool, 121);
+        for(i=0; i<121; i++) {
+                fail_unless(str1[i]==0, "not zeroed");
+        }
+        str1 = mempool_alloc(pool, 12000);
+        for(i=0; i<12000; i++) {
+                fail_unless(str1[i]==0, "large chunk not zeroed");
+        }
+        mempool_delete(pool);
+}
+END_TEST
+
+START_TEST(test_largeallocations)
+{
+        struct mempool *pool;
+        gsize total;
+
+        pool = mempool_new();
+        total = 0;
+
+        mempool_alloc(pool, 256);
+        total+=256;
+        fail_unless(mempool_size(pool)>=total, "256 bytes");
+
+        mempool_alloc(pool, 4098);
+        total+=4098;
+        fail_unless(mempool_size(pool)>=total, "4k");
+
+        mempool_alloc(pool, 1024*1024);
+        total+=1024*1024;
+        fail_unless(mempool_size(pool)>=total, "1M");
+
+        mempool_delete(pool);
+}
+END_TEST
+
+/**
+ * Make sure chunks taken from the same block don't overlap.
+ */
+START_TEST(test_manyallocations)
+{
+        struct mempool *pool;
+        char *chunks[1000];
+        int i;
+
+        pool = mempool_new();
+        for(i=0; i<1000; i++) {
+                chunks[i] = mempool_alloc(pool, 1+i%37);
+                memset(chunks[i], i%256, 1+i%37);
+        }
+        for(i=0; i<1000; i++) {
+                int j;
+                for(j=0; j<1+i%37; j++) {
+                        fail_unless((unsigned char)chunks[i][j]==i%256, "chunks overlap");
+                }
+        }
+        mempool_delete(pool);
+}
+END_TEST
+
+START_TEST(test_strdup)
+{
+        struct mempool *pool;
+        char *str;
+
+        pool = mempool_new();
+        str = mempool_strdup(pool, "hello, world");
+        fail_unless(str!=NULL, "null str");
+        fail_unless(strcmp("hello, world", str)==0, "wrong copy");
+        fail_unless(mempool_strdup(pool, NULL)==NULL, "NULL should be copied as NULL");
+        mempool_delete(pool);
+}
+END_TEST
+
+static int callback_calls;
+START_TEST(test_enlist)
+{
+        struct mempool *pool;
+
+        pool = mempool_new();
+        callback_calls=0;
+        mempool_enlist(pool, (gpointer)0xf001f001, test_enlist_callback);
+        fail_unless(callback_calls==0, "enlist should not free");
+        mempool_delete(pool);
+        fail_unless(callback_calls==1, "resource not freed");
+}
+END_TEST
+
+typedef int (*toto_f)(int);
+
+/**
+ * Make sure the pointer that's returned is
+ * correctly aligned to store pointer. Try
+ * that with a function pointer
+ */
+START_TEST(test_align)
+{
+        struct mempool *pool;
+        toto_f *storage;
+
+        pool = mempool_new();
+        mempool_alloc(pool, 3);
+        storage = mempool_alloc_type(pool, toto_f);
+        fail_unless(((gsize)storage)%sizeof(gpointer)==0, "not aligned");
+        *storage=toto;
+        fail_unless((*storage)(14)==15, "call to toto() failed");
+        mempool_delete(pool);
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *mempool_check_suite(void)
+{
+        Suite *s = suite_create("mempool");
+        TCase *tc_core = tcase_create("mempool_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_newpool);
+        tcase_add_test(tc_core, test_zeroed);
+        tcase_add_test(tc_core, test_largeallocations);
+        tcase_add_test(tc_core, test_manyallocations);
+        tcase_add_test(tc_core, test_strdup);
+        tcase_add_test(tc_core, test_enlist);
+        tcase_add_test(tc_core, test_align);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = mempool_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+static int toto(int val)
+{
+        return 1+val;
+}
+
+static void test_enlist_callback(gpointer ptr)
+{
+        fail_unless(ptr==(gpointer)0xf001f001, "wrong pointer");
+        callback_calls++;
+}
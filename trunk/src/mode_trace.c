@@ -0,0 +1,28 @@
+#include "mode_trace.h"
+#include "ocha_init.h"
+#include <stdio.h>
+
+/** \file Print the events recorded by ocha daemon, see trace.h
+ *
+ */
+
+/* ------------------------- prototypes: static functions */
+
+/* ------------------------- definitions */
+
+/* ------------------------- public functions */
+int mode_trace(int argc, char *argv[])
+{
+        char *dump;
+
+        dump=ocha_init_get_trace();
+        if(dump==NULL) {
+                return 1;
+        }
+        fputs(dump, stdout);
+        g_free(dump);
+        return 0;
+}
+
+/* ------------------------- static functions */
+
@@ -0,0 +1,8 @@
+#ifndef MODE_TRACE_H
+#define MODE_TRACE_H
+
+/** \file Print what the ocha daemon has been doing lately
+ */
+int mode_trace(int argc, char *argv[]);
+
+#endif /* MODE_TRACE_H */
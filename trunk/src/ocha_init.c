@@ -4,6 +4,7 @@
 
 #include "ocha_init.h"
 #include "restart.h"
+#include "trace.h"
 #include <glib.h>
 #include <libgnome/libgnome.h>
 #include <libgnome/gnome-init.h>
@@ -36,6 +37,9 @@
 #define KILL "kill"
 #define KILL_LEN (strlen(KILL)+1)
 
+#define TRACE_DUMP "trace"
+#define TRACE_DUMP_LEN (strlen(TRACE_DUMP)+1)
+
 gchar *ocha_init_indexer_argv[] = {
         BINDIR "/ocha",
         "--nice",
@@ -72,6 +76,7 @@ static gboolean channel_client_data(GIOChannel *source, GIOCondition cond, gpoin
 static gboolean channel_hangup(GIOChannel *source, GIOCondition cond, gpointer userdata);
 static int client_connect(void);
 static void kill_ocha(void);
+static void send_trace(int fd);
 
 /* ------------------------- public functions */
 
@@ -169,6 +174,31 @@ gboolean ocha_init_kill()
         }
 }
 
+char *ocha_init_get_trace()
+{
+        int s;
+        GString *dump;
+        char buffer[1024];
+        ssize_t ret;
+
+        s=client_connect();
+        if(s==-1) {
+                fprintf(stderr, "ocha:error: no instance of ocha to trace.\n");
+                return NULL;
+        }
+        if(send(s, TRACE_DUMP, TRACE_DUMP_LEN, 0)!=TRACE_DUMP_LEN) {
+                fprintf(stderr, "ocha:error: could not ask for the trace: %s\n", strerror(errno));
+                close(s);
+                return NULL;
+        }
+        dump=g_string_new("");
+        while((ret=recv(s, buffer, sizeof(buffer), 0))>0) {
+                g_string_append_len(dump, buffer, ret);
+        }
+        close(s);
+        return g_string_free(dump, FALSE/*return content*/);
+}
+
 gboolean ocha_init_ocha_is_running()
 {
         int s;
@@ -287,6 +317,8 @@ static gboolean channel_client_data(GIOChannel *source, GIOCondition cond, gpoin
                         fprintf(stderr,
                                 "ocha:warning: killed\n");
                         kill_ocha();
+                } else if(buffer[0]=='t') {
+                        send_trace(fd);
                 }
         }
         g_io_channel_close(source);
@@ -336,6 +368,32 @@ static int client_connect(void)
         return retval;
 }
 
+/**
+ * Send the trace of ochad to a client, see trace_dump()
+ *
+ * @param fd socket of the client
+ */
+static void send_trace(int fd)
+{
+        char *dump;
+        size_t len;
+        size_t sent;
+        ssize_t ret;
+
+        dump=trace_dump();
+        len=strlen(dump);
+        for(sent=0; sent<len; sent+=ret) {
+                ret=send(fd, dump+sent, len-sent, 0);
+                if(ret<=0) {
+                        fprintf(stderr,
+                                "ocha:warning: could not send trace to client: %s\n",
+                                strerror(errno));
+                        break;
+                }
+        }
+        g_free(dump);
+}
+
 /**
  * What it means to 'kill' ocha
  */
@@ -42,6 +42,15 @@ void ocha_init_requires_catalog(const char *catalog_path);
  */
 gboolean ocha_init_kill(void);
 
+/**
+ * Get the events recorded by the running instance
+ * of ocha, see trace_dump().
+ *
+ * @return the events, to free with g_free(), or NULL if there's
+ * no instance of ocha (error has been displayed to stderr)
+ */
+char *ocha_init_get_trace(void);
+
 /**
  * Check whether another instance of ocha is running.
  * @return true if another instance is runninng
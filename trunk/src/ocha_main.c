@@ -13,6 +13,7 @@
 #include "mode_index.h"
 #include "mode_install.h"
 #include "mode_stop.h"
+#include "mode_trace.h"
 #include "ocha_init.h"
 #include "libgnome/libgnome.h"
 #include <stdio.h>
@@ -39,6 +40,8 @@ int main(int argc, char *argv[])
                 return mode_install(argc, argv);
         } else if(strcmp(mode, "stop")==0) {
                 return mode_stop(argc, argv);
+        } else if(strcmp(mode, "trace")==0) {
+                return mode_trace(argc, argv);
         } else {
                 fprintf(stderr,
                         "error: unknown mode: '%s' valid modes are: 'index', 'install', 'preferences'\n",
@@ -8,6 +8,8 @@
 #include "queryrunner.h"
 #include "catalog.h"
 #include "catalog_queryrunner.h"
+#include "memory_queryrunner.h"
+#include "composite_queryrunner.h"
 #include "query.h"
 #include "resultlist.h"
 #include "ocha_init.h"
@@ -65,6 +67,7 @@ int main(int argc, char *argv[])
         struct result_queue *queue;
         struct queryrunner *runner;
         struct keygrab_data keygrab_data;
+        gboolean in_memory = FALSE;
 
         for(i=1; i<argc; i++) {
                 const char *arg = argv[i];
@@ -100,6 +103,11 @@ int main(int argc, char *argv[])
                         }
                         fprintf(pidh, "%d\n", pid);
                         fclose(pidh);
+                } else if(strcmp("--in-memory", arg)==0) {
+                        in_memory=TRUE;
+                } else if(strcmp("--fuzzy", arg)==0) {
+                        /* before any query runner is created */
+                        query_set_mode(QUERY_MODE_FUZZY);
                 }
         }
 
@@ -110,7 +118,19 @@ int main(int argc, char *argv[])
         catalog_path = config.catalog_path;
 
         queue = querywin_get_result_queue();
-        runner=catalog_queryrunner_new(catalog_path, queue);
+        if(in_memory) {
+                /* results come from memory right away, the catalog
+                 * only runs the deeper search of consolidate() */
+                runner=composite_queryrunner_new(NULL/*default context*/, queue);
+                composite_queryrunner_add(runner,
+                                          memory_queryrunner_new(catalog_path,
+                                                                 composite_queryrunner_get_queue(runner)));
+                composite_queryrunner_add_deep(runner,
+                                               catalog_queryrunner_new(catalog_path,
+                                                                       composite_queryrunner_get_queue(runner)));
+        } else {
+                runner=catalog_queryrunner_new(catalog_path, queue);
+        }
 
         querywin_set_queryrunner(runner);
 
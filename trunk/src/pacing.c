@@ -0,0 +1,123 @@
+/** \file
+ * Implementation of the API defined in pacing.h
+ */
+
+#include "pacing.h"
+
+/**
+ * Number of results in the first bunch, when it's not
+ * known how many results the user can see at once.
+ */
+#define FIRST_BUNCH_SIZE 4
+
+/**
+ * Time given to the user to react to the first bunch,
+ * once it's been displayed, before sending more results (ms).
+ * If the user doesn't react after that time,
+ * it probably means that more results will
+ * help.
+ */
+#define AFTER_FIRST_BUNCH_TIMEOUT 800
+
+/**
+ * Number of results in a later bunch, as long
+ * as the time the UI takes to handle a result isn't known.
+ */
+#define LATER_BUNCH_SIZE 8
+
+/**
+ * Largest bunch, however fast the UI is.
+ */
+#define MAX_BUNCH_SIZE 50
+
+/**
+ * Main loop time a later bunch may take, so that
+ * the UI stays responsive while it's displayed (ms).
+ */
+#define BUNCH_DISPATCH_TIME 40
+
+/**
+ * Minimum time between two later bunches (ms).
+ * It gives the UI some time to handle user input and
+ * the user some time to type a new query.
+ */
+#define MIN_BUNCH_INTERVAL 50
+
+/**
+ * Maximum time spent waiting for the UI to catch up (ms).
+ */
+#define MAX_UI_LAG 2000
+
+/* ------------------------- prototypes */
+static unsigned long ui_lag(struct result_queue_stats *stats);
+
+/* ------------------------- public functions */
+void pacing_init(struct pacing *pacing, struct result_queue *queue, gboolean first_bunch)
+{
+        g_return_if_fail(pacing!=NULL);
+        g_return_if_fail(queue!=NULL);
+
+        pacing->queue=queue;
+        pacing->first_bunch=first_bunch;
+}
+
+/**
+ * The first bunch fills the result list. Later bunches
+ * take about BUNCH_DISPATCH_TIME to display, minus the
+ * results the UI hasn't handled yet.
+ */
+int pacing_bunch_size(struct pacing *pacing)
+{
+        struct result_queue_stats stats;
+        int size;
+
+        g_return_val_if_fail(pacing!=NULL, 1);
+
+        result_queue_get_stats(pacing->queue, &stats);
+        if(pacing->first_bunch) {
+                size = stats.visible_rows>0 ? stats.visible_rows:FIRST_BUNCH_SIZE;
+        } else if(stats.dispatch_time==0) {
+                size = LATER_BUNCH_SIZE;
+        } else {
+                size = (int)((BUNCH_DISPATCH_TIME*1000)/stats.dispatch_time);
+                size -= (int)stats.backlog;
+        }
+        return CLAMP(size, 1, MAX_BUNCH_SIZE);
+}
+
+/**
+ * After the first bunch, give the user time to react once the
+ * UI has displayed it. After later bunches, wait just long enough
+ * for the UI to catch up.
+ */
+unsigned long pacing_timeout(struct pacing *pacing)
+{
+        struct result_queue_stats stats;
+        unsigned long lag;
+
+        g_return_val_if_fail(pacing!=NULL, AFTER_FIRST_BUNCH_TIMEOUT);
+
+        result_queue_get_stats(pacing->queue, &stats);
+        lag=ui_lag(&stats);
+        if(pacing->first_bunch) {
+                pacing->first_bunch=FALSE;
+                return lag+AFTER_FIRST_BUNCH_TIMEOUT;
+        }
+        return MAX(lag, MIN_BUNCH_INTERVAL);
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Estimate the time the UI needs to handle the
+ * results that are waiting in the queue.
+ *
+ * @return time in milliseconds, at most MAX_UI_LAG
+ */
+static unsigned long ui_lag(struct result_queue_stats *stats)
+{
+        unsigned long lag;
+
+        lag=(stats->backlog*stats->dispatch_time)/1000;
+        return MIN(lag, MAX_UI_LAG);
+}
@@ -0,0 +1,62 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <glib.h>
+#include "result_queue.h"
+
+/** \file
+ * Decide how many results a query runner should send
+ * at once and how long it should wait before sending more.
+ *
+ * The results are sent in bunches. The first bunch should fill
+ * the result list as fast as possible. The query runner then pauses
+ * to let the user refine the query before it sends more. Later
+ * bunches are as large as the UI can display without becoming
+ * unresponsive and they are sent as fast as the UI consumes them.
+ *
+ * All of it is computed from what the result queue knows about
+ * the UI, see struct result_queue_stats.
+ *
+ * A pacing structure is used by one thread only.
+ */
+
+/**
+ * State of the pacing of the results of one query.
+ */
+struct pacing
+{
+        /** where the results are sent */
+        struct result_queue *queue;
+
+        /** TRUE until the first bunch has been sent */
+        gboolean first_bunch;
+};
+
+/**
+ * Initialize the pacing for a new query.
+ *
+ * @param pacing structure to initialize
+ * @param queue queue the results will be sent to
+ * @param first_bunch TRUE if the next bunch is the
+ * first bunch of a new query, FALSE if the user has already
+ * seen some results and is waiting for more
+ */
+void pacing_init(struct pacing *pacing, struct result_queue *queue, gboolean first_bunch);
+
+/**
+ * Number of results to send in the next bunch.
+ *
+ * @param pacing
+ * @return a number of results, at least 1
+ */
+int pacing_bunch_size(struct pacing *pacing);
+
+/**
+ * Time to wait after a bunch has been sent, before sending the next one.
+ *
+ * @param pacing
+ * @return the timeout, in milliseconds
+ */
+unsigned long pacing_timeout(struct pacing *pacing);
+
+#endif /*PACING_H*/
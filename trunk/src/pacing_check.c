@@ -0,0 +1,99 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <check.h>
+#include "pacing.h"
+#include "result_queue.h"
+
+static struct result_queue *queue;
+
+/* ------------------------- prototypes */
+static Suite *pacing_check_suite(void);
+static void handler(struct result_queue_element *element, gpointer userdata);
+
+/* ------------------------- test case */
+static void setup()
+{
+        queue=result_queue_new(NULL/*default context*/,
+                               handler,
+                               NULL/*userdata*/);
+}
+
+static void teardown()
+{
+        result_queue_delete(queue);
+}
+
+START_TEST(test_first_bunch)
+{
+        struct pacing pacing;
+
+        pacing_init(&pacing, queue, TRUE/*first bunch*/);
+        fail_unless(pacing_bunch_size(&pacing)==4, "default first bunch");
+
+        result_queue_set_visible_rows(queue, 11);
+        fail_unless(pacing_bunch_size(&pacing)==11, "first bunch should fill the list");
+
+        fail_unless(pacing_timeout(&pacing)>=800, "no time to react to the first bunch");
+        fail_unless(pacing_bunch_size(&pacing)==8, "default later bunch");
+        fail_unless(pacing_timeout(&pacing)<800, "later bunches should come faster");
+}
+END_TEST
+
+START_TEST(test_later_bunch)
+{
+        struct pacing pacing;
+
+        pacing_init(&pacing, queue, FALSE/*first bunch*/);
+        fail_unless(pacing_bunch_size(&pacing)==8, "default later bunch");
+        fail_unless(pacing_timeout(&pacing)>0, "no pause between bunches");
+}
+END_TEST
+
+START_TEST(test_stats)
+{
+        struct result_queue_stats stats;
+
+        result_queue_get_stats(queue, &stats);
+        fail_unless(stats.backlog==0, "backlog");
+        fail_unless(stats.dispatch_time==0, "unknown dispatch time");
+        fail_unless(stats.visible_rows==0, "unknown visible rows");
+
+        result_queue_set_visible_rows(queue, 7);
+        result_queue_get_stats(queue, &stats);
+        fail_unless(stats.visible_rows==7, "visible rows");
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *pacing_check_suite(void)
+{
+        Suite *s = suite_create("pacing");
+        TCase *tc_core = tcase_create("pacing_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_first_bunch);
+        tcase_add_test(tc_core, test_later_bunch);
+        tcase_add_test(tc_core, test_stats);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = pacing_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+static void handler(struct result_queue_element *element, gpointer userdata)
+{
+        element->result->release(element->result);
+}
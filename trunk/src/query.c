@@ -1,18 +1,119 @@
 #include "query.h"
+#include "substring.h"
 #include <glib.h>
 #include <string.h>
 
+/**
+ * Score of a character of the query found in the name, see
+ * fuzzy_word_score(). The other scores are bonuses and penalties
+ * added to it.
+ */
+#define SCORE_MATCH 16
+/** Bonus of a character found at the start of a word of the name */
+#define BONUS_BOUNDARY 8
+/** Bonus of a character found at a lowercase to uppercase change */
+#define BONUS_CAMEL 7
+/** Minimum bonus of a character found right after the previous one */
+#define BONUS_CONSECUTIVE 4
+/** The bonus of the first character of a word of the query is multiplied by this */
+#define FIRST_CHAR_MULTIPLIER 2
+/** Penalty of the first character skipped between two characters of the query */
+#define GAP_START -3
+/** Penalty of each other character skipped */
+#define GAP_EXTENSION -1
+/** Score of the worst fuzzy match, see query_matcher_score() */
+#define MIN_SCORE 0.1
+
+/** Characters that separate words in names */
+#define SEPARATORS " -_./\\:"
+
+/**
+ * Mode set by query_set_mode(), a enum QueryMode. Atomic.
+ */
+static gint current_mode = QUERY_MODE_SUBSTRING;
+
+/**
+ * Hidden structure, see query_compile()
+ */
+struct query_matcher
+{
+        /** Mode the query was compiled with */
+        enum QueryMode mode;
+
+        /** Mask of the bytes of all words, see query_char_mask() */
+        guint64 mask;
+
+        /**
+         * The prepared query, with a '\0' in place of each space;
+         * words point into it
+         */
+        char *prepared;
+
+        /** Non-empty words of the prepared query, NULL-terminated */
+        char **words;
+
+        /** Length of each word, in bytes */
+        gsize *word_lens;
+
+        /** TRUE if the query was empty, in which case nothing matches */
+        gboolean empty;
+};
+
 /* ------------------------- prototypes */
 static char *prepare(const char *str);
+static char **prepare_words(const char *str);
+static guint64 char_bit(guchar c);
+static gboolean word_ismatch(enum QueryMode mode, const char *name, gsize name_len, const char *word, gsize word_len);
+static gboolean fuzzy_window(const char *name, gsize name_len, const char *word, gsize word_len, gsize *start_out, gsize *end_out);
+static float fuzzy_word_score(const char *name, gsize name_len, const char *original, const char *word, gsize word_len, GArray *spans);
+static int position_bonus(const char *name, const char *original, gsize pos);
+static void merge_spans(GArray *spans);
+static gint compare_spans(gconstpointer a, gconstpointer b);
+static gboolean map_spans(const char *prepared, const char *name, GArray *spans);
+static void append_markup_escaped(GString *gstr, const char *str, gsize len);
 
 /* query_highlight: not static, because used from test case, but not public either... */
 gboolean query_highlight(const char *query, const char *name, char *highlight);
 
 /* ------------------------- public functions */
+char *query_prepare(const char *str)
+{
+        g_return_val_if_fail(str!=NULL, NULL);
+        return prepare(str);
+}
+
+void query_set_mode(enum QueryMode mode)
+{
+        gint old;
+
+        do {
+                old=g_atomic_int_get(&current_mode);
+        } while(!g_atomic_int_compare_and_exchange(&current_mode, old, (gint)mode));
+}
+
+enum QueryMode query_get_mode(void)
+{
+        return (enum QueryMode)g_atomic_int_get(&current_mode);
+}
+
+guint64 query_char_mask(const char *prepared)
+{
+        guint64 mask;
+        const char *current;
+
+        g_return_val_if_fail(prepared!=NULL, 0);
+
+        mask=0;
+        for(current=prepared; *current!='\0'; current++) {
+                mask|=char_bit((guchar)*current);
+        }
+        return mask;
+}
+
 gboolean query_ismatch(const char *query, const char *name)
 {
-        char *query_prepared;
-        const char *name_prepared;
+        struct query_matcher *matcher;
+        char *name_prepared;
         gboolean retval;
 
         g_return_val_if_fail(query!=NULL, FALSE);
@@ -21,45 +122,312 @@ gboolean query_ismatch(const char *query, const char *name)
         if(query[0]=='\0' || name[0]=='\0')
                 return FALSE;
 
-        query_prepared =  prepare(query);
-        name_prepared =  prepare(name);
+        matcher = query_compile(query);
+        name_prepared = prepare(name);
+        retval = query_matcher_ismatch(matcher, name_prepared);
+        g_free(name_prepared);
+        query_matcher_free(matcher);
+        return retval;
+}
 
-        if(strcmp(name_prepared, query_prepared)==0)
-                retval=TRUE;
-        else {
-                char *current=query_prepared;
-                retval=TRUE;
-                do {
-                        const char *found;
-                        char *space;
+struct query_matcher *query_compile(const char *query)
+{
+        struct query_matcher *matcher;
+        char *current;
+        int count;
+
+        g_return_val_if_fail(query!=NULL, NULL);
+
+        matcher = g_new(struct query_matcher, 1);
+        matcher->mode = query_get_mode();
+        matcher->mask = 0;
+        matcher->empty = query[0]=='\0';
+        matcher->prepared = prepare(query);
+
+        /* there can't be more words than there are bytes */
+        matcher->words = g_new(char *, strlen(matcher->prepared)/2+2);
+        matcher->word_lens = g_new(gsize, strlen(matcher->prepared)/2+2);
+        count=0;
+        current=matcher->prepared;
+        while(current!=NULL) {
+                char *space;
+
+                space = strchr(current, ' ');
+                if(space!=NULL) {
+                        *space='\0';
+                }
+                /* empty words are substrings of any name */
+                if(current[0]!='\0') {
+                        matcher->words[count]=current;
+                        matcher->word_lens[count]=strlen(current);
+                        matcher->mask|=query_char_mask(current);
+                        count++;
+                }
+                current = space!=NULL ? space+1:NULL;
+        }
+        matcher->words[count]=NULL;
+        return matcher;
+}
 
-                        space =  strchr(current, ' ');
-                        if(space!=NULL)
-                                *space='\0';
+void query_matcher_free(struct query_matcher *matcher)
+{
+        g_return_if_fail(matcher!=NULL);
 
-                        found =  strstr(name_prepared, current);
-                        if(found==NULL) {
-                                retval=FALSE;
+        g_free(matcher->words);
+        g_free(matcher->word_lens);
+        g_free(matcher->prepared);
+        g_free(matcher);
+}
+
+gboolean query_matcher_ismatch(const struct query_matcher *matcher, const char *prepared_name)
+{
+        gsize name_len;
+        int i;
+
+        g_return_val_if_fail(matcher!=NULL, FALSE);
+        g_return_val_if_fail(prepared_name!=NULL, FALSE);
+
+        if(matcher->empty || prepared_name[0]=='\0')
+                return FALSE;
+
+        name_len = strlen(prepared_name);
+        for(i=0; matcher->words[i]!=NULL; i++) {
+                if(!word_ismatch(matcher->mode,
+                                 prepared_name,
+                                 name_len,
+                                 matcher->words[i],
+                                 matcher->word_lens[i])) {
+                        return FALSE;
+                }
+        }
+        return TRUE;
+}
+
+gboolean query_matcher_may_match(const struct query_matcher *matcher, guint64 name_mask)
+{
+        g_return_val_if_fail(matcher!=NULL, FALSE);
+
+        return !matcher->empty && (matcher->mask & ~name_mask)==0;
+}
+
+float query_matcher_score(const struct query_matcher *matcher, const char *prepared_name, const char *name)
+{
+        gsize name_len;
+        float total;
+        int i;
+
+        g_return_val_if_fail(matcher!=NULL, 0.0);
+        g_return_val_if_fail(prepared_name!=NULL, 0.0);
+
+        if(matcher->mode!=QUERY_MODE_FUZZY) {
+                return query_matcher_ismatch(matcher, prepared_name) ? 1.0:0.0;
+        }
+        if(matcher->empty || prepared_name[0]=='\0')
+                return 0.0;
+
+        name_len = strlen(prepared_name);
+        /* the name can only tell where the uppercase letters
+         * are if preparing it didn't move anything */
+        if(name!=NULL && strlen(name)!=name_len) {
+                name=NULL;
+        }
+        total=0.0;
+        for(i=0; matcher->words[i]!=NULL; i++) {
+                float score;
+
+                score=fuzzy_word_score(prepared_name,
+                                       name_len,
+                                       name,
+                                       matcher->words[i],
+                                       matcher->word_lens[i],
+                                       NULL/*spans*/);
+                if(score<0.0) {
+                        return 0.0;
+                }
+                total+=score;
+        }
+        if(i==0) {
+                /* only spaces */
+                return 1.0;
+        }
+        return MIN_SCORE+(1.0-MIN_SCORE)*total/i;
+}
+
+gboolean query_matcher_result_ismatch(const struct query_matcher *matcher, const struct result *result)
+{
+        char *name_prepared;
+        gboolean retval;
+
+        g_return_val_if_fail(matcher!=NULL, FALSE);
+        g_return_val_if_fail(result!=NULL, FALSE);
+
+        if(result->prepared_name!=NULL) {
+                return query_matcher_ismatch(matcher, result->prepared_name);
+        }
+        if(result->name[0]=='\0') {
+                return FALSE;
+        }
+        name_prepared = prepare(result->name);
+        retval = query_matcher_ismatch(matcher, name_prepared);
+        g_free(name_prepared);
+        return retval;
+}
+
+gboolean query_is_refinement(const char *previous, const char *query)
+{
+        char **previous_words;
+        char **words;
+        gboolean retval;
+        int i;
+
+        g_return_val_if_fail(previous!=NULL, FALSE);
+        g_return_val_if_fail(query!=NULL, FALSE);
+
+        previous_words = prepare_words(previous);
+        words = prepare_words(query);
+
+        /* the empty query matches nothing */
+        retval = previous_words[0]!=NULL && words[0]!=NULL;
+        for(i=0; retval && previous_words[i]!=NULL; i++) {
+                int j;
+
+                retval=FALSE;
+                for(j=0; words[j]!=NULL; j++) {
+                        if(word_ismatch(query_get_mode(),
+                                        words[j],
+                                        strlen(words[j]),
+                                        previous_words[i],
+                                        strlen(previous_words[i]))) {
+                                retval=TRUE;
                                 break;
                         }
-                        if(space)
-                                current=space+1;
-                        else
-                                break;
-                } while(TRUE);
+                }
         }
 
-        g_free((void *)query_prepared);
-        g_free((void *)name_prepared);
+        g_strfreev(previous_words);
+        g_strfreev(words);
         return retval;
 }
 
 gboolean query_result_ismatch(const char *query, const struct result *result)
 {
+        struct query_matcher *matcher;
+        gboolean retval;
+
         g_return_val_if_fail(query!=NULL, FALSE);
         g_return_val_if_fail(result!=NULL, FALSE);
 
-        return query_ismatch(query, result->name);
+        matcher = query_compile(query);
+        retval = query_matcher_result_ismatch(matcher, result);
+        query_matcher_free(matcher);
+        return retval;
+}
+
+gboolean query_matcher_spans(const struct query_matcher *matcher, const char *prepared_name, GArray *spans)
+{
+        gsize name_len;
+        int i;
+
+        g_return_val_if_fail(matcher!=NULL, FALSE);
+        g_return_val_if_fail(prepared_name!=NULL, FALSE);
+        g_return_val_if_fail(spans!=NULL, FALSE);
+
+        g_array_set_size(spans, 0);
+        if(matcher->empty || prepared_name[0]=='\0')
+                return FALSE;
+
+        name_len = strlen(prepared_name);
+        for(i=0; matcher->words[i]!=NULL; i++) {
+                if(matcher->mode==QUERY_MODE_FUZZY) {
+                        if(fuzzy_word_score(prepared_name,
+                                            name_len,
+                                            NULL/*original*/,
+                                            matcher->words[i],
+                                            matcher->word_lens[i],
+                                            spans)<0.0) {
+                                g_array_set_size(spans, 0);
+                                return FALSE;
+                        }
+                } else {
+                        const char *found;
+                        struct query_span span;
+
+                        found=substring_find_len(prepared_name,
+                                                 name_len,
+                                                 matcher->words[i],
+                                                 matcher->word_lens[i]);
+                        if(found==NULL) {
+                                g_array_set_size(spans, 0);
+                                return FALSE;
+                        }
+                        span.start=found-prepared_name;
+                        span.end=span.start+matcher->word_lens[i];
+                        g_array_append_val(spans, span);
+                }
+        }
+        merge_spans(spans);
+        return TRUE;
+}
+
+gboolean query_matcher_append_markup(const struct query_matcher *matcher,
+                                     GString *gstr,
+                                     const char *name,
+                                     const char *prepared_name,
+                                     const char *highlight_on,
+                                     const char *highlight_off)
+{
+        char *prepared;
+        char *normalized;
+        const char *display;
+        GArray *spans;
+        gboolean retval;
+        gsize pos;
+        guint i;
+
+        g_return_val_if_fail(matcher!=NULL, FALSE);
+        g_return_val_if_fail(gstr!=NULL, FALSE);
+        g_return_val_if_fail(name!=NULL, FALSE);
+        g_return_val_if_fail(highlight_on!=NULL, FALSE);
+        g_return_val_if_fail(highlight_off!=NULL, FALSE);
+
+        prepared=NULL;
+        if(prepared_name==NULL) {
+                prepared=prepare(name);
+                prepared_name=prepared;
+        }
+        spans=g_array_new(FALSE/*not zero-terminated*/,
+                          FALSE/*don't clear*/,
+                          sizeof(struct query_span));
+        retval=query_matcher_spans(matcher, prepared_name, spans);
+
+        normalized=NULL;
+        display=name;
+        if(retval && !map_spans(prepared_name, display, spans)) {
+                /* the name might not be composed the way
+                 * prepared names are */
+                normalized=g_utf8_normalize(name, -1, G_NORMALIZE_ALL_COMPOSE);
+                display=normalized;
+                if(!map_spans(prepared_name, display, spans)) {
+                        g_array_set_size(spans, 0);
+                }
+        }
+
+        pos=0;
+        for(i=0; i<spans->len; i++) {
+                const struct query_span *span = &g_array_index(spans, struct query_span, i);
+
+                append_markup_escaped(gstr, display+pos, span->start-pos);
+                g_string_append(gstr, highlight_on);
+                append_markup_escaped(gstr, display+span->start, span->end-span->start);
+                g_string_append(gstr, highlight_off);
+                pos=span->end;
+        }
+        append_markup_escaped(gstr, display+pos, strlen(display+pos));
+
+        g_array_free(spans, TRUE/*free content*/);
+        g_free(normalized);
+        g_free(prepared);
+        return retval;
 }
 
 /**
@@ -75,151 +443,500 @@ gboolean query_result_ismatch(const char *query, const struct result *result)
  * result, it actually works in UTF-8. You should only
  * feed it UTF-8 strings.
  *
- * @param query (normalized UTF8 with G_NORMALIZE_ALL_COMPOSE)
+ * This is query_matcher_spans() for tests, which prefer
+ * looking at bytes.
+ *
+ * @param query
  * @param name name or path (normalized UTF8 with G_NORMALIZE_ALL_COMPOSE)
  * @param highlight a string of at least the same length as name
  * @return TRUE if there was any match
  */
 gboolean query_highlight(const char *query, const char *name, char *highlight)
 {
-        char *query_prepared;
-        const char *name_prepared;
+        struct query_matcher *matcher;
+        char *name_prepared;
+        GArray *spans;
         gboolean retval;
+        guint i;
 
         g_return_val_if_fail(query!=NULL, FALSE);
         g_return_val_if_fail(name!=NULL, FALSE);
         g_return_val_if_fail(highlight!=NULL, FALSE);
 
-        g_return_val_if_fail(query!=NULL, FALSE);
-        g_return_val_if_fail(name!=NULL, FALSE);
-
-        query_prepared =  g_utf8_casefold(query, -1);
-        name_prepared =  g_utf8_casefold(name, -1);
-
         memset(highlight, '\0', strlen(name)+1);
 
-        if(strcmp(name_prepared, query_prepared)==0) {
-                strcpy(highlight, name);
-                retval=TRUE;
-        } else {
-                char *current=query_prepared;
-                retval=TRUE;
-
-                do {
-                        const char *found;
-                        char *space;
-                        space =  strchr(current, ' ');
-                        if(space!=NULL)
-                                *space='\0';
-
-                        found =  strstr(name_prepared, current);
-                        if(found==NULL) {
-                                retval=FALSE;
-                                break;
-                        } else {
-                                const char *cur;
-                                int start_index;
-                                int end_index;
-                                const char *start_ptr;
-                                const char *end_ptr;
-                                char *highlight_ptr;
-
-                                start_index =  g_utf8_pointer_to_offset(name_prepared,
-                                                                        found);
-                                end_index =  start_index+g_utf8_strlen(current,
-                                                                       -1);
-                                start_ptr =  g_utf8_offset_to_pointer(name,
-                                                                      start_index);
-                                end_ptr =  g_utf8_offset_to_pointer(name,
-                                                                    end_index);
-                                highlight_ptr = highlight+(start_ptr-name);
-
-                                for(cur=start_ptr; cur<end_ptr; cur++, highlight_ptr++) {
-                                        *highlight_ptr=*cur;
-                                }
-                        }
-                        if(space) {
-                                current=space+1;
-                        } else {
-                                break;
-                        }
-                } while(TRUE);
+        matcher = query_compile(query);
+        name_prepared = prepare(name);
+        spans = g_array_new(FALSE/*not zero-terminated*/,
+                            FALSE/*don't clear*/,
+                            sizeof(struct query_span));
+        retval = query_matcher_spans(matcher, name_prepared, spans)
+                && map_spans(name_prepared, name, spans);
+        if(retval) {
+                for(i=0; i<spans->len; i++) {
+                        const struct query_span *span = &g_array_index(spans, struct query_span, i);
+
+                        memcpy(highlight+span->start,
+                               name+span->start,
+                               span->end-span->start);
+                }
         }
 
-        g_free((void *)query_prepared);
-        g_free((void *)name_prepared);
+        g_array_free(spans, TRUE/*free content*/);
+        g_free(name_prepared);
+        query_matcher_free(matcher);
         return retval;
-
-        return FALSE;
 }
 
-
 const char *query_pango_highlight(const char *query,
                                   const char *str,
                                   const char *highlight_on,
                                   const char *highlight_off)
 {
-        char *norm_query;
-        char *norm_str;
-        int norm_str_len;
-        char *highlight;
+        struct query_matcher *matcher;
+        GString *gstr;
         char *retval;
 
-        norm_query =  g_utf8_normalize(query, -1, G_NORMALIZE_ALL_COMPOSE);
-        norm_str =  g_utf8_normalize(str, -1, G_NORMALIZE_ALL_COMPOSE);
-        norm_str_len =  strlen(norm_str);
-        highlight = g_malloc(norm_str_len+1);
-
-        if(query_highlight(query, str, highlight)) {
-                GString *gstr = g_string_new("");
-                gboolean last_highlighted=FALSE;
-                char *buffer = g_malloc(norm_str_len+1);
-                int bufpos=0;
-                int i;
-
-                for(i=0; i<norm_str_len; i++) {
-                        gboolean current_highlighted = highlight[i]!='\0';
-                        if(current_highlighted!=last_highlighted) {
-                                if(bufpos>0) {
-                                        const char *escaped;
-                                        escaped = g_markup_escape_text(buffer, bufpos);
-                                        g_string_append(gstr, escaped);
-                                        g_free((void*)escaped);
-                                        bufpos=0;
-                                }
+        g_return_val_if_fail(query!=NULL, NULL);
+        g_return_val_if_fail(str!=NULL, NULL);
+
+        matcher = query_compile(query);
+        gstr = g_string_new("");
+        query_matcher_append_markup(matcher,
+                                    gstr,
+                                    str,
+                                    NULL/*prepare it*/,
+                                    highlight_on,
+                                    highlight_off);
+        query_matcher_free(matcher);
+
+        retval = gstr->str;
+        g_string_free(gstr, FALSE/*don't free content*/);
+        return retval;
+}
+
+/* ------------------------- static functions */
 
-                                g_string_append(gstr,
-                                                current_highlighted
-                                                ? highlight_on
-                                                : highlight_off);
-                                last_highlighted=current_highlighted;
+/**
+ * Prepare a query and split it into words.
+ *
+ * @param str query
+ * @return NULL-terminated array of non-empty words, to free
+ * with g_strfreev()
+ */
+static char **prepare_words(const char *str)
+{
+        char *prepared;
+        char **words;
+        int i;
+        int count;
+
+        prepared = prepare(str);
+        words = g_strsplit(prepared, " ", -1/*no max*/);
+        g_free(prepared);
+
+        count=0;
+        for(i=0; words[i]!=NULL; i++) {
+                if(words[i][0]!='\0') {
+                        words[count]=words[i];
+                        count++;
+                } else {
+                        g_free(words[i]);
+                }
+        }
+        words[count]=NULL;
+        return words;
+}
+
+/**
+ * Choose the bit of a byte in a mask computed by query_char_mask().
+ */
+static guint64 char_bit(guchar c)
+{
+        guint bit;
+
+        if(c>='a' && c<='z') {
+                bit=c-'a';
+        } else if(c>='0' && c<='9') {
+                bit=26+(c-'0');
+        } else {
+                bit=36+c%28;
+        }
+        return ((guint64)1)<<bit;
+}
+
+/**
+ * Look for a word of a query in a name.
+ *
+ * @param mode how to look for the word
+ * @param name prepared name
+ * @param name_len length of name, in bytes
+ * @param word prepared word of the query
+ * @param word_len length of word, in bytes
+ * @return TRUE if word is a substring of name or, in
+ * QUERY_MODE_FUZZY, a subsequence of name
+ */
+static gboolean word_ismatch(enum QueryMode mode,
+                             const char *name,
+                             gsize name_len,
+                             const char *word,
+                             gsize word_len)
+{
+        gsize start;
+        gsize end;
+
+        if(mode==QUERY_MODE_FUZZY) {
+                return fuzzy_window(name, name_len, word, word_len, &start, &end);
+        }
+        return substring_find_len(name, name_len, word, word_len)!=NULL;
+}
+
+/**
+ * Find the shortest part of a name that contains the
+ * characters of a word, in order.
+ *
+ * The first part of the name that contains them all is found
+ * by looking for the characters one after the other, then
+ * looking for them backward from the end of this part
+ * makes it as short as possible. For "gnmterm" and "gnome-terminal",
+ * this is "gnome-term".
+ *
+ * Characters are compared whole, so a character can't be
+ * made of the bytes of two characters of the name.
+ *
+ * @param name prepared name
+ * @param name_len length of name, in bytes
+ * @param word prepared word of the query, not empty
+ * @param word_len length of word, in bytes
+ * @param start_out offset of the first byte of the part of the name (out)
+ * @param end_out offset of the byte that follows the part of the name (out)
+ * @return TRUE if all characters were found, FALSE if word is not
+ * a subsequence of name
+ */
+static gboolean fuzzy_window(const char *name,
+                             gsize name_len,
+                             const char *word,
+                             gsize word_len,
+                             gsize *start_out,
+                             gsize *end_out)
+{
+        gsize pos;
+        gsize w;
+        gsize end;
+
+        pos=0;
+        w=0;
+        while(w<word_len) {
+                gsize char_len;
+                const char *found;
+
+                char_len = g_utf8_next_char(word+w)-(word+w);
+                /* the first byte of a character is never found
+                 * inside another character */
+                found=NULL;
+                while(pos+char_len<=name_len) {
+                        found=(const char *)memchr(name+pos, word[w], name_len-pos-char_len+1);
+                        if(found==NULL || memcmp(found, word+w, char_len)==0) {
+                                break;
                         }
-                        buffer[bufpos]=norm_str[i];
-                        bufpos++;
+                        pos=found-name+1;
+                        found=NULL;
                 }
-                if(bufpos>0) {
-                        const char *escaped = g_markup_escape_text(buffer, bufpos);
-                        g_string_append(gstr, escaped);
-                        g_free((void *)escaped);
+                if(found==NULL) {
+                        return FALSE;
                 }
-                if(last_highlighted) {
-                        g_string_append(gstr, highlight_off);
+                pos=found-name+char_len;
+                w+=char_len;
+        }
+        end=pos;
+
+        /* now backward, from the last character */
+        w=word_len;
+        while(w>0) {
+                gsize char_len;
+
+                char_len=w;
+                w=g_utf8_prev_char(word+w)-word;
+                char_len-=w;
+                pos-=char_len;
+                while(memcmp(name+pos, word+w, char_len)!=0) {
+                        /* it's there, since the forward pass found it */
+                        pos--;
                 }
+        }
+        *start_out=pos;
+        *end_out=end;
+        return TRUE;
+}
 
-                g_free(buffer);
-                g_free(norm_str);
+/**
+ * Compute how well a word of the query matches a name, in
+ * the style of fzf.
+ *
+ * The characters of the word are looked for in the part of the
+ * name found by fuzzy_window(). Each character found
+ * is worth SCORE_MATCH, plus the bonus computed by position_bonus().
+ * A character that follows the previous character of the word
+ * directly gets at least the bonus of the first character
+ * of the run and at least BONUS_CONSECUTIVE. Each character of
+ * the name skipped between two characters of the word costs
+ * GAP_START or GAP_EXTENSION.
+ *
+ * @param name prepared name
+ * @param name_len length of name, in bytes
+ * @param original name before it was prepared, of the same
+ * length, or NULL
+ * @param word prepared word of the query, not empty
+ * @param word_len length of word, in bytes
+ * @param spans if not NULL, a GArray of struct query_span to which
+ * the runs of characters found are appended
+ * @return -1.0 if the word doesn't match, a score between 0.0 and 1.0
+ * otherwise, 1.0 being the best possible score for this word
+ */
+static float fuzzy_word_score(const char *name,
+                              gsize name_len,
+                              const char *original,
+                              const char *word,
+                              gsize word_len,
+                              GArray *spans)
+{
+        gsize start;
+        gsize end;
+        gsize pos;
+        gsize w;
+        int score;
+        int max_score;
+        int run_bonus;
+        gboolean consecutive;
+        gboolean in_gap;
+
+        if(!fuzzy_window(name, name_len, word, word_len, &start, &end)) {
+                return -1.0;
+        }
 
-                retval = gstr->str;
-                g_string_free(gstr, FALSE/*don't free content*/);
-        } else {
-                retval=norm_str;
+        score=0;
+        run_bonus=0;
+        consecutive=FALSE;
+        in_gap=FALSE;
+        w=0;
+        for(pos=start; pos<end && w<word_len; ) {
+                gsize char_len;
+                gsize word_char_len;
+
+                char_len = g_utf8_next_char(name+pos)-(name+pos);
+                word_char_len = g_utf8_next_char(word+w)-(word+w);
+                if(char_len==word_char_len && memcmp(name+pos, word+w, char_len)==0) {
+                        int bonus;
+
+                        bonus=position_bonus(name, original, pos);
+                        if(consecutive) {
+                                bonus=MAX(bonus, MAX(run_bonus, BONUS_CONSECUTIVE));
+                        } else {
+                                run_bonus=bonus;
+                        }
+                        if(w==0) {
+                                bonus*=FIRST_CHAR_MULTIPLIER;
+                        }
+                        score+=SCORE_MATCH+bonus;
+                        if(spans!=NULL) {
+                                if(consecutive) {
+                                        g_array_index(spans, struct query_span, spans->len-1).end=pos+char_len;
+                                } else {
+                                        struct query_span span;
+
+                                        span.start=pos;
+                                        span.end=pos+char_len;
+                                        g_array_append_val(spans, span);
+                                }
+                        }
+                        consecutive=TRUE;
+                        in_gap=FALSE;
+                        w+=word_char_len;
+                } else {
+                        score+=in_gap ? GAP_EXTENSION:GAP_START;
+                        consecutive=FALSE;
+                        in_gap=TRUE;
+                }
+                pos+=char_len;
         }
-        g_free(norm_query);
-        g_free(highlight);
-        return retval;
+
+        /* every character at the start of a word, the first
+         * one at the start of the name */
+        max_score=g_utf8_strlen(word, word_len)*(SCORE_MATCH+BONUS_BOUNDARY)
+                + (FIRST_CHAR_MULTIPLIER-1)*BONUS_BOUNDARY;
+        if(score<=0) {
+                return 0.0;
+        }
+        if(score>=max_score) {
+                return 1.0;
+        }
+        return (float)score/max_score;
 }
 
-/* ------------------------- static functions */
+/**
+ * Compute the bonus of a character of the name that
+ * matches a character of the query.
+ *
+ * @param name prepared name
+ * @param original name before it was prepared, of the same length, or NULL
+ * @param pos offset of the character in name
+ * @return BONUS_BOUNDARY for the first character of the name or a
+ * character that follows a separator, BONUS_CAMEL for an uppercase
+ * ASCII letter that follows a lowercase ASCII letter in original, 0
+ * otherwise
+ */
+static int position_bonus(const char *name, const char *original, gsize pos)
+{
+        if(pos==0 || strchr(SEPARATORS, name[pos-1])!=NULL) {
+                return BONUS_BOUNDARY;
+        }
+        if(original!=NULL
+           && g_ascii_isupper(original[pos])
+           && g_ascii_islower(original[pos-1])) {
+                return BONUS_CAMEL;
+        }
+        return 0;
+}
+
+/**
+ * Sort spans and merge the ones that overlap or touch.
+ *
+ * @param spans a GArray of struct query_span
+ */
+static void merge_spans(GArray *spans)
+{
+        struct query_span *last;
+        guint i;
+
+        if(spans->len<2) {
+                return;
+        }
+        g_array_sort(spans, compare_spans);
+        last=&g_array_index(spans, struct query_span, 0);
+        for(i=1; i<spans->len; i++) {
+                const struct query_span *span = &g_array_index(spans, struct query_span, i);
+
+                if(span->start<=last->end) {
+                        last->end=MAX(last->end, span->end);
+                } else {
+                        last++;
+                        *last=*span;
+                }
+        }
+        g_array_set_size(spans, last-&g_array_index(spans, struct query_span, 0)+1);
+}
+
+/**
+ * Order spans by start (GCompareFunc)
+ */
+static gint compare_spans(gconstpointer a, gconstpointer b)
+{
+        const struct query_span *span_a = (const struct query_span *)a;
+        const struct query_span *span_b = (const struct query_span *)b;
+
+        if(span_a->start<span_b->start) {
+                return -1;
+        }
+        return span_a->start>span_b->start ? 1:0;
+}
+
+/**
+ * Turn spans of a prepared name into spans of the name
+ * it was prepared from.
+ *
+ * Preparing a name usually changes characters, but not their
+ * number, so the Nth character of the prepared name
+ * is the Nth character of the name. If that's not the
+ * case, the spans can't be mapped.
+ *
+ * @param prepared prepared name
+ * @param name name before it was prepared
+ * @param spans sorted spans of prepared, merged by merge_spans(),
+ * that are modified in place
+ * @return TRUE if the spans were mapped, FALSE if the names don't
+ * have the same number of characters, in which case spans is
+ * left as it is
+ */
+static gboolean map_spans(const char *prepared, const char *name, GArray *spans)
+{
+        const char *p;
+        const char *n;
+        guint i;
+
+        if(spans->len==0) {
+                return TRUE;
+        }
+        if(strcmp(prepared, name)==0) {
+                return TRUE;
+        }
+        if(g_utf8_strlen(prepared, -1)!=g_utf8_strlen(name, -1)) {
+                return FALSE;
+        }
+
+        p=prepared;
+        n=name;
+        for(i=0; i<spans->len; i++) {
+                struct query_span *span = &g_array_index(spans, struct query_span, i);
+
+                while(p<prepared+span->start) {
+                        p=g_utf8_next_char(p);
+                        n=g_utf8_next_char(n);
+                }
+                span->start=n-name;
+                while(p<prepared+span->end) {
+                        p=g_utf8_next_char(p);
+                        n=g_utf8_next_char(n);
+                }
+                span->end=n-name;
+        }
+        return TRUE;
+}
+
+/**
+ * Append part of a string to a GString, escaped for pango markup,
+ * the way g_markup_escape_text() would, without
+ * allocating anything.
+ *
+ * @param gstr
+ * @param str UTF-8 string
+ * @param len number of bytes of str to append
+ */
+static void append_markup_escaped(GString *gstr, const char *str, gsize len)
+{
+        const char *end;
+        const char *run;
+        const char *current;
+
+        end=str+len;
+        run=str;
+        for(current=str; current<end; current++) {
+                const char *entity;
+
+                switch(*current) {
+                case '&':
+                        entity="&amp;";
+                        break;
+                case '<':
+                        entity="&lt;";
+                        break;
+                case '>':
+                        entity="&gt;";
+                        break;
+                case '\'':
+                        entity="&apos;";
+                        break;
+                case '"':
+                        entity="&quot;";
+                        break;
+                default:
+                        continue;
+                }
+                g_string_append_len(gstr, run, current-run);
+                g_string_append(gstr, entity);
+                run=current+1;
+        }
+        g_string_append_len(gstr, run, end-run);
+}
 
 static char *prepare(const char *str)
 {
@@ -15,11 +15,67 @@
  *
  */
 
+/**
+ * A query that's been prepared once to be matched against
+ * many names, see query_compile().
+ */
+struct query_matcher;
+
+/**
+ * A part of a name that matches a query, see query_matcher_spans()
+ */
+struct query_span
+{
+        /** Offset of the first byte of the part */
+        gsize start;
+
+        /** Offset of the byte that follows the part */
+        gsize end;
+};
+
+/**
+ * How the words of a query are looked for in names,
+ * see query_set_mode()
+ */
+enum QueryMode {
+        /** every word of the query must be a substring of the name */
+        QUERY_MODE_SUBSTRING,
+        /**
+         * the characters of every word of the query must be
+         * found in the name in the same order, but not necessarily
+         * next to each other: "gnmterm" matches "gnome-terminal"
+         */
+        QUERY_MODE_FUZZY
+};
+
+/**
+ * Choose how queries are matched, for the whole application.
+ *
+ * This is meant to be called once, at startup, before any
+ * query is run; matchers that have already been compiled
+ * keep the mode they were compiled with. The default mode
+ * is QUERY_MODE_SUBSTRING.
+ *
+ * @param mode
+ */
+void query_set_mode(enum QueryMode mode);
+
+/**
+ * Get the mode set by query_set_mode().
+ *
+ * Other implementations of query matching, such as the
+ * catalog, must follow this mode.
+ *
+ * @return the current mode
+ */
+enum QueryMode query_get_mode(void);
+
 /**
  * Return TRUE if the query matches the given name.
  *
  * If you've got a result already, use query_result_ismatch()
- * instead.
+ * instead. To match the same query against many names,
+ * use query_compile() instead.
  *
  * @param query
  * @param name
@@ -27,6 +83,165 @@
  */
 gboolean query_ismatch(const char *query, const char *name);
 
+/**
+ * Normalize and casefold a string, the way query_ismatch()
+ * does before comparing the query and the name.
+ *
+ * A name prepared with this function matches a query if
+ * every space-separated word of the prepared query is a
+ * substring of the prepared name or, in QUERY_MODE_FUZZY, a
+ * subsequence of the prepared name.
+ *
+ * @param str an UTF-8 string
+ * @return a newly-allocated string, to free with g_free()
+ */
+char *query_prepare(const char *str);
+
+/**
+ * Compute the characters a prepared name contains, for
+ * query_matcher_may_match().
+ *
+ * Each bit stands for a byte value: there's one bit per ASCII
+ * letter and digit, the other bytes share the remaining bits.
+ *
+ * @param prepared a name prepared with query_prepare()
+ * @return a mask of the bytes found in the name
+ */
+guint64 query_char_mask(const char *prepared);
+
+/**
+ * Prepare a query for matching it against many names.
+ *
+ * The query is normalized, casefolded and split into
+ * words once, so that matching it against a prepared name
+ * requires no allocation. The query is matched the way
+ * query_get_mode() says.
+ *
+ * @param query
+ * @return a new matcher, to free with query_matcher_free()
+ */
+struct query_matcher *query_compile(const char *query);
+
+/**
+ * Free a matcher created by query_compile().
+ *
+ * @param matcher
+ */
+void query_matcher_free(struct query_matcher *matcher);
+
+/**
+ * Return TRUE if the compiled query matches a prepared name.
+ *
+ * This is the same as calling query_ismatch() with the original
+ * query and name, without any allocation.
+ *
+ * @param matcher
+ * @param prepared_name a name prepared with query_prepare()
+ * @return TRUE if the name matches the query
+ */
+gboolean query_matcher_ismatch(const struct query_matcher *matcher, const char *prepared_name);
+
+/**
+ * Quickly rule out names that can't match a compiled query.
+ *
+ * A name can only match if it contains every byte of the
+ * query. Checking this using a mask computed in advance
+ * is much cheaper than query_matcher_ismatch(), especially
+ * in QUERY_MODE_FUZZY, where most names are rejected by
+ * this check.
+ *
+ * @param matcher
+ * @param name_mask mask computed by query_char_mask() on the
+ * prepared name
+ * @return FALSE if the name doesn't match, TRUE if it might
+ */
+gboolean query_matcher_may_match(const struct query_matcher *matcher, guint64 name_mask);
+
+/**
+ * Compute how well a compiled query matches a prepared name.
+ *
+ * In QUERY_MODE_FUZZY, the score is higher when the characters
+ * are found at the start of words, either after a separator
+ * or at a lowercase to uppercase change in name, and
+ * when they're found next to each other. "term" scores
+ * higher than "trml" against "gnome-terminal".
+ *
+ * In QUERY_MODE_SUBSTRING, all names that match have the same
+ * score, 1.0.
+ *
+ * @param matcher
+ * @param prepared_name a name prepared with query_prepare()
+ * @param name the name before it was prepared, to find
+ * lowercase to uppercase changes, or NULL
+ * @return 0.0 if the name doesn't match, a score greater
+ * than 0.0 and at most 1.0 otherwise
+ */
+float query_matcher_score(const struct query_matcher *matcher, const char *prepared_name, const char *name);
+
+/**
+ * Return TRUE if the compiled query matches the given result.
+ *
+ * This is the same as calling query_result_ismatch() with the
+ * original query. If the result comes with a prepared name,
+ * this call requires no allocation.
+ *
+ * @param matcher
+ * @param result
+ * @return TRUE if the name of the result matches the query
+ */
+gboolean query_matcher_result_ismatch(const struct query_matcher *matcher, const struct result *result);
+
+/**
+ * Match a prepared name and tell which parts of it match.
+ *
+ * This gives the same answer as query_matcher_ismatch(). The
+ * parts are the first occurrence of each word of the query or,
+ * in QUERY_MODE_FUZZY, the characters of each word that
+ * were found.
+ *
+ * @param matcher
+ * @param prepared_name a name prepared with query_prepare()
+ * @param spans a GArray of struct query_span that's set to the parts of
+ * prepared_name that match, sorted, with the parts that overlap
+ * or touch merged. It's emptied if the name doesn't match.
+ * @return TRUE if the name matches the query
+ */
+gboolean query_matcher_spans(const struct query_matcher *matcher, const char *prepared_name, GArray *spans);
+
+/**
+ * Append a name to a string as pango markup, with the parts that
+ * match the query highlighted.
+ *
+ * The name is matched only once, by query_matcher_spans(), and
+ * if a prepared name is given, the name isn't prepared again. If
+ * the name doesn't match, it's appended without highlights.
+ *
+ * @param matcher
+ * @param gstr string to append to
+ * @param name name to display
+ * @param prepared_name name prepared with query_prepare(), or NULL
+ * @param highlight_on pango markup that opens a highlighted zone
+ * @param highlight_off pango markup that closes a highlighted zone
+ * @return TRUE if the name matches the query
+ */
+gboolean query_matcher_append_markup(const struct query_matcher *matcher, GString *gstr, const char *name, const char *prepared_name, const char *highlight_on, const char *highlight_off);
+
+/**
+ * Check whether a query only matches names matched by a previous query.
+ *
+ * This is the case when every word of the previous query is
+ * a substring of some word of the new query, for example
+ * when "fir" becomes "fire" or "fire fox", or in QUERY_MODE_FUZZY
+ * a subsequence of some word of the new query. The names that match
+ * the new query can then be found among the names that matched
+ * the previous query.
+ *
+ * @param previous previous query
+ * @param query new query
+ * @return TRUE if everything query matches is matched by previous
+ */
+gboolean query_is_refinement(const char *previous, const char *query);
+
 /**
  * Return TRUE if the query matches the given result.
  *
@@ -39,6 +254,9 @@ gboolean query_result_ismatch(const char *query, const struct result *result);
 /**
  * Highlight a string that's queried on using pango markup.
  *
+ * This compiles the query and prepares the string; to highlight
+ * many names, see query_matcher_append_markup().
+ *
  * @param query the query
  * @param str the string to compare the query with
  * @param highlight_on pango markup that opens a highlighted zone
@@ -0,0 +1,207 @@
+/** \file
+ * Implementation of the API defined in query_cache.h
+ */
+
+#include "query_cache.h"
+#include "query.h"
+#include <string.h>
+
+/**
+ * A query and its results.
+ */
+struct query_cache_entry
+{
+        /** normalized query, the key of the hash table */
+        char *key;
+        gpointer value;
+        gsize size;
+        /** link of the entry in lru */
+        GList *link;
+};
+
+struct query_cache
+{
+        /** char * (normalized query) x struct query_cache_entry * */
+        GHashTable *entries;
+
+        /** struct query_cache_entry *, the most recently used first */
+        GQueue *lru;
+
+        guint max_entries;
+        gsize max_size;
+        query_cache_free_f free_value;
+
+        /** Protects stats */
+        GMutex *lock;
+
+        /** See query_cache_get_stats() */
+        struct query_cache_stats stats;
+};
+
+/* ------------------------- prototypes */
+static char *normalize(const char *query);
+static void remove_entry(struct query_cache *cache, struct query_cache_entry *entry);
+
+/* ------------------------- public functions */
+struct query_cache *query_cache_new(guint max_entries, gsize max_size, query_cache_free_f free_value)
+{
+        struct query_cache *cache;
+
+        g_return_val_if_fail(max_entries>0, NULL);
+        g_return_val_if_fail(free_value!=NULL, NULL);
+
+        cache = g_new(struct query_cache, 1);
+        cache->entries=g_hash_table_new(g_str_hash, g_str_equal);
+        cache->lru=g_queue_new();
+        cache->max_entries=max_entries;
+        cache->max_size=max_size;
+        cache->free_value=free_value;
+        cache->lock=g_mutex_new();
+        memset(&cache->stats, 0, sizeof(struct query_cache_stats));
+        return cache;
+}
+
+gpointer query_cache_lookup(struct query_cache *cache, const char *query)
+{
+        struct query_cache_entry *entry;
+        char *key;
+
+        g_return_val_if_fail(cache!=NULL, NULL);
+        g_return_val_if_fail(query!=NULL, NULL);
+
+        key=normalize(query);
+        entry=(struct query_cache_entry *)g_hash_table_lookup(cache->entries, key);
+        g_free(key);
+
+        g_mutex_lock(cache->lock);
+        if(entry!=NULL) {
+                cache->stats.hits++;
+        } else {
+                cache->stats.misses++;
+        }
+        g_mutex_unlock(cache->lock);
+
+        if(entry==NULL) {
+                return NULL;
+        }
+        g_queue_unlink(cache->lru, entry->link);
+        g_queue_push_head_link(cache->lru, entry->link);
+        return entry->value;
+}
+
+void query_cache_add(struct query_cache *cache, const char *query, gpointer value, gsize size)
+{
+        struct query_cache_entry *entry;
+        char *key;
+
+        g_return_if_fail(cache!=NULL);
+        g_return_if_fail(query!=NULL);
+
+        if(size>cache->max_size) {
+                cache->free_value(value);
+                return;
+        }
+
+        key=normalize(query);
+        entry=(struct query_cache_entry *)g_hash_table_lookup(cache->entries, key);
+        if(entry!=NULL) {
+                remove_entry(cache, entry);
+        }
+
+        entry = g_new(struct query_cache_entry, 1);
+        entry->key=key;
+        entry->value=value;
+        entry->size=size;
+        g_queue_push_head(cache->lru, entry);
+        entry->link=cache->lru->head;
+        g_hash_table_insert(cache->entries, entry->key, entry);
+
+        g_mutex_lock(cache->lock);
+        cache->stats.entries++;
+        cache->stats.size+=size;
+        g_mutex_unlock(cache->lock);
+
+        while(cache->stats.entries>cache->max_entries
+              || cache->stats.size>cache->max_size) {
+                remove_entry(cache, (struct query_cache_entry *)cache->lru->tail->data);
+        }
+}
+
+void query_cache_clear(struct query_cache *cache)
+{
+        g_return_if_fail(cache!=NULL);
+
+        while(cache->lru->head!=NULL) {
+                remove_entry(cache, (struct query_cache_entry *)cache->lru->head->data);
+        }
+}
+
+void query_cache_get_stats(struct query_cache *cache, struct query_cache_stats *stats)
+{
+        g_return_if_fail(cache!=NULL);
+        g_return_if_fail(stats!=NULL);
+
+        g_mutex_lock(cache->lock);
+        memcpy(stats, &cache->stats, sizeof(struct query_cache_stats));
+        g_mutex_unlock(cache->lock);
+}
+
+void query_cache_free(struct query_cache *cache)
+{
+        g_return_if_fail(cache!=NULL);
+
+        query_cache_clear(cache);
+        g_hash_table_destroy(cache->entries);
+        g_queue_free(cache->lru);
+        g_mutex_free(cache->lock);
+        g_free(cache);
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Normalize a query: the words of the query,
+ * prepared by query_prepare(), separated by one space.
+ *
+ * @return a new string, to free with g_free()
+ */
+static char *normalize(const char *query)
+{
+        GString *key;
+        char *prepared;
+        char **words;
+        int i;
+
+        prepared=query_prepare(query);
+        words=g_strsplit(prepared, " ", -1/*no max*/);
+        key=g_string_new("");
+        for(i=0; words[i]!=NULL; i++) {
+                if(words[i][0]!='\0') {
+                        if(key->len>0) {
+                                g_string_append_c(key, ' ');
+                        }
+                        g_string_append(key, words[i]);
+                }
+        }
+        g_strfreev(words);
+        g_free(prepared);
+        return g_string_free(key, FALSE/*return content*/);
+}
+
+/**
+ * Remove an entry from the cache and free it.
+ */
+static void remove_entry(struct query_cache *cache, struct query_cache_entry *entry)
+{
+        g_hash_table_remove(cache->entries, entry->key);
+        g_queue_delete_link(cache->lru, entry->link);
+
+        g_mutex_lock(cache->lock);
+        cache->stats.entries--;
+        cache->stats.size-=entry->size;
+        g_mutex_unlock(cache->lock);
+
+        cache->free_value(entry->value);
+        g_free(entry->key);
+        g_free(entry);
+}
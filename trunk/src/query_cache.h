@@ -0,0 +1,105 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <glib.h>
+
+/** \file
+ * A bounded cache of query results, keyed by query.
+ *
+ * Queries are normalized with query_prepare() before they're
+ * used as keys, so "Term" and "term " are the same query.
+ *
+ * When the cache is full, the least recently used
+ * queries are removed first. The cache is bounded by
+ * the number of queries and the total size of the results.
+ *
+ * The values are opaque to the cache, which frees them using the
+ * function passed to query_cache_new().
+ *
+ * The cache is meant to be used by one thread,
+ * except for query_cache_get_stats(), which can be
+ * called from any thread.
+ */
+
+/**
+ * Statistics of a query cache, see query_cache_get_stats()
+ */
+struct query_cache_stats
+{
+        /** number of queries in the cache */
+        guint entries;
+        /** total size of the results in the cache, in bytes */
+        gsize size;
+        /** number of successful lookups */
+        gulong hits;
+        /** number of failed lookups */
+        gulong misses;
+};
+
+/**
+ * Function that frees a value of the cache.
+ */
+typedef void (*query_cache_free_f)(gpointer value);
+
+/**
+ * Create a new cache.
+ *
+ * @param max_entries maximum number of queries kept in the cache
+ * @param max_size maximum total size of the values, in bytes
+ * @param free_value function that frees the values, called when
+ * they are removed from the cache
+ * @return a new cache, to free with query_cache_free()
+ */
+struct query_cache *query_cache_new(guint max_entries, gsize max_size, query_cache_free_f free_value);
+
+/**
+ * Look for the results of a query.
+ *
+ * A successful lookup makes the query the most
+ * recently used.
+ *
+ * @param cache
+ * @param query the query, not normalized
+ * @return the value or NULL. The value belongs to the cache
+ * and can only be used until the cache is modified.
+ */
+gpointer query_cache_lookup(struct query_cache *cache, const char *query);
+
+/**
+ * Add the results of a query into the cache, replacing the
+ * results already in the cache for the same query.
+ *
+ * The least recently used queries are removed until
+ * the cache is within its bounds.
+ *
+ * @param cache
+ * @param query the query, not normalized
+ * @param value the results, which now belong to the cache
+ * @param size size of the value, in bytes. A value larger than
+ * the maximum size of the cache is freed immediately.
+ */
+void query_cache_add(struct query_cache *cache, const char *query, gpointer value, gsize size);
+
+/**
+ * Remove all the queries from the cache.
+ *
+ * The statistics about hits and misses are kept.
+ */
+void query_cache_clear(struct query_cache *cache);
+
+/**
+ * Get statistics about a cache.
+ *
+ * This call is thread-safe.
+ *
+ * @param cache
+ * @param stats structure to fill (out)
+ */
+void query_cache_get_stats(struct query_cache *cache, struct query_cache_stats *stats);
+
+/**
+ * Free the cache and all the values it contains.
+ */
+void query_cache_free(struct query_cache *cache);
+
+#endif /*QUERY_CACHE_H*/
@@ -0,0 +1,161 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "query_cache.h"
+
+static struct query_cache *cache;
+
+/** number of values freed by free_value() */
+static int freed;
+
+/* ------------------------- prototypes */
+static Suite *query_cache_check_suite(void);
+static void free_value(gpointer value);
+
+/* ------------------------- test case */
+static void setup()
+{
+        freed=0;
+        cache=query_cache_new(3/*entries*/, 100/*bytes*/, free_value);
+}
+
+static void teardown()
+{
+        query_cache_free(cache);
+}
+
+START_TEST(test_lookup)
+{
+        struct query_cache_stats stats;
+
+        fail_unless(query_cache_lookup(cache, "term")==NULL, "empty cache");
+        query_cache_add(cache, "term", g_strdup("terminal"), 10);
+        fail_unless(query_cache_lookup(cache, "term")!=NULL, "added");
+        fail_unless(strcmp("terminal", (char *)query_cache_lookup(cache, "term"))==0, "value");
+        fail_unless(query_cache_lookup(cache, "fire")==NULL, "other query");
+
+        query_cache_get_stats(cache, &stats);
+        fail_unless(stats.entries==1, "entries");
+        fail_unless(stats.size==10, "size");
+        fail_unless(stats.hits==2, "hits");
+        fail_unless(stats.misses==2, "misses");
+}
+END_TEST
+
+START_TEST(test_normalize)
+{
+        query_cache_add(cache, "Term", g_strdup("terminal"), 10);
+        fail_unless(query_cache_lookup(cache, " term ")!=NULL, "case and spaces");
+
+        query_cache_add(cache, "mail  box", g_strdup("mailbox"), 10);
+        fail_unless(query_cache_lookup(cache, "MAIL box")!=NULL, "words");
+}
+END_TEST
+
+START_TEST(test_replace)
+{
+        struct query_cache_stats stats;
+
+        query_cache_add(cache, "term", g_strdup("terminal"), 10);
+        query_cache_add(cache, "term", g_strdup("gnome-terminal"), 20);
+        fail_unless(freed==1, "old value not freed");
+        fail_unless(strcmp("gnome-terminal", (char *)query_cache_lookup(cache, "term"))==0, "value");
+
+        query_cache_get_stats(cache, &stats);
+        fail_unless(stats.entries==1, "entries");
+        fail_unless(stats.size==20, "size");
+}
+END_TEST
+
+START_TEST(test_lru)
+{
+        query_cache_add(cache, "term", g_strdup("terminal"), 10);
+        query_cache_add(cache, "fire", g_strdup("firefox"), 10);
+        query_cache_add(cache, "mail", g_strdup("mailer"), 10);
+        fail_unless(query_cache_lookup(cache, "term")!=NULL, "term");
+
+        query_cache_add(cache, "edit", g_strdup("editor"), 10);
+        fail_unless(freed==1, "one value should have been removed");
+        fail_unless(query_cache_lookup(cache, "fire")==NULL, "least recently used");
+        fail_unless(query_cache_lookup(cache, "term")!=NULL, "recently used");
+        fail_unless(query_cache_lookup(cache, "mail")!=NULL, "mail");
+        fail_unless(query_cache_lookup(cache, "edit")!=NULL, "edit");
+}
+END_TEST
+
+START_TEST(test_size)
+{
+        struct query_cache_stats stats;
+
+        query_cache_add(cache, "term", g_strdup("terminal"), 60);
+        query_cache_add(cache, "fire", g_strdup("firefox"), 60);
+        fail_unless(query_cache_lookup(cache, "term")==NULL, "too large");
+        fail_unless(query_cache_lookup(cache, "fire")!=NULL, "fire");
+
+        query_cache_add(cache, "mail", g_strdup("mailer"), 200);
+        fail_unless(freed==2, "value larger than the cache");
+        fail_unless(query_cache_lookup(cache, "mail")==NULL, "mail");
+
+        query_cache_get_stats(cache, &stats);
+        fail_unless(stats.entries==1, "entries");
+        fail_unless(stats.size==60, "size");
+}
+END_TEST
+
+START_TEST(test_clear)
+{
+        struct query_cache_stats stats;
+
+        query_cache_add(cache, "term", g_strdup("terminal"), 10);
+        query_cache_add(cache, "fire", g_strdup("firefox"), 10);
+        fail_unless(query_cache_lookup(cache, "term")!=NULL, "term");
+        query_cache_clear(cache);
+        fail_unless(freed==2, "values not freed");
+        fail_unless(query_cache_lookup(cache, "term")==NULL, "cleared");
+
+        query_cache_get_stats(cache, &stats);
+        fail_unless(stats.entries==0, "entries");
+        fail_unless(stats.size==0, "size");
+        fail_unless(stats.hits==1, "hits kept");
+        fail_unless(stats.misses==1, "misses kept");
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *query_cache_check_suite(void)
+{
+        Suite *s = suite_create("query_cache");
+        TCase *tc_core = tcase_create("query_cache_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_lookup);
+        tcase_add_test(tc_core, test_normalize);
+        tcase_add_test(tc_core, test_replace);
+        tcase_add_test(tc_core, test_lru);
+        tcase_add_test(tc_core, test_size);
+        tcase_add_test(tc_core, test_clear);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = query_cache_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+static void free_value(gpointer value)
+{
+        freed++;
+        g_free(value);
+}
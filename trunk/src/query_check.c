@@ -30,6 +30,7 @@ extern gboolean query_highlight(const char *query, const char *name, char *highl
 static void displayable_highlight(char *highlight, int len);
 static void assertHighlightIs(const char *query, const char *name, const char *pattern);
 static void _assertTrue(const char *msg, gboolean expression, const char *file, int line);
+static void assertMatcherAgrees(const char *query, const char *name);
 
 /* ------------------------- test cases */
 static void setup()
@@ -42,7 +43,9 @@ static void setup()
 }
 
 static void teardown()
-{}
+{
+        query_set_mode(QUERY_MODE_SUBSTRING);
+}
 
 START_TEST(test_ismatch_exact)
 {
@@ -142,6 +145,34 @@ START_TEST(test_ismatch_utf8)
 END_TEST
 
 
+START_TEST(test_is_refinement)
+{
+        printf("--test_is_refinement\n");
+        assertTrue("'fire' refines 'fir'",
+                   query_is_refinement("fir", "fire"));
+        assertTrue("'afire' refines 'fir'",
+                   query_is_refinement("fir", "afire"));
+        assertTrue("'fir fox' refines 'fir'",
+                   query_is_refinement("fir", "fir fox"));
+        assertTrue("'fox fire' refines 'fi fo'",
+                   query_is_refinement("fi fo", "fox fire"));
+        assertTrue("'FIRE' refines 'fir'",
+                   query_is_refinement("fir", "FIRE"));
+        assertTrue("'fir' refines 'fir'",
+                   query_is_refinement("fir", "fir"));
+        assertTrue("'fi' does not refine 'fir'",
+                   !query_is_refinement("fir", "fi"));
+        assertTrue("'fox' does not refine 'fir'",
+                   !query_is_refinement("fir", "fox"));
+        assertTrue("'fire' does not refine 'fir fox'",
+                   !query_is_refinement("fir fox", "fire"));
+        assertTrue("nothing refines ''",
+                   !query_is_refinement("", "fir"));
+        assertTrue("'' refines nothing",
+                   !query_is_refinement("fir", " "));
+}
+END_TEST
+
 START_TEST(test_result_ismatch)
 {
         struct result result;
@@ -160,6 +191,220 @@ START_TEST(test_result_ismatch)
 }
 END_TEST
 
+START_TEST(test_matcher)
+{
+        printf("--test_matcher\n");
+        assertMatcherAgrees("baaaa", "baaaa");
+        assertMatcherAgrees("bobo", "baaaa");
+        assertMatcherAgrees("a b c", "a b c");
+        assertMatcherAgrees("b  c", "abc");
+        assertMatcherAgrees(" ", "abc");
+        assertMatcherAgrees("", "abc");
+        assertMatcherAgrees("abc", "");
+        assertMatcherAgrees("c ab", "abc");
+        assertMatcherAgrees("ca", "abc");
+        assertMatcherAgrees("FOX", "firefox");
+        assertMatcherAgrees(utf8_AYTO, utf8_Ti_einai_ayto);
+        assertMatcherAgrees(utf8_ete, utf8_CET_ETE_accents);
+        assertMatcherAgrees(utf8_AYTO_EINAI, utf8_TI_EINAI_AYTO);
+}
+END_TEST
+
+START_TEST(test_matcher_result)
+{
+        struct result result;
+        struct query_matcher *matcher;
+
+        printf("--test_matcher_result\n");
+        memset(&result, 0, sizeof(result));
+        result.name="bottom";
+        matcher=query_compile("to bo");
+        assertTrue("'to bo' and result(bottom)",
+                   query_matcher_result_ismatch(matcher, &result));
+
+        /* the prepared name is used instead of the name */
+        result.prepared_name="other";
+        assertTrue("'to bo' and result(other)",
+                   !query_matcher_result_ismatch(matcher, &result));
+        query_matcher_free(matcher);
+}
+END_TEST
+
+/**
+ * Compare query_ismatch() and a compiled query on 10000 names.
+ */
+START_TEST(test_matcher_benchmark)
+{
+        const int count = 10000;
+        char **names;
+        char **prepared;
+        struct query_matcher *matcher;
+        GTimer *timer;
+        double uncompiled;
+        double compiled;
+        int matches;
+        int compiled_matches;
+        int i;
+
+        printf("--test_matcher_benchmark\n");
+        names=g_new(char *, count);
+        prepared=g_new(char *, count);
+        for(i=0; i<count; i++) {
+                names[i]=g_strdup_printf("Application Number %d (%s)",
+                                         i,
+                                         i%2==0 ? "Terminal":"Editor");
+                prepared[i]=query_prepare(names[i]);
+        }
+
+        timer=g_timer_new();
+        matches=0;
+        for(i=0; i<count; i++) {
+                if(query_ismatch("term app", names[i])) {
+                        matches++;
+                }
+        }
+        uncompiled=g_timer_elapsed(timer, NULL/*microseconds*/);
+
+        g_timer_start(timer);
+        matcher=query_compile("term app");
+        compiled_matches=0;
+        for(i=0; i<count; i++) {
+                if(query_matcher_ismatch(matcher, prepared[i])) {
+                        compiled_matches++;
+                }
+        }
+        query_matcher_free(matcher);
+        compiled=g_timer_elapsed(timer, NULL/*microseconds*/);
+
+        printf("%d names: query_ismatch() %.2fms, compiled query %.2fms\n",
+               count,
+               uncompiled*1000.0,
+               compiled*1000.0);
+        fail_unless(matches==count/2, "wrong number of matches");
+        fail_unless(compiled_matches==matches, "compiled query disagrees");
+
+        g_timer_destroy(timer);
+        for(i=0; i<count; i++) {
+                g_free(names[i]);
+                g_free(prepared[i]);
+        }
+        g_free(names);
+        g_free(prepared);
+}
+END_TEST
+
+START_TEST(test_fuzzy_ismatch)
+{
+        printf("--test_fuzzy_ismatch\n");
+        query_set_mode(QUERY_MODE_FUZZY);
+        assertTrue("gnmterm==gnome-terminal",
+                   query_ismatch("gnmterm", "gnome-terminal"));
+        assertTrue("GT==gnome-terminal",
+                   query_ismatch("GT", "gnome-terminal"));
+        assertTrue("term gn==gnome-terminal",
+                   query_ismatch("term gn", "gnome-terminal"));
+        assertTrue("mg!=gnome-terminal",
+                   !query_ismatch("mg", "gnome-terminal"));
+        assertTrue("gnmtx!=gnome-terminal",
+                   !query_ismatch("gnmtx", "gnome-terminal"));
+        assertTrue("ete==Cet ete",
+                   query_ismatch(utf8_ete, utf8_Cet_ete));
+        /* the bytes of \xc3\xa9 are in the name, but not
+         * in the same character */
+        assertTrue("e!=\xc3\xa3\xc2\xa9",
+                   !query_ismatch("\xc3\xa9", "\xc3\xa3\xc2\xa9"));
+        assertTrue("empty query",
+                   !query_ismatch("", "gnome-terminal"));
+        assertMatcherAgrees("gnmterm", "gnome-terminal");
+        assertMatcherAgrees("gnmtx", "gnome-terminal");
+        assertMatcherAgrees(utf8_AYTO, utf8_Ti_einai_ayto);
+}
+END_TEST
+
+START_TEST(test_fuzzy_score)
+{
+        struct query_matcher *matcher;
+
+        printf("--test_fuzzy_score\n");
+        query_set_mode(QUERY_MODE_FUZZY);
+        matcher=query_compile("term");
+        assertTrue("term: no match",
+                   query_matcher_score(matcher, "gnome-shell", "gnome-shell")==0.0);
+        assertTrue("term: substring at the start of a word",
+                   query_matcher_score(matcher, "gnome-terminal", "gnome-terminal")==1.0);
+        assertTrue("term: consecutive is better",
+                   query_matcher_score(matcher, "gnome-terminal", NULL)
+                   >query_matcher_score(matcher, "the remote", NULL));
+        assertTrue("term: start of a word is better",
+                   query_matcher_score(matcher, "terminal", NULL)
+                   >query_matcher_score(matcher, "determine", NULL));
+        query_matcher_free(matcher);
+
+        matcher=query_compile("gnmterm");
+        assertTrue("gnmterm: word starts are better",
+                   query_matcher_score(matcher, "gnome-terminal", NULL)
+                   >query_matcher_score(matcher, "agnomexterminal", NULL));
+        assertTrue("gnmterm: between 0 and 1",
+                   query_matcher_score(matcher, "agnomexterminal", NULL)>0.0);
+        query_matcher_free(matcher);
+
+        matcher=query_compile("ff");
+        assertTrue("ff: camel case is better",
+                   query_matcher_score(matcher, "firefox", "FireFox")
+                   >query_matcher_score(matcher, "firefox", "Firefox"));
+        query_matcher_free(matcher);
+
+        /* in substring mode, all matches are equal */
+        query_set_mode(QUERY_MODE_SUBSTRING);
+        matcher=query_compile("term");
+        assertTrue("substring: match",
+                   query_matcher_score(matcher, "determine", NULL)==1.0);
+        assertTrue("substring: no match",
+                   query_matcher_score(matcher, "the remote", NULL)==0.0);
+        query_matcher_free(matcher);
+}
+END_TEST
+
+START_TEST(test_fuzzy_is_refinement)
+{
+        printf("--test_fuzzy_is_refinement\n");
+        query_set_mode(QUERY_MODE_FUZZY);
+        assertTrue("'gnmt' refines 'gnm'",
+                   query_is_refinement("gnm", "gnmt"));
+        assertTrue("'gnome' refines 'gnm'",
+                   query_is_refinement("gnm", "gnome"));
+        assertTrue("'gn' does not refine 'gnm'",
+                   !query_is_refinement("gnm", "gn"));
+        assertTrue("'mng' does not refine 'gnm'",
+                   !query_is_refinement("gnm", "mng"));
+}
+END_TEST
+
+START_TEST(test_char_mask)
+{
+        struct query_matcher *matcher;
+        char *prepared;
+
+        printf("--test_char_mask\n");
+        query_set_mode(QUERY_MODE_FUZZY);
+        matcher=query_compile("gnm TERM");
+        prepared=query_prepare("gnome-terminal");
+        assertTrue("gnome-terminal may match",
+                   query_matcher_may_match(matcher, query_char_mask(prepared)));
+        assertTrue("gnome-shell can't match",
+                   !query_matcher_may_match(matcher, query_char_mask("gnome-shell")));
+        assertTrue("empty name can't match",
+                   !query_matcher_may_match(matcher, query_char_mask("")));
+        g_free(prepared);
+        query_matcher_free(matcher);
+
+        matcher=query_compile("");
+        assertTrue("empty query matches nothing",
+                   !query_matcher_may_match(matcher, query_char_mask("abc")));
+        query_matcher_free(matcher);
+}
+END_TEST
+
 START_TEST(test_highlight_exact)
 {
         printf("--test_highlight_exact\n");
@@ -258,6 +503,83 @@ START_TEST(test_pango_highlight)
 }
 END_TEST
 
+START_TEST(test_matcher_spans)
+{
+        struct query_matcher *matcher;
+        GArray *spans;
+
+        printf("--test_matcher_spans\n");
+        spans=g_array_new(FALSE/*not zero-terminated*/, FALSE/*don't clear*/, sizeof(struct query_span));
+
+        matcher=query_compile("boy ogg sog");
+        assertTrue("substring match",
+                   query_matcher_spans(matcher, "soggy bottom boys", spans));
+        assertTrue("substring: 2 spans", spans->len==2);
+        assertTrue("substring: overlapping words merged",
+                   g_array_index(spans, struct query_span, 0).start==0
+                   && g_array_index(spans, struct query_span, 0).end==4);
+        assertTrue("substring: sorted",
+                   g_array_index(spans, struct query_span, 1).start==13
+                   && g_array_index(spans, struct query_span, 1).end==16);
+        assertTrue("substring: no match",
+                   !query_matcher_spans(matcher, "soggy bottom", spans));
+        assertTrue("substring: no spans if no match", spans->len==0);
+        query_matcher_free(matcher);
+
+        query_set_mode(QUERY_MODE_FUZZY);
+        matcher=query_compile("gnmterm");
+        assertTrue("fuzzy match",
+                   query_matcher_spans(matcher, "gnome-terminal", spans));
+        assertTrue("fuzzy: 3 spans", spans->len==3);
+        assertTrue("fuzzy: gn",
+                   g_array_index(spans, struct query_span, 0).start==0
+                   && g_array_index(spans, struct query_span, 0).end==2);
+        assertTrue("fuzzy: m",
+                   g_array_index(spans, struct query_span, 1).start==3
+                   && g_array_index(spans, struct query_span, 1).end==4);
+        assertTrue("fuzzy: term",
+                   g_array_index(spans, struct query_span, 2).start==6
+                   && g_array_index(spans, struct query_span, 2).end==10);
+        query_matcher_free(matcher);
+
+        g_array_free(spans, TRUE/*free content*/);
+}
+END_TEST
+
+START_TEST(test_matcher_append_markup)
+{
+        struct query_matcher *matcher;
+        GString *gstr;
+
+        printf("--test_matcher_append_markup\n");
+        gstr=g_string_new("");
+
+        matcher=query_compile("oo");
+        assertTrue("match",
+                   query_matcher_append_markup(matcher, gstr, "Foo & <Bar>", "foo & <bar>", "[", "]"));
+        assertTrue("highlighted and escaped",
+                   strcmp("F[oo] &amp; &lt;Bar&gt;", gstr->str)==0);
+
+        g_string_assign(gstr, "x");
+        assertTrue("no match",
+                   !query_matcher_append_markup(matcher, gstr, "'bar'", NULL/*prepare it*/, "[", "]"));
+        assertTrue("appended, escaped, not highlighted",
+                   strcmp("x&apos;bar&apos;", gstr->str)==0);
+        query_matcher_free(matcher);
+
+        query_set_mode(QUERY_MODE_FUZZY);
+        matcher=query_compile("gnmterm");
+        g_string_assign(gstr, "");
+        assertTrue("fuzzy match",
+                   query_matcher_append_markup(matcher, gstr, "Gnome-Terminal", NULL/*prepare it*/, "[", "]"));
+        assertTrue("fuzzy highlighted",
+                   strcmp("[Gn]o[m]e-[Term]inal", gstr->str)==0);
+        query_matcher_free(matcher);
+
+        g_string_free(gstr, TRUE/*free content*/);
+}
+END_TEST
+
 /* ------------------------- test suite */
 
 static Suite *query_check_suite(void)
@@ -275,7 +597,15 @@ static Suite *query_check_suite(void)
         tcase_add_test(tc_core, test_ismatch_case_insensitive);
         tcase_add_test(tc_core, test_ismatch_utf8);
 
+        tcase_add_test(tc_core, test_is_refinement);
         tcase_add_test(tc_core, test_result_ismatch);
+        tcase_add_test(tc_core, test_matcher);
+        tcase_add_test(tc_core, test_matcher_result);
+        tcase_add_test(tc_core, test_matcher_benchmark);
+        tcase_add_test(tc_core, test_fuzzy_ismatch);
+        tcase_add_test(tc_core, test_fuzzy_score);
+        tcase_add_test(tc_core, test_fuzzy_is_refinement);
+        tcase_add_test(tc_core, test_char_mask);
 
         tcase_add_test(tc_core, test_highlight_exact);
         tcase_add_test(tc_core, test_highlight_substring);
@@ -285,6 +615,8 @@ static Suite *query_check_suite(void)
         tcase_add_test(tc_core, test_highlight_utf8);
 
         tcase_add_test(tc_core, test_pango_highlight);
+        tcase_add_test(tc_core, test_matcher_spans);
+        tcase_add_test(tc_core, test_matcher_append_markup);
 
         return s;
 }
@@ -350,6 +682,31 @@ static void assertHighlightIs(const char *query, const char *name, const char *p
         g_free(goal);
 }
 
+/**
+ * Make sure query_ismatch() and a compiled query
+ * give the same answer.
+ */
+static void assertMatcherAgrees(const char *query, const char *name)
+{
+        struct query_matcher *matcher;
+        char *prepared;
+        gboolean expected;
+        gboolean actual;
+
+        matcher=query_compile(query);
+        prepared=query_prepare(name);
+        expected=query_ismatch(query, name);
+        actual=query_matcher_ismatch(matcher, prepared);
+        fail_unless(expected==actual,
+                    g_strdup_printf("assertMatcherAgrees(%s, %s): query_ismatch() returned %s, the matcher %s\n",
+                                    query,
+                                    name,
+                                    expected ? "TRUE":"FALSE",
+                                    actual ? "TRUE":"FALSE"));
+        g_free(prepared);
+        query_matcher_free(matcher);
+}
+
 static void _assertTrue(const char *msg, gboolean expression, const char *file, int line)
 {
         _fail_unless(expression, file, line, "failure", msg, NULL);
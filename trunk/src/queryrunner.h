@@ -22,7 +22,7 @@ typedef unsigned long QueryId;
  * <li>call start() to tell the runner to get ready (make connections, open files...)</li>
  * <li>call run_quey() several times, with different queries</li>
  * <li>sometimes call consolidate() to get more results, if the user is waiting</li>
- * <li>call stop() once the user has chosen or abandoned the query (close connections, close files...)</li>
+ * <li>call stop() once the user has chosen or abandoned the query (close connections, close files..., now or after a while, in case start() is called again soon)</li>
  * <li>go back to the first point or call release()</li>
  * </ol>
  */
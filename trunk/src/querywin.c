@@ -2,6 +2,7 @@
 #include "resultlist.h"
 #include "string_utils.h"
 #include "query.h"
+#include "debounce.h"
 #include <string.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
@@ -17,21 +18,33 @@ static GtkWidget *treeview;
 static GtkWidget *scroll;
 static GString* query_str;
 static GString* running_query;
+/** running_query, compiled */
+static struct query_matcher *running_matcher;
 static QueryId running_query_id;
-static guint32 last_keypress;
+/**
+ * Time at which the running query was sent to the
+ * query runner, until its first result arrives.
+ */
+static GTimeVal running_query_sent;
+/** TRUE until the first result of the running query arrives */
+static gboolean waiting_for_first_result;
+/**
+ * ID of the timeout that'll run the query, 0 if
+ * there's none, see set_query_string()
+ */
+static guint run_query_source;
+static struct debounce debounce;
 #define query_label_text_len 256
 static char query_label_text[256];
 gboolean shown;
+/**
+ * Time after which the query runner is asked to look
+ * deeper for results, if the query hasn't changed (ms).
+ */
+#define CONSOLIDATE_DELAY 1500
 static struct result_queue *result_queue;
 static struct queryrunner *queryrunner;
 static gboolean queryrunner_started;
-/**
- * Index of the next entry to verify.
- * -1 means they've all been verified.
- *
- * verified!=-1 <=> verify_when_idle_cb is runnig
- */
-static gboolean verified=-1;
 
 #define assert_initialized() g_return_if_fail(result_queue)
 #define assert_queryrunner_set() g_return_if_fail(queryrunner);
@@ -41,19 +54,21 @@ static gboolean focus_out_cb(GtkWidget* widget, GdkEventFocus* ev, gpointer user
 static gboolean map_event_cb(GtkWidget *widget, GdkEvent *ev, gpointer userdata);
 static void result_handler_cb(struct result_queue_element *element, gpointer userdata);
 static gboolean run_query(gpointer userdata);
+static gboolean consolidate_query(gpointer userdata);
 static void set_query_string(void);
 static void reset_query_string(void);
 static gboolean key_release_event_cb(GtkWidget* widget, GdkEventKey *ev, gpointer userdata);
 static void querywin_create(GtkWidget *list);
 static gboolean execute_result(struct result *result);
-static gboolean verify_when_idle_cb(gpointer userdata);
 
 /* ------------------------- public functions */
 
 void querywin_init()
 {
         query_str=g_string_new("");
+        debounce_init(&debounce);
         running_query=g_string_new("");
+        running_matcher=query_compile("");
         result_queue=result_queue_new(NULL/*default context*/,
                                       result_handler_cb,
                                       NULL/*userdata*/);
@@ -102,14 +117,18 @@ void querywin_start()
         if(shown) {
                 return;
         }
-        last_keypress=0;
-        /* restart verification */
+        debounce_reset(&debounce);
 
-        if(verified==-1) {
-                verified=0;
-                g_idle_add(verify_when_idle_cb, NULL/*data*/);
+        /* get the query runner ready while the user
+         * types the first key */
+        if(!queryrunner_started) {
+                queryrunner->start(queryrunner);
+                queryrunner_started=TRUE;
         }
 
+        /* restart verification */
+        resultlist_verify_all();
+
         gtk_widget_show(querywin);
         shown=TRUE;
 }
@@ -129,6 +148,10 @@ void querywin_stop()
         gtk_widget_hide(querywin);
         shown=FALSE;
 
+        if(run_query_source!=0) {
+                g_source_remove(run_query_source);
+                run_query_source=0;
+        }
         reset_query_string();
 
         gtk_adjustment_set_value(gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(scroll)),
@@ -175,9 +198,21 @@ static void result_handler_cb(struct result_queue_element *element, gpointer use
         g_return_if_fail(element);
         result=element->result;
 
+        if(waiting_for_first_result && running_query_id==element->query_id) {
+                GTimeVal now;
+                long cost;
+
+                g_get_current_time(&now);
+                cost=(now.tv_sec-running_query_sent.tv_sec)*1000
+                        + (now.tv_usec-running_query_sent.tv_usec)/1000;
+                if(cost>=0) {
+                        debounce_query_cost(&debounce, (guint32)cost);
+                }
+                waiting_for_first_result=FALSE;
+        }
         if(running_query_id==element->query_id
-           || query_result_ismatch(running_query->str, result)) {
-                resultlist_add_result(running_query->str,
+           || query_matcher_result_ismatch(running_matcher, result)) {
+                resultlist_add_result(running_matcher,
                                       result);
         } else {
                 result->release(result);
@@ -189,6 +224,7 @@ static void result_handler_cb(struct result_queue_element *element, gpointer use
  */
 static gboolean run_query(gpointer userdata)
 {
+        run_query_source=0;
         if(!queryrunner_started) {
                 queryrunner->start(queryrunner);
                 queryrunner_started=TRUE;
@@ -196,7 +232,34 @@ static gboolean run_query(gpointer userdata)
         if(strcmp(running_query->str, query_str->str)!=0) {
                 g_string_assign(running_query, query_str->str);
                 strstrip_on_gstring(running_query);
+                query_matcher_free(running_matcher);
+                running_matcher=query_compile(running_query->str);
+                result_queue_set_visible_rows(result_queue,
+                                              resultlist_get_visible_rows());
+                g_get_current_time(&running_query_sent);
+                waiting_for_first_result=TRUE;
                 running_query_id=queryrunner->run_query(queryrunner, running_query->str);
+                g_timeout_add(CONSOLIDATE_DELAY,
+                              consolidate_query,
+                              GUINT_TO_POINTER(running_query_id));
+        }
+        return FALSE;
+}
+
+/**
+ * Ask the query runner for more results, if the user is still
+ * waiting for the results of the same query (gtk timeout callback)
+ *
+ * @param userdata ID of the query to consolidate
+ */
+static gboolean consolidate_query(gpointer userdata)
+{
+        QueryId query_id = GPOINTER_TO_UINT(userdata);
+
+        if(queryrunner_started
+           && running_query_id!=0
+           && running_query_id==query_id) {
+                queryrunner->consolidate(queryrunner);
         }
         return FALSE;
 }
@@ -206,14 +269,29 @@ static gboolean run_query(gpointer userdata)
  * the window, and set the timeout for actually
  * running the query if the user waits long enough
  * for it to be worth it.
+ *
+ * There's only ever one such timeout; a new keystroke
+ * replaces it. The delay is chosen by debounce.h.
  */
 static void set_query_string()
 {
+        guint delay;
+
         strncpy(query_label_text, query_str->str, query_label_text_len-1);
         gtk_label_set_text(GTK_LABEL(query_label), query_label_text);
         resultlist_set_current_query(query_str->str);
         running_query_id=0;
-        g_timeout_add(300, run_query, NULL/*userdata*/);
+        waiting_for_first_result=FALSE;
+        if(run_query_source!=0) {
+                g_source_remove(run_query_source);
+                run_query_source=0;
+        }
+        delay=debounce_delay(&debounce);
+        if(delay==0) {
+                run_query(NULL/*userdata*/);
+        } else {
+                run_query_source=g_timeout_add(delay, run_query, NULL/*userdata*/);
+        }
 }
 
 /**
@@ -225,6 +303,8 @@ static void reset_query_string()
 {
         g_string_assign(query_str, "");
         g_string_assign(running_query, "");
+        query_matcher_free(running_matcher);
+        running_matcher=query_compile("");
         *query_label_text='\0';
         gtk_label_set_text(GTK_LABEL(query_label), query_label_text);
         resultlist_clear();
@@ -241,11 +321,11 @@ static gboolean key_release_event_cb(GtkWidget* widget, GdkEventKey *ev, gpointe
 
         case GDK_Delete:
         case GDK_BackSpace:
+                debounce_keystroke(&debounce, ev->time);
                 if(query_str && query_str->len>0) {
                         g_string_truncate(query_str, query_str->len-1);
                         set_query_string();
                 }
-                last_keypress=ev->time;
                 return TRUE; /*handled*/
 
         case GDK_Return:
@@ -261,9 +341,9 @@ static gboolean key_release_event_cb(GtkWidget* widget, GdkEventKey *ev, gpointe
 
         default:
                 if(ev->string && ev->string[0]!='\0') {
+                        debounce_keystroke(&debounce, ev->time);
                         g_string_append(query_str, ev->string);
                         set_query_string();
-                        last_keypress=ev->time;
                         return TRUE;/*handled*/
                 }
                 break;
@@ -344,14 +424,3 @@ static gboolean execute_result(struct result *result)
         }
         return TRUE;
 }
-
-static gboolean verify_when_idle_cb(gpointer userdata)
-{
-        if(resultlist_verify_nth(verified)) {
-                verified++;
-                return TRUE/*continue*/;
-        } else {
-                verified=-1;
-                return FALSE/*remove*/;
-        }
-}
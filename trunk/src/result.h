@@ -72,6 +72,20 @@ struct result
          * @param self the result
          */
         void (*release)(struct result *self);
+
+        /**
+         * Pertinence of this result, according to the
+         * query runner, between 0 and 1. Results with a
+         * higher pertinence should be presented first.
+         */
+        float pertinence;
+
+        /**
+         * The name prepared by query_prepare(), so that it
+         * doesn't have to be prepared again each time it's matched
+         * against a query, or NULL if the result doesn't have it.
+         */
+        const char *prepared_name;
 };
 
 /** Result error quark */
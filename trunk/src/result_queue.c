@@ -1,10 +1,28 @@
 #include "result_queue.h"
+#include "trace.h"
 #include <glib.h>
 #include <string.h>
 /** \file
  * Implementation of the API defined in result_queue.h
  */
 
+/**
+ * Number of events in a block.
+ */
+#define BLOCK_SIZE 32
+
+/**
+ * Maximum number of blocks kept for reuse
+ * by a result queue.
+ */
+#define MAX_FREE_BLOCKS 16
+
+/**
+ * Weight of the last measure in the average
+ * dispatch time is 1/DISPATCH_TIME_SMOOTHING.
+ */
+#define DISPATCH_TIME_SMOOTHING 8
+
 /**
  * The public structure, struct result_queue, which
  * can also be seen as a source.
@@ -14,8 +32,24 @@ struct result_queue
         /** The corresponding GSource, so that one can be cast to the other. */
         GSource source;
 
-        /** Asynchronous queue */
-        GAsyncQueue* async_queue;
+        /** Protects the blocks and the other fields that say so */
+        GMutex *lock;
+
+        /**
+         * Blocks of events waiting to be dispatched, the oldest
+         * first; new events go to the last block, if there's room.
+         * Protected by lock.
+         */
+        struct event_block *first_block;
+
+        /** Last block of the list that starts with first_block */
+        struct event_block *last_block;
+
+        /**
+         * Number of events waiting to be dispatched, including
+         * the events of the block being dispatched. Atomic.
+         */
+        gint pending;
 
         /** result handler */
         result_queue_handler_f handler;
@@ -25,6 +59,52 @@ struct result_queue
 
         /** user data passed to constructor */
         gpointer userdata;
+
+        /**
+         * Blocks whose events have all been dispatched, kept to be
+         * reused by result_queue_add_batch(). Protected by lock.
+         */
+        GTrashStack *free_blocks;
+
+        /** Number of blocks in free_blocks */
+        int free_block_count;
+
+        /**
+         * Average time the handler takes (microseconds), see
+         * struct result_queue_stats. Protected by lock.
+         */
+        gulong dispatch_time;
+
+        /**
+         * See result_queue_set_visible_rows(). Protected by lock.
+         */
+        int visible_rows;
+
+        /**
+         * Latest query of each caller, struct current_query, see
+         * result_queue_set_current_query(). Protected by lock.
+         */
+        GArray *current_queries;
+
+        /**
+         * TRUE if a caller has started a new query since the
+         * queue was last purged of stale events. Protected by lock.
+         */
+        gboolean purge_needed;
+
+        /**
+         * Number of stale results discarded so far. Protected by lock.
+         */
+        guint dropped;
+};
+
+/**
+ * Latest query of a caller
+ */
+struct current_query
+{
+        struct queryrunner *caller;
+        QueryId query_id;
 };
 
 #define RESULT_QUEUE(source) ((struct result_queue *)(source))
@@ -39,6 +119,21 @@ struct event
         QueryId query_id;
 };
 
+/**
+ * Storage for several events, so that the events
+ * added at the same time are moved around together.
+ */
+struct event_block
+{
+        /** next block in the queue */
+        struct event_block *next;
+
+        /** number of events in the block */
+        int count;
+
+        struct event events[BLOCK_SIZE];
+};
+
 /** Number of result queues on the system.
  * This is not part of the public API and is meant
  * to be used only by test cases.
@@ -53,8 +148,13 @@ static gboolean result_queue_source_dispatch(GSource *source, GSourceFunc callba
 static void result_queue_source_finalize(GSource *source);
 
 /* ------------------------- prototypes: other */
-static struct event *event_new(struct result_queue *queue, struct queryrunner *caller, QueryId query_id, struct result *result);
-static void event_free(struct event *queue);
+static struct event_block *block_new_unlocked(struct result_queue *queue);
+static void block_free_unlocked(struct result_queue *queue, struct event_block *block);
+static struct event_block *block_pop(struct result_queue *queue);
+static gboolean is_stale_unlocked(struct result_queue *queue, struct queryrunner *caller, QueryId query_id);
+static GPtrArray *purge_unlocked(struct result_queue *queue, GPtrArray *stale);
+static void release_results(GPtrArray *results);
+static glong elapsed_us(GTimeVal *since);
 static gboolean source_callback(gpointer data);
 
 /* ------------------------- definitions */
@@ -80,10 +180,22 @@ struct result_queue* result_queue_new(GMainContext* context,
         queue = (struct result_queue *)
                 g_source_new(&source_functions,
                              sizeof(struct result_queue));
-        queue->async_queue=g_async_queue_new();
+        queue->lock=g_mutex_new();
+        queue->first_block=NULL;
+        queue->last_block=NULL;
+        queue->pending=0;
         queue->handler=handler;
         queue->main_context=context;
         queue->userdata=userdata;
+        queue->free_blocks=NULL;
+        queue->free_block_count=0;
+        queue->dispatch_time=0;
+        queue->visible_rows=0;
+        queue->current_queries=g_array_new(FALSE/*not zero-terminated*/,
+                                           FALSE/*don't clear*/,
+                                           sizeof(struct current_query));
+        queue->purge_needed=FALSE;
+        queue->dropped=0;
 
         g_source_set_callback(SOURCE(queue),
                               source_callback,
@@ -115,15 +227,122 @@ void result_queue_add(struct result_queue *queue,
                       QueryId query_id,
                       struct result *result)
 {
-        struct event *ev;
+        g_return_if_fail(result);
+
+        result_queue_add_batch(queue, caller, query_id, &result, 1);
+}
+
+void result_queue_add_batch(struct result_queue *queue,
+                            struct queryrunner *caller,
+                            QueryId query_id,
+                            struct result **results,
+                            int count)
+{
+        struct event_block *block;
+        GPtrArray *stale;
+        int i;
 
         /* WARNING: can be used by more than one thread at a time */
         g_return_if_fail(queue);
-        g_return_if_fail(result);
+        g_return_if_fail(results!=NULL || count==0);
+
+        if(count<=0) {
+                return;
+        }
+
+        stale=NULL;
+        g_mutex_lock(queue->lock);
+        if(queue->purge_needed) {
+                stale=purge_unlocked(queue, stale);
+        }
+        if(is_stale_unlocked(queue, caller, query_id)) {
+                /* the caller has started another query since */
+                queue->dropped+=count;
+                g_mutex_unlock(queue->lock);
+
+                for(i=0; i<count; i++) {
+                        results[i]->release(results[i]);
+                }
+                release_results(stale);
+                return;
+        }
+        block=queue->last_block;
+        for(i=0; i<count; i++) {
+                struct event *ev;
+
+                if(block==NULL || block->count==BLOCK_SIZE) {
+                        block=block_new_unlocked(queue);
+                        if(queue->last_block==NULL) {
+                                queue->first_block=block;
+                        } else {
+                                queue->last_block->next=block;
+                        }
+                        queue->last_block=block;
+                }
+                ev=&block->events[block->count];
+                ev->queue=queue;
+                ev->caller=caller;
+                ev->result=results[i];
+                ev->query_id=query_id;
+                block->count++;
+        }
+        g_atomic_int_add(&queue->pending, count);
+        g_mutex_unlock(queue->lock);
 
-        ev = event_new(queue, caller, query_id, result);
-        g_async_queue_push(queue->async_queue, ev);
         g_main_context_wakeup(queue->main_context);
+        release_results(stale);
+}
+
+void result_queue_set_current_query(struct result_queue *queue,
+                                    struct queryrunner *caller,
+                                    QueryId query_id)
+{
+        struct current_query *current;
+        guint i;
+
+        g_return_if_fail(queue);
+
+        g_mutex_lock(queue->lock);
+        for(i=0; i<queue->current_queries->len; i++) {
+                current=&g_array_index(queue->current_queries, struct current_query, i);
+                if(current->caller==caller) {
+                        break;
+                }
+        }
+        if(i==queue->current_queries->len) {
+                struct current_query new_current;
+
+                new_current.caller=caller;
+                new_current.query_id=query_id;
+                g_array_append_val(queue->current_queries, new_current);
+        } else {
+                current=&g_array_index(queue->current_queries, struct current_query, i);
+                current->query_id=query_id;
+        }
+        queue->purge_needed=TRUE;
+        g_mutex_unlock(queue->lock);
+}
+
+void result_queue_get_stats(struct result_queue *queue, struct result_queue_stats *stats)
+{
+        g_return_if_fail(queue);
+        g_return_if_fail(stats);
+
+        stats->backlog=MAX(0, g_atomic_int_get(&queue->pending));
+        g_mutex_lock(queue->lock);
+        stats->dispatch_time=queue->dispatch_time;
+        stats->visible_rows=queue->visible_rows;
+        stats->dropped=queue->dropped;
+        g_mutex_unlock(queue->lock);
+}
+
+void result_queue_set_visible_rows(struct result_queue *queue, int rows)
+{
+        g_return_if_fail(queue);
+
+        g_mutex_lock(queue->lock);
+        queue->visible_rows=MAX(0, rows);
+        g_mutex_unlock(queue->lock);
 }
 
 /* ------------------------- member functions: result_queue_source */
@@ -146,7 +365,7 @@ static gboolean result_queue_source_prepare(GSource *source, gint *timeout)
         g_return_val_if_fail(source, FALSE);
         queue = (struct result_queue *)source;
         *timeout=-1;
-        return g_async_queue_length(queue->async_queue)>0;
+        return g_atomic_int_get(&queue->pending)>0;
 }
 
 /**
@@ -159,12 +378,20 @@ static gboolean result_queue_source_check(GSource *source)
 
         g_return_val_if_fail(source, FALSE);
         queue = (struct result_queue *)source;
-        return g_async_queue_length(queue->async_queue)>0;
+        return g_atomic_int_get(&queue->pending)>0;
 }
 
 /**
  * Call the GSource callback.
  *
+ * The events are taken one block at a time. The time the
+ * callback takes is measured, to compute the average dispatch time.
+ *
+ * Events that have gone stale since they were added, because their
+ * caller has started another query, are released without calling
+ * the callback. Most of them should have been purged by
+ * result_queue_add_batch() already, on the thread of the query runner.
+ *
  * @param source
  * @param callback callback function, which may be NULL
  * @param user_data ignored
@@ -173,15 +400,57 @@ static gboolean result_queue_source_check(GSource *source)
 static gboolean result_queue_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
 {
         struct result_queue *queue;
-        struct event *ev;
+        struct event_block *block;
 
         g_return_val_if_fail(source, FALSE);
         g_return_val_if_fail(callback==source_callback, FALSE);
 
         queue = RESULT_QUEUE(source);
-        while( (ev=(struct event *)g_async_queue_try_pop(queue->async_queue)) != NULL) {
-                callback(ev);
-                event_free(ev);
+        while( (block=block_pop(queue)) != NULL) {
+                gboolean stale[BLOCK_SIZE];
+                gulong dispatch_time;
+                int i;
+
+                g_mutex_lock(queue->lock);
+                dispatch_time=queue->dispatch_time;
+                for(i=0; i<block->count; i++) {
+                        stale[i]=is_stale_unlocked(queue,
+                                                   block->events[i].caller,
+                                                   block->events[i].query_id);
+                        if(stale[i]) {
+                                queue->dropped++;
+                        }
+                }
+                g_mutex_unlock(queue->lock);
+
+                for(i=0; i<block->count; i++) {
+                        struct event *ev = &block->events[i];
+                        GTimeVal start;
+                        glong elapsed;
+
+                        if(stale[i]) {
+                                ev->result->release(ev->result);
+                                g_atomic_int_add(&queue->pending, -1);
+                                continue;
+                        }
+                        g_get_current_time(&start);
+                        callback(ev);
+                        elapsed=elapsed_us(&start);
+                        TRACE(TRACE_RESULT_DISPATCH, ev->query_id, elapsed, NULL);
+                        g_atomic_int_add(&queue->pending, -1);
+
+                        if(dispatch_time==0) {
+                                dispatch_time=elapsed;
+                        } else {
+                                dispatch_time=(dispatch_time*(DISPATCH_TIME_SMOOTHING-1)+elapsed)
+                                        /DISPATCH_TIME_SMOOTHING;
+                        }
+                }
+
+                g_mutex_lock(queue->lock);
+                queue->dispatch_time=dispatch_time;
+                block_free_unlocked(queue, block);
+                g_mutex_unlock(queue->lock);
         }
         return TRUE;
 }
@@ -198,49 +467,221 @@ static gboolean result_queue_source_dispatch(GSource *source, GSourceFunc callba
 static void result_queue_source_finalize(GSource *source)
 {
         struct result_queue *queue;
-        GAsyncQueue* async_queue;
-        struct event *ev;
+        struct event_block *block;
 
         g_return_if_fail(source);
         queue = RESULT_QUEUE(source);
-        async_queue = queue->async_queue;
-        g_async_queue_lock(async_queue);
-
-        /* Just in case: empty the queue, release the results and unreference */
-        while((ev=(struct event *)g_async_queue_try_pop_unlocked(async_queue))!=NULL) {
-                struct result *result = ev->result;
-                if(result && result->release) {
-                        result->release(result);
+
+        /* Just in case: empty the queue and release the results */
+        while((block=block_pop(queue))!=NULL) {
+                int i;
+
+                for(i=0; i<block->count; i++) {
+                        struct result *result = block->events[i].result;
+                        if(result && result->release) {
+                                result->release(result);
+                        }
                 }
-                event_free(ev);
+                g_free(block);
+        }
+        while((block=(struct event_block *)g_trash_stack_pop(&queue->free_blocks))!=NULL) {
+                g_free(block);
         }
-        g_async_queue_unref_and_unlock(async_queue);
+        g_array_free(queue->current_queries, TRUE/*free segment*/);
+        g_mutex_free(queue->lock);
         result_queue_counter--;
 }
 
 /* ------------------------- static functions */
 
-static struct event *event_new(struct result_queue *queue,
-                               struct queryrunner *caller,
-                               QueryId query_id,
-                               struct result *result)
+/**
+ * Get a new, empty block, reusing a free block if possible.
+ *
+ * The lock of the queue must be held by the caller.
+ */
+static struct event_block *block_new_unlocked(struct result_queue *queue)
+{
+        struct event_block *block;
+
+        block = (struct event_block *)g_trash_stack_pop(&queue->free_blocks);
+        if(block) {
+                queue->free_block_count--;
+        } else {
+                block = g_new(struct event_block, 1);
+        }
+        block->next=NULL;
+        block->count=0;
+        return block;
+}
+
+/**
+ * Give back a block whose events have all been dispatched,
+ * with the lock of the queue already held by the caller.
+ */
+static void block_free_unlocked(struct result_queue *queue, struct event_block *block)
+{
+        g_return_if_fail(block);
+
+        if(queue->free_block_count<MAX_FREE_BLOCKS) {
+                /* a struct event_block is larger than a GTrashStack */
+                g_trash_stack_push(&queue->free_blocks, block);
+                queue->free_block_count++;
+        } else {
+                g_free(block);
+        }
+}
+
+/**
+ * Take the oldest block out of the queue.
+ *
+ * Once it's out of the queue, the block belongs to the caller and
+ * no events will be added into it, so it can be read without a lock.
+ *
+ * @return a block, or NULL if the queue is empty
+ */
+static struct event_block *block_pop(struct result_queue *queue)
+{
+        struct event_block *block;
+
+        g_mutex_lock(queue->lock);
+        block=queue->first_block;
+        if(block!=NULL) {
+                queue->first_block=block->next;
+                if(queue->first_block==NULL) {
+                        queue->last_block=NULL;
+                }
+                block->next=NULL;
+        }
+        g_mutex_unlock(queue->lock);
+        return block;
+}
+
+/**
+ * Check whether the caller of an event has started another
+ * query since, with the lock of the queue already held.
+ *
+ * @param queue
+ * @param caller origin of the event
+ * @param query_id query of the event
+ * @return TRUE if the event is stale and should be discarded
+ */
+static gboolean is_stale_unlocked(struct result_queue *queue, struct queryrunner *caller, QueryId query_id)
 {
-        struct event *retval;
+        guint i;
 
-        g_return_val_if_fail(result!=NULL, NULL);
+        for(i=0; i<queue->current_queries->len; i++) {
+                struct current_query *current;
+
+                current=&g_array_index(queue->current_queries, struct current_query, i);
+                if(current->caller==caller) {
+                        return query_id<current->query_id;
+                }
+        }
+        return FALSE;
+}
+
+/**
+ * Take the stale events out of the queue, with the lock of the
+ * queue already held.
+ *
+ * The results of the stale events must be released by the caller,
+ * after the lock has been released, with release_results().
+ *
+ * @param queue
+ * @param stale array to append the results of the stale events
+ * to or NULL
+ * @return the array the results have been appended to, which might
+ * be a new array, or NULL if there were no stale events and stale
+ * was NULL
+ */
+static GPtrArray *purge_unlocked(struct result_queue *queue, GPtrArray *stale)
+{
+        struct event_block *block;
+        struct event_block *previous;
+        struct event_block *next;
+        int removed;
+
+        removed=0;
+        previous=NULL;
+        for(block=queue->first_block; block!=NULL; block=next) {
+                int from;
+                int to;
+
+                next=block->next;
+                to=0;
+                for(from=0; from<block->count; from++) {
+                        struct event *ev = &block->events[from];
+
+                        if(is_stale_unlocked(queue, ev->caller, ev->query_id)) {
+                                if(stale==NULL) {
+                                        stale=g_ptr_array_new();
+                                }
+                                g_ptr_array_add(stale, ev->result);
+                                removed++;
+                        } else {
+                                if(to!=from) {
+                                        block->events[to]=*ev;
+                                }
+                                to++;
+                        }
+                }
+                block->count=to;
+
+                if(block->count==0) {
+                        /* unlink the empty block */
+                        if(previous==NULL) {
+                                queue->first_block=next;
+                        } else {
+                                previous->next=next;
+                        }
+                        if(queue->last_block==block) {
+                                queue->last_block=previous;
+                        }
+                        block_free_unlocked(queue, block);
+                } else {
+                        previous=block;
+                }
+        }
+        queue->dropped+=removed;
+        g_atomic_int_add(&queue->pending, -removed);
+        queue->purge_needed=FALSE;
+        return stale;
+}
 
+/**
+ * Release the results collected by purge_unlocked() and
+ * free the array.
+ *
+ * @param results array of struct result * or NULL
+ */
+static void release_results(GPtrArray *results)
+{
+        guint i;
 
-        retval = g_new(struct event, 1);
-        retval->queue=queue;
-        retval->caller=caller;
-        retval->result=result;
-        retval->query_id=query_id;
-        return retval;
+        if(results==NULL) {
+                return;
+        }
+        for(i=0; i<results->len; i++) {
+                struct result *result = (struct result *)g_ptr_array_index(results, i);
+                result->release(result);
+        }
+        g_ptr_array_free(results, TRUE/*free segment*/);
 }
-static void event_free(struct event *event)
+
+/**
+ * Time elapsed since some point in time.
+ *
+ * @return elapsed time in microseconds, at least 1
+ */
+static glong elapsed_us(GTimeVal *since)
 {
-        g_return_if_fail(event);
-        g_free(event);
+        GTimeVal now;
+        glong elapsed;
+
+        g_get_current_time(&now);
+        elapsed=(now.tv_sec-since->tv_sec)*G_USEC_PER_SEC
+                + (now.tv_usec-since->tv_usec);
+        return MAX(1, elapsed);
 }
 
 /**
@@ -258,6 +699,8 @@ static gboolean source_callback(gpointer data)
 
         ev = (struct event*)data;
         element.caller=ev->caller;
+        /* events don't keep the query */
+        element.query=NULL;
         element.query_id=ev->query_id;
         element.result=ev->result;
         ev->queue->handler(&element, ev->queue->userdata);
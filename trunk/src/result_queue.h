@@ -11,7 +11,9 @@
  * glib/gdk main loop.
  *
  * A result queue is mainly a GSource based on
- * a GAsyncQueue.
+ * a list of blocks of results. Results that are
+ * added together travel together, in the same block,
+ * and cost one lock and one wakeup of the main loop.
  *
  * A result queue is meant to be used by several
  * threads at the same time, with one thread
@@ -53,6 +55,40 @@ struct result_queue_element
         struct result *result;
 };
 
+/**
+ * How fast the results sent into a queue are consumed.
+ *
+ * Query runners use it to decide how many results to send
+ * at once and how long to wait before sending more.
+ */
+struct result_queue_stats
+{
+        /**
+         * Number of results waiting to be passed to the handler
+         */
+        guint backlog;
+
+        /**
+         * Average time the handler takes to process one
+         * result, in microseconds, or 0 if it's not known yet
+         */
+        gulong dispatch_time;
+
+        /**
+         * Number of results the user can see at once, or 0
+         * if it's not known, see result_queue_set_visible_rows()
+         */
+        int visible_rows;
+
+        /**
+         * Number of results that have been discarded without
+         * being passed to the handler, because they belonged
+         * to a query that had been superseded, see
+         * result_queue_set_current_query()
+         */
+        guint dropped;
+};
+
 /**
  * A new result was added into the query queue.
  *
@@ -110,4 +146,64 @@ void result_queue_delete(struct result_queue* queue);
  */
 void result_queue_add(struct result_queue *queue, struct queryrunner *caller, QueryId query_id, struct result *result);
 
+/**
+ * Put several results of the same query into the queue, in order.
+ *
+ * It's the same as calling result_queue_add() for each
+ * result, only much cheaper.
+ *
+ * This call is thread-safe.
+ *
+ * @param queue
+ * @param caller query runner that added these results, see result_queue_add()
+ * @param query_id ID of the query that's being run
+ * @param results the results. The results now belong to the queue, but
+ * the array itself still belongs to the caller.
+ * @param count number of results in the array
+ */
+void result_queue_add_batch(struct result_queue *queue, struct queryrunner *caller, QueryId query_id, struct result **results, int count);
+
+/**
+ * Tell the queue that a query runner has started a new query.
+ *
+ * From then on, the results this caller sends for older queries
+ * are not passed to the handler anymore; they are released
+ * instead. Most of them are released by result_queue_add_batch(),
+ * on the thread of the query runner, so that the main loop
+ * doesn't have to deal with them.
+ *
+ * Query runners call this function from run_query(), before
+ * they return the new ID. A caller that never calls this
+ * function gets all its results passed to the handler.
+ *
+ * This call is thread-safe.
+ *
+ * @param queue
+ * @param caller the query runner that sends the results
+ * @param query_id the new ID; the IDs of a caller must only increase
+ */
+void result_queue_set_current_query(struct result_queue *queue, struct queryrunner *caller, QueryId query_id);
+
+/**
+ * Get the current state of the queue.
+ *
+ * This call is thread-safe.
+ *
+ * @param queue
+ * @param stats structure to fill (out)
+ */
+void result_queue_get_stats(struct result_queue *queue, struct result_queue_stats *stats);
+
+/**
+ * Tell the query runners how many results the user
+ * can see at once.
+ *
+ * This call is thread-safe.
+ *
+ * @param queue
+ * @param rows number of results that fit on the screen, 0 if
+ * it's not known
+ */
+void result_queue_set_visible_rows(struct result_queue *queue, int rows);
+
 #endif /*RESULT_QUEUE_H*/
@@ -37,6 +37,24 @@ struct mock_result
 #define PRODUCER_THREAD_RESULT_COUNT 1000
 #define PRODUCER_COUNT 10
 
+/** Number of results sent by test_throughput() */
+#define THROUGHPUT_RESULT_COUNT 50000
+/** Number of results added at once by test_throughput(), in batch mode */
+#define THROUGHPUT_BATCH 32
+
+/**
+ * Data shared by the producer and the consumer
+ * of test_throughput()
+ */
+struct throughput
+{
+        struct result_queue *queue;
+        GMainLoop *loop;
+        struct mock_result *mocks;
+        gboolean batch;
+        int dispatched;
+};
+
 static GPrivate* thread_identity;
 static GMutex* thread_mutex;
 static struct result_queue *thread_queue;
@@ -57,6 +75,10 @@ static struct result_queue* process_queue(void);
 static void assert_all_released(void);
 static gpointer producer_thread(gpointer mocks);
 static void test_add_result_from_several_thread_handler(struct result_queue_element *element, gpointer userdata);
+static double measure_throughput(gboolean batch);
+static gpointer throughput_producer(gpointer userdata);
+static void throughput_handler(struct result_queue_element *element, gpointer userdata);
+static void handler_count_current(struct result_queue_element *element, gpointer userdata);
 
 /* ------------------------- definitions */
 static struct mock_result results[] = {
@@ -209,6 +231,89 @@ START_TEST(test_add_result_from_several_threads)
 }
 END_TEST
 
+START_TEST(test_add_batch)
+{
+        struct result_queue* queue;
+        struct result *batch[RESULTS_LEN];
+        int i;
+
+        TEST_HEADER(test_add_batch);
+
+        queue = result_queue_new(NULL/*no context*/,
+                                 handler_release,
+                                 NULL/*userdata*/);
+        for(i=0; i<RESULTS_LEN; i++) {
+                batch[i]=&results[i].result;
+        }
+        result_queue_add_batch(queue, NULL/*query runner*/, 19/*query_id*/, batch, 2);
+        result_queue_add_batch(queue, NULL/*query runner*/, 19/*query_id*/, batch+2, RESULTS_LEN-2);
+        loop_as_long_as_necessary();
+        assert_all_released();
+        result_queue_delete(queue);
+}
+END_TEST
+
+START_TEST(test_drop_stale)
+{
+        struct result_queue* queue;
+        struct queryrunner runner;
+        struct queryrunner other_runner;
+        struct result_queue_stats stats;
+        int dispatched;
+
+        TEST_HEADER(test_drop_stale);
+
+        dispatched=0;
+        queue = result_queue_new(NULL/*no context*/,
+                                 handler_count_current,
+                                 &dispatched/*userdata*/);
+        result_queue_set_current_query(queue, &runner, 1);
+        result_queue_add(queue, &runner, 1, &results[0].result);
+        result_queue_add(queue, &runner, 1, &results[1].result);
+        result_queue_add(queue, &other_runner, 1, &results[2].result);
+
+        result_queue_set_current_query(queue, &runner, 2);
+        /* results of query 1 already in the queue are
+         * purged by the next call to result_queue_add() */
+        result_queue_add(queue, &runner, 1, &results[3].result);
+        fail_unless(results[0].released, "queued result not purged");
+        fail_unless(results[1].released, "queued result not purged");
+        fail_unless(results[3].released, "stale result not dropped");
+        fail_unless(!results[2].released, "result of another runner dropped");
+
+        result_queue_add(queue, &runner, 2, &results[4].result);
+        result_queue_add(queue, &runner, 3, &results[5].result);
+        loop_as_long_as_necessary();
+        assert_all_released();
+        fail_unless(dispatched==3, "wrong number of results dispatched");
+
+        result_queue_get_stats(queue, &stats);
+        fail_unless(stats.dropped==3, "wrong number of results dropped");
+        result_queue_delete(queue);
+}
+END_TEST
+
+/**
+ * Compare the number of events per second a queue can
+ * handle, when results are added one by one and in batches.
+ */
+START_TEST(test_throughput)
+{
+        double single;
+        double batch;
+
+        TEST_HEADER(test_throughput);
+
+        single=measure_throughput(FALSE/*one by one*/);
+        batch=measure_throughput(TRUE/*batch*/);
+        printf("throughput: %.0f events/s one by one, %.0f events/s in batches of %d\n",
+               single,
+               batch,
+               THROUGHPUT_BATCH);
+        fail_unless(single>0 && batch>0, "no throughput");
+}
+END_TEST
+
 /* ------------------------- member functions: mock_result */
 
 static gboolean mock_result_execute(struct result *_result, GError **err)
@@ -245,6 +350,9 @@ static Suite *result_queue_check_suite(void)
         tcase_add_test(tc_core, test_quit);
         tcase_add_test(tc_core, test_gtk_loop);
         tcase_add_test(tc_core, test_add_result_from_several_threads);
+        tcase_add_test(tc_core, test_add_batch);
+        tcase_add_test(tc_core, test_drop_stale);
+        tcase_add_test(tc_core, test_throughput);
         return s;
 }
 
@@ -356,4 +464,110 @@ static void test_add_result_from_several_thread_handler(struct result_queue_elem
         }
 }
 
+/**
+ * Send THROUGHPUT_RESULT_COUNT results through a queue
+ * from another thread.
+ *
+ * @param batch if TRUE, add the results in batches, otherwise
+ * add them one by one
+ * @return events per second
+ */
+static double measure_throughput(gboolean batch)
+{
+        struct throughput data;
+        GThread *producer;
+        GTimer *timer;
+        double elapsed;
+        int i;
+
+        data.loop=g_main_loop_new(NULL/*default context*/, FALSE/*not running*/);
+        data.queue=result_queue_new(NULL/*no context*/,
+                                    throughput_handler,
+                                    &data/*userdata*/);
+        data.mocks=g_new(struct mock_result, THROUGHPUT_RESULT_COUNT);
+        data.batch=batch;
+        data.dispatched=0;
+        for(i=0; i<THROUGHPUT_RESULT_COUNT; i++) {
+                data.mocks[i].result.name="resultx";
+                data.mocks[i].result.long_name="resultx (long)";
+                data.mocks[i].result.path="resultx/path";
+                data.mocks[i].result.release=mock_result_release;
+                data.mocks[i].result.validate=mock_result_validate;
+                data.mocks[i].result.execute=mock_result_execute;
+                data.mocks[i].executed=FALSE;
+                data.mocks[i].released=FALSE;
+        }
+
+        timer=g_timer_new();
+        producer=g_thread_create(throughput_producer,
+                                 &data,
+                                 TRUE/*joinable*/,
+                                 NULL/*error*/);
+        g_main_loop_run(data.loop);
+        g_timer_stop(timer);
+        g_thread_join(producer);
+        elapsed=g_timer_elapsed(timer, NULL/*microseconds*/);
+
+        for(i=0; i<THROUGHPUT_RESULT_COUNT; i++) {
+                fail_unless(data.mocks[i].released, "mock not released");
+        }
+
+        g_timer_destroy(timer);
+        result_queue_delete(data.queue);
+        g_main_loop_unref(data.loop);
+        g_free(data.mocks);
+        return elapsed>0 ? THROUGHPUT_RESULT_COUNT/elapsed:0;
+}
+
+static gpointer throughput_producer(gpointer userdata)
+{
+        struct throughput *data = (struct throughput *)userdata;
+        struct result *batch[THROUGHPUT_BATCH];
+        int i;
+        int j;
+
+        for(i=0; i<THROUGHPUT_RESULT_COUNT; i+=j) {
+                if(data->batch) {
+                        for(j=0; j<THROUGHPUT_BATCH && i+j<THROUGHPUT_RESULT_COUNT; j++) {
+                                batch[j]=&data->mocks[i+j].result;
+                        }
+                        result_queue_add_batch(data->queue,
+                                               NULL/*runner*/,
+                                               19/*query_id*/,
+                                               batch,
+                                               j);
+                } else {
+                        result_queue_add(data->queue,
+                                         NULL/*runner*/,
+                                         19/*query_id*/,
+                                         &data->mocks[i].result);
+                        j=1;
+                }
+        }
+        return NULL;
+}
+
+static void throughput_handler(struct result_queue_element *element, gpointer userdata)
+{
+        struct throughput *data = (struct throughput *)userdata;
+
+        element->result->release(element->result);
+        data->dispatched++;
+        if(data->dispatched==THROUGHPUT_RESULT_COUNT) {
+                g_main_loop_quit(data->loop);
+        }
+}
+
+/**
+ * Count the results that are passed to the handler and
+ * release them.
+ *
+ * @param userdata a pointer to the counter (int *)
+ */
+static void handler_count_current(struct result_queue_element *element, gpointer userdata)
+{
+        int *dispatched = (int *)userdata;
 
+        (*dispatched)++;
+        element->result->release(element->result);
+}
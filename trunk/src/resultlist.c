@@ -1,8 +1,21 @@
 #include "resultlist.h"
 #include "query.h"
+#include "validator.h"
 #include <string.h>
 #include <ctype.h>
 
+/**
+ * Number of seconds the validity of a result is
+ * remembered.
+ */
+#define VALIDITY_TTL 30
+
+/**
+ * Number of results resultlist_verify_all() sends
+ * to the validator at a time.
+ */
+#define VERIFY_CHUNK 16
+
 /**
  * Container for a result and some associated
  * data.
@@ -15,6 +28,17 @@ struct resultholder
         const char *label_markup;
         /** true if it's been executed */
         gboolean executed;
+        /**
+         * Number of checks of the result the validator
+         * hasn't answered yet. The holder can only be freed
+         * once it's 0.
+         */
+        int checking;
+        /**
+         * true if the holder has been removed from the list while
+         * it was being checked; it'll be freed once the check is over
+         */
+        gboolean removed;
 };
 
 /**
@@ -43,18 +67,38 @@ static GHashTable *hash;
 /** List selection */
 static GtkTreeSelection *selection;
 
+/** Last value computed by resultlist_get_visible_rows() */
+static int visible_rows;
+
+/** Checks the results in the background */
+static struct validator *validator;
+
+/**
+ * Next row resultlist_verify_all() will check, NULL before
+ * the first chunk. The reference follows the row when the rows
+ * before it are removed. Only valid while verify_source!=0
+ */
+static GtkTreeRowReference *verify_next;
+
+/** ID of the idle source of resultlist_verify_all() or 0 */
+static guint verify_source;
+
 /* ------------------------- prototypes */
 static void row_inserted_cb(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer userdata);
 static void row_deleted_cb(GtkTreeModel *model, GtkTreePath *path, gpointer userdata);
 static void select_first_row_if_no_selection(void);
-static struct resultholder *resultholder_new(const char *query, struct result *result);
-static void resultholder_refresh(const char *query, struct resultholder *self);
+static struct resultholder *resultholder_new(const struct query_matcher *matcher, struct result *result);
+static gboolean resultholder_refresh(const struct query_matcher *matcher, struct resultholder *self);
 static void resultholder_delete(struct resultholder *self);
+static void resultholder_free(struct resultholder *self);
+static void resultholder_check(struct resultholder *self);
+static void validator_done_cb(struct result *result, gboolean valid, gpointer userdata);
+static gboolean verify_chunk_cb(gpointer userdata);
 static void append_markup_escaped(GString *gstr, const char *str);
-static void append_query_pango_highlight(GString *gstr, const char *query, const char *str, const char *on, const char *off);
-static const char *create_highlighted_label_markup(const char *query, struct result  *result);
+static const char *create_highlighted_label_markup(const struct query_matcher *matcher, struct result *result, gboolean *matches_out);
 static void cell_name_data_func(GtkTreeViewColumn* col, GtkCellRenderer* renderer, GtkTreeModel* model, GtkTreeIter* iter, gpointer userdata);
 static gboolean verify_iter(GtkTreeIter *iter);
+static void remove_holder(struct resultholder *holder);
 
 /* ------------------------- public functions */
 void resultlist_init()
@@ -83,6 +127,10 @@ void resultlist_init()
 
         selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(view));
 
+        validator = validator_new(NULL/*default context*/,
+                                  validator_done_cb,
+                                  VALIDITY_TTL);
+
         hash=g_hash_table_new_full(g_str_hash,
                                    g_str_equal,
                                    g_free/*key_destroy_func*/,
@@ -136,6 +184,9 @@ void resultlist_executed(struct result *result)
 void resultlist_set_current_query(const char *query)
 {
         GtkTreeIter iter;
+        struct query_matcher *matcher;
+
+        matcher=query_compile(query);
 
         if(gtk_tree_model_get_iter_first(GTK_TREE_MODEL(model),
                                          &iter)) {
@@ -143,8 +194,7 @@ void resultlist_set_current_query(const char *query)
                 do {
                         struct resultholder *holder;
                         gtk_tree_model_get(GTK_TREE_MODEL(model), &iter, 0, &holder, -1);
-                        if(query_result_ismatch(query, holder->result)) {
-                                /* update the label */resultholder_refresh(query, holder);
+                        if(resultholder_refresh(matcher, holder)) {
                                 /* make sure viewers are told about this change */
                                 gtk_list_store_set(model, &iter,
                                                    0,
@@ -157,6 +207,7 @@ void resultlist_set_current_query(const char *query)
                         }
                 } while(go_on);
         }
+        query_matcher_free(matcher);
 }
 
 GtkWidget *resultlist_get_widget()
@@ -179,15 +230,26 @@ struct result *resultlist_get_selected()
         return NULL;
 }
 
-void resultlist_add_result(const char *query, struct result *result)
+/**
+ * The result is only checked on the main thread if the
+ * validator already knows the answer. Otherwise, it's added
+ * and checked in the background.
+ */
+void resultlist_add_result(const struct query_matcher *matcher, struct result *result)
 {
         GtkTreeIter iter;
         const char *path = result->path;
+        enum ValidatorValidity validity;
 
-        if(g_hash_table_lookup(hash, path) || !result->validate(result)) {
+        if(g_hash_table_lookup(hash, path)) {
+                result->release(result);
+                return;
+        }
+        validity = validator_get_cached(validator, path);
+        if(validity==VALIDATOR_INVALID) {
                 result->release(result);
         } else {
-                struct resultholder *holder = resultholder_new(query, result);
+                struct resultholder *holder = resultholder_new(matcher, result);
                 gtk_list_store_append(model, &iter);
                 gtk_list_store_set(model, &iter,
                                    0,
@@ -196,6 +258,9 @@ void resultlist_add_result(const char *query, struct result *result)
                 g_hash_table_insert(hash,
                                     g_strdup(result->path),
                                     holder);
+                if(validity==VALIDATOR_UNKNOWN) {
+                        resultholder_check(holder);
+                }
         }
 }
 
@@ -203,27 +268,38 @@ void resultlist_add_result(const char *query, struct result *result)
 
 void resultlist_verify_all(void)
 {
-        GtkTreeIter iter;
-        if(gtk_tree_model_get_iter_first(GTK_TREE_MODEL(model),
-                                         &iter)) {
-                gboolean go_on;
-                do {
-                        go_on = verify_iter(&iter);
-                } while(go_on);
+        if(verify_source!=0) {
+                return;
         }
+        verify_next=NULL;
+        verify_source=g_idle_add(verify_chunk_cb, NULL/*data*/);
 }
 
-gboolean resultlist_verify_nth(int index)
+/**
+ * The height of a row is only known while there's a row
+ * on the list, so the last value computed is kept.
+ */
+int resultlist_get_visible_rows(void)
 {
-        GtkTreeIter iter;
-        if(gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(model),
-                                         &iter,
-                                         NULL/*parent=root*/,
-                                         index)) {
-                return verify_iter(&iter);
-        } else {
-                return FALSE;
+        GdkRectangle visible;
+        GdkRectangle row;
+        GtkTreePath *path;
+
+        if(!GTK_WIDGET_REALIZED(view)) {
+                return visible_rows;
+        }
+
+        path=gtk_tree_path_new_first();
+        gtk_tree_view_get_background_area(GTK_TREE_VIEW(view),
+                                          path,
+                                          NULL/*column*/,
+                                          &row);
+        gtk_tree_path_free(path);
+        if(row.height>0) {
+                gtk_tree_view_get_visible_rect(GTK_TREE_VIEW(view), &visible);
+                visible_rows=visible.height/row.height;
         }
+        return visible_rows;
 }
 
 /* ------------------------- static functions */
@@ -264,77 +340,200 @@ static void select_first_row_if_no_selection()
 /**
  * Create a new result holder.
  *
+ * @param matcher query to highlight
  * @param result
  * @return a resultholder linked to the result
  */
-static struct resultholder *resultholder_new(const char *query,
+static struct resultholder *resultholder_new(const struct query_matcher *matcher,
                                              struct result *result)
 {
         struct resultholder *retval;
+        gboolean matches;
 
         g_return_val_if_fail(result, NULL);
 
         retval =  g_new(struct resultholder, 1);
         retval->result=result;
-        retval->label_markup=create_highlighted_label_markup(query, result);
+        retval->label_markup=create_highlighted_label_markup(matcher, result, &matches);
         retval->executed=FALSE;
+        retval->checking=0;
+        retval->removed=FALSE;
         return retval;
 }
 
 /**
  * Refresh a result holder, after a query has
  * changed, for example.
+ *
+ * The label is only changed if the result matches
+ * the new query.
+ *
+ * @param matcher new query
  * @param self old result holder
+ * @return TRUE if the result matches the query
  * @see #query_str
  */
-static void resultholder_refresh(const char *query,
-                                 struct resultholder *self)
+static gboolean resultholder_refresh(const struct query_matcher *matcher,
+                                     struct resultholder *self)
 {
-        g_return_if_fail(self);
+        const char *markup;
+        gboolean matches;
+
+        g_return_val_if_fail(self, FALSE);
+
+        markup=create_highlighted_label_markup(matcher, self->result, &matches);
+        if(!matches) {
+                g_free((void *)markup);
+                return FALSE;
+        }
         g_free((void *)self->label_markup);
-         self->label_markup=create_highlighted_label_markup(query, self->result);
+        self->label_markup=markup;
+        return TRUE;
 }
 
 /**
- * Free a result holder and the result in it.
+ * Free a result holder and the result in it, once
+ * it's not being checked anymore.
  * @param self result holder to free
  */
 static void resultholder_delete(struct resultholder *self)
 {
         g_return_if_fail(self);
+        if(self->checking>0) {
+                /* the validator is using the result; wait for it to give it back */
+                self->removed=TRUE;
+        } else {
+                resultholder_free(self);
+        }
+}
+
+/**
+ * Free a result holder and the result in it, now.
+ * @param self result holder to free
+ */
+static void resultholder_free(struct resultholder *self)
+{
         self->result->release(self->result);
         g_free((void *)self->label_markup);
         g_free(self);
 }
 
+/**
+ * Have the result of a holder checked in the background, unless
+ * it's being checked already.
+ * @param self result holder
+ */
+static void resultholder_check(struct resultholder *self)
+{
+        if(self->checking>0) {
+                return;
+        }
+        self->checking++;
+        validator_check(validator, self->result, self/*userdata*/);
+}
+
+/**
+ * A result has been checked (validator callback).
+ *
+ * Invalid results are removed from the list. Holders that
+ * have been removed while their result was being checked
+ * are freed.
+ *
+ * @param result
+ * @param valid
+ * @param userdata the struct resultholder
+ */
+static void validator_done_cb(struct result *result, gboolean valid, gpointer userdata)
+{
+        struct resultholder *holder = (struct resultholder *)userdata;
+
+        g_return_if_fail(holder!=NULL);
+        g_return_if_fail(holder->checking>0);
+
+        holder->checking--;
+        if(holder->removed) {
+                if(holder->checking==0) {
+                        resultholder_free(holder);
+                }
+        } else if(!valid) {
+                remove_holder(holder);
+        }
+}
+
+/**
+ * Send the next VERIFY_CHUNK rows to the validator (idle callback)
+ *
+ * If the next row has been removed since the last chunk,
+ * the pass starts over from the first row. The rows that
+ * have been checked already are in the validator's cache.
+ *
+ * @return TRUE as long as there are rows left
+ */
+static gboolean verify_chunk_cb(gpointer userdata)
+{
+        GtkTreeIter iter;
+        GtkTreePath *path;
+        gboolean go_on;
+        int i;
+
+        if(verify_next!=NULL && gtk_tree_row_reference_valid(verify_next)) {
+                path=gtk_tree_row_reference_get_path(verify_next);
+                go_on=gtk_tree_model_get_iter(GTK_TREE_MODEL(model), &iter, path);
+                gtk_tree_path_free(path);
+        } else {
+                go_on=gtk_tree_model_get_iter_first(GTK_TREE_MODEL(model), &iter);
+        }
+        if(verify_next!=NULL) {
+                gtk_tree_row_reference_free(verify_next);
+                verify_next=NULL;
+        }
+
+        for(i=0; go_on && i<VERIFY_CHUNK; i++) {
+                go_on=verify_iter(&iter);
+        }
+        if(go_on) {
+                path=gtk_tree_model_get_path(GTK_TREE_MODEL(model), &iter);
+                verify_next=gtk_tree_row_reference_new(GTK_TREE_MODEL(model), path);
+                gtk_tree_path_free(path);
+        } else {
+                verify_source=0;
+        }
+        return go_on;
+}
+
 static void append_markup_escaped(GString *gstr, const char *str)
 {
         char *escaped = g_markup_escape_text(str, -1);
         g_string_append(gstr, escaped);
         g_free(escaped);
 }
-static void append_query_pango_highlight(GString *gstr,
-                                                  const char *query,
-                                                  const char *str,
-                                                  const char *on,
-                                                  const char *off)
-{
-        const char *markup = query_pango_highlight(query, str, on, off);
-        g_string_append(gstr, markup);
-        g_free((void *)markup);
-}
-
-static const char *create_highlighted_label_markup(const char *query,
-                                                   struct result  *result)
+/**
+ * Create the label of a result, with the parts of its name
+ * that match the query highlighted.
+ *
+ * The name is matched and highlighted in a single pass,
+ * using the prepared name that comes with the result, if any.
+ *
+ * @param matcher query
+ * @param result
+ * @param matches_out set to TRUE if the name matches the query (out)
+ * @return pango markup, to free with g_free()
+ */
+static const char *create_highlighted_label_markup(const struct query_matcher *matcher,
+                                                   struct result *result,
+                                                   gboolean *matches_out)
 {
         const char *markup;
-        const char *name;
         GString *full;
 
-        name =  result->name;
         full =  g_string_new("");
         g_string_append(full, "<big><b>");
-        append_query_pango_highlight(full, query, name, "<u>", "</u>");
+        *matches_out=query_matcher_append_markup(matcher,
+                                                 full,
+                                                 result->name,
+                                                 result->prepared_name,
+                                                 "<u>",
+                                                 "</u>");
         g_string_append(full, "</b></big>\n<small>");
         append_markup_escaped(full, result->long_name);
         g_string_append(full, "</small>");
@@ -360,15 +559,41 @@ static void cell_name_data_func(GtkTreeViewColumn* col,
         }
 }
 
+/**
+ * Send the result of a row to the validator.
+ *
+ * @param iter the row, which is moved to the next row
+ * @return TRUE if there's a next row
+ */
 static gboolean verify_iter(GtkTreeIter *iter)
 {
         struct resultholder *holder;
 
         gtk_tree_model_get(GTK_TREE_MODEL(model), iter, 0, &holder, -1);
-        if(!holder->result->validate(holder->result)) {
-                g_hash_table_remove(hash, holder->result->path);
-                return gtk_list_store_remove(GTK_LIST_STORE(model), iter);
-        } else {
-                return gtk_tree_model_iter_next(GTK_TREE_MODEL(model), iter);
+        resultholder_check(holder);
+        return gtk_tree_model_iter_next(GTK_TREE_MODEL(model), iter);
+}
+
+/**
+ * Remove a holder from the list.
+ *
+ * @param holder a holder that's on the list
+ */
+static void remove_holder(struct resultholder *holder)
+{
+        GtkTreeIter iter;
+        gboolean go_on;
+
+        go_on=gtk_tree_model_get_iter_first(GTK_TREE_MODEL(model), &iter);
+        while(go_on) {
+                struct resultholder *current = NULL;
+
+                gtk_tree_model_get(GTK_TREE_MODEL(model), &iter, 0, &current, -1);
+                if(current==holder) {
+                        g_hash_table_remove(hash, holder->result->path);
+                        gtk_list_store_remove(GTK_LIST_STORE(model), &iter);
+                        return;
+                }
+                go_on=gtk_tree_model_iter_next(GTK_TREE_MODEL(model), &iter);
         }
 }
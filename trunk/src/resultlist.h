@@ -3,6 +3,7 @@
 
 #include <gtk/gtk.h>
 #include "result.h"
+#include "query.h"
 
 /** \file Maintain a gtk list view and model representing
  * the current result list.
@@ -41,10 +42,15 @@ void resultlist_clear(void);
 /**
  * Add a result to the list.
  *
- * @param query query for this result
+ * The result is added right away, unless it's already known
+ * to be invalid. It's then checked in the background and
+ * removed from the list if it turns out to be invalid.
+ *
+ * @param matcher compiled query for this result, whose
+ * matches are highlighted
  * @param result
  */
-void resultlist_add_result(const char *query, struct result *);
+void resultlist_add_result(const struct query_matcher *matcher, struct result *);
 
 /**
  * Tell the list that the given result has been executed.
@@ -71,18 +77,20 @@ void resultlist_set_current_query(const char *query);
  * This function should be called after long inactivity
  * periods, during which files may have been deleted or
  * removed or windows closed.
+ *
+ * The results are checked in the background, a few at a
+ * time, and removed from the list once they've been found
+ * to be invalid. Calling this function again before all results
+ * have been checked does nothing.
  */
 void resultlist_verify_all(void);
 
 /**
- * Verify one result and remove it.
+ * Get the number of results that can be seen without scrolling.
  *
- * @param index result index (starting at 0)
- * @return true if there's more after this one,
- * false if there's no more valid index after
- * this one or if the index was invalid to begin
- * with.
+ * @return a number of rows, or 0 if it can't be known
+ * because no result has ever been displayed
  */
-gboolean resultlist_verify_nth(int index);
+int resultlist_get_visible_rows(void);
 
 #endif
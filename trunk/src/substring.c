@@ -0,0 +1,256 @@
+/** \file
+ * Implementation of the API defined in substring.h
+ */
+
+#include "substring.h"
+#include <string.h>
+
+/*
+ * The SIMD kernels are compiled with target attributes, so that
+ * they're there even if the rest of the program is compiled for
+ * an older CPU, and only called if the CPU supports them.
+ */
+#if defined(__GNUC__) \
+        && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9)) \
+        && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#endif
+
+/**
+ * Kernel in use, a enum SubstringKernel, or -1 until
+ * it's been chosen. Atomic.
+ */
+static gint current_kernel = -1;
+
+/* ------------------------- prototypes */
+static enum SubstringKernel best_kernel(void);
+static gboolean is_supported(enum SubstringKernel kernel);
+static const char *find_scalar(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len);
+#ifdef HAVE_X86_KERNELS
+static const char *find_sse2(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len) __attribute__((target("sse2")));
+static const char *find_avx2(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len) __attribute__((target("avx2")));
+#endif
+
+/* ------------------------- public functions */
+const char *substring_find(const char *haystack, const char *needle)
+{
+        g_return_val_if_fail(haystack!=NULL, NULL);
+        g_return_val_if_fail(needle!=NULL, NULL);
+
+        return substring_find_len(haystack, strlen(haystack), needle, strlen(needle));
+}
+
+const char *substring_find_len(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len)
+{
+        g_return_val_if_fail(haystack!=NULL, NULL);
+        g_return_val_if_fail(needle!=NULL, NULL);
+
+        if(needle_len==0) {
+                return haystack;
+        }
+        if(needle_len>haystack_len) {
+                return NULL;
+        }
+        if(needle_len==1) {
+                return (const char *)memchr(haystack, needle[0], haystack_len);
+        }
+        switch(substring_get_kernel()) {
+#ifdef HAVE_X86_KERNELS
+        case SUBSTRING_AVX2:
+                return find_avx2(haystack, haystack_len, needle, needle_len);
+        case SUBSTRING_SSE2:
+                return find_sse2(haystack, haystack_len, needle, needle_len);
+#endif
+        default:
+                return find_scalar(haystack, haystack_len, needle, needle_len);
+        }
+}
+
+enum SubstringKernel substring_get_kernel(void)
+{
+        gint kernel;
+
+        kernel=g_atomic_int_get(&current_kernel);
+        if(kernel<0) {
+                /* every thread would choose the same kernel */
+                g_atomic_int_compare_and_exchange(&current_kernel, -1, (gint)best_kernel());
+                kernel=g_atomic_int_get(&current_kernel);
+        }
+        return (enum SubstringKernel)kernel;
+}
+
+gboolean substring_set_kernel(enum SubstringKernel kernel)
+{
+        gint old;
+
+        if(!is_supported(kernel)) {
+                return FALSE;
+        }
+        do {
+                old=g_atomic_int_get(&current_kernel);
+        } while(!g_atomic_int_compare_and_exchange(&current_kernel, old, (gint)kernel));
+        return TRUE;
+}
+
+const char *substring_kernel_name(enum SubstringKernel kernel)
+{
+        switch(kernel) {
+        case SUBSTRING_SCALAR:
+                return "scalar";
+        case SUBSTRING_SSE2:
+                return "sse2";
+        case SUBSTRING_AVX2:
+                return "avx2";
+        }
+        return "unknown";
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Choose the fastest kernel the CPU supports.
+ */
+static enum SubstringKernel best_kernel(void)
+{
+        if(is_supported(SUBSTRING_AVX2)) {
+                return SUBSTRING_AVX2;
+        }
+        if(is_supported(SUBSTRING_SSE2)) {
+                return SUBSTRING_SSE2;
+        }
+        return SUBSTRING_SCALAR;
+}
+
+/**
+ * Check whether a kernel has been compiled in and
+ * can be run on this CPU.
+ */
+static gboolean is_supported(enum SubstringKernel kernel)
+{
+        switch(kernel) {
+        case SUBSTRING_SCALAR:
+                return TRUE;
+#ifdef HAVE_X86_KERNELS
+        case SUBSTRING_SSE2:
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("sse2");
+        case SUBSTRING_AVX2:
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx2");
+#endif
+        default:
+                return FALSE;
+        }
+}
+
+/**
+ * Look for needle, byte by byte.
+ *
+ * This is also used for the end of the haystack by the other
+ * kernels, where there's not enough bytes left for a
+ * whole block.
+ *
+ * @param haystack
+ * @param haystack_len
+ * @param needle
+ * @param needle_len at least 1
+ * @return a pointer to needle in haystack or NULL
+ */
+static const char *find_scalar(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len)
+{
+        const char *current;
+        const char *last;
+
+        if(needle_len>haystack_len) {
+                return NULL;
+        }
+        current=haystack;
+        last=haystack+haystack_len-needle_len;
+        while(current<=last) {
+                current=(const char *)memchr(current, needle[0], last-current+1);
+                if(current==NULL) {
+                        return NULL;
+                }
+                if(memcmp(current+1, needle+1, needle_len-1)==0) {
+                        return current;
+                }
+                current++;
+        }
+        return NULL;
+}
+
+#ifdef HAVE_X86_KERNELS
+/**
+ * Look for needle, 16 positions at a time.
+ *
+ * For each position in the block, the first byte of
+ * the needle is compared with the byte at that position and the
+ * last byte of the needle with the byte needle_len-1 bytes
+ * further. The rest of the needle is only compared where both match.
+ *
+ * @param haystack
+ * @param haystack_len
+ * @param needle
+ * @param needle_len at least 2
+ * @return a pointer to needle in haystack or NULL
+ */
+static const char *find_sse2(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len)
+{
+        __m128i first;
+        __m128i last;
+        gsize i;
+
+        first=_mm_set1_epi8(needle[0]);
+        last=_mm_set1_epi8(needle[needle_len-1]);
+        /* both loads must stay within the haystack */
+        for(i=0; i+needle_len-1+16<=haystack_len; i+=16) {
+                __m128i block_first;
+                __m128i block_last;
+                gulong mask;
+                gint bit;
+
+                block_first=_mm_loadu_si128((const __m128i *)(haystack+i));
+                block_last=_mm_loadu_si128((const __m128i *)(haystack+i+needle_len-1));
+                mask=(guint)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                            _mm_cmpeq_epi8(last, block_last)));
+                for(bit=g_bit_nth_lsf(mask, -1); bit>=0; bit=g_bit_nth_lsf(mask, bit)) {
+                        if(memcmp(haystack+i+bit+1, needle+1, needle_len-2)==0) {
+                                return haystack+i+bit;
+                        }
+                }
+        }
+        return find_scalar(haystack+i, haystack_len-i, needle, needle_len);
+}
+
+/**
+ * Same as find_sse2(), 32 positions at a time.
+ */
+static const char *find_avx2(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len)
+{
+        __m256i first;
+        __m256i last;
+        gsize i;
+
+        first=_mm256_set1_epi8(needle[0]);
+        last=_mm256_set1_epi8(needle[needle_len-1]);
+        for(i=0; i+needle_len-1+32<=haystack_len; i+=32) {
+                __m256i block_first;
+                __m256i block_last;
+                gulong mask;
+                gint bit;
+
+                block_first=_mm256_loadu_si256((const __m256i *)(haystack+i));
+                block_last=_mm256_loadu_si256((const __m256i *)(haystack+i+needle_len-1));
+                mask=(guint32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                                    _mm256_cmpeq_epi8(last, block_last)));
+                for(bit=g_bit_nth_lsf(mask, -1); bit>=0; bit=g_bit_nth_lsf(mask, bit)) {
+                        if(memcmp(haystack+i+bit+1, needle+1, needle_len-2)==0) {
+                                return haystack+i+bit;
+                        }
+                }
+        }
+        /* there might be room for a 16-byte block */
+        return find_sse2(haystack+i, haystack_len-i, needle, needle_len);
+}
+#endif /*HAVE_X86_KERNELS*/
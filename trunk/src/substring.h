@@ -0,0 +1,85 @@
+#ifndef SUBSTRING_H
+#define SUBSTRING_H
+
+#include <glib.h>
+
+/** \file
+ * Substring search tuned for matching short query words
+ * against many names.
+ *
+ * The search looks for the first and the last byte of the
+ * word 16 or 32 bytes at a time, using SSE2 or AVX2 if the
+ * CPU has them, and only compares the whole word where both
+ * bytes are found. The kernel is chosen at runtime.
+ *
+ * The search works on bytes, so it gives exactly the same
+ * answers as strstr() on UTF-8 strings, whatever the kernel.
+ */
+
+/**
+ * Implementations of the search
+ */
+enum SubstringKernel {
+        /** plain C, available everywhere */
+        SUBSTRING_SCALAR,
+        /** 16 bytes at a time */
+        SUBSTRING_SSE2,
+        /** 32 bytes at a time */
+        SUBSTRING_AVX2
+};
+
+/**
+ * Find the first occurrence of a string in another string.
+ *
+ * This is the same as strstr(haystack, needle).
+ *
+ * @param haystack string to look into
+ * @param needle string to look for
+ * @return a pointer to the first occurrence of needle in haystack,
+ * or NULL
+ */
+const char *substring_find(const char *haystack, const char *needle);
+
+/**
+ * Find the first occurrence of a string in another string, whose
+ * lengths are known.
+ *
+ * @param haystack string to look into
+ * @param haystack_len length of haystack, in bytes
+ * @param needle string to look for
+ * @param needle_len length of needle, in bytes
+ * @return a pointer to the first occurrence of needle in haystack,
+ * or NULL
+ */
+const char *substring_find_len(const char *haystack, gsize haystack_len, const char *needle, gsize needle_len);
+
+/**
+ * Get the kernel substring_find() uses.
+ *
+ * Unless substring_set_kernel() has been called, it's the
+ * fastest kernel the CPU supports.
+ *
+ * @return a kernel
+ */
+enum SubstringKernel substring_get_kernel(void);
+
+/**
+ * Force substring_find() to use a specific kernel.
+ *
+ * This is meant for tests and benchmarks.
+ *
+ * @param kernel
+ * @return FALSE if the kernel isn't available on this CPU or
+ * hasn't been compiled in, in which case nothing changes
+ */
+gboolean substring_set_kernel(enum SubstringKernel kernel);
+
+/**
+ * Name of a kernel, for benchmarks and debugging.
+ *
+ * @param kernel
+ * @return a static string
+ */
+const char *substring_kernel_name(enum SubstringKernel kernel);
+
+#endif /*SUBSTRING_H*/
@@ -0,0 +1,264 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <check.h>
+#include "substring.h"
+#include "query.h"
+
+/** Number of random strings compared by test_random */
+#define RANDOM_COUNT 200000
+
+/** Number of names in the arena of test_benchmark */
+#define ARENA_NAMES 1000000
+
+/**
+ * Characters random strings are made of. There are few
+ * of them, so that there are many matches, and some of
+ * them are UTF-8 sequences.
+ */
+static const char *alphabet[] = { "a", "b", "c", " ", "\xc3\xa9", "\xce\xb1" };
+#define ALPHABET_LEN (sizeof(alphabet)/sizeof(char *))
+
+/* ------------------------- prototypes */
+static Suite *substring_check_suite(void);
+static void random_string(char *dest, int max_chars);
+static void assert_same_as_strstr(const char *haystack, const char *needle);
+static double scan_arena(const char *arena, const guint32 *offsets, int count, const char *query, int *matches);
+
+/* ------------------------- test case */
+static void setup()
+{
+        setlocale(LC_ALL, "C");
+}
+
+static void teardown()
+{
+}
+
+START_TEST(test_edges)
+{
+        enum SubstringKernel kernel;
+
+        for(kernel=SUBSTRING_SCALAR; kernel<=SUBSTRING_AVX2; kernel++) {
+                if(!substring_set_kernel(kernel)) {
+                        continue;
+                }
+                printf("--test_edges(%s)\n", substring_kernel_name(kernel));
+                assert_same_as_strstr("", "");
+                assert_same_as_strstr("abc", "");
+                assert_same_as_strstr("", "a");
+                assert_same_as_strstr("a", "a");
+                assert_same_as_strstr("ab", "abc");
+                /* around the end of 16- and 32-byte blocks */
+                assert_same_as_strstr("xxxxxxxxxxxxxxxab", "ab");
+                assert_same_as_strstr("xxxxxxxxxxxxxxxxab", "ab");
+                assert_same_as_strstr("xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxab", "ab");
+                assert_same_as_strstr("xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxab", "ab");
+                assert_same_as_strstr("xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxterminal", "terminal");
+                assert_same_as_strstr("axxxxxxxxxxxxxxxxxxxxxxxxxxxxxxb", "axxxxxxxxxxxxxxxxxxxxxxxxxxxxxxb");
+                /* first and last bytes match, but not the middle */
+                assert_same_as_strstr("abxc abc", "abc");
+                assert_same_as_strstr("\xc3\xa9t\xc3\xa9 \xc3\xa9t\xc3\xa9", "\xa9 \xc3");
+        }
+}
+END_TEST
+
+/**
+ * Compare all kernels with strstr() and compiled queries with
+ * query_ismatch() on random strings.
+ */
+START_TEST(test_random)
+{
+        enum SubstringKernel kernel;
+        char haystack[400];
+        char needle[40];
+        char query[40];
+        int i;
+
+        for(kernel=SUBSTRING_SCALAR; kernel<=SUBSTRING_AVX2; kernel++) {
+                if(!substring_set_kernel(kernel)) {
+                        printf("--test_random(%s): not available\n",
+                               substring_kernel_name(kernel));
+                        continue;
+                }
+                printf("--test_random(%s)\n", substring_kernel_name(kernel));
+                srand(1);
+                for(i=0; i<RANDOM_COUNT; i++) {
+                        struct query_matcher *matcher;
+                        char *prepared;
+                        gboolean expected;
+                        gboolean actual;
+
+                        random_string(haystack, rand()%80);
+                        random_string(needle, rand()%5);
+                        assert_same_as_strstr(haystack, needle);
+
+                        random_string(query, rand()%5);
+                        matcher=query_compile(query);
+                        prepared=query_prepare(haystack);
+                        actual=query_matcher_ismatch(matcher, prepared);
+                        substring_set_kernel(SUBSTRING_SCALAR);
+                        expected=query_ismatch(query, haystack);
+                        substring_set_kernel(kernel);
+                        fail_unless(expected==actual, "compiled query disagrees with query_ismatch()");
+                        g_free(prepared);
+                        query_matcher_free(matcher);
+                }
+        }
+}
+END_TEST
+
+/**
+ * Match a query against one million names stored one after the
+ * other, the way the memory query runner stores them, with
+ * each kernel.
+ */
+START_TEST(test_benchmark)
+{
+        enum SubstringKernel kernel;
+        GString *arena;
+        guint32 *offsets;
+        int expected;
+        int i;
+
+        printf("--test_benchmark\n");
+        arena=g_string_new("");
+        offsets=g_new(guint32, ARENA_NAMES);
+        for(i=0; i<ARENA_NAMES; i++) {
+                char *name;
+
+                offsets[i]=arena->len;
+                name=g_strdup_printf("%s %d %s",
+                                     i%3==0 ? "gnome-terminal":"document",
+                                     i,
+                                     i%7==0 ? "settings":"report.txt");
+                g_string_append(arena, name);
+                g_string_append_c(arena, '\0');
+                g_free(name);
+        }
+
+        expected=-1;
+        for(kernel=SUBSTRING_SCALAR; kernel<=SUBSTRING_AVX2; kernel++) {
+                double elapsed;
+                int matches;
+
+                if(!substring_set_kernel(kernel)) {
+                        continue;
+                }
+                elapsed=scan_arena(arena->str, offsets, ARENA_NAMES, "term settings", &matches);
+                printf("%d names, %s: %.1fms, %d matches\n",
+                       ARENA_NAMES,
+                       substring_kernel_name(kernel),
+                       elapsed*1000.0,
+                       matches);
+                if(expected<0) {
+                        expected=matches;
+                }
+                fail_unless(matches==expected, "kernels disagree");
+        }
+        fail_unless(expected>0, "no matches");
+
+        g_free(offsets);
+        g_string_free(arena, TRUE/*free content*/);
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *substring_check_suite(void)
+{
+        Suite *s = suite_create("substring");
+        TCase *tc_core = tcase_create("substring_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_edges);
+        tcase_add_test(tc_core, test_random);
+        tcase_add_test(tc_core, test_benchmark);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = substring_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Fill a buffer with random characters of the alphabet.
+ *
+ * @param dest a buffer big enough for max_chars UTF-8 characters
+ * @param max_chars number of characters
+ */
+static void random_string(char *dest, int max_chars)
+{
+        int i;
+
+        dest[0]='\0';
+        for(i=0; i<max_chars; i++) {
+                strcat(dest, alphabet[rand()%ALPHABET_LEN]);
+        }
+}
+
+static void assert_same_as_strstr(const char *haystack, const char *needle)
+{
+        char *copy;
+        const char *expected;
+        const char *actual;
+
+        /* a copy of the exact size, so that reading past
+         * the end would be noticed by memory checkers */
+        copy=g_strdup(haystack);
+        expected=strstr(copy, needle);
+        actual=substring_find(copy, needle);
+        fail_unless(expected==actual,
+                    g_strdup_printf("substring_find(\"%s\", \"%s\") with %s: expected %d got %d\n",
+                                    haystack,
+                                    needle,
+                                    substring_kernel_name(substring_get_kernel()),
+                                    expected ? (int)(expected-copy):-1,
+                                    actual ? (int)(actual-copy):-1));
+        g_free(copy);
+}
+
+/**
+ * Match a query against all names of the arena.
+ *
+ * @param arena names, prepared with query_prepare()
+ * @param offsets offset of each name in the arena
+ * @param count number of names
+ * @param query
+ * @param matches number of matches (out)
+ * @return time it took, in seconds
+ */
+static double scan_arena(const char *arena, const guint32 *offsets, int count, const char *query, int *matches)
+{
+        struct query_matcher *matcher;
+        GTimer *timer;
+        double elapsed;
+        int i;
+
+        matcher=query_compile(query);
+        timer=g_timer_new();
+        *matches=0;
+        for(i=0; i<count; i++) {
+                if(query_matcher_ismatch(matcher, arena+offsets[i])) {
+                        (*matches)++;
+                }
+        }
+        elapsed=g_timer_elapsed(timer, NULL/*microseconds*/);
+        g_timer_destroy(timer);
+        query_matcher_free(matcher);
+        return elapsed;
+}
@@ -0,0 +1,219 @@
+/** \file
+ * Implementation of the API defined in trace.h
+ */
+
+#include "trace.h"
+#include <string.h>
+
+/**
+ * An event, as recorded by trace_event()
+ */
+struct trace_entry
+{
+        GTimeVal time;
+        enum TraceType type;
+        guint query_id;
+        glong value;
+        char detail[TRACE_DETAIL_LEN];
+};
+
+/**
+ * Ring buffer of one thread.
+ *
+ * The events are only written by the thread the ring
+ * belongs to. Rings are never freed, since trace_dump()
+ * may read them at any time.
+ */
+struct trace_ring
+{
+        /** number of the ring, in order of creation */
+        int number;
+
+        /**
+         * Number of events recorded so far; the next event
+         * goes to events[count%TRACE_RING_SIZE]
+         */
+        gint count;
+
+        struct trace_entry events[TRACE_RING_SIZE];
+
+        /** next ring in the list of all rings */
+        struct trace_ring *next;
+};
+
+/**
+ * An event with the number of its thread, as collected by trace_dump().
+ */
+struct dump_entry
+{
+        int thread;
+        struct trace_entry entry;
+};
+
+/** Ring of the current thread */
+static GStaticPrivate ring_key = G_STATIC_PRIVATE_INIT;
+
+/** Protects rings and ring_count */
+static GStaticMutex rings_lock = G_STATIC_MUTEX_INIT;
+
+/** All rings, the newest first */
+static struct trace_ring *rings;
+
+/** Number of rings in rings */
+static int ring_count;
+
+/* ------------------------- prototypes */
+static struct trace_ring *ring_new(void);
+static const char *type_name(enum TraceType type);
+static gint compare_dump_entries(gconstpointer a, gconstpointer b);
+
+/* ------------------------- public functions */
+void trace_event(enum TraceType type, guint query_id, glong value, const char *detail)
+{
+        struct trace_ring *ring;
+        struct trace_entry *entry;
+
+        ring=(struct trace_ring *)g_static_private_get(&ring_key);
+        if(ring==NULL) {
+                ring=ring_new();
+                g_static_private_set(&ring_key, ring, NULL/*never freed*/);
+        }
+
+        entry=&ring->events[ring->count%TRACE_RING_SIZE];
+        g_get_current_time(&entry->time);
+        entry->type=type;
+        entry->query_id=query_id;
+        entry->value=value;
+        if(detail!=NULL) {
+                g_strlcpy(entry->detail, detail, TRACE_DETAIL_LEN);
+        } else {
+                entry->detail[0]='\0';
+        }
+
+        /* publish the event */
+        g_atomic_int_inc(&ring->count);
+}
+
+char *trace_dump(void)
+{
+        GArray *entries;
+        GString *dump;
+        struct trace_ring *ring;
+        guint i;
+
+        entries=g_array_new(FALSE/*not zero-terminated*/,
+                            FALSE/*don't clear*/,
+                            sizeof(struct dump_entry));
+        g_static_mutex_lock(&rings_lock);
+        for(ring=rings; ring!=NULL; ring=ring->next) {
+                gint count;
+                gint first;
+                gint j;
+
+                count=g_atomic_int_get(&ring->count);
+                first=count>TRACE_RING_SIZE ? count-TRACE_RING_SIZE:0;
+                for(j=first; j<count; j++) {
+                        struct dump_entry dentry;
+
+                        dentry.thread=ring->number;
+                        memcpy(&dentry.entry,
+                               &ring->events[j%TRACE_RING_SIZE],
+                               sizeof(struct trace_entry));
+                        dentry.entry.detail[TRACE_DETAIL_LEN-1]='\0';
+                        g_array_append_val(entries, dentry);
+                }
+        }
+        g_static_mutex_unlock(&rings_lock);
+
+        g_array_sort(entries, compare_dump_entries);
+
+        dump=g_string_new("");
+#ifndef OCHA_TRACE
+        g_string_append(dump, "# tracing disabled; run ./configure --enable-trace to enable it\n");
+#endif
+        for(i=0; i<entries->len; i++) {
+                struct dump_entry *dentry;
+
+                dentry=&g_array_index(entries, struct dump_entry, i);
+                g_string_append_printf(dump,
+                                       "%ld.%06ld thread-%d %s query=%u value=%ld %s\n",
+                                       (long)dentry->entry.time.tv_sec,
+                                       (long)dentry->entry.time.tv_usec,
+                                       dentry->thread,
+                                       type_name(dentry->entry.type),
+                                       dentry->entry.query_id,
+                                       dentry->entry.value,
+                                       dentry->entry.detail);
+        }
+        g_array_free(entries, TRUE/*free segment*/);
+        return g_string_free(dump, FALSE/*return content*/);
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Create a new ring and add it into the list of rings.
+ *
+ * @return a new ring, which is never freed
+ */
+static struct trace_ring *ring_new(void)
+{
+        struct trace_ring *ring;
+
+        ring=g_new(struct trace_ring, 1);
+        ring->count=0;
+
+        g_static_mutex_lock(&rings_lock);
+        ring->number=ring_count;
+        ring_count++;
+        ring->next=rings;
+        rings=ring;
+        g_static_mutex_unlock(&rings_lock);
+
+        return ring;
+}
+
+/**
+ * Name of an event type, as written by trace_dump()
+ */
+static const char *type_name(enum TraceType type)
+{
+        switch(type) {
+        case TRACE_QUERY_START:
+                return "query-start";
+        case TRACE_QUERY_END:
+                return "query-end";
+        case TRACE_SQL_EXEC:
+                return "sql-exec";
+        case TRACE_SQL_DONE:
+                return "sql-done";
+        case TRACE_RESULT_ENQUEUE:
+                return "result-enqueue";
+        case TRACE_FIRST_RESULT:
+                return "first-result";
+        case TRACE_FULL_LIST:
+                return "full-list";
+        case TRACE_RESULT_DISPATCH:
+                return "result-dispatch";
+        case TRACE_LAUNCH:
+                return "launch";
+        }
+        return "unknown";
+}
+
+/**
+ * Sort dump entries by time
+ */
+static gint compare_dump_entries(gconstpointer a, gconstpointer b)
+{
+        const GTimeVal *ta = &((const struct dump_entry *)a)->entry.time;
+        const GTimeVal *tb = &((const struct dump_entry *)b)->entry.time;
+
+        if(ta->tv_sec!=tb->tv_sec) {
+                return ta->tv_sec<tb->tv_sec ? -1:1;
+        }
+        if(ta->tv_usec!=tb->tv_usec) {
+                return ta->tv_usec<tb->tv_usec ? -1:1;
+        }
+        return 0;
+}
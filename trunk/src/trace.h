@@ -0,0 +1,92 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <glib.h>
+
+/** \file
+ * Lightweight tracing of what happens on the hot paths.
+ *
+ * Events are recorded with TRACE() into a ring buffer that belongs
+ * to the current thread, so recording an event takes no lock and
+ * does no I/O. The ring only keeps the last TRACE_RING_SIZE events
+ * of each thread. trace_dump() collects the events of all threads
+ * and ochad sends them to whoever asks through its socket
+ * ("ocha trace").
+ *
+ * TRACE() compiles to nothing unless OCHA_TRACE is defined, which
+ * is what ./configure --enable-trace does.
+ */
+
+/**
+ * Number of events kept for each thread
+ */
+#define TRACE_RING_SIZE 512
+
+/**
+ * Maximum length of the text attached to an event, including
+ * the final nul character. Longer texts are truncated.
+ */
+#define TRACE_DETAIL_LEN 48
+
+/**
+ * Type of the events
+ */
+enum TraceType {
+        /** a query runner started running a query; value=0 */
+        TRACE_QUERY_START,
+        /** a query runner is done with a query; value=number of results */
+        TRACE_QUERY_END,
+        /** a SQL statement is about to be run; value=maximum number of rows */
+        TRACE_SQL_EXEC,
+        /** a SQL statement is done; value=number of rows */
+        TRACE_SQL_DONE,
+        /** a result has been added to a result queue; value=entry id, if known */
+        TRACE_RESULT_ENQUEUE,
+        /** the first results of a query have been sent; value=time-to-first-result (ms) */
+        TRACE_FIRST_RESULT,
+        /** all the results of a query have been sent; value=time-to-full-list (ms) */
+        TRACE_FULL_LIST,
+        /** a result has been passed to the handler of a result queue; value=time it took (us) */
+        TRACE_RESULT_DISPATCH,
+        /** an entry is being launched; value=pid, if known */
+        TRACE_LAUNCH
+};
+
+#ifdef OCHA_TRACE
+/**
+ * Record an event in the ring buffer of the current thread.
+ *
+ * @param type an enum TraceType
+ * @param query_id id of the query the event is about, 0 if none
+ * @param value a number, whose meaning depends on the type
+ * @param detail some text or NULL; it's copied
+ */
+#define TRACE(type, query_id, value, detail) trace_event((type), (query_id), (value), (detail))
+#else
+#define TRACE(type, query_id, value, detail) ((void)0)
+#endif
+
+/**
+ * Record an event in the ring buffer of the current thread.
+ *
+ * Call TRACE() instead, so that the call disappears when
+ * tracing is disabled.
+ */
+void trace_event(enum TraceType type, guint query_id, glong value, const char *detail);
+
+/**
+ * Describe the events that are in the ring buffers of
+ * all threads, the oldest first, one per line.
+ *
+ * Threads go on recording events while the dump is being
+ * created, so the events that are being overwritten at that time
+ * might be garbled.
+ *
+ * @return a string, to free with g_free()
+ */
+char *trace_dump(void);
+
+#endif /*TRACE_H*/
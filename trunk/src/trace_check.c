@@ -0,0 +1,138 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+#include "trace.h"
+
+/* ------------------------- prototypes */
+static Suite *trace_check_suite(void);
+static gpointer trace_thread(gpointer userdata);
+static int count_lines(const char *str);
+
+/* ------------------------- test case */
+static void setup()
+{
+        g_thread_init(NULL/*vtable*/);
+}
+
+static void teardown()
+{
+}
+
+START_TEST(test_dump)
+{
+        char *dump;
+
+        trace_event(TRACE_QUERY_START, 12, 0, "term");
+        trace_event(TRACE_RESULT_ENQUEUE, 12, 42, "application");
+        dump=trace_dump();
+        printf("%s", dump);
+        fail_unless(strstr(dump, "query-start query=12 value=0 term\n")!=NULL,
+                    "query-start missing");
+        fail_unless(strstr(dump, "result-enqueue query=12 value=42 application\n")!=NULL,
+                    "result-enqueue missing");
+        fail_unless(strstr(dump, "query-start")<strstr(dump, "result-enqueue"),
+                    "wrong order");
+        g_free(dump);
+}
+END_TEST
+
+START_TEST(test_long_detail)
+{
+        char detail[TRACE_DETAIL_LEN*2];
+        char *dump;
+
+        memset(detail, 'x', sizeof(detail)-1);
+        detail[sizeof(detail)-1]='\0';
+        trace_event(TRACE_LAUNCH, 0, 0, detail);
+        dump=trace_dump();
+        fail_unless(strstr(dump, detail)==NULL, "detail should have been truncated");
+        detail[TRACE_DETAIL_LEN-1]='\0';
+        fail_unless(strstr(dump, detail)!=NULL, "truncated detail missing");
+        g_free(dump);
+}
+END_TEST
+
+START_TEST(test_ring)
+{
+        char *dump;
+        int i;
+
+        for(i=0; i<TRACE_RING_SIZE+10; i++) {
+                trace_event(TRACE_SQL_EXEC, 1, i, NULL);
+        }
+        dump=trace_dump();
+        fail_unless(strstr(dump, "value=9 ")==NULL, "oldest events should be gone");
+        fail_unless(strstr(dump, "value=10 ")!=NULL, "oldest event kept");
+        fail_unless(count_lines(dump)<=TRACE_RING_SIZE+1, "too many events");
+        g_free(dump);
+}
+END_TEST
+
+START_TEST(test_threads)
+{
+        GThread *thread;
+        char *dump;
+
+        trace_event(TRACE_QUERY_START, 1, 0, "main");
+        thread=g_thread_create(trace_thread,
+                               NULL/*userdata*/,
+                               TRUE/*joinable*/,
+                               NULL/*error*/);
+        g_thread_join(thread);
+        dump=trace_dump();
+        fail_unless(strstr(dump, "thread-0 query-start query=1 value=0 main\n")!=NULL,
+                    "event of the main thread missing");
+        fail_unless(strstr(dump, "thread-1 query-end query=1 value=3 other\n")!=NULL,
+                    "event of the other thread missing");
+        g_free(dump);
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *trace_check_suite(void)
+{
+        Suite *s = suite_create("trace");
+        TCase *tc_core = tcase_create("trace_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_dump);
+        tcase_add_test(tc_core, test_long_detail);
+        tcase_add_test(tc_core, test_ring);
+        tcase_add_test(tc_core, test_threads);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = trace_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+static gpointer trace_thread(gpointer userdata)
+{
+        trace_event(TRACE_QUERY_END, 1, 3, "other");
+        return NULL;
+}
+
+static int count_lines(const char *str)
+{
+        int count = 0;
+
+        for(; *str!='\0'; str++) {
+                if(*str=='\n') {
+                        count++;
+                }
+        }
+        return count;
+}
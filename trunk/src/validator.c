@@ -0,0 +1,320 @@
+/** \file
+ * Implementation of the API defined in validator.h
+ */
+
+#include "validator.h"
+
+/**
+ * Maximum number of results checked at the same time.
+ */
+#define WORKER_THREADS 2
+
+/**
+ * Maximum number of answers remembered. Once it's reached,
+ * the answers that are too old are forgotten and if that's
+ * not enough, all answers are forgotten.
+ */
+#define MAX_CACHE_ENTRIES 1024
+
+/**
+ * The public structure
+ */
+struct validator
+{
+        /** Context passed to validator_new() */
+        GMainContext *context;
+
+        /** Callback passed to validator_new() */
+        validator_done_f done;
+
+        /** Number of seconds answers are remembered */
+        guint ttl;
+
+        /** Worker threads, which run struct job */
+        GThreadPool *pool;
+
+        /** Protects cache, done_jobs and done_source */
+        GMutex *lock;
+
+        /**
+         * Answers, char * (URI) x struct cache_entry *.
+         * Protected by lock.
+         */
+        GHashTable *cache;
+
+        /**
+         * Jobs that are done, struct job *, the latest first.
+         * Protected by lock.
+         */
+        GSList *done_jobs;
+
+        /**
+         * Source that will pass done_jobs to the done callback, or
+         * NULL if it hasn't been created yet. Protected by lock.
+         */
+        GSource *done_source;
+};
+
+/**
+ * A remembered answer
+ */
+struct cache_entry
+{
+        /** TRUE if the URI was valid */
+        gboolean valid;
+
+        /** When the URI was checked (seconds) */
+        glong checked_at;
+};
+
+/**
+ * A result to check
+ */
+struct job
+{
+        struct result *result;
+        gpointer userdata;
+
+        /** Answer, set by the worker thread */
+        gboolean valid;
+};
+
+/* ------------------------- prototypes */
+static void worker(gpointer data, gpointer userdata);
+static gboolean done_cb(gpointer userdata);
+static void deliver(struct validator *validator, GSList *jobs);
+static void cache_set(struct validator *validator, const char *uri, gboolean valid);
+static gboolean is_expired(gpointer key, gpointer value, gpointer userdata);
+static gboolean always(gpointer key, gpointer value, gpointer userdata);
+static glong now(void);
+
+/* ------------------------- public functions */
+struct validator *validator_new(GMainContext *context, validator_done_f done, guint ttl)
+{
+        struct validator *validator;
+
+        g_return_val_if_fail(done!=NULL, NULL);
+
+        validator=g_new(struct validator, 1);
+        validator->context=context;
+        validator->done=done;
+        validator->ttl=ttl;
+        validator->lock=g_mutex_new();
+        validator->cache=g_hash_table_new_full(g_str_hash,
+                                               g_str_equal,
+                                               g_free/*key_destroy_func*/,
+                                               g_free/*value_destroy_func*/);
+        validator->done_jobs=NULL;
+        validator->done_source=NULL;
+        validator->pool=g_thread_pool_new(worker,
+                                          validator/*userdata*/,
+                                          WORKER_THREADS,
+                                          FALSE/*not exclusive*/,
+                                          NULL/*error*/);
+        return validator;
+}
+
+void validator_free(struct validator *validator)
+{
+        GSList *jobs;
+
+        g_return_if_fail(validator!=NULL);
+
+        /* run all jobs that are still in the pool */
+        g_thread_pool_free(validator->pool,
+                           FALSE/*not immediately*/,
+                           TRUE/*wait*/);
+
+        g_mutex_lock(validator->lock);
+        jobs=validator->done_jobs;
+        validator->done_jobs=NULL;
+        if(validator->done_source) {
+                g_source_destroy(validator->done_source);
+                g_source_unref(validator->done_source);
+                validator->done_source=NULL;
+        }
+        g_mutex_unlock(validator->lock);
+        deliver(validator, jobs);
+
+        g_hash_table_destroy(validator->cache);
+        g_mutex_free(validator->lock);
+        g_free(validator);
+}
+
+enum ValidatorValidity validator_get_cached(struct validator *validator, const char *uri)
+{
+        struct cache_entry *entry;
+        enum ValidatorValidity retval;
+
+        g_return_val_if_fail(validator!=NULL, VALIDATOR_UNKNOWN);
+        g_return_val_if_fail(uri!=NULL, VALIDATOR_UNKNOWN);
+
+        retval=VALIDATOR_UNKNOWN;
+        g_mutex_lock(validator->lock);
+        entry=(struct cache_entry *)g_hash_table_lookup(validator->cache, uri);
+        if(entry!=NULL && !is_expired(NULL/*key*/, entry, validator)) {
+                retval=entry->valid ? VALIDATOR_VALID:VALIDATOR_INVALID;
+        }
+        g_mutex_unlock(validator->lock);
+        return retval;
+}
+
+void validator_check(struct validator *validator, struct result *result, gpointer userdata)
+{
+        struct job *job;
+
+        g_return_if_fail(validator!=NULL);
+        g_return_if_fail(result!=NULL);
+
+        job=g_new(struct job, 1);
+        job->result=result;
+        job->userdata=userdata;
+        job->valid=FALSE;
+        g_thread_pool_push(validator->pool, job, NULL/*error*/);
+}
+
+/* ------------------------- static functions */
+
+/**
+ * Check a result (thread pool function)
+ *
+ * @param data the job
+ * @param userdata the validator
+ */
+static void worker(gpointer data, gpointer userdata)
+{
+        struct job *job = (struct job *)data;
+        struct validator *validator = (struct validator *)userdata;
+        enum ValidatorValidity validity;
+
+        /* the same URI might have been checked since the job was queued */
+        validity=validator_get_cached(validator, job->result->path);
+        if(validity==VALIDATOR_UNKNOWN) {
+                job->valid=job->result->validate(job->result);
+                cache_set(validator, job->result->path, job->valid);
+        } else {
+                job->valid = validity==VALIDATOR_VALID;
+        }
+
+        g_mutex_lock(validator->lock);
+        validator->done_jobs=g_slist_prepend(validator->done_jobs, job);
+        if(validator->done_source==NULL) {
+                validator->done_source=g_idle_source_new();
+                g_source_set_callback(validator->done_source,
+                                      done_cb,
+                                      validator,
+                                      NULL/*notify*/);
+                g_source_attach(validator->done_source, validator->context);
+        }
+        g_mutex_unlock(validator->lock);
+}
+
+/**
+ * Pass the jobs that are done to the done callback (idle callback).
+ *
+ * @param userdata the validator
+ * @return FALSE
+ */
+static gboolean done_cb(gpointer userdata)
+{
+        struct validator *validator = (struct validator *)userdata;
+        GSList *jobs;
+
+        g_mutex_lock(validator->lock);
+        jobs=validator->done_jobs;
+        validator->done_jobs=NULL;
+        g_source_unref(validator->done_source);
+        validator->done_source=NULL;
+        g_mutex_unlock(validator->lock);
+
+        deliver(validator, jobs);
+        return FALSE/*remove source*/;
+}
+
+/**
+ * Call the done callback and free the jobs.
+ *
+ * @param validator
+ * @param jobs list of struct job, the latest first. The list
+ * is freed by this function.
+ */
+static void deliver(struct validator *validator, GSList *jobs)
+{
+        GSList *item;
+
+        jobs=g_slist_reverse(jobs);
+        for(item=jobs; item!=NULL; item=g_slist_next(item)) {
+                struct job *job = (struct job *)item->data;
+
+                validator->done(job->result, job->valid, job->userdata);
+                g_free(job);
+        }
+        g_slist_free(jobs);
+}
+
+/**
+ * Remember an answer.
+ *
+ * @param validator
+ * @param uri
+ * @param valid
+ */
+static void cache_set(struct validator *validator, const char *uri, gboolean valid)
+{
+        struct cache_entry *entry;
+
+        if(validator->ttl==0) {
+                return;
+        }
+
+        entry=g_new(struct cache_entry, 1);
+        entry->valid=valid;
+        entry->checked_at=now();
+
+        g_mutex_lock(validator->lock);
+        if(g_hash_table_size(validator->cache)>=MAX_CACHE_ENTRIES) {
+                g_hash_table_foreach_remove(validator->cache, is_expired, validator);
+                if(g_hash_table_size(validator->cache)>=MAX_CACHE_ENTRIES) {
+                        g_hash_table_foreach_remove(validator->cache, always, NULL/*userdata*/);
+                }
+        }
+        g_hash_table_replace(validator->cache, g_strdup(uri), entry);
+        g_mutex_unlock(validator->lock);
+}
+
+/**
+ * Check whether an answer is too old (GHRFunc)
+ *
+ * @param key ignored
+ * @param value a struct cache_entry *
+ * @param userdata the validator
+ * @return TRUE if the answer is too old to be used
+ */
+static gboolean is_expired(gpointer key, gpointer value, gpointer userdata)
+{
+        struct cache_entry *entry = (struct cache_entry *)value;
+        struct validator *validator = (struct validator *)userdata;
+        glong age;
+
+        age=now()-entry->checked_at;
+        return age<0 || age>=(glong)validator->ttl;
+}
+
+/**
+ * GHRFunc that removes everything
+ */
+static gboolean always(gpointer key, gpointer value, gpointer userdata)
+{
+        return TRUE;
+}
+
+/**
+ * Current time, in seconds
+ */
+static glong now(void)
+{
+        GTimeVal time;
+
+        g_get_current_time(&time);
+        return time.tv_sec;
+}
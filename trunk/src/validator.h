@@ -0,0 +1,93 @@
+#ifndef VALIDATOR_H
+#define VALIDATOR_H
+
+#include <glib.h>
+#include "result.h"
+
+/** \file
+ * Check results in a pool of threads, so that the main loop
+ * doesn't have to wait for the disk or the network.
+ *
+ * result->validate() often has to look at the file system,
+ * which might be slow on network file systems. The validator
+ * calls it on a worker thread and passes the answer back to
+ * the main loop.
+ *
+ * Answers are remembered for a while, by URI (result->path),
+ * so that results that come back again and again are not
+ * checked every time.
+ */
+
+/**
+ * What the validator knows about a result
+ */
+enum ValidatorValidity {
+        /** the result hasn't been checked recently */
+        VALIDATOR_UNKNOWN,
+        /** the result was valid when it was last checked */
+        VALIDATOR_VALID,
+        /** the result was invalid when it was last checked */
+        VALIDATOR_INVALID
+};
+
+/**
+ * A result has been checked.
+ *
+ * This function is called on the thread that runs the main context
+ * passed to validator_new().
+ *
+ * @param result the result that was passed to validator_check(),
+ * which belongs to the caller again
+ * @param valid TRUE if the result is valid
+ * @param userdata passed to validator_check()
+ */
+typedef void (*validator_done_f)(struct result *result, gboolean valid, gpointer userdata);
+
+/**
+ * Create a new validator.
+ *
+ * @param context context on which the done callback is run, or NULL
+ * for the default context
+ * @param done function called with the result of the checks
+ * @param ttl number of seconds an answer is remembered
+ * @return a new validator, to free with validator_free()
+ */
+struct validator *validator_new(GMainContext *context, validator_done_f done, guint ttl);
+
+/**
+ * Free a validator.
+ *
+ * The checks that haven't been made yet are made before this function
+ * returns and the done callback is called for each of them, so that
+ * the caller gets all its results back.
+ *
+ * @param validator
+ */
+void validator_free(struct validator *validator);
+
+/**
+ * Tell what's known about a URI, without checking anything.
+ *
+ * This call is thread-safe.
+ *
+ * @param validator
+ * @param uri path of a result
+ * @return what was known about the URI the last time it was
+ * checked, or VALIDATOR_UNKNOWN if it's too long ago
+ */
+enum ValidatorValidity validator_get_cached(struct validator *validator, const char *uri);
+
+/**
+ * Check a result on a worker thread.
+ *
+ * The result will be passed to the done callback once it's
+ * been checked. Until then, the result must not be released,
+ * or modified.
+ *
+ * @param validator
+ * @param result result to check
+ * @param userdata passed to the done callback
+ */
+void validator_check(struct validator *validator, struct result *result, gpointer userdata);
+
+#endif /*VALIDATOR_H*/
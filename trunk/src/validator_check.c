@@ -0,0 +1,187 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <check.h>
+#include "validator.h"
+
+struct mock_result
+{
+        struct result result;
+        /** what validate() returns */
+        gboolean valid;
+        /** number of calls to validate(), atomic */
+        gint validated;
+        /** number of calls to the done callback */
+        int done;
+        /** what was passed to the done callback */
+        gboolean done_valid;
+};
+
+static struct mock_result results[] = {
+        { { "valid", "Valid", "/x/valid", TRUE/*enabled*/,
+            NULL/*execute*/, NULL/*validate*/, NULL/*release*/ }, TRUE/*valid*/ },
+        { { "invalid", "Invalid", "/x/invalid", TRUE/*enabled*/,
+            NULL/*execute*/, NULL/*validate*/, NULL/*release*/ }, FALSE/*valid*/ },
+};
+
+#define RESULTS_LEN (sizeof(results)/sizeof(struct mock_result))
+
+/** Number of calls to the done callback, all results included */
+static int done_count;
+
+/* ------------------------- prototypes */
+static Suite *validator_check_suite(void);
+static gboolean mock_result_validate(struct result *result);
+static void done_cb(struct result *result, gboolean valid, gpointer userdata);
+static void wait_for_done(int count);
+
+/* ------------------------- test case */
+static void setup()
+{
+        guint i;
+
+        g_thread_init(NULL/*vtable*/);
+        for(i=0; i<RESULTS_LEN; i++) {
+                results[i].result.validate=mock_result_validate;
+                results[i].validated=0;
+                results[i].done=0;
+                results[i].done_valid=FALSE;
+        }
+        done_count=0;
+}
+
+static void teardown()
+{
+}
+
+START_TEST(test_check)
+{
+        struct validator *validator;
+
+        validator=validator_new(NULL/*default context*/, done_cb, 60/*ttl*/);
+        validator_check(validator, &results[0].result, &results[0]);
+        validator_check(validator, &results[1].result, &results[1]);
+        wait_for_done(2);
+
+        fail_unless(results[0].done==1, "valid: done not called");
+        fail_unless(results[0].done_valid, "valid: wrong answer");
+        fail_unless(results[1].done==1, "invalid: done not called");
+        fail_unless(!results[1].done_valid, "invalid: wrong answer");
+        validator_free(validator);
+}
+END_TEST
+
+START_TEST(test_cache)
+{
+        struct validator *validator;
+
+        validator=validator_new(NULL/*default context*/, done_cb, 60/*ttl*/);
+        fail_unless(validator_get_cached(validator, "/x/valid")==VALIDATOR_UNKNOWN,
+                    "nothing should be known yet");
+
+        validator_check(validator, &results[0].result, &results[0]);
+        validator_check(validator, &results[1].result, &results[1]);
+        wait_for_done(2);
+        fail_unless(validator_get_cached(validator, "/x/valid")==VALIDATOR_VALID,
+                    "valid not cached");
+        fail_unless(validator_get_cached(validator, "/x/invalid")==VALIDATOR_INVALID,
+                    "invalid not cached");
+
+        validator_check(validator, &results[0].result, &results[0]);
+        wait_for_done(3);
+        fail_unless(results[0].done==2, "done not called");
+        fail_unless(results[0].done_valid, "wrong answer");
+        fail_unless(g_atomic_int_get(&results[0].validated)==1, "answer not reused");
+        validator_free(validator);
+}
+END_TEST
+
+START_TEST(test_no_cache)
+{
+        struct validator *validator;
+
+        validator=validator_new(NULL/*default context*/, done_cb, 0/*ttl*/);
+        validator_check(validator, &results[0].result, &results[0]);
+        wait_for_done(1);
+        fail_unless(validator_get_cached(validator, "/x/valid")==VALIDATOR_UNKNOWN,
+                    "answer should not have been kept");
+
+        validator_check(validator, &results[0].result, &results[0]);
+        wait_for_done(2);
+        fail_unless(g_atomic_int_get(&results[0].validated)==2, "answer reused");
+        validator_free(validator);
+}
+END_TEST
+
+START_TEST(test_free)
+{
+        struct validator *validator;
+
+        validator=validator_new(NULL/*default context*/, done_cb, 60/*ttl*/);
+        validator_check(validator, &results[0].result, &results[0]);
+        validator_check(validator, &results[1].result, &results[1]);
+        validator_free(validator);
+
+        fail_unless(results[0].done==1, "result 0 not given back");
+        fail_unless(results[1].done==1, "result 1 not given back");
+}
+END_TEST
+
+/* ------------------------- test suite */
+static Suite *validator_check_suite(void)
+{
+        Suite *s = suite_create("validator");
+        TCase *tc_core = tcase_create("validator_core");
+
+        suite_add_tcase(s, tc_core);
+        tcase_add_checked_fixture(tc_core, setup, teardown);
+        tcase_add_test(tc_core, test_check);
+        tcase_add_test(tc_core, test_cache);
+        tcase_add_test(tc_core, test_no_cache);
+        tcase_add_test(tc_core, test_free);
+
+        return s;
+}
+
+int main(void)
+{
+        int nf;
+        Suite *s = validator_check_suite ();
+        SRunner *sr = srunner_create (s);
+        srunner_run_all (sr, CK_NORMAL);
+        nf = srunner_ntests_failed (sr);
+        srunner_free (sr);
+        return (nf == 0) ? 0:10;
+}
+
+/* ------------------------- static functions */
+static gboolean mock_result_validate(struct result *_result)
+{
+        struct mock_result *result = (struct mock_result *)_result;
+
+        g_atomic_int_inc(&result->validated);
+        return result->valid;
+}
+
+static void done_cb(struct result *_result, gboolean valid, gpointer userdata)
+{
+        struct mock_result *result = (struct mock_result *)userdata;
+
+        fail_unless(&result->result==_result, "wrong userdata");
+        result->done++;
+        result->done_valid=valid;
+        done_count++;
+}
+
+/**
+ * Run the main loop until the done callback has been called
+ * count times.
+ */
+static void wait_for_done(int count)
+{
+        while(done_count<count) {
+                g_main_context_iteration(NULL/*default context*/,
+                                         TRUE/*may block*/);
+        }
+}